@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     Codecs of the data stored in the hash based database
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ffdb_codec.h"
+
+/**
+ * Shortest copy, and number of bits of the hash of four bytes looking
+ * up where they were seen last
+ */
+#define LZ_MINMATCH     4
+#define LZ_HASHLOG      12
+
+/**
+ * The last bytes are always literals, and no copy starts in the last
+ * LZ_MFLIMIT bytes, so the decoder never reads or writes past the end
+ */
+#define LZ_LASTLITERALS 5
+#define LZ_MFLIMIT      12
+
+/**
+ * Largest distance back of a copy
+ */
+#define LZ_MAXOFFSET    65535
+
+/**
+ * Literals are looked at less often the longer no copy is found, so
+ * data that do not compress are passed over quickly
+ */
+#define LZ_SKIPSHIFT    6
+
+static unsigned int
+_ffdb_lz_read32 (const unsigned char* p)
+{
+  unsigned int v;
+  memcpy (&v, p, sizeof(v));
+  return v;
+}
+
+static unsigned int
+_ffdb_lz_hash (unsigned int v)
+{
+  return (v * 2654435761U) >> (32 - LZ_HASHLOG);
+}
+
+/**
+ * Write a length that does not fit into four bits of a token
+ */
+static unsigned char*
+_ffdb_lz_put_length (unsigned char* op, unsigned int len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+/**
+ * Read a length that does not fit into four bits of a token
+ *
+ * @return position after the length, 0 if it runs past end
+ */
+static const unsigned char*
+_ffdb_lz_get_length (const unsigned char* ip, const unsigned char* end,
+		     unsigned int* len)
+{
+  unsigned int b;
+
+  do {
+    if (ip >= end)
+      return 0;
+    b = *ip++;
+    *len += b;
+  } while (b == 255);
+
+  return ip;
+}
+
+/**
+ * Compress len bytes of src into at most cap bytes of dst
+ */
+unsigned int
+__ffdb_lz_compress (const void* src, unsigned int len,
+		    void* dst, unsigned int cap)
+{
+  unsigned int table[1 << LZ_HASHLOG];
+  const unsigned char *base, *ip, *anchor, *ref, *iend, *mflimit, *mlimit;
+  unsigned char *op, *oend, *token;
+  unsigned int h, lit, mlen, off;
+
+  base = (const unsigned char *)src;
+  ip = anchor = base;
+  iend = base + len;
+  op = (unsigned char *)dst;
+  oend = op + cap;
+
+  if (len > LZ_MFLIMIT) {
+    mflimit = iend - LZ_MFLIMIT;
+    mlimit = iend - LZ_LASTLITERALS;
+    memset (table, 0, sizeof(table));
+
+    while (ip < mflimit) {
+      h = _ffdb_lz_hash (_ffdb_lz_read32 (ip));
+      ref = base + table[h];
+      table[h] = ip - base;
+
+      if (ref >= ip || ip - ref > LZ_MAXOFFSET ||
+	  _ffdb_lz_read32 (ref) != _ffdb_lz_read32 (ip)) {
+	ip += 1 + ((ip - anchor) >> LZ_SKIPSHIFT);
+	continue;
+      }
+
+      /* The copy may start before the four bytes found */
+      while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+	ip--;
+	ref--;
+      }
+      mlen = LZ_MINMATCH;
+      while (ip + mlen < mlimit && ip[mlen] == ref[mlen])
+	mlen++;
+
+      /* token, literals and copy have to fit */
+      lit = ip - anchor;
+      if (op + 1 + lit / 255 + 1 + lit + 2 + 
+	  (mlen - LZ_MINMATCH) / 255 + 1 > oend)
+	return 0;
+
+      token = op++;
+      if (lit >= 15) {
+	*token = 15 << 4;
+	op = _ffdb_lz_put_length (op, lit - 15);
+      }
+      else
+	*token = lit << 4;
+      memcpy (op, anchor, lit);
+      op += lit;
+
+      off = ip - ref;
+      *op++ = off & 0xff;
+      *op++ = off >> 8;
+
+      if (mlen - LZ_MINMATCH >= 15) {
+	*token |= 15;
+	op = _ffdb_lz_put_length (op, mlen - LZ_MINMATCH - 15);
+      }
+      else
+	*token |= mlen - LZ_MINMATCH;
+
+      ip += mlen;
+      anchor = ip;
+
+      /* Remember a position inside the copy as well */
+      if (ip < mflimit)
+	table[_ffdb_lz_hash (_ffdb_lz_read32 (ip - 2))] = ip - 2 - base;
+    }
+  }
+
+  /* The rest are literals */
+  lit = iend - anchor;
+  if (op + 1 + lit / 255 + 1 + lit > oend)
+    return 0;
+  token = op++;
+  if (lit >= 15) {
+    *token = 15 << 4;
+    op = _ffdb_lz_put_length (op, lit - 15);
+  }
+  else
+    *token = lit << 4;
+  memcpy (op, anchor, lit);
+  op += lit;
+
+  return op - (unsigned char *)dst;
+}
+
+/**
+ * Decompress len bytes of src into exactly rawlen bytes of dst
+ */
+int
+__ffdb_lz_decompress (const void* src, unsigned int len,
+		      void* dst, unsigned int rawlen)
+{
+  const unsigned char *ip, *iend, *ref;
+  unsigned char *op, *ostart, *oend;
+  unsigned int token, lit, mlen, off, i;
+
+  ip = (const unsigned char *)src;
+  iend = ip + len;
+  op = ostart = (unsigned char *)dst;
+  oend = op + rawlen;
+
+  while (ip < iend) {
+    token = *ip++;
+
+    lit = token >> 4;
+    if (lit == 15 && !(ip = _ffdb_lz_get_length (ip, iend, &lit)))
+      return -1;
+    if (lit > (unsigned int)(iend - ip) || lit > (unsigned int)(oend - op))
+      return -1;
+    memcpy (op, ip, lit);
+    op += lit;
+    ip += lit;
+
+    /* The last sequence has literals only */
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return -1;
+    off = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (off == 0 || off > (unsigned int)(op - ostart))
+      return -1;
+
+    mlen = token & 15;
+    if (mlen == 15 && !(ip = _ffdb_lz_get_length (ip, iend, &mlen)))
+      return -1;
+    mlen += LZ_MINMATCH;
+    if (mlen > (unsigned int)(oend - op))
+      return -1;
+
+    /* A copy may overlap the bytes it produces */
+    ref = op - off;
+    if (off >= mlen)
+      memcpy (op, ref, mlen);
+    else {
+      for (i = 0; i < mlen; i++)
+	op[i] = ref[i];
+    }
+    op += mlen;
+  }
+
+  return (op == oend) ? 0 : -1;
+}
+
+/**
+ * The filter loops take the element width as a constant where they
+ * can, so that the compiler unrolls and vectorizes them
+ */
+static inline void
+_ffdb_shuffle (const unsigned char* src, unsigned int n, unsigned int width,
+	       unsigned char* dst)
+{
+  unsigned int b, i;
+
+  if (n == 0)
+    return;
+  for (b = 0; b < width; b++) {
+    dst[b * n] = src[b];
+    for (i = 1; i < n; i++)
+      dst[b * n + i] = src[i * width + b] ^ src[(i - 1) * width + b];
+  }
+}
+
+static inline void
+_ffdb_unshuffle (const unsigned char* src, unsigned int n,
+		 unsigned int width, unsigned char* dst)
+{
+  unsigned int b, i;
+
+  if (n == 0)
+    return;
+  for (b = 0; b < width; b++)
+    dst[b] = src[b * n];
+  /* Each element depends on the one before, the bytes of it do not */
+  for (i = 1; i < n; i++) {
+    for (b = 0; b < width; b++)
+      dst[i * width + b] = src[b * n + i] ^ dst[(i - 1) * width + b];
+  }
+}
+
+void
+__ffdb_shuffle (const void* src, unsigned int len, unsigned int width,
+		void* dst)
+{
+  const unsigned char* ip = (const unsigned char *)src;
+  unsigned char* op = (unsigned char *)dst;
+  unsigned int n = (width > 0) ? len / width : 0;
+
+  if (width == 16)
+    _ffdb_shuffle (ip, n, 16, op);
+  else if (width == 8)
+    _ffdb_shuffle (ip, n, 8, op);
+  else if (width == 4)
+    _ffdb_shuffle (ip, n, 4, op);
+  else if (width > 1)
+    _ffdb_shuffle (ip, n, width, op);
+  else
+    n = 0;
+  memcpy (op + n * width, ip + n * width, len - n * width);
+}
+
+void
+__ffdb_unshuffle (const void* src, unsigned int len, unsigned int width,
+		  void* dst)
+{
+  const unsigned char* ip = (const unsigned char *)src;
+  unsigned char* op = (unsigned char *)dst;
+  unsigned int n = (width > 0) ? len / width : 0;
+
+  if (width == 16)
+    _ffdb_unshuffle (ip, n, 16, op);
+  else if (width == 8)
+    _ffdb_unshuffle (ip, n, 8, op);
+  else if (width == 4)
+    _ffdb_unshuffle (ip, n, 4, op);
+  else if (width > 1)
+    _ffdb_unshuffle (ip, n, width, op);
+  else
+    n = 0;
+  memcpy (op + n * width, ip + n * width, len - n * width);
+}
@@ -0,0 +1,103 @@
+/**
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     Codecs of the data stored in the hash based database
+ *
+ *     The lz codec is a byte oriented LZ77 in the form of LZ4 blocks:
+ *     runs of literals followed by copies of up to 64 KB back. It is
+ *     fast enough to decode at memory speed, and no extra library is
+ *     needed to link against.
+ *
+ *     The shuffle filter goes ahead of the lz codec on arrays of
+ *     numbers. Each element is xored with the one before it, and the
+ *     bytes are regrouped so that byte 0 of all elements comes first,
+ *     then byte 1, and so on. Bytes that change slowly from element to
+ *     element, like the signs and exponents of floating point numbers,
+ *     then turn into long runs of zeros.
+ *
+ */
+#ifndef _FFDB_CODEC_H
+#define _FFDB_CODEC_H
+
+#ifdef _cplusplus
+extern "C" {
+#endif
+
+/**
+ * The codec word stored with each datum: the codec in the low byte and
+ * the element width of the shuffle filter in the next, 0 if the datum
+ * is not filtered
+ */
+#define FFDB_CODEC_ID(word)          ((word) & 0xff)
+#define FFDB_CODEC_WIDTH(word)       (((word) >> 8) & 0xff)
+#define FFDB_CODEC_WORD(codec,width) ((codec) | ((width) << 8))
+
+/**
+ * Largest element width of the shuffle filter
+ */
+#define FFDB_FILTER_MAXWIDTH 255
+
+/**
+ * Compress len bytes of src into at most cap bytes of dst
+ *
+ * @return length of the compressed data, 0 if they do not fit into cap
+ * bytes. The caller keeps the data as they are then.
+ */
+extern unsigned int
+__ffdb_lz_compress (const void* src, unsigned int len,
+		    void* dst, unsigned int cap);
+
+/**
+ * Decompress len bytes of src into exactly rawlen bytes of dst
+ *
+ * @return 0 on success, -1 if the compressed data are corrupted
+ */
+extern int
+__ffdb_lz_decompress (const void* src, unsigned int len,
+		      void* dst, unsigned int rawlen);
+
+/**
+ * Xor each element of width bytes of src with the one before it, and
+ * write the bytes of the result to dst one byte position at a time.
+ * Bytes past the last whole element are copied as they are.
+ */
+extern void
+__ffdb_shuffle (const void* src, unsigned int len, unsigned int width,
+		void* dst);
+
+/**
+ * Undo __ffdb_shuffle of len bytes of src into dst
+ */
+extern void
+__ffdb_unshuffle (const void* src, unsigned int len, unsigned int width,
+		  void* dst);
+
+#ifdef _cplusplus
+};
+#endif
+
+#endif
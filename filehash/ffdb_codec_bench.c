@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     Benchmark of the data codecs on values shaped like correlators:
+ *     the file size with and without compression, with and without the
+ *     shuffle filter, and the read rate on a cold and on a warm cache
+ *
+ *     Build with: make codecbench
+ *     Run with:   codecbench [file [number of keys [number of time slices]]]
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "ffdb_db.h"
+#include "ffdb_codec.h"
+
+static double
+_now (void)
+{
+  struct timeval tv;
+  gettimeofday (&tv, 0);
+  return tv.tv_sec + tv.tv_usec * 1.0e-6;
+}
+
+/**
+ * Fill nt complex doubles of a correlator of key i: an exponential
+ * decay with a little noise in the real parts. With noisy set the
+ * imaginary parts are noise too, otherwise they vanish.
+ */
+static void
+_fill (double* buf, unsigned int i, unsigned int nt, int noisy)
+{
+  unsigned int t, seed = i * 2654435761u + 1;
+  double c = 1.0e3 * (1 + i % 17);
+
+  for (t = 0; t < nt; t++) {
+    seed = seed * 1103515245u + 12345u;
+    buf[2 * t] = c * (1.0 + 0.01 * ((seed >> 8) / 16777216.0 - 0.5));
+    seed = seed * 1103515245u + 12345u;
+    buf[2 * t + 1] = noisy ? c * ((seed >> 8) / 16777216.0 - 0.5) : 0.0;
+    c *= 0.8;
+  }
+}
+
+/**
+ * Drop the pages of the file from the operating system page cache
+ */
+static void
+_drop_cache (const char* fname)
+{
+  int fd;
+
+  fd = open (fname, O_RDONLY);
+  if (fd < 0)
+    return;
+  fdatasync (fd);
+  posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+  close (fd);
+}
+
+static void
+_info (FFDB_HASHINFO* info, int codec, unsigned int width)
+{
+  memset (info, 0, sizeof(FFDB_HASHINFO));
+  info->bsize = 4096;
+  info->nbuckets = 1024;
+  info->cachesize = 64 * 1024 * 1024;
+  info->userinfolen = 16;
+  info->numconfigs = 1;
+  info->compress = codec;
+  info->filterwidth = width;
+}
+
+/**
+ * Compress and decompress the values of all keys in memory, with the
+ * shuffle filter of width bytes if it is not 0. Return MB/s of raw
+ * data each way and the compression ratio
+ */
+static int
+_codec (unsigned int nkeys, unsigned int nt, int noisy, unsigned int width,
+	double* cmb, double* dmb, double* ratio)
+{
+  unsigned int vsize = 2 * nt * sizeof(double);
+  unsigned int cap = vsize + vsize / 255 + 16;
+  unsigned int i, clen;
+  unsigned long raw = 0, total = 0;
+  char *vbuf, *cbuf, *dbuf, *sbuf;
+  double start, tc = 0.0, td = 0.0;
+  int bad = 0;
+
+  vbuf = (char *)malloc (vsize);
+  cbuf = (char *)malloc (cap);
+  dbuf = (char *)malloc (vsize);
+  sbuf = (char *)malloc (vsize);
+  if (!vbuf || !cbuf || !dbuf || !sbuf) {
+    fprintf (stderr, "Cannot allocate codec buffers\n");
+    exit (1);
+  }
+
+  for (i = 0; i < nkeys; i++) {
+    _fill ((double *)vbuf, i, nt, noisy);
+
+    start = _now ();
+    if (width) {
+      __ffdb_shuffle (vbuf, vsize, width, sbuf);
+      clen = __ffdb_lz_compress (sbuf, vsize, cbuf, cap);
+    }
+    else
+      clen = __ffdb_lz_compress (vbuf, vsize, cbuf, cap);
+    tc += _now () - start;
+
+    start = _now ();
+    if (width) {
+      if (__ffdb_lz_decompress (cbuf, clen, sbuf, vsize) != 0)
+	bad++;
+      __ffdb_unshuffle (sbuf, vsize, width, dbuf);
+    }
+    else if (__ffdb_lz_decompress (cbuf, clen, dbuf, vsize) != 0)
+      bad++;
+    td += _now () - start;
+
+    if (memcmp (vbuf, dbuf, vsize) != 0)
+      bad++;
+    raw += vsize;
+    total += clen;
+  }
+
+  *cmb = raw / tc / (1024.0 * 1024.0);
+  *dmb = raw / td / (1024.0 * 1024.0);
+  *ratio = (double)raw / total;
+
+  free (vbuf);
+  free (cbuf);
+  free (dbuf);
+  free (sbuf);
+  return bad;
+}
+
+/**
+ * Read all keys in order, return MB/s of values
+ */
+static double
+_read (const char* fname, unsigned int nkeys, unsigned int nt, int noisy,
+       int* bad)
+{
+  FFDB_HASHINFO info;
+  FFDB_DB* db;
+  FFDB_DBT key, val;
+  unsigned int vsize = 2 * nt * sizeof(double);
+  unsigned int i;
+  char kbuf[16];
+  char* ref;
+  double start;
+
+  ref = (char *)malloc (vsize);
+  _info (&info, FFDB_CODEC_NONE, 0);
+  db = ffdb_dbopen (fname, O_RDONLY, 0644, &info);
+  if (!ref || !db) {
+    fprintf (stderr, "Cannot open %s\n", fname);
+    exit (1);
+  }
+
+  start = _now ();
+  for (i = 0; i < nkeys; i++) {
+    key.data = kbuf;
+    key.size = sprintf (kbuf, "key%u", i);
+    val.data = 0;
+    val.size = 0;
+    if (db->get (db, &key, &val, 0) != 0) {
+      (*bad)++;
+      continue;
+    }
+    _fill ((double *)ref, i, nt, noisy);
+    if (val.size != vsize || memcmp (val.data, ref, vsize) != 0)
+      (*bad)++;
+    free (val.data);
+  }
+  start = _now () - start;
+
+  db->close (db);
+  free (ref);
+  return nkeys * (double)vsize / start / (1024.0 * 1024.0);
+}
+
+/**
+ * Write nkeys values with the codec, then read them back on a cold
+ * and on a warm cache
+ */
+static int
+_bench (const char* fname, int codec, unsigned int width, unsigned int nkeys,
+	unsigned int nt, int noisy)
+{
+  FFDB_HASHINFO info;
+  FFDB_DB* db;
+  FFDB_DBT key, val;
+  struct stat st;
+  unsigned int vsize = 2 * nt * sizeof(double);
+  unsigned int i;
+  char kbuf[16];
+  char* vbuf;
+  double start, twrite, cold, warm;
+  int bad = 0;
+
+  vbuf = (char *)malloc (vsize);
+  _info (&info, codec, width);
+  db = ffdb_dbopen (fname, O_RDWR | O_CREAT | O_TRUNC, 0644, &info);
+  if (!vbuf || !db) {
+    fprintf (stderr, "Cannot create %s\n", fname);
+    return 1;
+  }
+
+  start = _now ();
+  for (i = 0; i < nkeys; i++) {
+    key.data = kbuf;
+    key.size = sprintf (kbuf, "key%u", i);
+    _fill ((double *)vbuf, i, nt, noisy);
+    val.data = vbuf;
+    val.size = vsize;
+    if (db->put (db, &key, &val, 0) != 0) {
+      fprintf (stderr, "Cannot insert key %u\n", i);
+      return 1;
+    }
+  }
+  db->close (db);
+  twrite = _now () - start;
+  free (vbuf);
+
+  if (stat (fname, &st) != 0) {
+    fprintf (stderr, "Cannot stat %s\n", fname);
+    return 1;
+  }
+
+  _drop_cache (fname);
+  cold = _read (fname, nkeys, nt, noisy, &bad);
+  warm = _read (fname, nkeys, nt, noisy, &bad);
+
+  printf ("%10s %8s %12.1f %10.3f %12.1f %12.1f\n",
+	  noisy ? "noisy" : "real",
+	  codec == FFDB_CODEC_NONE ? "none" : (width ? "shuf+lz" : "lz"),
+	  st.st_size / (1024.0 * 1024.0), twrite, cold, warm);
+
+  if (bad) {
+    fprintf (stderr, "%d values are wrong\n", bad);
+    return 1;
+  }
+  return 0;
+}
+
+int
+main (int argc, char** argv)
+{
+  const char* fname = "codecbench.db";
+  unsigned int nkeys = 50000, nt = 128;
+  unsigned int widths[] = {0, 2 * sizeof(double)};
+  double cmb, dmb, ratio;
+  int noisy, w;
+
+  if (argc > 1)
+    fname = argv[1];
+  if (argc > 2)
+    nkeys = atoi (argv[2]);
+  if (argc > 3)
+    nt = atoi (argv[3]);
+  if (nkeys == 0 || nt == 0) {
+    fprintf (stderr, "Usage: %s [file [number of keys [number of time slices]]]\n",
+	     argv[0]);
+    return 1;
+  }
+
+  printf ("%u correlators of %u complex time slices\n", nkeys, nt);
+  printf ("%10s %8s %12s %12s %8s\n", "values", "codec",
+	  "comp MB/s", "decomp MB/s", "ratio");
+  for (noisy = 0; noisy < 2; noisy++) {
+    for (w = 0; w < 2; w++) {
+      if (_codec (nkeys, nt, noisy, widths[w], &cmb, &dmb, &ratio) != 0) {
+	fprintf (stderr, "The codec does not round trip\n");
+	return 1;
+      }
+      printf ("%10s %8s %12.1f %12.1f %8.2f\n", noisy ? "noisy" : "real",
+	      widths[w] ? "shuf+lz" : "lz", cmb, dmb, ratio);
+    }
+  }
+
+  printf ("\n%10s %8s %12s %10s %12s %12s\n", "values", "codec",
+	  "file MB", "write (s)", "cold MB/s", "warm MB/s");
+  for (noisy = 0; noisy < 2; noisy++) {
+    if (_bench (fname, FFDB_CODEC_NONE, 0, nkeys, nt, noisy) != 0)
+      return 1;
+    for (w = 0; w < 2; w++) {
+      if (_bench (fname, FFDB_CODEC_LZ, widths[w], nkeys, nt, noisy) != 0)
+	return 1;
+    }
+  }
+
+  unlink (fname);
+  return 0;
+}
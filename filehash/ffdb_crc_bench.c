@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     Microbenchmark of the crc32 checksum routine against the
+ *     byte at a time reference routine
+ *
+ *     Build with: make crcbench
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "ffdb_db.h"
+#include "ffdb_hash_func.h"
+
+typedef unsigned int (*crcfunc_t) (unsigned int crc,
+				   const unsigned char* buf,
+				   unsigned int len);
+
+static double
+_now (void)
+{
+  struct timeval tv;
+  gettimeofday (&tv, 0);
+  return tv.tv_sec + tv.tv_usec * 1.0e-6;
+}
+
+/**
+ * Checksum a buffer in chunks of size len again and again
+ * return MB per second, and the checksum of the buffer in result
+ */
+static double
+_bench (crcfunc_t func, const unsigned char* buf, unsigned int buflen,
+	unsigned int len, unsigned int* result)
+{
+  double start, elapsed;
+  unsigned long total = 0;
+  unsigned int off;
+
+  start = _now ();
+  do {
+    for (off = 0; off + len <= buflen; off += len)
+      func (0, buf + off, len);
+    total += buflen;
+    elapsed = _now () - start;
+  } while (elapsed < 0.5);
+  *result = func (0, buf, buflen);
+
+  return total / elapsed / (1024.0 * 1024.0);
+}
+
+int
+main (int argc, char** argv)
+{
+  unsigned int buflen = 64 * 1024 * 1024;
+  unsigned int sizes[] = {4096, 8192, 1024 * 1024, 16 * 1024 * 1024};
+  unsigned int i, len, off, r1, r2;
+  unsigned char* buf;
+  double fast, slow;
+
+  __ffdb_crc32_init ();
+
+  buf = (unsigned char *)malloc (buflen);
+  if (!buf) {
+    fprintf (stderr, "Cannot allocate benchmark buffer\n");
+    return 1;
+  }
+  srand (1234);
+  for (i = 0; i < buflen; i++)
+    buf[i] = (unsigned char)rand ();
+
+  /* The fast routine must give the same checksum at any alignment */
+  for (i = 0; i < 10000; i++) {
+    off = rand () % 64;
+    len = rand () % 20000;
+    r1 = __ffdb_crc32_checksum (i, buf + off, len);
+    r2 = __ffdb_crc32_checksum_bytewise (i, buf + off, len);
+    if (r1 != r2) {
+      fprintf (stderr, "Checksum mismatch at offset %d length %d: 0x%x != 0x%x\n",
+	       off, len, r1, r2);
+      return 1;
+    }
+  }
+
+  printf ("%12s %14s %14s %8s\n", "size", "bytewise MB/s", "current MB/s", "speedup");
+  for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+    slow = _bench (__ffdb_crc32_checksum_bytewise, buf, buflen, sizes[i], &r1);
+    fast = _bench (__ffdb_crc32_checksum, buf, buflen, sizes[i], &r2);
+    if (r1 != r2) {
+      fprintf (stderr, "Checksum mismatch on size %d\n", sizes[i]);
+      return 1;
+    }
+    printf ("%12u %14.1f %14.1f %8.2f\n", sizes[i], slow, fast, fast/slow);
+  }
+
+  free (buf);
+  return 0;
+}
@@ -156,6 +156,12 @@ typedef struct _ffdb_cursor_
 {
   /* Get routine */
   /* If data is null (0), caller is not interested in data */
+  /* If the space provided in key or data is too small, FFDB_SPECIAL
+   * is returned with the needed length in size. The same item is
+   * read again with FFDB_CURRENT */
+  /* No page is held between calls, so a cursor can be left open while
+   * other threads write. Keys written meanwhile may be missed or
+   * returned twice */
   int (*get) (struct _ffdb_cursor_ *c, 
 	      FFDB_DBT* key,  FFDB_DBT* data, unsigned int flags);
   /* Close this cursor */
@@ -189,7 +195,13 @@ typedef struct __ffdb {
  * Hash database magic number and version
  */
 #define FFDB_HASHMAGIC 0xcece3434
-#define FFDB_HASHVERSION 5
+#define FFDB_HASHVERSION 10
+
+/*
+ * Files of versions from FFDB_HASHVERSION_MIN on are opened read only.
+ * They are brought up to the current version by ffdb_upgrade.
+ */
+#define FFDB_HASHVERSION_MIN 5
 
 /*
  * How do we store key and data on a page
@@ -211,6 +223,22 @@ typedef struct {
 				  */
   unsigned int   userinfolen;    /* how many bytes for user information */
   unsigned int   numconfigs;     /* number of configurations */
+  int            ioengine;       /* page I/O engine, see below */
+  int            orderedindex;   /* keep an ordered index of the keys of
+				  * a new database for range cursors
+				  */
+  int            hashfunc;       /* hash function of a new database,
+				  * see below
+				  */
+  int            compress;       /* codec of the data of a new database,
+				  * see below
+				  */
+  unsigned int   compressmin;    /* data shorter than this are stored
+				  * as they are
+				  */
+  unsigned int   filterwidth;    /* element width of the data for the
+				  * shuffle filter, 0 for none
+				  */
 #if 0
   unsigned int  (*hash) (const void *, unsigned int); /* hash function */
                                 /* key compare func */
@@ -218,6 +246,43 @@ typedef struct {
 #endif
 } FFDB_HASHINFO;
 
+/*
+ * Page I/O engines used to read and write many pages at once.
+ * FFDB_IO_AUTO uses io_uring when the kernel provides it and the
+ * synchronous engine otherwise.
+ */
+#define FFDB_IO_AUTO  0
+#define FFDB_IO_SYNC  1
+#define FFDB_IO_URING 2
+
+/*
+ * Hash functions of the keys. The one a database is created with is
+ * recorded in its header and used from then on. FFDB_HASH_DEFAULT
+ * picks FFDB_HASH_WY, which hashes eight bytes at a time. FFDB_HASH_FNV
+ * is the byte at a time function of earlier versions. Files of versions
+ * before 8 do not record their hash function and are opened with
+ * FFDB_HASH_FNV, as is the database ffdb_upgrade makes of them.
+ */
+#define FFDB_HASH_DEFAULT 0
+#define FFDB_HASH_FNV     1
+#define FFDB_HASH_WY      2
+
+/*
+ * Codecs of the data. The codec a database is created with is recorded
+ * in its header and applied to all data of at least compressmin bytes
+ * (FFDB_COMPRESS_MIN if 0). Data that do not shrink by an eighth are
+ * stored as they are. Each datum records how it is stored, so any
+ * reader decodes it.
+ *
+ * Arrays of numbers compress far better after the shuffle filter,
+ * which is applied ahead of the codec when filterwidth is the width in
+ * bytes of the numbers, e.g. 8 for doubles and 16 for complex doubles.
+ */
+#define FFDB_CODEC_NONE   0
+#define FFDB_CODEC_LZ     1
+
+#define FFDB_COMPRESS_MIN 512
+
 
 /*
  * Internal byte swapping code if we are using little endian
@@ -297,6 +362,51 @@ typedef struct _config_info_
   char fname[_FFDB_MAX_FNAME];
 }ffdb_config_info_t;
 
+/*
+ * Layouts of the values of the configurations, kept in the type of
+ * each configuration. With FFDB_LAYOUT_KEY_MAJOR the values of all
+ * configurations of a key are stored as one datum. With
+ * FFDB_LAYOUT_CONFIG_MAJOR the value of each configuration is stored
+ * on its own, on the data page run of the configuration, so that the
+ * values of one configuration for many keys sit on few pages
+ * (see ffdb_put_config).
+ */
+#define FFDB_LAYOUT_KEY_MAJOR    0
+#define FFDB_LAYOUT_CONFIG_MAJOR 1
+
+
+/**
+ * A borrowed view of a datum returned by ffdb_get_view.
+ * Either page is the data page pinned for the view, or buf is a copy
+ * of a datum spanning several pages.
+ */
+typedef struct _ffdb_view_
+{
+  void* page;                   /* pinned data page              */
+  void* buf;                    /* malloced copy of the datum    */
+}ffdb_view_t;
+
+
+/**
+ * Routine called by ffdb_scan for each key and data pair. The data
+ * of the key and of the datum belong to the scan and are only valid
+ * until the routine returns, so the routine copies what it keeps.
+ * Any return value other than 0 stops the scan.
+ */
+typedef int (*ffdb_scan_func_t) (FFDB_DBT* key, FFDB_DBT* data, void* arg);
+
+
+/**
+ * Counts of a database kept in its header, returned by ffdb_stat
+ */
+typedef struct _ffdb_stat_
+{
+  unsigned int nkeys;           /* number of keys                */
+  unsigned int nbuckets;        /* number of buckets             */
+  unsigned int bsize;           /* page size                     */
+  unsigned int numconfigs;      /* number of configurations      */
+}ffdb_stat_t;
+
 
 /**
  * All configuration information 
@@ -426,6 +536,277 @@ extern unsigned int
 ffdb_max_user_info_len (const FFDB_DB* db);
 
 
+/**
+ * Get data for a key without copying it when the data lies on a single
+ * page. The page stays pinned, so writers of this page wait until the
+ * view is released. Release the view as soon as the data is consumed.
+ *
+ * @param db pointer to underlying database
+ * @param key the key
+ * @param data on return data->data points at the datum
+ * @param view the view to be released by ffdb_release_view
+ *
+ * @return 0 on success, FFDB_NOT_FOUND if the key is not found. -1 on
+ * failure
+ */
+extern int
+ffdb_get_view (const FFDB_DB* db, const FFDB_DBT* key, FFDB_DBT* data,
+	       ffdb_view_t* view);
+
+
+/**
+ * Release a view obtained from ffdb_get_view
+ *
+ * @param db pointer to underlying database
+ * @param view the view
+ */
+extern void
+ffdb_release_view (const FFDB_DB* db, ffdb_view_t* view);
+
+
+/**
+ * Get the length of the data for a key without reading the data
+ *
+ * @param db pointer to underlying database
+ * @param key the key
+ * @param size on return the length of the data
+ *
+ * @return 0 on success, FFDB_NOT_FOUND if the key is not found. -1 on
+ * failure
+ */
+extern int
+ffdb_get_size (const FFDB_DB* db, const FFDB_DBT* key, unsigned int* size);
+
+
+/**
+ * Get len bytes of the data for a key starting at byte offset. Only the
+ * data pages holding these bytes are read.
+ *
+ * @param db pointer to underlying database
+ * @param key the key
+ * @param data if data->data is null, it is malloced and the caller has
+ * to free it. Otherwise data->size is the space provided
+ * @param offset the first byte of the data to get
+ * @param len the number of bytes to get
+ *
+ * @return 0 on success, FFDB_NOT_FOUND if the key is not found.
+ * FFDB_SPECIAL if the space provided is too small, with the needed
+ * length in data->size. -1 on failure, with errno EINVAL if the bytes
+ * lie beyond the data
+ */
+extern int
+ffdb_get_range (const FFDB_DB* db, const FFDB_DBT* key, FFDB_DBT* data,
+		unsigned int offset, unsigned int len);
+
+
+/**
+ * Put a key and data pair into the database, with the data on the data
+ * page run of a configuration. The pages of a run hold data of this
+ * configuration only, so data put for the same configuration one key
+ * after another sit next to each other.
+ *
+ * @param db pointer to underlying database
+ * @param key the key
+ * @param data the data
+ * @param config the configuration number
+ *
+ * @return 0 on success. -1 on failure, with errno EINVAL if there is no
+ * such configuration
+ */
+extern int
+ffdb_put_config (const FFDB_DB* db, FFDB_DBT* key, const FFDB_DBT* data,
+		 unsigned int config);
+
+
+/**
+ * Overwrite data->size bytes of the data for a key starting at byte
+ * offset. The length of the data stays the same and only the data
+ * pages holding these bytes are written.
+ *
+ * @param db pointer to underlying database
+ * @param key the key
+ * @param data the new bytes
+ * @param offset the first byte of the data to overwrite
+ *
+ * @return 0 on success, FFDB_NOT_FOUND if the key is not found.
+ * -1 on failure, with errno EINVAL if the bytes lie beyond the data
+ * and EPERM if the database is read only
+ */
+extern int
+ffdb_put_range (const FFDB_DB* db, const FFDB_DBT* key, const FFDB_DBT* data,
+		unsigned int offset);
+
+
+/**
+ * Get data for many keys at once. Keys are hashed up front and looked
+ * up in ascending bucket page order. Then data are read in ascending
+ * data page order.
+ *
+ * @param db pointer to underlying database
+ * @param keys n keys
+ * @param vals n data. The data of a key not found is empty. Caller
+ * has to free the data of each key found.
+ * @param n number of keys
+ * @param nthreads number of threads reading the database. The calling
+ * thread is one of them.
+ *
+ * @return 0 on success, FFDB_NOT_FOUND if some keys are not found. -1 on
+ * failure
+ */
+extern int
+ffdb_get_many (const FFDB_DB* db, const FFDB_DBT keys[], FFDB_DBT vals[],
+	       unsigned int n, unsigned int nthreads);
+
+
+/**
+ * Load many key and data pairs into an empty database. The hash table
+ * is sized for all pairs up front and the pairs are partitioned by
+ * their final bucket. Each bucket page is then written with its
+ * overflow pages in one go, without looking up any key and without
+ * splitting any bucket, and data pages are appended one after another
+ * in bucket order. The header is written once at the end. A key given
+ * more than once keeps its last data.
+ *
+ * @param db pointer to underlying database opened for writing
+ * @param keys n keys
+ * @param vals n data
+ * @param n number of pairs
+ *
+ * @return 0 on success. -1 on failure with a proper errno set. errno is
+ * EINVAL if the database is not empty
+ */
+extern int
+ffdb_bulk_load (FFDB_DB* db, FFDB_DBT keys[], FFDB_DBT vals[],
+		unsigned int n);
+
+
+/**
+ * Compact the database while it is being used. Live data on data pages
+ * that are mostly dead are moved onto the current data page, and the
+ * emptied pages are reused. After all pages have been looked at, free
+ * pages at the end of the file are cut off the file. Readers may use
+ * the database meanwhile. Compaction writes the database, so it is
+ * called by the thread doing insertions.
+ *
+ * @param db pointer to underlying database opened for writing
+ * @param npages maximum number of pages to look at in this call. The
+ * next call continues from where this call stopped
+ *
+ * @return 1 if there are more pages to look at, 0 if a pass over the
+ * whole file is done. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_compact (FFDB_DB* db, unsigned int npages);
+
+
+/**
+ * Create a key cursor walking only buckets lo up to but not including
+ * hi. Cursors over disjoint ranges are independent of each other, so
+ * each of them can be used by a different thread. A range going past
+ * the last bucket ends at the last bucket.
+ *
+ * @param db pointer to underlying database
+ * @param c returned cursor, which is closed by its close routine
+ * @param lo first bucket
+ * @param hi bucket after the last bucket
+ *
+ * @return 0 on success, -1 on failure with a proper errno set
+ */
+extern int
+ffdb_cursor_range (const FFDB_DB* db, ffdb_cursor_t** c,
+		   unsigned int lo, unsigned int hi);
+
+
+/**
+ * Create a key cursor walking the keys from lo up to but not including
+ * hi in key order. Keys are compared byte by byte and a key sorts
+ * before a longer key starting with the same bytes. The database has
+ * to be created with orderedindex set in its open information.
+ * As with other cursors no page is held between calls. A key inserted
+ * or deleted during a walk may or may not be returned.
+ *
+ * @param db pointer to underlying database
+ * @param c returned cursor, which is closed by its close routine
+ * @param lo first key. A null lo starts at the smallest key
+ * @param hi key after the last key. A null hi goes to the largest key
+ *
+ * @return 0 on success, -1 on failure with a proper errno set. errno is
+ * EINVAL if the database keeps no ordered index
+ */
+extern int
+ffdb_cursor_ordered (const FFDB_DB* db, ffdb_cursor_t** c,
+		     const FFDB_DBT* lo, const FFDB_DBT* hi);
+
+
+/**
+ * Create a key cursor walking the keys starting with prefix in key
+ * order. See ffdb_cursor_ordered
+ *
+ * @param db pointer to underlying database
+ * @param c returned cursor, which is closed by its close routine
+ * @param prefix the leading bytes of all keys walked
+ *
+ * @return 0 on success, -1 on failure with a proper errno set
+ */
+extern int
+ffdb_cursor_prefix (const FFDB_DB* db, ffdb_cursor_t** c,
+		    const FFDB_DBT* prefix);
+
+
+/**
+ * Get number of buckets of the hash table. Buckets 0 up to this
+ * number minus one hold all keys
+ *
+ * @param db pointer to underlying database
+ *
+ * @return number of buckets
+ */
+extern unsigned int
+ffdb_num_buckets (const FFDB_DB* db);
+
+
+/**
+ * Get number of keys stored in the database
+ *
+ * @param db pointer to underlying database
+ *
+ * @return number of keys
+ */
+extern unsigned int
+ffdb_num_keys (const FFDB_DB* db);
+
+
+/**
+ * Get the counts of a database kept in its header. Nothing but the
+ * header is read, so this is cheap for any size of database
+ *
+ * @param db pointer to underlying database
+ * @param st returned counts
+ *
+ * @return 0 on success
+ */
+extern int
+ffdb_stat (const FFDB_DB* db, ffdb_stat_t* st);
+
+
+/**
+ * Scan all key and data pairs in the order their data are stored in
+ * the file instead of the hash order of a cursor. The file is read
+ * front to back in large batches, and the key of each datum is found
+ * through the back pointer stored with the datum. Pairs inserted,
+ * deleted or moved by compaction during a scan may be missed.
+ *
+ * @param db pointer to underlying database
+ * @param func routine called for each pair
+ * @param arg argument passed to func
+ *
+ * @return 0 on success, -1 on failure, otherwise the value returned by
+ * func to stop the scan
+ */
+extern int
+ffdb_scan (const FFDB_DB* db, ffdb_scan_func_t func, void* arg);
+
+
 /*
  * A routine which reset the database handle under panic mode
  */
@@ -67,6 +67,7 @@
  *
  */
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -77,12 +78,14 @@
 
 #ifdef _FFDB_DEBUG
 #include <assert.h>
+#include <pthread.h>
 #endif
 
 #include "ffdb_db.h"
 #include "ffdb_pagepool.h"
 #include "ffdb_page.h"
 #include "ffdb_hash_func.h"
+#include "ffdb_codec.h"
 #include "ffdb_hash.h"
 
 
@@ -157,6 +160,11 @@ _ffdb_swap_header (ffdb_htab_t* hashp)
   M_32_SWAP(hdrp->num_cfigs);
   M_32_SWAP(hdrp->h_charkey);
   M_32_SWAP(hdrp->num_moved_pages);
+  M_32_SWAP(hdrp->idx_page);
+  M_32_SWAP(hdrp->hash_func);
+  M_32_SWAP(hdrp->codec);
+  M_32_SWAP(hdrp->codec_min);
+  M_32_SWAP(hdrp->codec_width);
   for (i = 0; i < NCACHED; i++) 
     M_32_SWAP(hdrp->spares[i]);
   for (i = 0; i < NCACHED; i++) 
@@ -193,6 +201,11 @@ _ffdb_swap_header_copy(ffdb_hashhdr_t* srcp, ffdb_hashhdr_t* destp)
   P_32_COPY(srcp->num_cfigs, destp->num_cfigs);
   P_32_COPY(srcp->h_charkey, destp->h_charkey);
   P_32_COPY(srcp->num_moved_pages, destp->num_moved_pages);
+  P_32_COPY(srcp->idx_page, destp->idx_page);
+  P_32_COPY(srcp->hash_func, destp->hash_func);
+  P_32_COPY(srcp->codec, destp->codec);
+  P_32_COPY(srcp->codec_min, destp->codec_min);
+  P_32_COPY(srcp->codec_width, destp->codec_width);
   for (i = 0; i < NCACHED; i++) 
     P_32_COPY(srcp->spares[i], destp->spares[i]);
   for (i = 0; i < NCACHED; i++) 
@@ -228,8 +241,7 @@ _ffdb_hput_header (ffdb_htab_t* hashp)
 
 
   /* write the header */
-  lseek(hashp->fp, 0, SEEK_SET);
-  num_copied = write(hashp->fp, whdrp, sizeof(ffdb_hashhdr_t));
+  num_copied = pwrite(hashp->fp, whdrp, sizeof(ffdb_hashhdr_t), 0);
   if (num_copied != sizeof(ffdb_hashhdr_t)) {
     fprintf(stderr, "hash: could not write hash header");
     return -1;
@@ -269,6 +281,7 @@ _ffdb_hdestroy (ffdb_htab_t* hashp)
 
   if (hashp->rearrange_pages && hashp->save_file)
     ffdb_rearrage_pages_on_close (hashp);
+  ffdb_index_unload (hashp);
 
 #ifdef _FFDB_STATISTICS
   { 
@@ -310,6 +323,7 @@ _ffdb_hdestroy (ffdb_htab_t* hashp)
 #endif
   ffdb_pagepool_sync (hashp->mp);
   ffdb_pagepool_close (hashp->mp);
+  hashp->mp = 0;
 
   /* Reduce file size if possible */
   if (hashp->rearrange_pages)
@@ -328,6 +342,10 @@ _ffdb_hdestroy (ffdb_htab_t* hashp)
     free(hashp->bigdata_buf);
   if (hashp->bigkey_buf)
     free(hashp->bigkey_buf);
+  if (hashp->run_dpages)
+    free(hashp->run_dpages);
+  if (hashp->codec_buf)
+    free(hashp->codec_buf);
 
   if (save_errno) {
     errno = save_errno;
@@ -357,10 +375,17 @@ _ffdb_init_hash(ffdb_htab_t* hashp, const char* file,
     fprintf (stderr, "Info: Data will be stored in big endian format.\n");
 #endif
 
+  hashp->hdr.version = FFDB_HASHVERSION;
+  hashp->pair_overhead = FFDB_PAIR_OVERHEAD;
+  hashp->dhdr_size = sizeof(ffdb_data_header_t);
   hashp->hdr.nkeys = 0;
   hashp->hdr.bsize = DEF_BUCKET_SIZE;
   hashp->hdr.bshift = DEF_BUCKET_SHIFT;
   hashp->hdr.ffactor = DEF_FFACTOR;
+  hashp->hdr.hash_func = FFDB_HASH_WY;
+  hashp->hdr.codec = FFDB_CODEC_NONE;
+  hashp->hdr.codec_min = FFDB_COMPRESS_MIN;
+  hashp->hdr.codec_width = 0;
   hashp->hash = __ffdb_default_hash;
   hashp->h_compare = __ffdb_default_cmp;
   memset(hashp->hdr.spares, 0, sizeof(hashp->hdr.spares));
@@ -391,6 +416,31 @@ _ffdb_init_hash(ffdb_htab_t* hashp, const char* file,
 
     /* Set rearrange page flag */
     hashp->rearrange_pages = info->rearrangepages;
+
+    /* The hash function is recorded in the header */
+    if (info->hashfunc != FFDB_HASH_DEFAULT) {
+      if (!(hashp->hash = __ffdb_hash_func(info->hashfunc))) {
+	errno = EINVAL;
+	return errno;
+      }
+      hashp->hdr.hash_func = info->hashfunc;
+    }
+
+    /* So is the codec of the data */
+    if (info->compress != FFDB_CODEC_NONE) {
+      if (info->compress != FFDB_CODEC_LZ) {
+	errno = EINVAL;
+	return errno;
+      }
+      hashp->hdr.codec = info->compress;
+    }
+    if (info->compressmin)
+      hashp->hdr.codec_min = info->compressmin;
+    if (info->filterwidth > FFDB_FILTER_MAXWIDTH) {
+      errno = EINVAL;
+      return errno;
+    }
+    hashp->hdr.codec_width = info->filterwidth;
     
 #if 0
     if (info->hash)
@@ -404,14 +454,40 @@ _ffdb_init_hash(ffdb_htab_t* hashp, const char* file,
 }
 
 
+/**
+ * Length of the header of a file of a version. Fields were added to
+ * the header ahead of the spares as the format changed.
+ */
+static unsigned int
+_ffdb_header_size (int version)
+{
+  unsigned int size = sizeof(ffdb_hashhdr_t);
+
+  if (version < FFDB_VERSION_FILTER)
+    size -= sizeof(unsigned int);          /* codec_width */
+  if (version < FFDB_VERSION_CODEC)
+    size -= 2 * sizeof(unsigned int);      /* codec, codec_min */
+  if (version < FFDB_VERSION_HASH_FUNC)
+    size -= sizeof(unsigned int);          /* hash_func */
+  if (version < FFDB_VERSION_INDEX)
+    size -= sizeof(pgno_t);                /* idx_page */
+  return size;
+}
+
 /**
  * Functions to get/put hash header.  We access the file directly.
+ *
+ * The header of a file of an older version is read into the current
+ * header, and the fields the file does not have are set to what the
+ * file was written with.
  */
 unsigned int
 _ffdb_hget_header(ffdb_htab_t *hashp, unsigned int page_size)
 {
-  unsigned num_copied, i, newchksum;
+  unsigned num_copied, i, newchksum, size, tail;
+  unsigned char buf[sizeof(ffdb_hashhdr_t)];
   unsigned char *hdr_dest;
+  int version;
 
   num_copied = 0;
   i = 0;
@@ -422,17 +498,33 @@ _ffdb_hget_header(ffdb_htab_t *hashp, unsigned int page_size)
    * XXX
    * This should not be printing to stderr on a "normal" error case.
    */
-  lseek(hashp->fp, 0, SEEK_SET);
-  num_copied = read(hashp->fp, hdr_dest, sizeof(ffdb_hashhdr_t));
+  num_copied = pread(hashp->fp, buf, sizeof(ffdb_hashhdr_t), 0);
   if (num_copied != sizeof(ffdb_hashhdr_t)) {
     fprintf(stderr, "Fatal error : hash could not retrieve header");
     return 0;
   }
 
+  /* The version tells how long the header is */
+  memcpy (&version, buf + offsetof(ffdb_hashhdr_t, version), sizeof(int));
+  if (hashp->mborder == LITTLE_ENDIAN)
+    M_32_SWAP(version);
+  if (version < FFDB_HASHVERSION_MIN || version > FFDB_HASHVERSION)
+    return 0;
+  size = _ffdb_header_size (version);
+
   /* Now I need compare checksum value */
   newchksum = 0;
-  newchksum = __ffdb_crc32_checksum (newchksum, hdr_dest,
-				     sizeof(ffdb_hashhdr_t) - sizeof(unsigned int));
+  newchksum = __ffdb_crc32_checksum (newchksum, buf,
+				     size - sizeof(unsigned int));
+
+  /* Fields were added in order ahead of the spares, so the file has
+   * the fields up to some added field, then the spares and the rest
+   */
+  tail = sizeof(ffdb_hashhdr_t) - offsetof(ffdb_hashhdr_t, spares);
+  memset (hdr_dest, 0, sizeof(ffdb_hashhdr_t));
+  memcpy (hdr_dest, buf, size - tail);
+  memcpy (hdr_dest + offsetof(ffdb_hashhdr_t, spares), buf + size - tail, 
+	  tail);
 
   if (hashp->mborder == LITTLE_ENDIAN)
     _ffdb_swap_header(hashp);
@@ -442,6 +534,21 @@ _ffdb_hget_header(ffdb_htab_t *hashp, unsigned int page_size)
     exit (1);
   }
 
+  /* What older files do not record. The hash function is picked on open */
+  if (version < FFDB_VERSION_INDEX)
+    hashp->hdr.idx_page = 0;
+  if (version < FFDB_VERSION_CODEC) {
+    hashp->hdr.codec = FFDB_CODEC_NONE;
+    hashp->hdr.codec_min = FFDB_COMPRESS_MIN;
+  }
+  if (version < FFDB_VERSION_FILTER)
+    hashp->hdr.codec_width = 0;
+
+  hashp->pair_overhead = (version < FFDB_VERSION_KEY_HASH) ?
+    FFDB_PAIR_OVERHEAD_V5 : FFDB_PAIR_OVERHEAD;
+  hashp->dhdr_size = (version < FFDB_VERSION_CODEC) ?
+    FFDB_DATA_OVERHEAD_V8 : sizeof(ffdb_data_header_t);
+
 #if 0
   if (hashp->hdr.lorder == LITTLE_ENDIAN) 
     fprintf (stderr, "Info: Data are stored in little endian format.\n");
@@ -611,6 +718,9 @@ _ffdb_init_htab (ffdb_htab_t* hashp, int nb, FFDB_HASHINFO* info)
   for (i = 0; i < NCACHED; i++)
     hashp->hdr.free_pages[i] = INVALID_PGNO;
 
+  /* The ordered key index gets its first page with the first key */
+  hashp->hdr.idx_page = (info && info->orderedindex) ? INVALID_PGNO : 0;
+
   /* current spliting level */
   hashp->hdr.ovfl_point = l2;
 
@@ -668,6 +778,9 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
   memset (hashp, 0, sizeof(ffdb_htab_t));
   hashp->fp = -1;
   hashp->curr_dpage = INVALID_PGNO;
+  hashp->curr_run = -1;
+  hashp->main_dpage = INVALID_PGNO;
+  hashp->compact_page = INVALID_PGNO;
   hashp->rearrange_pages = 1;
 
   /* check this machine byte order */
@@ -724,7 +837,6 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
     else
       hashp->h_compare = __ffdb_default_cmp;
 #else
-    hashp->hash = __ffdb_default_hash;
     hashp->h_compare = __ffdb_default_cmp;
 #endif
 
@@ -748,8 +860,32 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
       return 0;
     }
     
-    /* check hash version */
-    if (hashp->hdr.version != FFDB_HASHVERSION) {
+    /* check hash version: older files are read as they are */
+    if (hashp->hdr.version < FFDB_HASHVERSION_MIN ||
+	hashp->hdr.version > FFDB_HASHVERSION) {
+      close (hashp->fp);
+      free (hashp);
+      errno = EFTYPE;
+      return 0;
+    }
+    if (hashp->hdr.version < FFDB_HASHVERSION &&
+	(hashp->flags & O_ACCMODE) != O_RDONLY) {
+      fprintf (stderr, "%s is a version %d database, which can only be opened read only. Run ffdb_upgrade to write to it.\n", 
+	       fname, hashp->hdr.version);
+      close (hashp->fp);
+      free (hashp);
+      errno = EFTYPE;
+      return 0;
+    }
+
+    /*
+     * use the hash function the file was created with. Files before
+     * FFDB_VERSION_HASH_FUNC do not record it, all of them were
+     * created with __ham_func5, which h_charkey checks below
+     */
+    if (hashp->hdr.version < FFDB_VERSION_HASH_FUNC)
+      hashp->hdr.hash_func = FFDB_HASH_FNV;
+    if (!(hashp->hash = __ffdb_hash_func(hashp->hdr.hash_func))) {
       close (hashp->fp);
       free (hashp);
       errno = EFTYPE;
@@ -812,6 +948,21 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
    */
   ffdb_pagepool_filter(hashp->mp, ffdb_pgin_routine, ffdb_pgout_routine, hashp);
 
+  /**
+   * Batches of pages are read and written by the I/O engine asked for
+   */
+  ffdb_pagepool_ioengine(hashp->mp, info ? info->ioengine : FFDB_IO_AUTO);
+
+  /**
+   * A read only file in the native byte order is memory mapped so that
+   * processes opening the same file share the operating system page
+   * cache instead of each keeping a private copy. If the file cannot be
+   * mapped, the page pool is used as before.
+   */
+  if (!new_table && (hashp->flags & O_ACCMODE) == O_RDONLY &&
+      hashp->hdr.lorder == hashp->mborder)
+    ffdb_pagepool_mmap (hashp->mp, ffdb_pgcheck_routine);
+
   /*
    * For a new table, set up the appropriate hashtable information
    */
@@ -1022,9 +1173,17 @@ _ffdb_hash_close (FFDB_DB* dbp)
 unsigned int
 _ffdb_call_hash (ffdb_htab_t* hashp, const void* k, unsigned int len)
 {
-  unsigned int n, bucket;
+  return _ffdb_hash_bucket (hashp, hashp->hash (k, len));
+}
+
+/**
+ * Bucket number of a full hash value
+ */
+unsigned int
+_ffdb_hash_bucket (ffdb_htab_t* hashp, unsigned int n)
+{
+  unsigned int bucket;
 
-  n = hashp->hash (k, len);
   bucket = (n & hashp->hdr.high_mask); /* n mod 2^(i + 1) */
 
   if (bucket > hashp->hdr.max_bucket) {
@@ -1075,6 +1234,7 @@ _ffdb_expand_table (ffdb_htab_t* hashp)
   if (spare_indx > hashp->hdr.ovfl_point) {
     /* update current data page value */
     hashp->curr_dpage = INVALID_PGNO;
+    ffdb_reset_data_runs (hashp);
     hashp->hdr.ovfl_point = spare_indx;
     isdoubling = 1;
   }
@@ -1140,7 +1300,8 @@ _ffdb_hash_get (const FFDB_DB* dbp, const FFDB_DBT* key,
   item.seek_size = PAIRSIZE(key, data);
 
   /* calculate hash value for this key */
-  bucket = _ffdb_call_hash (hashp, key->data, key->size);
+  item.key_hash = hashp->hash (key->data, key->size);
+  bucket = _ffdb_hash_bucket (hashp, item.key_hash);
   item.bucket = bucket;
   
 #ifdef _FFDB_DEBUG
@@ -1167,11 +1328,12 @@ _ffdb_hash_get (const FFDB_DB* dbp, const FFDB_DBT* key,
 
 
 /**
- * Put a key and data pair into the database
+ * Put a key and data pair into the database. The data go to the data
+ * page run of configuration run, unless run is -1
  */
 static int
-_ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
-		unsigned int flag)
+_ffdb_put_data (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
+		unsigned int flag, int run)
 {
   ffdb_htab_t* hashp;
   ffdb_hent_t item;
@@ -1212,13 +1374,31 @@ _ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
     return -1;
   }
 
+  if (run >= 0 && (unsigned int)run >= hashp->hdr.num_cfigs) {
+    FFDB_LOCK (hashp->lock);
+    hashp->db_errno = errno = EINVAL;
+    FFDB_UNLOCK (hashp->lock);
+    return -1;
+  }
+
+  /* A key of the ordered key index has to fit on an index page */
+  if (hashp->hdr.idx_page != 0 && key->size > FFDB_MAX_INDEX_KEYSIZE(hashp)) {
+    fprintf (stderr, "Key of %d bytes is too long for the ordered index.\n",
+	     key->size);
+    FFDB_LOCK (hashp->lock);
+    hashp->db_errno = errno = EINVAL;
+    FFDB_UNLOCK (hashp->lock);
+    return -1;
+  }
+
   /* initialize item */
   memset (&item, 0, sizeof (ffdb_hent_t));
   /* Calculate the hash item size */
   item.seek_size = PAIRSIZE(key, data);
 
   /* calculate hash value for this key */
-  bucket = _ffdb_call_hash (hashp, key->data, key->size);
+  item.key_hash = hashp->hash (key->data, key->size);
+  bucket = _ffdb_hash_bucket (hashp, item.key_hash);
   item.bucket = bucket;
 
 #ifdef _FFDB_DEBUG
@@ -1233,6 +1413,14 @@ _ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
 
 
   FFDB_LOCK(hashp->lock);
+
+  /* New data of a configuration go to its data page run */
+  if (run >= 0 && ffdb_enter_data_run (hashp, run) != 0) {
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_release_item (hashp, &item);
+    return -1;
+  }
+
   if (item.status == ITEM_NO_MORE) {
     /* There is no item found, we need to insert this item */
     /* Find out whether there is space on this page to fit this pair */
@@ -1241,9 +1429,16 @@ _ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
       fprintf (stderr, "This data item bucket %d fit with page %d\n", bucket, item.pgno);
 #endif
       if ((status = ffdb_add_pair (hashp, key, data, &item, 0)) != 0) {
+	ffdb_leave_data_run (hashp);
 	FFDB_UNLOCK (hashp->lock);  
 	return status;
       }
+      if ((status = ffdb_index_insert (hashp, key)) != 0) {
+	hashp->hdr.nkeys++;
+	ffdb_leave_data_run (hashp);
+	FFDB_UNLOCK (hashp->lock);
+	return status;
+      }
     }
     else {
       /* Data will not fit on the page */
@@ -1253,15 +1448,23 @@ _ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
 
       /* First chain an overflow page */
       if ((status = ffdb_add_ovflpage (hashp, key, data, &item)) != 0) {
+	ffdb_leave_data_run (hashp);
 	FFDB_UNLOCK (hashp->lock);  
 	return status;
       }
+      if ((status = ffdb_index_insert (hashp, key)) != 0) {
+	hashp->hdr.nkeys++;
+	ffdb_leave_data_run (hashp);
+	FFDB_UNLOCK (hashp->lock);
+	return status;
+      }
 
       /* Now I need to expand the table even though the current bucket
        * may not be splited at this moment
        */
       if ((status = _ffdb_expand_table (hashp)) != 0) {
 	hashp->hdr.nkeys++;
+	ffdb_leave_data_run (hashp);
 	FFDB_UNLOCK (hashp->lock);
 	return status;
       }
@@ -1274,11 +1477,13 @@ _ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
      * a replace flag
      */
     if (flag && flag == FFDB_NOOVERWRITE) {
+      ffdb_leave_data_run (hashp);
       FFDB_UNLOCK (hashp->lock);  
       return -1;
     }
 
     if ((status = ffdb_add_pair (hashp, key, data, &item, 1)) != 0) {
+      ffdb_leave_data_run (hashp);
       FFDB_UNLOCK (hashp->lock);  
       return -1;
     }
@@ -1288,18 +1493,90 @@ _ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
   if (newkey)
     hashp->hdr.nkeys++;
 
+  ffdb_leave_data_run (hashp);
   FFDB_UNLOCK (hashp->lock);  
   return 0;
 }
 
 
 /**
- * Delete a key from the database
+ * Put a key and data pair into the database
+ */
+static int
+_ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
+		unsigned int flag)
+{
+  return _ffdb_put_data (dbp, key, data, flag, -1);
+}
+
+/**
+ * Put a key and data pair with the data on the data page run of a
+ * configuration
+ */
+int
+ffdb_put_config (const FFDB_DB* db, FFDB_DBT* key, const FFDB_DBT* data,
+		 unsigned int config)
+{
+  return _ffdb_put_data (db, key, data, 0, (int)config);
+}
+
+
+/**
+ * Delete a key and its data from the database
+ * returns 0: on success
+ * returns 1: where the key not found
+ * returns -1: there is an error
+ * currently there is no flag is used
  */
 static int
 _ffdb_hash_delete (const FFDB_DB* dbp, const FFDB_DBT* key, unsigned int flag)
 {
-  return 0;
+  ffdb_htab_t* hashp;
+  ffdb_hent_t item;
+  FFDB_DBT nodata;
+  int status;
+
+  hashp = (ffdb_htab_t *)dbp->internal;
+
+  /* check file permission, if this is a read only file, cannot do it */
+  if ((hashp->flags & O_ACCMODE) == O_RDONLY) {
+    FFDB_LOCK (hashp->lock);
+    hashp->db_errno = errno = EPERM;
+    FFDB_UNLOCK (hashp->lock);
+    return -1;
+  }
+
+  /* initialize item */
+  memset (&item, 0, sizeof (ffdb_hent_t));
+  nodata.data = 0;
+  nodata.size = 0;
+  item.seek_size = PAIRSIZE(key, &nodata);
+
+  /* calculate hash value for this key */
+  item.key_hash = hashp->hash (key->data, key->size);
+  item.bucket = _ffdb_hash_bucket (hashp, item.key_hash);
+
+  /* Find the key with its pages held exclusively as an insertion does */
+  status = ffdb_find_item (hashp, (FFDB_DBT *)key, &nodata, &item);
+  if (status != 0)  /* Something is really wrong */
+    return status;
+
+  FFDB_LOCK(hashp->lock);
+  if (item.status != ITEM_OK) {
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_release_item (hashp, &item);
+    return FFDB_NOT_FOUND;
+  }
+
+  /* The page of this item is put back by the call */
+  status = ffdb_delete_pair (hashp, &item);
+  if (status == 0) {
+    hashp->hdr.nkeys--;
+    status = ffdb_index_delete (hashp, key);
+  }
+
+  FFDB_UNLOCK (hashp->lock);
+  return status;
 }
 
 
@@ -1350,10 +1627,11 @@ _ffdb_hash_sync (const FFDB_DB *dbp, unsigned int flags)
 }
 
 /**
- * Return a new cursor
+ * Return a new cursor walking buckets [lo, hi)
  */
 static int
-_ffdb_hash_cursor (const FFDB_DB* dbp, ffdb_cursor_t** c, unsigned int type)
+_ffdb_new_cursor (const FFDB_DB* dbp, ffdb_cursor_t** c, unsigned int type,
+		  pgno_t lo, pgno_t hi)
 {
   ffdb_cursor_t *nc;
   ffdb_crs_t* inc;
@@ -1381,7 +1659,21 @@ _ffdb_hash_cursor (const FFDB_DB* dbp, ffdb_cursor_t** c, unsigned int type)
   inc->pcursor = nc;
   memset (&inc->item, 0, sizeof(ffdb_hent_t));  
   inc->item.status = ITEM_CLEAN;
+  inc->lo_bucket = lo;
+  inc->hi_bucket = hi;
+  inc->ra_bucket = 0;
+  inc->ra_window = 0;
+  inc->page_mod = 0;
+  inc->key_hash = 0;
+  inc->key_len = inc->key_max = 0;
+  inc->key = 0;
+  inc->ordered = 0;
+  memset (&inc->lo, 0, sizeof(FFDB_DBT));
+  memset (&inc->hi, 0, sizeof(FFDB_DBT));
+  /* Cursors of different threads share the queue */
+  FFDB_LOCK(inc->hashp->lock);
   FFDB_TAILQ_INSERT_TAIL(&(inc->hashp->curs_queue), inc, queue);
+  FFDB_UNLOCK(inc->hashp->lock);
 
   /* Set internal pointer */
   nc->internal = inc;
@@ -1397,6 +1689,15 @@ _ffdb_hash_cursor (const FFDB_DB* dbp, ffdb_cursor_t** c, unsigned int type)
   return 0;
 }
 
+/**
+ * Return a new cursor walking all buckets
+ */
+static int
+_ffdb_hash_cursor (const FFDB_DB* dbp, ffdb_cursor_t** c, unsigned int type)
+{
+  return _ffdb_new_cursor (dbp, c, type, 0, INVALID_PGNO);
+}
+
 
 /**
  * Code related to configuration and user information
@@ -1532,52 +1833,840 @@ ffdb_max_user_info_len (const FFDB_DB* db)
 }
 
 
-/************************************************************************
- * Cursor related routines                                              *
- ************************************************************************/
-static int
-_ffdb_cursor_get  (ffdb_cursor_t* cursor, FFDB_DBT* key,
-		   FFDB_DBT* data, unsigned int flags)
+/**
+ * Get part of the data for a key
+ */
+int
+ffdb_get_range (const FFDB_DB* db, const FFDB_DBT* key, FFDB_DBT* data,
+		unsigned int offset, unsigned int len)
 {
+  ffdb_htab_t* hashp;
+  ffdb_hent_t item;
   int status;
-  ffdb_crs_t*  icrs = (ffdb_crs_t *)cursor->internal;
-  ffdb_htab_t* hashp = icrs->hashp;
-  unsigned int realflags;
 
-  /* Check flag to see whether it is valid */
-  if (flags != FFDB_FIRST && flags != FFDB_LAST &&
-      flags != FFDB_NEXT && flags != FFDB_PREV) {
-    fprintf (stderr, "Unsupported cursor get flag %d\n", flags);
+  hashp = (ffdb_htab_t *)db->internal;
+
+  memset (&item, 0, sizeof (ffdb_hent_t));
+  item.seek_size = PAIRSIZE(key, data);
+  item.key_hash = hashp->hash (key->data, key->size);
+  item.bucket = _ffdb_hash_bucket (hashp, item.key_hash);
+
+  status = ffdb_find_item (hashp, (FFDB_DBT *)key, 0, &item);
+  if (status != 0)
     return -1;
+
+  if (item.status == ITEM_NO_MORE) {
+    ffdb_release_item (hashp, &item);
+    return FFDB_NOT_FOUND;
   }
-    
-  realflags = flags;
-  if (cursor->type == FFDB_KEY_CURSOR) {
-    /* If the cursor has not been initialized */
-    if (flags == FFDB_NEXT && icrs->item.status == ITEM_CLEAN)
-      realflags = FFDB_FIRST;
-    
-    if (flags == FFDB_PREV && icrs->item.status == ITEM_CLEAN)
-      realflags = FFDB_LAST;
 
-    FFDB_LOCK(icrs->lock);
-    status = ffdb_cursor_find_by_key (hashp, icrs, key, data, realflags);
-    FFDB_UNLOCK(icrs->lock);
+  /* page of the item is released after the call */
+  return ffdb_get_item_range (hashp, &item, data, offset, len);
+}
+
+/**
+ * Overwrite part of the data for a key
+ */
+int
+ffdb_put_range (const FFDB_DB* db, const FFDB_DBT* key, const FFDB_DBT* data,
+		unsigned int offset)
+{
+  ffdb_htab_t* hashp;
+  ffdb_hent_t item;
+  FFDB_DBT nodata;
+  int status;
+
+  hashp = (ffdb_htab_t *)db->internal;
+
+  /* check file permission, if this is a read only file, cannot do it */
+  if ((hashp->flags & O_ACCMODE) == O_RDONLY) {
+    FFDB_LOCK (hashp->lock);
+    hashp->db_errno = errno = EPERM;
+    FFDB_UNLOCK (hashp->lock);
+    return -1;
   }
-  else {
-    status = 0;
+
+  memset (&item, 0, sizeof (ffdb_hent_t));
+  nodata.data = 0;
+  nodata.size = 0;
+  item.seek_size = PAIRSIZE(key, &nodata);
+  item.key_hash = hashp->hash (key->data, key->size);
+  item.bucket = _ffdb_hash_bucket (hashp, item.key_hash);
+
+  /* Find the key with its pages held exclusively as an insertion does */
+  status = ffdb_find_item (hashp, (FFDB_DBT *)key, &nodata, &item);
+  if (status != 0)
+    return -1;
+
+  FFDB_LOCK(hashp->lock);
+  if (item.status != ITEM_OK) {
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_release_item (hashp, &item);
+    return FFDB_NOT_FOUND;
   }
+
+  /* page of the item is released after the call */
+  status = ffdb_put_item_range (hashp, &item, data, offset);
+  FFDB_UNLOCK (hashp->lock);
+
   return status;
 }
 
+/**
+ * Get the length of the data for a key
+ */
+int
+ffdb_get_size (const FFDB_DB* db, const FFDB_DBT* key, unsigned int* size)
+{
+  ffdb_htab_t* hashp;
+  ffdb_hent_t item;
+  int status;
+
+  hashp = (ffdb_htab_t *)db->internal;
 
-static int
-_ffdb_cursor_close (ffdb_cursor_t* cursor)
+  memset (&item, 0, sizeof (ffdb_hent_t));
+  item.key_hash = hashp->hash (key->data, key->size);
+  item.bucket = _ffdb_hash_bucket (hashp, item.key_hash);
+
+  status = ffdb_find_item (hashp, (FFDB_DBT *)key, 0, &item);
+  if (status != 0)
+    return -1;
+
+  if (item.status == ITEM_NO_MORE) {
+    ffdb_release_item (hashp, &item);
+    return FFDB_NOT_FOUND;
+  }
+
+  /* page of the item is released after the call */
+  return ffdb_get_item_size (hashp, &item, size);
+}
+
+/**
+ * Get a view of data for a key
+ */
+int
+ffdb_get_view (const FFDB_DB* db, const FFDB_DBT* key, FFDB_DBT* data,
+	       ffdb_view_t* view)
 {
-  ffdb_crs_t* inc = (ffdb_crs_t *)cursor->internal;
-  ffdb_htab_t* hashp = inc->hashp;
+  ffdb_htab_t* hashp;
+  ffdb_hent_t item;
+  int status;
 
-  FFDB_TAILQ_REMOVE(&(hashp->curs_queue), inc, queue);
+  hashp = (ffdb_htab_t *)db->internal;
+
+  view->page = 0;
+  view->buf = 0;
+  data->data = 0;
+  data->size = 0;
+
+  memset (&item, 0, sizeof (ffdb_hent_t));
+  item.seek_size = PAIRSIZE(key, data);
+  item.key_hash = hashp->hash (key->data, key->size);
+  item.bucket = _ffdb_hash_bucket (hashp, item.key_hash);
+
+  status = ffdb_find_item (hashp, (FFDB_DBT *)key, 0, &item);
+  if (status != 0)
+    return -1;
+
+  if (item.status == ITEM_NO_MORE) {
+    ffdb_release_item (hashp, &item);
+    return FFDB_NOT_FOUND;
+  }
+
+  /* page of the item is released after the call */
+  status = ffdb_get_item_view (hashp, &item, data, &view->page);
+  if (status == 0 && !view->page)
+    view->buf = data->data;
+
+  return status;
+}
+
+/**
+ * Release a view of data
+ */
+void
+ffdb_release_view (const FFDB_DB* db, ffdb_view_t* view)
+{
+  ffdb_htab_t* hashp;
+
+  hashp = (ffdb_htab_t *)db->internal;
+
+  if (view->page)
+    ffdb_put_page (hashp, view->page, HASH_DATA_PAGE, 0);
+  if (view->buf)
+    free (view->buf);
+
+  view->page = 0;
+  view->buf = 0;
+}
+
+
+/**
+ * One request of a batched get
+ */
+typedef struct _ffdb_mreq_
+{
+  unsigned int idx;             /* index into keys and vals       */
+  pgno_t       page;            /* bucket page of the key         */
+  ffdb_hent_t  item;            /* key page and index of the item */
+  ffdb_datap_t datap;           /* where the data is              */
+  int          status;          /* 0, FFDB_NOT_FOUND or -1        */
+}ffdb_mreq_t;
+
+/**
+ * A slice of the sorted requests handled by one thread
+ */
+typedef struct _ffdb_mget_
+{
+  const FFDB_DB*   dbp;
+  const FFDB_DBT*  keys;
+  FFDB_DBT*        vals;
+  ffdb_mreq_t*     reqs;
+  unsigned int     nreqs;
+  int              status;
+}ffdb_mget_t;
+
+static int
+_ffdb_mreq_page_cmp (const void* a, const void* b)
+{
+  const ffdb_mreq_t* r1 = (const ffdb_mreq_t *)a;
+  const ffdb_mreq_t* r2 = (const ffdb_mreq_t *)b;
+
+  if (r1->page != r2->page)
+    return (r1->page < r2->page) ? -1 : 1;
+  return (r1->idx < r2->idx) ? -1 : (r1->idx > r2->idx);
+}
+
+static int
+_ffdb_mreq_data_cmp (const void* a, const void* b)
+{
+  const ffdb_mreq_t* r1 = (const ffdb_mreq_t *)a;
+  const ffdb_mreq_t* r2 = (const ffdb_mreq_t *)b;
+
+  /* Not found items go last */
+  if (r1->status != r2->status)
+    return (r1->status == 0) ? -1 : 1;
+  if (r1->datap.first != r2->datap.first)
+    return (r1->datap.first < r2->datap.first) ? -1 : 1;
+  return (r1->datap.offset < r2->datap.offset) ? -1 : 
+    (r1->datap.offset > r2->datap.offset);
+}
+
+/**
+ * Read ahead the different pages needed by the next requests of a
+ * slice, either their bucket pages or the first pages of their data
+ * @return index of the first request whose page is not read ahead
+ */
+static unsigned int
+_ffdb_mget_prefetch (ffdb_htab_t* hashp, ffdb_mreq_t* reqs,
+		     unsigned int from, unsigned int nreqs, int data)
+{
+  pgno_t pgnos[FFDB_IO_DEPTH];
+  pgno_t pgno;
+  unsigned int i, n;
+
+  n = 0;
+  for (i = from; i < nreqs; i++) {
+    if (data) {
+      /* not found items are sorted last */
+      if (reqs[i].status != 0)
+	return nreqs;
+      pgno = reqs[i].datap.first;
+    }
+    else
+      pgno = reqs[i].page;
+    if (n > 0 && pgnos[n - 1] == pgno)
+      continue;
+    if (n == FFDB_IO_DEPTH)
+      break;
+    pgnos[n++] = pgno;
+  }
+
+  /* A single page is read just as fast when it is needed */
+  if (n > 1)
+    ffdb_pagepool_prefetch (hashp->mp, pgnos, n);
+  return i;
+}
+
+/**
+ * Resolve a slice of requests sorted by bucket page: first find every
+ * key walking bucket pages in ascending order, then read every datum
+ * walking data pages in ascending order.
+ */
+static void*
+_ffdb_get_many_i (void* arg)
+{
+  ffdb_mget_t* mg = (ffdb_mget_t *)arg;
+  ffdb_htab_t* hashp = (ffdb_htab_t *)mg->dbp->internal;
+  ffdb_mreq_t* req;
+  FFDB_DBT* val;
+  unsigned int i, nfound, next;
+  int status;
+
+  nfound = 0;
+  next = 0;
+  for (i = 0; i < mg->nreqs; i++) {
+    if (i == next)
+      next = _ffdb_mget_prefetch (hashp, mg->reqs, i, mg->nreqs, 0);
+    req = &mg->reqs[i];
+    if (ffdb_find_item (hashp, (FFDB_DBT *)&mg->keys[req->idx], 0,
+			&req->item) != 0) {
+      req->status = -1;
+      continue;
+    }
+    if (req->item.status == ITEM_NO_MORE) {
+      ffdb_release_item (hashp, &req->item);
+      req->status = FFDB_NOT_FOUND;
+      continue;
+    }
+    /* remember where the data is, the key page is put back right away */
+    req->datap = *(DATAP(req->item.pagep, req->item.pgndx));
+    ffdb_put_page (hashp, req->item.pagep, HASH_RAW_PAGE, 0);
+    req->item.pagep = 0;
+    req->status = 0;
+    nfound++;
+  }
+
+  if (nfound > 1)
+    qsort (mg->reqs, mg->nreqs, sizeof(ffdb_mreq_t), _ffdb_mreq_data_cmp);
+
+  next = 0;
+  for (i = 0; i < mg->nreqs; i++) {
+    if (i == next)
+      next = _ffdb_mget_prefetch (hashp, mg->reqs, i, mg->nreqs, 1);
+    req = &mg->reqs[i];
+    val = &mg->vals[req->idx];
+    if (req->status == 0) {
+      status = ffdb_get_item_data (hashp, &req->item, &req->datap, val);
+      /* the data has been moved by a writer, look it up again */
+      if (status == 1)
+	status = _ffdb_hash_get (mg->dbp, &mg->keys[req->idx], val, 0);
+      req->status = status;
+    }
+    if (req->status == -1)
+      mg->status = -1;
+    else if (req->status == FFDB_NOT_FOUND && mg->status == 0)
+      mg->status = FFDB_NOT_FOUND;
+  }
+
+  return 0;
+}
+
+/**
+ * Get data for many keys at once
+ */
+int
+ffdb_get_many (const FFDB_DB* db, const FFDB_DBT keys[], FFDB_DBT vals[],
+	       unsigned int n, unsigned int nthreads)
+{
+  ffdb_htab_t* hashp;
+  ffdb_mreq_t* reqs;
+  ffdb_mget_t* mgs;
+  pthread_t* tids;
+  unsigned int i, j, start, chunk;
+  int status;
+
+  hashp = (ffdb_htab_t *)db->internal;
+
+  for (i = 0; i < n; i++) {
+    vals[i].data = 0;
+    vals[i].size = 0;
+  }
+  if (n == 0)
+    return 0;
+
+  reqs = (ffdb_mreq_t *)calloc (n, sizeof(ffdb_mreq_t));
+  if (!reqs) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* Hash every key and sort the requests by bucket page */
+  for (i = 0; i < n; i++) {
+    reqs[i].idx = i;
+    reqs[i].item.seek_size = PAIRSIZE(&keys[i], &vals[i]);
+    reqs[i].item.key_hash = hashp->hash (keys[i].data, keys[i].size);
+    reqs[i].item.bucket = _ffdb_hash_bucket (hashp, reqs[i].item.key_hash);
+    BUCKET_TO_PAGE(reqs[i].item.bucket, reqs[i].page);
+  }
+  qsort (reqs, n, sizeof(ffdb_mreq_t), _ffdb_mreq_page_cmp);
+
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > n)
+    nthreads = n;
+
+  mgs = (ffdb_mget_t *)calloc (nthreads, sizeof(ffdb_mget_t));
+  tids = (pthread_t *)calloc (nthreads, sizeof(pthread_t));
+  if (!mgs || !tids) {
+    free (mgs);
+    free (tids);
+    free (reqs);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* Each thread gets a contiguous range of bucket pages */
+  chunk = n / nthreads;
+  start = 0;
+  for (i = 0; i < nthreads; i++) {
+    mgs[i].dbp = db;
+    mgs[i].keys = keys;
+    mgs[i].vals = vals;
+    mgs[i].reqs = &reqs[start];
+    mgs[i].nreqs = (i == nthreads - 1) ? n - start : chunk;
+    mgs[i].status = 0;
+    start += mgs[i].nreqs;
+  }
+
+  for (i = 1; i < nthreads; i++) {
+    if (pthread_create (&tids[i], 0, _ffdb_get_many_i, &mgs[i]) != 0) {
+      /* run the rest in this thread */
+      for (j = i; j < nthreads; j++)
+	_ffdb_get_many_i (&mgs[j]);
+      break;
+    }
+  }
+  _ffdb_get_many_i (&mgs[0]);
+  for (j = 1; j < i; j++)
+    pthread_join (tids[j], 0);
+
+  status = 0;
+  for (i = 0; i < nthreads; i++) {
+    if (mgs[i].status == -1)
+      status = -1;
+    else if (mgs[i].status == FFDB_NOT_FOUND && status == 0)
+      status = FFDB_NOT_FOUND;
+  }
+
+  free (tids);
+  free (mgs);
+  free (reqs);
+
+  return status;
+}
+
+
+/**
+ * Grow an empty hash table to at least nb buckets in one step.
+ * The bucket pages of the current table keep their page numbers, and
+ * no data or overflow page has been allocated yet.
+ */
+static void
+_ffdb_presize_htab (ffdb_htab_t* hashp, unsigned int nb)
+{
+  unsigned int l2, i;
+
+  l2 = __ffdb_log2 (nb);
+  if (l2 <= hashp->hdr.ovfl_point)
+    return;
+  if (l2 >= NCACHED - 1)
+    l2 = NCACHED - 2;
+
+  /* populate spares the same way as _ffdb_init_htab */
+  for (i = hashp->hdr.ovfl_point + 1; i <= l2; i++) {
+    if (i == 1)
+      hashp->hdr.spares[1] = hashp->hdr.hdrpages + 1;
+    else
+      hashp->hdr.spares[i] = hashp->hdr.spares[i - 1] + POW2(i - 2);
+  }
+  for (; i < NCACHED; i++)
+    hashp->hdr.spares[i] = 0;
+
+  hashp->hdr.ovfl_point = l2;
+  hashp->hdr.max_bucket = hashp->hdr.high_mask = POW2(l2) - 1;
+  hashp->hdr.low_mask = (POW2(l2) >> 1) - 1;
+  hashp->curr_dpage = INVALID_PGNO;
+  ffdb_reset_data_runs (hashp);
+}
+
+/**
+ * Order of bulk loaded pairs: by bucket page, then by hash value and
+ * position, so that equal keys are next to each other
+ */
+static int
+_ffdb_mreq_hash_cmp (const void* a, const void* b)
+{
+  const ffdb_mreq_t* r1 = (const ffdb_mreq_t *)a;
+  const ffdb_mreq_t* r2 = (const ffdb_mreq_t *)b;
+
+  if (r1->page != r2->page)
+    return (r1->page < r2->page) ? -1 : 1;
+  if (r1->item.key_hash != r2->item.key_hash)
+    return (r1->item.key_hash < r2->item.key_hash) ? -1 : 1;
+  return (r1->idx < r2->idx) ? -1 : (r1->idx > r2->idx);
+}
+
+/**
+ * Load many pairs into an empty database
+ */
+int
+ffdb_bulk_load (FFDB_DB* db, FFDB_DBT keys[], FFDB_DBT vals[],
+		unsigned int n)
+{
+  ffdb_htab_t* hashp;
+  ffdb_mreq_t* reqs;
+  unsigned int *idx, *hashes;
+  unsigned long total, space;
+  unsigned int i, j, m, start, nb;
+  int status;
+
+  hashp = (ffdb_htab_t *)db->internal;
+
+  if ((hashp->flags & O_ACCMODE) == O_RDONLY) {
+    errno = EPERM;
+    return -1;
+  }
+
+  /* A key of the ordered key index has to fit on an index page */
+  for (i = 0; i < n && hashp->hdr.idx_page != 0; i++) {
+    if (keys[i].size > FFDB_MAX_INDEX_KEYSIZE(hashp)) {
+      fprintf (stderr, "Key of %d bytes is too long for the ordered index.\n",
+	       keys[i].size);
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  reqs = (ffdb_mreq_t *)calloc (n > 0 ? n : 1, sizeof(ffdb_mreq_t));
+  idx = (unsigned int *)malloc ((n > 0 ? n : 1) * sizeof(unsigned int));
+  hashes = (unsigned int *)malloc ((n > 0 ? n : 1) * sizeof(unsigned int));
+  if (!reqs || !idx || !hashes) {
+    free (reqs);
+    free (idx);
+    free (hashes);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* Only a table without any key and any data page can be resized */
+  FFDB_LOCK (hashp->lock);
+  if (hashp->hdr.nkeys != 0 || 
+      hashp->hdr.spares[hashp->hdr.ovfl_point + 1] != 0) {
+    FFDB_UNLOCK (hashp->lock);
+    fprintf (stderr, "ffdb_bulk_load: database is not empty.\n");
+    free (reqs);
+    free (idx);
+    free (hashes);
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Size the table so that bucket pages are 3/4 full at the end */
+  total = 0;
+  for (i = 0; i < n; i++) 
+    total += PAIRSIZE(&keys[i], &vals[i]) + PAIR_OVERHEAD;
+  space = (hashp->hdr.bsize - PAGE_OVERHEAD) * 3 / 4;
+  nb = (unsigned int)(total / space) + 1;
+  _ffdb_presize_htab (hashp, nb);
+
+  /* Partition the pairs by their final bucket */
+  for (i = 0; i < n; i++) {
+    reqs[i].idx = i;
+    reqs[i].item.key_hash = hashp->hash (keys[i].data, keys[i].size);
+    reqs[i].item.bucket = _ffdb_hash_bucket (hashp, reqs[i].item.key_hash);
+    BUCKET_TO_PAGE(reqs[i].item.bucket, reqs[i].page);
+  }
+  qsort (reqs, n, sizeof(ffdb_mreq_t), _ffdb_mreq_hash_cmp);
+
+  /* A key given more than once keeps its last data, as with puts */
+  m = 0;
+  for (i = 0; i < n; i++) {
+    for (j = i + 1; j < n && reqs[j].page == reqs[i].page &&
+	   reqs[j].item.key_hash == reqs[i].item.key_hash; j++) {
+      if (keys[reqs[j].idx].size == keys[reqs[i].idx].size &&
+	  memcmp (keys[reqs[j].idx].data, keys[reqs[i].idx].data,
+		  keys[reqs[i].idx].size) == 0)
+	break;
+    }
+    if (j < n && reqs[j].page == reqs[i].page &&
+	reqs[j].item.key_hash == reqs[i].item.key_hash)
+      continue;
+    reqs[m++] = reqs[i];
+  }
+
+  /* Each bucket page and its overflow pages are written at once, and
+   * data pages are appended one after another in bucket order
+   */
+  status = 0;
+  for (start = 0; start < m && status == 0; start = i) {
+    for (i = start; i < m && reqs[i].page == reqs[start].page; i++) {
+      idx[i - start] = reqs[i].idx;
+      hashes[i - start] = reqs[i].item.key_hash;
+    }
+    status = ffdb_bulk_bucket (hashp, reqs[start].item.bucket, keys, vals,
+			       idx, hashes, i - start);
+  }
+
+  for (i = 0; i < m && status == 0; i++) {
+    hashp->hdr.nkeys++;
+    status = ffdb_index_insert (hashp, &keys[reqs[i].idx]);
+  }
+
+  /* The header is written once for the whole load */
+  if (_ffdb_flush_meta (hashp) != 0 && status == 0)
+    status = -1;
+  FFDB_UNLOCK (hashp->lock);
+
+  free (reqs);
+  free (idx);
+  free (hashes);
+  return status;
+}
+
+
+/**
+ * Compact the database a number of pages at a time
+ */
+int
+ffdb_compact (FFDB_DB* db, unsigned int npages)
+{
+  ffdb_htab_t* hashp;
+  int status;
+
+  hashp = (ffdb_htab_t *)db->internal;
+
+  if ((hashp->flags & O_ACCMODE) == O_RDONLY) {
+    errno = EPERM;
+    return -1;
+  }
+
+  status = ffdb_compact_pages (hashp, npages);
+
+  /* New end of the file and new free pages */
+  if (status == 0) {
+    FFDB_LOCK (hashp->lock);
+    _ffdb_flush_meta (hashp);
+    FFDB_UNLOCK (hashp->lock);
+  }
+  return status;
+}
+
+
+/**
+ * Return a new key cursor walking a range of buckets
+ */
+int
+ffdb_cursor_range (const FFDB_DB* db, ffdb_cursor_t** c, 
+		   unsigned int lo, unsigned int hi)
+{
+  if (lo >= hi) {
+    errno = EINVAL;
+    *c = 0;
+    return -1;
+  }
+  return _ffdb_new_cursor (db, c, FFDB_KEY_CURSOR, lo, hi);
+}
+
+
+/**
+ * Copy a key bounding an ordered cursor
+ */
+static int
+_ffdb_copy_bound (FFDB_DBT* dst, const void* data, unsigned int size)
+{
+  dst->data = malloc (size > 0 ? size : 1);
+  if (!dst->data) {
+    errno = ENOMEM;
+    return -1;
+  }
+  if (size > 0)
+    memcpy (dst->data, data, size);
+  dst->size = size;
+  return 0;
+}
+
+
+/**
+ * Return a new key cursor walking keys [lo, hi) of the ordered index
+ */
+int
+ffdb_cursor_ordered (const FFDB_DB* db, ffdb_cursor_t** c, 
+		     const FFDB_DBT* lo, const FFDB_DBT* hi)
+{
+  ffdb_htab_t* hashp;
+  ffdb_crs_t* inc;
+
+  hashp = (ffdb_htab_t *)db->internal;
+  *c = 0;
+  if (hashp->hdr.idx_page == 0) {
+    fprintf (stderr, "Database has no ordered key index.\n");
+    errno = EINVAL;
+    return -1;
+  }
+  if (_ffdb_new_cursor (db, c, FFDB_KEY_CURSOR, 0, INVALID_PGNO) != 0)
+    return -1;
+
+  inc = (ffdb_crs_t *)(*c)->internal;
+  inc->ordered = 1;
+  if ((lo && _ffdb_copy_bound (&inc->lo, lo->data, lo->size) != 0) ||
+      (hi && _ffdb_copy_bound (&inc->hi, hi->data, hi->size) != 0)) {
+    _ffdb_cursor_close (*c);
+    *c = 0;
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Return a new key cursor walking keys starting with a prefix. The keys
+ * stop before the prefix with its last byte below 0xff increased.
+ */
+int
+ffdb_cursor_prefix (const FFDB_DB* db, ffdb_cursor_t** c, 
+		    const FFDB_DBT* prefix)
+{
+  FFDB_DBT hi;
+  unsigned char* end;
+  unsigned int len;
+  int status;
+
+  end = (unsigned char *)malloc (prefix->size > 0 ? prefix->size : 1);
+  if (!end) {
+    errno = ENOMEM;
+    *c = 0;
+    return -1;
+  }
+  if (prefix->size > 0)
+    memcpy (end, prefix->data, prefix->size);
+
+  /* A prefix of all 0xff bytes goes up to the largest key */
+  len = prefix->size;
+  while (len > 0 && end[len - 1] == 0xff)
+    len--;
+  if (len > 0)
+    end[len - 1]++;
+  hi.data = end;
+  hi.size = len;
+
+  status = ffdb_cursor_ordered (db, c, prefix, len > 0 ? &hi : 0);
+  free (end);
+  return status;
+}
+
+
+/**
+ * Number of buckets of the hash table
+ */
+unsigned int
+ffdb_num_buckets (const FFDB_DB* db)
+{
+  ffdb_htab_t* hashp;
+  unsigned int num;
+
+  hashp = (ffdb_htab_t *)db->internal;
+
+  FFDB_LOCK (hashp->lock);
+  num = hashp->hdr.max_bucket + 1;
+  FFDB_UNLOCK (hashp->lock);
+  return num;
+}
+
+
+/**
+ * Number of keys stored in the database
+ */
+unsigned int
+ffdb_num_keys (const FFDB_DB* db)
+{
+  ffdb_htab_t* hashp;
+  unsigned int num;
+
+  hashp = (ffdb_htab_t *)db->internal;
+
+  FFDB_LOCK (hashp->lock);
+  num = hashp->hdr.nkeys;
+  FFDB_UNLOCK (hashp->lock);
+  return num;
+}
+
+
+/**
+ * Counts kept in the header
+ */
+int
+ffdb_stat (const FFDB_DB* db, ffdb_stat_t* st)
+{
+  ffdb_htab_t* hashp;
+
+  hashp = (ffdb_htab_t *)db->internal;
+
+  FFDB_LOCK (hashp->lock);
+  st->nkeys = hashp->hdr.nkeys;
+  st->nbuckets = hashp->hdr.max_bucket + 1;
+  st->bsize = hashp->hdr.bsize;
+  st->numconfigs = hashp->hdr.num_cfigs;
+  FFDB_UNLOCK (hashp->lock);
+  return 0;
+}
+
+
+/**
+ * Scan all pairs in the order their data are stored
+ */
+int
+ffdb_scan (const FFDB_DB* db, ffdb_scan_func_t func, void* arg)
+{
+  ffdb_htab_t* hashp;
+
+  hashp = (ffdb_htab_t *)db->internal;
+
+  return ffdb_scan_pages (hashp, func, arg);
+}
+
+
+/************************************************************************
+ * Cursor related routines                                              *
+ ************************************************************************/
+static int
+_ffdb_cursor_get  (ffdb_cursor_t* cursor, FFDB_DBT* key,
+		   FFDB_DBT* data, unsigned int flags)
+{
+  int status;
+  ffdb_crs_t*  icrs = (ffdb_crs_t *)cursor->internal;
+  ffdb_htab_t* hashp = icrs->hashp;
+  unsigned int realflags;
+
+  /* Check flag to see whether it is valid */
+  if (flags != FFDB_FIRST && flags != FFDB_LAST &&
+      flags != FFDB_NEXT && flags != FFDB_PREV && flags != FFDB_CURRENT) {
+    fprintf (stderr, "Unsupported cursor get flag %d\n", flags);
+    return -1;
+  }
+    
+  realflags = flags;
+  if (cursor->type == FFDB_KEY_CURSOR) {
+    /* If the cursor has not been initialized */
+    if (flags == FFDB_NEXT && icrs->item.status == ITEM_CLEAN)
+      realflags = FFDB_FIRST;
+    
+    if (flags == FFDB_PREV && icrs->item.status == ITEM_CLEAN)
+      realflags = FFDB_LAST;
+
+    FFDB_LOCK(icrs->lock);
+    if (icrs->ordered)
+      status = ffdb_index_cursor_find (hashp, icrs, key, data, realflags);
+    else
+      status = ffdb_cursor_find_by_key (hashp, icrs, key, data, realflags);
+    FFDB_UNLOCK(icrs->lock);
+  }
+  else {
+    status = 0;
+  }
+  return status;
+}
+
+
+static int
+_ffdb_cursor_close (ffdb_cursor_t* cursor)
+{
+  ffdb_crs_t* inc = (ffdb_crs_t *)cursor->internal;
+  ffdb_htab_t* hashp = inc->hashp;
+
+  FFDB_LOCK(hashp->lock);
+  FFDB_TAILQ_REMOVE(&(hashp->curs_queue), inc, queue);
+  FFDB_UNLOCK(hashp->lock);
 
   /* Check whether there is a page need to be released */
   if (inc->item.pagep) {
@@ -1587,6 +2676,9 @@ _ffdb_cursor_close (ffdb_cursor_t* cursor)
 
   FFDB_LOCK_FINI(inc->lock);
   /* Free all memory */
+  free (inc->key);
+  free (inc->lo.data);
+  free (inc->hi.data);
   free (inc);
   free (cursor);
   return 0;
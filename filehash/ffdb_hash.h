@@ -88,6 +88,14 @@ typedef struct hashhdr {	/* Disk resident portion */
   unsigned int     num_cfigs;   /* number of configurations              */
   unsigned int	h_charkey;      /* value of hash(CHARKEY) */
   unsigned int  num_moved_pages;/* number of moved pages at the last level */
+  pgno_t        idx_page;       /* first page of the ordered key index,
+				 * 0 if there is no index and
+				 * INVALID_PGNO if it has no page yet
+				 */
+  unsigned int  hash_func;      /* hash function of the keys, FFDB_HASH_* */
+  unsigned int  codec;          /* codec of new data, FFDB_CODEC_*       */
+  unsigned int  codec_min;      /* shorter data are not encoded          */
+  unsigned int  codec_width;    /* element width of the shuffle filter   */
 #define NCACHED	32		/* number of spare points */
   pgno_t spares[NCACHED];       /* indicating starting page number at this 
 				 * spliting stage
@@ -97,6 +105,29 @@ typedef struct hashhdr {	/* Disk resident portion */
 } ffdb_hashhdr_t;
 
 
+/**
+ * Each page of the ordered key index is kept in memory with a copy of
+ * its first key. All keys on a page sort at or after its fence key and
+ * before the fence key of the next page.
+ */
+typedef struct _ffdb_idx_fence_ {
+  pgno_t page;                  /* index page number */
+  unsigned int len;             /* fence key length  */
+  unsigned char* key;           /* fence key         */
+} ffdb_idx_fence_t;
+
+/**
+ * Versions of the file format from which on the format has the
+ * feature. Older files are read as they are.
+ */
+#define FFDB_VERSION_KEY_HASH   6   /* slots keep the hash of the key    */
+#define FFDB_VERSION_INDEX      7   /* header has idx_page               */
+#define FFDB_VERSION_HASH_FUNC  8   /* header has hash_func, FNV before  */
+#define FFDB_VERSION_CODEC      9   /* header has codec and codec_min,
+				     * data headers have codec and rawlen
+				     */
+#define FFDB_VERSION_FILTER     10  /* header has codec_width            */
+
 /**
  * Hash table definition
  */
@@ -109,8 +140,12 @@ typedef struct htab {		/* Memory resident data structure */
   int	flags;	                /* Flag values */
   int	fp;		        /* File pointer */
   char *fname;        	        /* File path */
+  unsigned int pair_overhead;   /* bytes of a slot on a bucket page */
+  unsigned int dhdr_size;       /* bytes of a data header on a data page */
   char *bigdata_buf;	        /* Temporary Buffer for BIG data */
   int bigdata_len; 	        /* Length of bigdata_buf */
+  unsigned char *codec_buf;     /* Buffer to encode data being written */
+  unsigned int codec_buflen;    /* Length of codec_buf */
   char *bigkey_buf;	        /* Temporary Buffer for BIG keys */
   int bigkey_len;	        /* Length of bigkey_buf */
   unsigned short  *split_buf;	/* Temporary buffer for splits */
@@ -120,7 +155,22 @@ typedef struct htab {		/* Memory resident data structure */
   int	save_file;	        /* Indicates whether we need to flush file at
 				 * exit */
   pgno_t curr_dpage;            /* current data page number */
+  pgno_t *run_dpages;           /* current data page of the data page run
+				 * of each configuration
+				 */
+  unsigned int nruns;           /* number of data page runs */
+  int curr_run;                 /* run new data go to, -1 for none */
+  pgno_t main_dpage;            /* current data page outside the runs
+				 * while new data go to a run
+				 */
   int   rearrange_pages;        /* rearrange pages to save disk space */
+  pgno_t compact_page;          /* next page to be looked at by compaction */
+  pgno_t compact_limit;         /* data pages from here on are emptied */
+  ffdb_idx_fence_t *idx_fences; /* index pages in key order, loaded
+				 * on first use
+				 */
+  unsigned int idx_npages;      /* number of index pages */
+  unsigned int idx_max;         /* space of idx_fences */
   ffdb_pagepool_t *mp;		/* mpool for buffer management */
   pthread_mutex_t lock;		/* lock */
 } ffdb_htab_t;
@@ -137,6 +187,7 @@ typedef struct hash_ent_ {
   pgno_t		key_off;               /* key offset    */
   pgno_t                key_len;               /* key length    */
   pgno_t		data_off;              /* data offset   */
+  unsigned int          key_hash;              /* full hash of key */
   unsigned int          data_chksum;           /* data checksum */
   unsigned int   	caused_expand;         /* cause expand  */
 } ffdb_hent_t;
@@ -166,8 +217,38 @@ struct _ffdb_crs_
   ffdb_hent_t item;
   /* internal lock for the cursor */
   pthread_mutex_t lock;	
+  /* buckets [lo_bucket, hi_bucket) are walked by this cursor */
+  pgno_t lo_bucket;
+  pgno_t hi_bucket;
+  /* first bucket not read ahead yet */
+  pgno_t ra_bucket;
+  /* number of buckets read ahead at once, 0 when not walking forward */
+  unsigned int ra_window;
+  /* The key page is not held between calls. Its modification counter
+   * tells whether the item is still where it was. Otherwise the item
+   * is looked for by its key.
+   */
+  unsigned long page_mod;
+  unsigned int key_hash;
+  unsigned int key_len;
+  unsigned int key_max;
+  unsigned char* key;
+  /* A cursor over the ordered key index walks keys in [lo, hi) in key
+   * order. The key above is the key the cursor is on. hi.data is null
+   * when there is no upper bound.
+   */
+  int ordered;
+  FFDB_DBT lo;
+  FFDB_DBT hi;
 };
 
+/**
+ * A cursor walking forward reads ahead this many bucket pages at first.
+ * The window doubles each time it is used up, up to the I/O depth.
+ */
+#define FFDB_CURSOR_RA_MIN      8
+#define FFDB_CURSOR_RA_MAX      FFDB_IO_DEPTH
+
 
 /**
  * Constants
@@ -255,6 +336,11 @@ struct _ffdb_crs_
 extern unsigned int _ffdb_call_hash (ffdb_htab_t* hashp, const void* k, 
 				     unsigned int len);
 
+/**
+ * Turn a full hash value of a key into a bucket number
+ */
+extern unsigned int _ffdb_hash_bucket (ffdb_htab_t* hashp, unsigned int n);
+
 /**
  * Get a new page
  * This routine is always called before get_page
@@ -317,7 +403,8 @@ extern int ffdb_release_item (ffdb_htab_t* hashp,
  *
  * @param hashp the hash table pointer
  * @param key   the key
- * @param val   the data
+ * @param val   the data. If val is null, this is a lookup only and the
+ * pages are pinned shared with other readers.
  * @param item  the information for the hash entry
  * 
  * @return 0 success. check item->status to see whether the item is here. 
@@ -338,12 +425,92 @@ extern int ffdb_find_item (ffdb_htab_t* hashp,
  * @param item  the information for the hash entry
  * @param freepage whether to put page back pointed by item
  *
- * @return return 0 (always since we know the key is there). return -1 otherwise
+ * @return return 0 (always since we know the key is there). return
+ * FFDB_SPECIAL if the space provided in val is too small, with the
+ * needed length in val->size. return -1 otherwise
  */
 extern int ffdb_get_item (ffdb_htab_t* hashp,
 			  const FFDB_DBT* key, FFDB_DBT* val,
 			  ffdb_hent_t* item, int freepage);
 
+/**
+ * Get data of an item found earlier by ffdb_find_item whose page has been
+ * put back since. Writers may have moved the data in the meantime.
+ *
+ * @param hashp the hash table pointer
+ * @param item  the item with its page number and index
+ * @param datap the data pointer of the item copied while the page was pinned
+ * @param val   the data is malloced and caller has to free
+ *
+ * @return 0 on success. return 1 if the data no longer belongs to the
+ * item, and -1 on failure
+ */
+extern int ffdb_get_item_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			       ffdb_datap_t* datap, FFDB_DBT* val);
+
+/**
+ * Get part of the data of an item. The item contains page and index
+ * information obtained from ffdb_find_item call. The page of the item
+ * is always put back.
+ *
+ * @param hashp the hash table pointer
+ * @param item  the information for the hash entry
+ * @param val   the data as in ffdb_get_item
+ * @param offset the first byte of the data to get
+ * @param len   the number of bytes to get
+ *
+ * @return 0 on success. return FFDB_SPECIAL if the space provided in
+ * val is too small, with the needed length in val->size. return -1 with
+ * errno EINVAL if the bytes lie beyond the data, and -1 otherwise
+ */
+extern int ffdb_get_item_range (ffdb_htab_t* hashp, ffdb_hent_t* item,
+				FFDB_DBT* val, unsigned int offset,
+				unsigned int len);
+
+/**
+ * Overwrite part of the data of an item in place. The item contains
+ * page and index information obtained from ffdb_find_item call with
+ * its key page held exclusively. The page of the item is always put
+ * back.
+ *
+ * @param hashp the hash table pointer
+ * @param item  the information for the hash entry
+ * @param val   the new bytes
+ * @param offset the first byte of the data to overwrite
+ *
+ * @return 0 on success. return -1 with errno EINVAL if the bytes lie
+ * beyond the data, and -1 otherwise
+ */
+extern int ffdb_put_item_range (ffdb_htab_t* hashp, ffdb_hent_t* item,
+				const FFDB_DBT* val, unsigned int offset);
+
+/**
+ * Get the length of the data of an item before encoding. The item
+ * contains page and index information obtained from ffdb_find_item
+ * call. The page of the item is always put back.
+ *
+ * @return 0 on success, -1 on failure
+ */
+extern int ffdb_get_item_size (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			       unsigned int* size);
+
+/**
+ * Get a view of an item from database. The item contains page and index 
+ * information obtained from ffdb_find_item call. The page of the item
+ * is always put back.
+ *
+ * @param hashp the hash table pointer
+ * @param item  the information for the hash entry
+ * @param val   the data. If the data lies on a single page, val->data
+ * points into that page. Otherwise val->data is a malloced copy.
+ * @param page  the data page which stays pinned for the view, or null
+ * if val->data is a copy
+ *
+ * @return return 0 on success. return -1 otherwise
+ */
+extern int ffdb_get_item_view (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			       FFDB_DBT* val, void** page);
+
 /**
  * Add a pair of key and data into the hash database
  *
@@ -376,6 +543,65 @@ extern int ffdb_add_ovflpage (ffdb_htab_t* hashp,
 			      FFDB_DBT* key, const FFDB_DBT* val, 
 			      ffdb_hent_t* item);
 
+/**
+ * Fill the empty page of a bucket with new pairs in one go. Overflow
+ * pages are chained to the page as it fills up, and the data are put
+ * on the current data page one after another.
+ *
+ * @param hashp the hash table pointer
+ * @param bucket the bucket of all pairs
+ * @param keys the keys of the database being built
+ * @param vals the data of the database being built
+ * @param idx indices into keys and vals of the n pairs of the bucket
+ * @param hashes hash values of the n keys
+ * @param n number of pairs
+ *
+ * @return 0 on success. return -1 on failure
+ */
+extern int ffdb_bulk_bucket (ffdb_htab_t* hashp, unsigned int bucket,
+			     FFDB_DBT keys[], const FFDB_DBT vals[],
+			     const unsigned int idx[],
+			     const unsigned int hashes[], unsigned int n);
+
+
+/**
+ * Delete the pair of key and data of an item found by ffdb_find_item.
+ * The data are marked deleted and the data pages and overflow pages
+ * left without valid content are put onto the free pages.
+ *
+ * @param hashp the hash table pointer
+ * @param item the item of the key to be deleted. Its page is put back
+ *
+ * @return 0 on success. return -1 on failure
+ */
+extern int ffdb_delete_pair (ffdb_htab_t* hashp, ffdb_hent_t* item);
+
+/**
+ * Compact data pages a number of pages at a time. Live data on mostly
+ * dead data pages are moved to the current data page. Free pages at the
+ * end of the file are cut off when a pass over all pages is done.
+ *
+ * @param hashp the hash table pointer
+ * @param npages maximum number of pages to look at
+ *
+ * @return 1 if there are more pages to look at, 0 if a pass is done,
+ * -1 on failure
+ */
+extern int ffdb_compact_pages (ffdb_htab_t* hashp, unsigned int npages);
+
+/**
+ * Scan all key and data pairs in the order the data are stored in
+ * the file
+ *
+ * @param hashp the hash table pointer
+ * @param func routine called for each pair
+ * @param arg argument passed to func
+ *
+ * @return 0 on success, -1 on failure, otherwise the value returned by
+ * func to stop the scan
+ */
+extern int ffdb_scan_pages (ffdb_htab_t* hashp, ffdb_scan_func_t func,
+			    void* arg);
 
 /**
  * Split a bucket: this happens when a bucket is full. This bucket may not be 
@@ -421,11 +647,13 @@ extern int ffdb_rearrage_pages_on_open (ffdb_htab_t* hashp);
 /**
  * Reduce file size if possible. For example, the first time
  * a file was not doing rearrange pages and second time this
- * file is doing page rearrange
+ * file is doing page rearrange. While the page pool is open, the file
+ * is cut right after the last page in use.
  *
  * @param hashp the pointer to hash table
+ * @return 0 on success, otherwise errno
  */
-extern void ffdb_reduce_filesize (ffdb_htab_t* hashp);
+extern int ffdb_reduce_filesize (ffdb_htab_t* hashp);
 
 
 /**
@@ -439,6 +667,37 @@ extern void ffdb_reduce_filesize (ffdb_htab_t* hashp);
 extern pgno_t ffdb_last_data_page (ffdb_htab_t* hashp, pgno_t start);
 
 
+/**
+ * Send new data to the data page run of a configuration instead of the
+ * current data page. The data of a configuration then sit on pages
+ * of their own. Called with hashp->lock held, and undone by
+ * ffdb_leave_data_run before the lock is released.
+ *
+ * @param hashp the usual hash table pointer
+ * @param run the configuration number
+ *
+ * @return 0 on success, -1 with errno EINVAL if there is no such
+ * configuration
+ */
+extern int ffdb_enter_data_run (ffdb_htab_t* hashp, unsigned int run);
+
+/**
+ * Send new data back to the current data page. Nothing is done if no
+ * run has been entered.
+ *
+ * @param hashp the usual hash table pointer
+ */
+extern void ffdb_leave_data_run (ffdb_htab_t* hashp);
+
+/**
+ * Start all data page runs over on new pages. Done when the table
+ * doubles, as the current data page is.
+ *
+ * @param hashp the usual hash table pointer
+ */
+extern void ffdb_reset_data_runs (ffdb_htab_t* hashp);
+
+
 /**
  * Set configuration information
  * 
@@ -506,7 +765,12 @@ extern int ffdb_get_uinfo (ffdb_htab_t* hashp, unsigned char data[],
 
 
 /**
- * Cursor Get routine 
+ * Cursor Get routine. If the space provided in key or data is too
+ * small, FFDB_SPECIAL is returned with the needed length in the size
+ * field, and the item can be read again with FFDB_CURRENT.
+ * No page is pinned between calls, so writers are not held up by
+ * cursors. Keys inserted, deleted or moved by a split during a walk
+ * may be missed or returned twice.
  */
 extern int ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
 				    FFDB_DBT* key, FFDB_DBT* data,
@@ -514,6 +778,39 @@ extern int ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
 
 
 
+/**
+ * Add a key to the ordered key index if the database keeps one.
+ * Called with hashp->lock held
+ *
+ * @return 0 on success, -1 on failure
+ */
+extern int ffdb_index_insert (ffdb_htab_t* hashp, const FFDB_DBT* key);
+
+/**
+ * Remove a key from the ordered key index if the database keeps one.
+ * Index pages left empty are freed. Called with hashp->lock held
+ *
+ * @return 0 on success, -1 on failure
+ */
+extern int ffdb_index_delete (ffdb_htab_t* hashp, const FFDB_DBT* key);
+
+/**
+ * Forget the index pages kept in memory. They are loaded again from the
+ * index pages on the next use, which is needed after pages are moved
+ */
+extern void ffdb_index_unload (ffdb_htab_t* hashp);
+
+/**
+ * Cursor Get routine of a cursor over the ordered key index. Same
+ * semantics as ffdb_cursor_find_by_key. The cursor remembers the
+ * key it is on, and the next key is looked up in the index again on
+ * each call. Data are looked up by key in the hash table.
+ */
+extern int ffdb_index_cursor_find (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+				   FFDB_DBT* key, FFDB_DBT* data,
+				   unsigned int flags);
+
+
 /**
  * Get all page information and display them. This is for debug purpose
  */
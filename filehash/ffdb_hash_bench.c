@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     Microbenchmark of the key hash functions, and of inserts into a
+ *     table that starts with one bucket and splits all the way up
+ *
+ *     Build with: make hashbench
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "ffdb_db.h"
+#include "ffdb_hash_func.h"
+
+static double
+_now (void)
+{
+  struct timeval tv;
+  gettimeofday (&tv, 0);
+  return tv.tv_sec + tv.tv_usec * 1.0e-6;
+}
+
+/**
+ * Hash keys of length len back to back out of buf, return MB/s
+ */
+static double
+_bench (ffdb_hash_func_t func, const unsigned char* buf, unsigned int buflen,
+	unsigned int len, unsigned int* result)
+{
+  double start, elapsed;
+  unsigned long total = 0;
+  unsigned int off, h = 0;
+
+  start = _now ();
+  do {
+    for (off = 0; off + len <= buflen; off += len)
+      h += func (buf + off, len);
+    total += buflen;
+    elapsed = _now () - start;
+  } while (elapsed < 0.5);
+  *result = h;
+
+  return total / elapsed / (1024.0 * 1024.0);
+}
+
+/**
+ * Insert num keys of length klen into a new table, return seconds
+ */
+static double
+_insert (const char* fname, int hashfunc, unsigned int num, unsigned int klen)
+{
+  FFDB_HASHINFO info;
+  FFDB_DB* db;
+  FFDB_DBT key, data;
+  char kbuf[1024], dbuf[16];
+  unsigned int i;
+  double start;
+
+  memset (&info, 0, sizeof(info));
+  info.bsize = 4096;
+  info.nbuckets = 1;
+  info.cachesize = 256 * 1024 * 1024;
+  info.numconfigs = 1;
+  info.hashfunc = hashfunc;
+
+  db = ffdb_dbopen (fname, O_RDWR | O_CREAT | O_TRUNC, 0644, &info);
+  if (!db) {
+    fprintf (stderr, "Cannot open %s\n", fname);
+    exit (1);
+  }
+
+  memset (kbuf, 'k', klen);
+  memset (dbuf, 'd', sizeof(dbuf));
+  key.data = kbuf;
+  key.size = klen;
+  data.data = dbuf;
+  data.size = sizeof(dbuf);
+
+  start = _now ();
+  for (i = 0; i < num; i++) {
+    sprintf (kbuf + klen - 10, "%010u", i);
+    if (db->put (db, &key, &data, 0) != 0) {
+      fprintf (stderr, "Cannot insert key %u\n", i);
+      exit (1);
+    }
+  }
+  start = _now () - start;
+
+  db->close (db);
+  unlink (fname);
+  return start;
+}
+
+int
+main (int argc, char** argv)
+{
+  unsigned int buflen = 16 * 1024 * 1024;
+  unsigned int sizes[] = {8, 16, 32, 64, 128, 256, 1024};
+  unsigned int klens[] = {16, 64, 256};
+  unsigned int num = argc > 1 ? atoi (argv[1]) : 200000;
+  unsigned int i, r1, r2;
+  unsigned char* buf;
+  double fnv, wy;
+
+  buf = (unsigned char *)malloc (buflen);
+  if (!buf) {
+    fprintf (stderr, "Cannot allocate benchmark buffer\n");
+    return 1;
+  }
+  srand (1234);
+  for (i = 0; i < buflen; i++)
+    buf[i] = (unsigned char)rand ();
+
+  printf ("%12s %14s %14s %8s\n", "key size", "fnv MB/s", "wyhash MB/s", "speedup");
+  for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+    fnv = _bench (__ham_func5, buf, buflen, sizes[i], &r1);
+    wy = _bench (__ffdb_wyhash, buf, buflen, sizes[i], &r2);
+    printf ("%12u %14.1f %14.1f %8.2f\n", sizes[i], fnv, wy, wy/fnv);
+  }
+
+  printf ("\n%u inserts from one bucket\n", num);
+  printf ("%12s %14s %14s %8s\n", "key size", "fnv s", "wyhash s", "speedup");
+  for (i = 0; i < sizeof(klens)/sizeof(klens[0]); i++) {
+    fnv = _insert ("hashbench.db", FFDB_HASH_FNV, num, klens[i]);
+    wy = _insert ("hashbench.db", FFDB_HASH_WY, num, klens[i]);
+    printf ("%12u %14.3f %14.3f %8.2f\n", klens[i], fnv, wy, fnv/wy);
+  }
+
+  free (buf);
+  return 0;
+}
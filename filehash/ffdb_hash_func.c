@@ -91,6 +91,7 @@
  * PUBLIC: u_int32_t __ham_func2 __P((DB *, const void *, u_int32_t));
  */
 #include <stdio.h>
+#include <string.h>
 #include "ffdb_db.h"
 #include "ffdb_hash_func.h"
 
@@ -253,6 +254,148 @@ __ham_test(const void *key, unsigned int len)
 }
 
 
+/**
+ * Word at a time hash after wyhash (final version 4) by Wang Yi.
+ *
+ * Keys are read eight bytes at a time as little endian words, so a
+ * file gives the same hash values on every host. Each pair of words is
+ * folded with one 64x64->128 bit multiply. The 64 bit result is folded
+ * into 32 bits, of which the table uses the low ones.
+ */
+static const unsigned long long _ffdb_wy_secret[4] = {
+  0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+  0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+static inline void
+_ffdb_wymum (unsigned long long* a, unsigned long long* b)
+{
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 r = *a;
+
+  r *= *b;
+  *a = (unsigned long long)r;
+  *b = (unsigned long long)(r >> 64);
+#else
+  unsigned long long ha = *a >> 32, hb = *b >> 32;
+  unsigned long long la = (unsigned int)*a, lb = (unsigned int)*b;
+  unsigned long long rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  unsigned long long t = rl + (rm0 << 32), c = t < rl, lo, hi;
+
+  lo = t + (rm1 << 32);
+  c += lo < t;
+  hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  *a = lo;
+  *b = hi;
+#endif
+}
+
+static inline unsigned long long
+_ffdb_wymix (unsigned long long a, unsigned long long b)
+{
+  _ffdb_wymum (&a, &b);
+  return a ^ b;
+}
+
+static inline unsigned long long
+_ffdb_wyr8 (const unsigned char* p)
+{
+  unsigned long long v;
+
+  memcpy (&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64 (v);
+#endif
+  return v;
+}
+
+static inline unsigned long long
+_ffdb_wyr4 (const unsigned char* p)
+{
+  unsigned int v;
+
+  memcpy (&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32 (v);
+#endif
+  return v;
+}
+
+static inline unsigned long long
+_ffdb_wyr3 (const unsigned char* p, unsigned int k)
+{
+  return (((unsigned long long)p[0]) << 16) | 
+    (((unsigned long long)p[k >> 1]) << 8) | p[k - 1];
+}
+
+unsigned int
+__ffdb_wyhash (const void* key, unsigned int len)
+{
+  const unsigned char* p = (const unsigned char *)key;
+  const unsigned long long* s = _ffdb_wy_secret;
+  unsigned long long seed, a, b, see1, see2;
+  unsigned int i;
+
+  seed = _ffdb_wymix (s[0], s[1]);
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (_ffdb_wyr4 (p) << 32) | _ffdb_wyr4 (p + ((len >> 3) << 2));
+      b = (_ffdb_wyr4 (p + len - 4) << 32) | 
+	_ffdb_wyr4 (p + len - 4 - ((len >> 3) << 2));
+    }
+    else if (len > 0) {
+      a = _ffdb_wyr3 (p, len);
+      b = 0;
+    }
+    else
+      a = b = 0;
+  }
+  else {
+    i = len;
+    if (i > 48) {
+      see1 = see2 = seed;
+      do {
+	seed = _ffdb_wymix (_ffdb_wyr8 (p) ^ s[1], _ffdb_wyr8 (p + 8) ^ seed);
+	see1 = _ffdb_wymix (_ffdb_wyr8 (p + 16) ^ s[2], _ffdb_wyr8 (p + 24) ^ see1);
+	see2 = _ffdb_wymix (_ffdb_wyr8 (p + 32) ^ s[3], _ffdb_wyr8 (p + 40) ^ see2);
+	p += 48;
+	i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = _ffdb_wymix (_ffdb_wyr8 (p) ^ s[1], _ffdb_wyr8 (p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = _ffdb_wyr8 (p + i - 16);
+    b = _ffdb_wyr8 (p + i - 8);
+  }
+  a ^= s[1];
+  b ^= seed;
+  _ffdb_wymum (&a, &b);
+  a = _ffdb_wymix (a ^ s[0] ^ len, b ^ s[1]);
+
+  return (unsigned int)(a ^ (a >> 32));
+}
+
+/**
+ * Hash function recorded in the header as id, 0 for an unknown id
+ */
+ffdb_hash_func_t
+__ffdb_hash_func (unsigned int id)
+{
+  switch (id) {
+  case FFDB_HASH_FNV:
+    return __ham_func5;
+  case FFDB_HASH_WY:
+    return __ffdb_wyhash;
+  default:
+    return 0;
+  }
+}
+
+
 /**
  * A simple implementation of log2 on an integer
  */
@@ -296,9 +439,9 @@ __ham_defcmp(const FFDB_DBT* a, const FFDB_DBT* b)
 }
 
 /**
- * Setting default hash function
+ * Setting default hash function of new databases
  */
-unsigned int (*__ffdb_default_hash)(const void* key, unsigned int len) = __ham_func5;
+unsigned int (*__ffdb_default_hash)(const void* key, unsigned int len) = __ffdb_wyhash;
 
 /**
  * Setting default compare function
@@ -314,12 +457,92 @@ int (*__ffdb_default_cmp)(const FFDB_DBT *a, const FFDB_DBT *b)= __ham_defcmp;
 
 /**
  * this part of code is from GNUnet
+ *
+ * The table is extended to eight tables so that eight bytes are
+ * folded at a time (slicing-by-8). Table 0 is the original byte table.
  */
-static unsigned int _ffdb_crc_table[256];
+static unsigned int _ffdb_crc_table[8][256];
 static int _ffdb_crc32_inited = 0;
 
 #define _CRC32POLY (unsigned int)0xedb88320
 
+/**
+ * Checksum routine selected at initialization
+ */
+static unsigned int (*_ffdb_crc32_func) (unsigned int crc, 
+					 const unsigned char* buf,
+					 unsigned int len) = __ffdb_crc32_checksum_bytewise;
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+
+/**
+ * ARMv8 crc32 instructions use the same polynomial as the table above
+ * (crc32c instructions are a different one)
+ */
+__attribute__((target("+crc")))
+static unsigned int
+_ffdb_crc32_armv8 (unsigned int crc, const unsigned char* buf,
+		   unsigned int len)
+{
+  unsigned long long v;
+
+  crc ^= 0xffffffff;
+  while (len && ((unsigned long)buf & 7)) {
+    crc = __builtin_aarch64_crc32b (crc, *buf++);
+    len--;
+  }
+  while (len >= 8) {
+    memcpy (&v, buf, 8);
+    crc = __builtin_aarch64_crc32x (crc, v);
+    buf += 8;
+    len -= 8;
+  }
+  while (len--)
+    crc = __builtin_aarch64_crc32b (crc, *buf++);
+  return crc ^ 0xffffffff;
+}
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/**
+ * Slicing-by-8: fold eight bytes with eight table lookups
+ */
+static unsigned int
+_ffdb_crc32_slice8 (unsigned int crc, const unsigned char* buf,
+		    unsigned int len)
+{
+  unsigned int w0, w1;
+
+  crc ^= 0xffffffff;
+  while (len && ((unsigned long)buf & 3)) {
+    crc = (crc >> 8) ^ _ffdb_crc_table[0][(crc ^ *buf++) & 0xff];
+    len--;
+  }
+  while (len >= 8) {
+    memcpy (&w0, buf, 4);
+    memcpy (&w1, buf + 4, 4);
+    w0 ^= crc;
+    crc = _ffdb_crc_table[7][w0 & 0xff] ^
+      _ffdb_crc_table[6][(w0 >> 8) & 0xff] ^
+      _ffdb_crc_table[5][(w0 >> 16) & 0xff] ^
+      _ffdb_crc_table[4][w0 >> 24] ^
+      _ffdb_crc_table[3][w1 & 0xff] ^
+      _ffdb_crc_table[2][(w1 >> 8) & 0xff] ^
+      _ffdb_crc_table[1][(w1 >> 16) & 0xff] ^
+      _ffdb_crc_table[0][w1 >> 24];
+    buf += 8;
+    len -= 8;
+  }
+  while (len--)
+    crc = (crc >> 8) ^ _ffdb_crc_table[0][(crc ^ *buf++) & 0xff];
+  return crc ^ 0xffffffff;
+}
+#endif
+
 /**
  * This routine initialize the CRC table above
  */
@@ -328,13 +551,29 @@ void __ffdb_crc32_init (void)
   if (!_ffdb_crc32_inited) {
     unsigned int i, j;
     unsigned int  h = 1;
-    _ffdb_crc_table[0] = 0;
+    _ffdb_crc_table[0][0] = 0;
     for (i = 128; i; i >>= 1) {
       h = (h >> 1) ^ ((h & 1) ? _CRC32POLY : 0);
       /* h is now crc_table[i] */
       for (j = 0; j < 256; j += 2 * i)
-	_ffdb_crc_table[i + j] = _ffdb_crc_table[j] ^ h;
+	_ffdb_crc_table[0][i + j] = _ffdb_crc_table[0][j] ^ h;
+    }
+    /* table k is the crc of a byte followed by k zero bytes */
+    for (i = 0; i < 256; i++) {
+      h = _ffdb_crc_table[0][i];
+      for (j = 1; j < 8; j++) {
+	h = (h >> 8) ^ _ffdb_crc_table[0][h & 0xff];
+	_ffdb_crc_table[j][i] = h;
+      }
     }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    _ffdb_crc32_func = _ffdb_crc32_slice8;
+#endif
+#if defined(__aarch64__) && defined(__linux__)
+    if (getauxval (AT_HWCAP) & HWCAP_CRC32)
+      _ffdb_crc32_func = _ffdb_crc32_armv8;
+#endif
     _ffdb_crc32_inited = 1;
   }
 }
@@ -346,10 +585,92 @@ void __ffdb_crc32_init (void)
 unsigned int 
 __ffdb_crc32_checksum (unsigned int crc, const unsigned char* buf, 
 		       unsigned int len)
+{
+  return _ffdb_crc32_func (crc, buf, len);
+}
+
+/**
+ * Multiply a 32x32 matrix over GF(2) with a vector
+ */
+static unsigned int
+_ffdb_gf2_matrix_times (const unsigned int* mat, unsigned int vec)
+{
+  unsigned int sum = 0;
+
+  while (vec) {
+    if (vec & 1)
+      sum ^= *mat;
+    vec >>= 1;
+    mat++;
+  }
+  return sum;
+}
+
+static void
+_ffdb_gf2_matrix_square (unsigned int* square, const unsigned int* mat)
+{
+  int n;
+
+  for (n = 0; n < 32; n++)
+    square[n] = _ffdb_gf2_matrix_times (mat, mat[n]);
+}
+
+/**
+ * Advance a crc32 value over len zero bytes without the initial and
+ * final inversion, in log(len) steps (after crc32_combine of zlib).
+ * For two buffers a and b of the same length,
+ * checksum(a) ^ checksum(b) is the value over a ^ b from 0, so a
+ * checksum can be updated from the bytes that changed.
+ */
+unsigned int
+__ffdb_crc32_shift (unsigned int crc, unsigned long len)
+{
+  unsigned int even[32], odd[32], row;
+  int n;
+
+  if (len == 0)
+    return crc;
+
+  /* operator for one zero bit */
+  odd[0] = _CRC32POLY;
+  row = 1;
+  for (n = 1; n < 32; n++) {
+    odd[n] = row;
+    row <<= 1;
+  }
+
+  /* operators for two and four zero bits */
+  _ffdb_gf2_matrix_square (even, odd);
+  _ffdb_gf2_matrix_square (odd, even);
+
+  /* apply the operators of one zero byte, two, four, ... */
+  do {
+    _ffdb_gf2_matrix_square (even, odd);
+    if (len & 1)
+      crc = _ffdb_gf2_matrix_times (even, crc);
+    len >>= 1;
+    if (len == 0)
+      break;
+    _ffdb_gf2_matrix_square (odd, even);
+    if (len & 1)
+      crc = _ffdb_gf2_matrix_times (odd, crc);
+    len >>= 1;
+  } while (len);
+
+  return crc;
+}
+
+/**
+ * Caculate crc32 checksum one byte at a time. This is the reference
+ * for the faster routines
+ */
+unsigned int 
+__ffdb_crc32_checksum_bytewise (unsigned int crc, const unsigned char* buf, 
+				unsigned int len)
 {
   crc ^= 0xffffffff;
   while (len--)
-    crc = (crc >> 8) ^ _ffdb_crc_table[(crc ^ *buf++) & 0xff];
+    crc = (crc >> 8) ^ _ffdb_crc_table[0][(crc ^ *buf++) & 0xff];
   return crc ^ 0xffffffff;
 }
 
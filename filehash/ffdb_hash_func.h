@@ -49,9 +49,13 @@ extern unsigned int __ham_func2(const void* key, unsigned int len);
 extern unsigned int __ham_func3(const void* key, unsigned int len);
 extern unsigned int __ham_func4(const void* key, unsigned int len);
 extern unsigned int __ham_func5(const void* key, unsigned int len);
+extern unsigned int __ffdb_wyhash(const void* key, unsigned int len);
 extern unsigned int __ffdb_log2(unsigned int num);
 extern int          __ham_defcmp(const FFDB_DBT* a, const FFDB_DBT* b);
 
+typedef unsigned int (*ffdb_hash_func_t)(const void* key, unsigned int len);
+extern ffdb_hash_func_t __ffdb_hash_func(unsigned int id);
+
 extern unsigned int (*__ffdb_default_hash)(const void* key, unsigned int len);
 extern int (*__ffdb_default_cmp)(const FFDB_DBT *a, const FFDB_DBT *b);
 
@@ -59,4 +63,8 @@ extern void __ffdb_crc32_init (void);
 extern unsigned int  __ffdb_crc32_checksum (unsigned int crc, 
 					    const unsigned char* buffer,
 					    unsigned int len);
+extern unsigned int  __ffdb_crc32_checksum_bytewise (unsigned int crc, 
+						     const unsigned char* buffer,
+						     unsigned int len);
+extern unsigned int  __ffdb_crc32_shift (unsigned int crc, unsigned long len);
 #endif
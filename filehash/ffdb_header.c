@@ -127,44 +127,22 @@ filedb_dbpanic(FILEDB_DB* dbp)
 
 
 /*
- * Check whether this database is empty or not
+ * Check whether this database is empty or not. The number of keys is
+ * kept in the header, so no page has to be read
  *
  */
 int filedb_is_db_empty(FILEDB_DB* dbhh)
 {
-  FFDB_DB* dbh = (FFDB_DB*)dbhh;
-  FFDB_DBT dbkey, dbdata;
-  ffdb_cursor_t* crp;
-  int  ret;
-    
-  /* create cursor */
-  ret = dbh->cursor(dbh, &crp, FFDB_KEY_CURSOR);
-  if (ret != 0) {
-    fprintf(stderr, "%s: cursor creation error", __func__);
-    exit(1);
-  }
+  return (filedb_num_keys(dbhh) == 0) ? 1 : 0;
+}
 
-  /* get first thing from the database  */
-  dbkey.data = dbdata.data = 0;
-  dbkey.size = dbdata.size = 0;
-  ret = crp->get (crp, &dbkey, &dbdata, FFDB_NEXT);
-  if (ret == 0) {
-    free (dbkey.data);
-    free (dbdata.data);
-    crp->close(crp);
-    return 0;
-  }
- 
-  if (ret != 0) {
-    fprintf(stderr, "%s: cursor first error", __func__);
-    exit(1);
-  }
-    
-  /* close cursor */
-  if (crp != NULL)
-    crp->close(crp);
 
-  return 1;
+/*
+ * Number of keys in this database
+ */
+unsigned int filedb_num_keys(const FILEDB_DB* dbhh)
+{
+  return ffdb_num_keys((const FFDB_DB*)dbhh);
 }
 
 
@@ -265,67 +243,126 @@ unsigned int filedb_get_num_configs(const FILEDB_DB* dbhh)
 
 
 /*
- * Return all keys to vectors in binary form of strings
+ * Set the layout of the values of the configurations
+ *
+ * @param dbhh pointer to underlying database
+ * @param layout FFDB_LAYOUT_KEY_MAJOR or FFDB_LAYOUT_CONFIG_MAJOR
+ *
+ * @return 0 on success -1 on failure with a proper errno set
  */
-void
-filedb_get_all_keys(FILEDB_DB* dbhh, void* keyss, unsigned int* num)
+int filedb_set_config_layout(FILEDB_DB* dbhh, int layout)
 {
-  FFDB_DB*   dbh  = (FFDB_DB*)dbhh;
-  FFDB_DBT** keys = (FFDB_DBT**)keyss;
-  int (*cursor) (const struct __ffdb *, ffdb_cursor_t **, unsigned int type) = dbh->cursor;
-
-  FFDB_DBT*  dbkey;
-  ffdb_cursor_t* crp;
-  int  ret;
-  unsigned int  old_num;
+  FFDB_DB* dbh  = (FFDB_DB*)dbhh;
+  ffdb_all_config_info_t allcfgs;
+  int i;
+  int ret;
 
-  /* Initialize holding location */
-  old_num = 0;
-  *num    = 1;
-  *keys = (FFDB_DBT*)calloc(1, (*num)*sizeof(FFDB_DBT));
-  if (*keys == NULL)
-  {
-    fprintf(stderr, "%s: cannot create initial space", __func__);
-    exit(1);
+  if (layout != FFDB_LAYOUT_KEY_MAJOR && layout != FFDB_LAYOUT_CONFIG_MAJOR) {
+    errno = EINVAL;
+    return -1;
   }
 
-  /* create cursor */
-  ret = (*cursor)(dbh, &crp, FFDB_KEY_CURSOR);
-  if (ret != 0)
-  {
-    fprintf(stderr, "%s: create Cursor Error", __func__);
-    exit(1);
-  }
+  if (ffdb_get_all_configs(dbh, &allcfgs) != 0)
+    return -1;
+
+  for (i = 0; i < allcfgs.numconfigs; i++)
+    allcfgs.allconfigs[i].type = layout;
+
+  /* set configuration information */
+  ret = ffdb_set_all_configs(dbh, &allcfgs);
+
+  /* cleanup */
+  free(allcfgs.allconfigs);
+
+  return ret;
+}
+
+
+/*
+ * Get the layout of the values of the configurations, kept with the
+ * first configuration
+ *
+ * @param dbhh pointer to underlying database
+ *
+ * @return the layout, or -1 on failure
+ */
+int filedb_get_config_layout(const FILEDB_DB* dbhh)
+{
+  FFDB_DB* dbh  = (FFDB_DB*)dbhh;
+  ffdb_all_config_info_t allcfgs;
+  int layout;
+
+  if (ffdb_num_configs(dbh) == 0)
+    return FFDB_LAYOUT_KEY_MAJOR;
+
+  if (ffdb_get_all_configs(dbh, &allcfgs) != 0)
+    return -1;
+  layout = allcfgs.allconfigs[0].type;
+  free(allcfgs.allconfigs);
+
+  return layout;
+}
+
 
-  /* Create initial space */
-  *keys = (FFDB_DBT*)realloc(*keys, (*num)*sizeof(FFDB_DBT));
-  if (*keys == NULL)
+/*
+ * Make space for at least num items of size bytes. The space is
+ * doubled, so that filling it one item at a time is linear
+ */
+static void*
+filedb_grow(void* p, unsigned long* max, unsigned long num, size_t size,
+	    const char* func)
+{
+  unsigned long nmax;
+
+  if (num <= *max && p != NULL)
+    return p;
+
+  nmax = (*max > 0) ? *max : 1;
+  while (nmax < num)
+    nmax *= 2;
+
+  p = realloc(p, nmax*size);
+  if (p == NULL)
   {
-    fprintf(stderr, "%s: cannot create space", __func__);
+    fprintf(stderr, "%s: cannot create space", func);
     exit(1);
   }
+  *max = nmax;
+  return p;
+}
+
+
+/*
+ * Return all keys a cursor walks over to vectors in binary form of
+ * strings. Space for hint keys is made up front. The cursor is closed
+ * afterwards
+ */
+static void
+filedb_cursor_keys(ffdb_cursor_t* crp, unsigned int hint, void* keyss,
+		   unsigned int* num)
+{
+  FFDB_DBT** keys = (FFDB_DBT**)keyss;
 
-  /* First test */
-  dbkey = &((*keys)[old_num]);
-  dbkey->data = 0;
-  dbkey->size = 0;
+  FFDB_DBT  dbkey;
+  unsigned long max;
+  int  ret;
+
+  /* Initialize holding location */
+  max   = 0;
+  *num  = 0;
+  *keys = (FFDB_DBT*)filedb_grow(NULL, &max, hint, sizeof(FFDB_DBT), __func__);
 
-  while ((ret = crp->get(crp, dbkey, 0, FFDB_NEXT)) == 0) 
+  dbkey.data = 0;
+  dbkey.size = 0;
+  while ((ret = crp->get(crp, &dbkey, 0, FFDB_NEXT)) == 0) 
   {
-    /* Need to create space for next key */
-    old_num = *num;
+    *keys = (FFDB_DBT*)filedb_grow(*keys, &max, *num + 1, sizeof(FFDB_DBT), __func__);
+    (*keys)[*num] = dbkey;
     *num += 1;
-    *keys = (FFDB_DBT*)realloc(*keys, (*num)*sizeof(FFDB_DBT));
-    if (*keys == NULL)
-    {
-      fprintf(stderr, "%s: cannot create intermediate", __func__);
-      exit(1);
-    }
 
     /* prepare */
-    dbkey = &((*keys)[old_num]);
-    dbkey->data = 0;
-    dbkey->size = 0;
+    dbkey.data = 0;
+    dbkey.size = 0;
   }
 
   if (ret != FFDB_NOT_FOUND)
@@ -333,15 +370,6 @@ filedb_get_all_keys(FILEDB_DB* dbhh, void* keyss, unsigned int* num)
     fprintf(stderr, "%s:  create Cursor Error", __func__);
     exit(1);
   }
-  
-  /* Remove the test space. The space within the key was not allocated, so do not need an additional free */
-  *num -= 1;
-  *keys = (FFDB_DBT*)realloc(*keys, (*num)*sizeof(FFDB_DBT));
-  if (*keys == NULL)
-  {
-    fprintf(stderr, "%s: cannot create intermediate", __func__);
-    exit(1);
-  }
 
   /* close cursor */
   if (crp != NULL)
@@ -350,118 +378,500 @@ filedb_get_all_keys(FILEDB_DB* dbhh, void* keyss, unsigned int* num)
 
 
 /**
- * Return all keys & data to vectors in binary form of strings
+ * Return all keys & data a cursor walks over to vectors in binary form
+ * of strings. Space for hint pairs is made up front. The cursor is
+ * closed afterwards
  */
-void
-filedb_get_all_pairs(FILEDB_DB* dbhh, void* keyss, void* valss, unsigned int* num)
+static void
+filedb_cursor_pairs(ffdb_cursor_t* crp, unsigned int hint, void* keyss,
+		    void* valss, unsigned int* num)
 {
-  FFDB_DB*   dbh  = (FFDB_DB*)dbhh;
   FFDB_DBT** keys = (FFDB_DBT**)keyss;
   FFDB_DBT** vals = (FFDB_DBT**)valss;
-  int (*cursor) (const struct __ffdb *, ffdb_cursor_t **, unsigned int type) = dbh->cursor;
 
-  FFDB_DBT*  dbkey;
-  FFDB_DBT*  dbval;
-  ffdb_cursor_t* crp;
+  FFDB_DBT  dbkey;
+  FFDB_DBT  dbval;
+  unsigned long kmax, vmax;
   int  ret;
-  unsigned int  old_num;
     
   /* Initialize holding location */
-  old_num = 0;
-  *num    = 1;
-  *keys = (FFDB_DBT*)calloc(1, (*num)*sizeof(FFDB_DBT));
-  if (*keys == NULL)
+  kmax  = vmax = 0;
+  *num  = 0;
+  *keys = (FFDB_DBT*)filedb_grow(NULL, &kmax, hint, sizeof(FFDB_DBT), __func__);
+  *vals = (FFDB_DBT*)filedb_grow(NULL, &vmax, hint, sizeof(FFDB_DBT), __func__);
+
+  dbkey.data = dbval.data = 0;
+  dbkey.size = dbval.size = 0;
+  while ((ret = crp->get(crp, &dbkey, &dbval, FFDB_NEXT)) == 0) 
   {
-    fprintf(stderr, "%s: cannot create initial space", __func__);
-    exit(1);
+    *keys = (FFDB_DBT*)filedb_grow(*keys, &kmax, *num + 1, sizeof(FFDB_DBT), __func__);
+    *vals = (FFDB_DBT*)filedb_grow(*vals, &vmax, *num + 1, sizeof(FFDB_DBT), __func__);
+    (*keys)[*num] = dbkey;
+    (*vals)[*num] = dbval;
+    *num += 1;
+
+    /* prepare */
+    dbkey.data = dbval.data = 0;
+    dbkey.size = dbval.size = 0;
   }
 
-  *vals = (FFDB_DBT*)calloc(1, (*num)*sizeof(FFDB_DBT));
-  if (*vals == NULL)
+  if (ret != FFDB_NOT_FOUND)
   {
-    fprintf(stderr, "%s: cannot create initial space", __func__);
+    fprintf(stderr, "%s:  create Cursor Error", __func__);
     exit(1);
   }
 
-  /* create cursor */
-  ret = (*cursor)(dbh, &crp, FFDB_KEY_CURSOR);
-  if (ret != 0)
+  /* close cursor */
+  if (crp != NULL)
+    crp->close(crp);
+}
+
+
+/*
+ * Space left in a packed buffer, as much as a FFDB_DBT can describe
+ */
+static unsigned int
+filedb_pack_room(unsigned long max, unsigned long len)
+{
+  return (max - len > 0xffffffffUL) ? 0xffffffffU : (unsigned int)(max - len);
+}
+
+
+/*
+ * Return all keys, and all data if with_data is set, a cursor walks
+ * over packed into one buffer each. The cursor copies straight into
+ * the buffers. When an item does not fit, the buffer grows and the
+ * item is read once more. The cursor is closed afterwards
+ */
+static void
+filedb_cursor_pack(ffdb_cursor_t* crp, unsigned int hint, int with_data,
+		   FILEDB_PACKED* packed)
+{
+  FFDB_DBT  dbkey;
+  FFDB_DBT  dbval;
+  unsigned long kmax, vmax, komax, vomax, klen, vlen;
+  unsigned int flags;
+  int  ret;
+
+  /* Initialize holding location. The buffers start at a small guess */
+  kmax = vmax = komax = vomax = 0;
+  klen = vlen = 0;
+  packed->num  = 0;
+  packed->keys = (unsigned char*)filedb_grow(NULL, &kmax, 32UL*hint + 1, 1, __func__);
+  packed->key_offs = (unsigned long*)filedb_grow(NULL, &komax, hint + 1,
+						 sizeof(unsigned long), __func__);
+  packed->key_offs[0] = 0;
+  packed->vals = NULL;
+  packed->val_offs = NULL;
+  if (with_data)
   {
-    fprintf(stderr, "%s: create Cursor Error", __func__);
-    exit(1);
+    packed->vals = (unsigned char*)filedb_grow(NULL, &vmax, 64UL*hint + 1, 1, __func__);
+    packed->val_offs = (unsigned long*)filedb_grow(NULL, &vomax, hint + 1,
+						   sizeof(unsigned long), __func__);
+    packed->val_offs[0] = 0;
   }
 
-  /* Create initial space */
-  *keys = (FFDB_DBT*)realloc(*keys, (*num)*sizeof(FFDB_DBT));
-  if (*keys == NULL)
+  flags = FFDB_NEXT;
+  for (;;)
   {
-    fprintf(stderr, "%s: cannot create space", __func__);
-    exit(1);
+    /* Keep some space, otherwise the cursor allocates on its own */
+    packed->keys = (unsigned char*)filedb_grow(packed->keys, &kmax, klen + 1, 1, __func__);
+    dbkey.data = packed->keys + klen;
+    dbkey.size = filedb_pack_room(kmax, klen);
+    if (with_data)
+    {
+      packed->vals = (unsigned char*)filedb_grow(packed->vals, &vmax, vlen + 1, 1, __func__);
+      dbval.data = packed->vals + vlen;
+      dbval.size = filedb_pack_room(vmax, vlen);
+    }
+
+    ret = crp->get(crp, &dbkey, with_data ? &dbval : 0, flags);
+    if (ret == FFDB_SPECIAL)
+    {
+      /* Too small, the sizes needed are returned */
+      packed->keys = (unsigned char*)filedb_grow(packed->keys, &kmax, klen + dbkey.size, 1, __func__);
+      if (with_data)
+	packed->vals = (unsigned char*)filedb_grow(packed->vals, &vmax, vlen + dbval.size, 1, __func__);
+      flags = FFDB_CURRENT;
+      continue;
+    }
+    if (ret != 0)
+      break;
+
+    packed->num += 1;
+    klen += dbkey.size;
+    packed->key_offs = (unsigned long*)filedb_grow(packed->key_offs, &komax, packed->num + 1,
+						   sizeof(unsigned long), __func__);
+    packed->key_offs[packed->num] = klen;
+    if (with_data)
+    {
+      vlen += dbval.size;
+      packed->val_offs = (unsigned long*)filedb_grow(packed->val_offs, &vomax, packed->num + 1,
+						     sizeof(unsigned long), __func__);
+      packed->val_offs[packed->num] = vlen;
+    }
+    flags = FFDB_NEXT;
   }
 
-  *vals = (FFDB_DBT*)realloc(*vals, (*num)*sizeof(FFDB_DBT));
-  if (*vals == NULL)
+  if (ret != FFDB_NOT_FOUND)
   {
-    fprintf(stderr, "%s: cannot create space", __func__);
+    fprintf(stderr, "%s:  create Cursor Error", __func__);
     exit(1);
   }
 
-  /* First test */
-  dbkey = &((*keys)[old_num]);
-  dbval = &((*vals)[old_num]);
-  dbkey->data = dbval->data = 0;
-  dbkey->size = dbval->size = 0;
+  /* close cursor */
+  if (crp != NULL)
+    crp->close(crp);
+}
+
+
+/*
+ * Create a cursor over all buckets, or over the buckets of one of
+ * nparts partitions of the buckets. The number of keys the cursor
+ * is expected to walk over is returned in hint
+ */
+static ffdb_cursor_t*
+filedb_partition_cursor(FFDB_DB* dbh, unsigned int part, unsigned int nparts,
+			unsigned int* hint, const char* func)
+{
+  ffdb_cursor_t* crp;
+  unsigned int nbuckets, lo, hi;
+  int ret;
+
+  /* Keys are spread evenly over the buckets */
+  *hint = ffdb_num_keys(dbh);
+  if (nparts > 1)
+    *hint = *hint / nparts + *hint / nparts / 8 + 1;
 
-  while ((ret = crp->get(crp, dbkey, dbval, FFDB_NEXT)) == 0) 
+  if (nparts <= 1)
+    ret = dbh->cursor(dbh, &crp, FFDB_KEY_CURSOR);
+  else
   {
-    /* Need to create space for next key */
-    old_num = *num;
-    *num += 1;
-    *keys = (FFDB_DBT*)realloc(*keys, (*num)*sizeof(FFDB_DBT));
-    if (*keys == NULL)
+    nbuckets = ffdb_num_buckets(dbh);
+    lo = (unsigned int)((unsigned long)nbuckets * part / nparts);
+    /* the last partition takes buckets added meanwhile as well */
+    if (part + 1 >= nparts)
+      hi = 0xffffffff;
+    else
+      hi = (unsigned int)((unsigned long)nbuckets * (part + 1) / nparts);
+
+    if (lo >= hi)
     {
-      fprintf(stderr, "%s: cannot create intermediate", __func__);
-      exit(1);
+      /* more partitions than buckets: nothing to walk */
+      lo = 0xfffffffe;
+      hi = 0xffffffff;
     }
+    ret = ffdb_cursor_range(dbh, &crp, lo, hi);
+  }
+
+  if (ret != 0)
+  {
+    fprintf(stderr, "%s: create Cursor Error", func);
+    exit(1);
+  }
+  return crp;
+}
+
+
+/*
+ * Return all keys to vectors in binary form of strings
+ */
+void
+filedb_get_all_keys(FILEDB_DB* dbhh, void* keyss, unsigned int* num)
+{
+  FFDB_DB* dbh = (FFDB_DB*)dbhh;
+
+  ffdb_cursor_t* crp;
+  unsigned int hint;
+
+  crp = filedb_partition_cursor(dbh, 0, 1, &hint, __func__);
+  filedb_cursor_keys(crp, hint, keyss, num);
+}
+
+
+/**
+ * Return all keys & data to vectors in binary form of strings
+ */
+void
+filedb_get_all_pairs(FILEDB_DB* dbhh, void* keyss, void* valss, unsigned int* num)
+{
+  FFDB_DB* dbh = (FFDB_DB*)dbhh;
+
+  ffdb_cursor_t* crp;
+  unsigned int hint;
+
+  crp = filedb_partition_cursor(dbh, 0, 1, &hint, __func__);
+  filedb_cursor_pairs(crp, hint, keyss, valss, num);
+}
+
+
+/*
+ * Return the keys of one partition of the buckets
+ */
+void
+filedb_get_partition_keys(FILEDB_DB* dbhh, unsigned int part, unsigned int nparts,
+			  void* keyss, unsigned int* num)
+{
+  FFDB_DB* dbh = (FFDB_DB*)dbhh;
+
+  ffdb_cursor_t* crp;
+  unsigned int hint;
+
+  crp = filedb_partition_cursor(dbh, part, nparts, &hint, __func__);
+  filedb_cursor_keys(crp, hint, keyss, num);
+}
+
 
-    *vals = (FFDB_DBT*)realloc(*vals, (*num)*sizeof(FFDB_DBT));
-    if (*vals == NULL)
+/*
+ * Return the keys & data of one partition of the buckets
+ */
+void
+filedb_get_partition_pairs(FILEDB_DB* dbhh, unsigned int part, unsigned int nparts,
+			   void* keyss, void* valss, unsigned int* num)
+{
+  FFDB_DB* dbh = (FFDB_DB*)dbhh;
+
+  ffdb_cursor_t* crp;
+  unsigned int hint;
+
+  crp = filedb_partition_cursor(dbh, part, nparts, &hint, __func__);
+  filedb_cursor_pairs(crp, hint, keyss, valss, num);
+}
+
+
+/*
+ * Holding location of the pairs of a scan
+ */
+typedef struct _filedb_scan_pairs_
+{
+  FFDB_DBT*    keys;
+  FFDB_DBT*    vals;
+  unsigned int num;
+  unsigned int max;
+} filedb_scan_pairs_t;
+
+static int
+filedb_scan_add_pair(FFDB_DBT* key, FFDB_DBT* data, void* arg)
+{
+  filedb_scan_pairs_t* sp = (filedb_scan_pairs_t*)arg;
+
+  /* Double the space when it is used up */
+  if (sp->num == sp->max)
+  {
+    sp->max = (sp->max == 0) ? 1024 : 2 * sp->max;
+    sp->keys = (FFDB_DBT*)realloc(sp->keys, sp->max*sizeof(FFDB_DBT));
+    sp->vals = (FFDB_DBT*)realloc(sp->vals, sp->max*sizeof(FFDB_DBT));
+    if (sp->keys == NULL || sp->vals == NULL)
     {
       fprintf(stderr, "%s: cannot create intermediate", __func__);
       exit(1);
     }
+  }
 
-    /* prepare */
-    dbkey = &((*keys)[old_num]); dbval = &((*vals)[old_num]);
-    dbkey->data = dbval->data = 0;
-    dbkey->size = dbval->size = 0;
+  /* The pair belongs to the scan, the caller gets copies */
+  sp->keys[sp->num].data = malloc(key->size > 0 ? key->size : 1);
+  sp->vals[sp->num].data = malloc(data->size > 0 ? data->size : 1);
+  if (sp->keys[sp->num].data == NULL || sp->vals[sp->num].data == NULL)
+  {
+    fprintf(stderr, "%s: cannot create intermediate", __func__);
+    exit(1);
   }
+  memcpy(sp->keys[sp->num].data, key->data, key->size);
+  memcpy(sp->vals[sp->num].data, data->data, data->size);
+  sp->keys[sp->num].size = key->size;
+  sp->vals[sp->num].size = data->size;
+  sp->num += 1;
+  return 0;
+}
 
-  if (ret != FFDB_NOT_FOUND)
+
+/*
+ * Return all keys & data in the order the data are stored in the file
+ */
+void
+filedb_scan_all_pairs(FILEDB_DB* dbhh, void* keyss, void* valss, unsigned int* num)
+{
+  FFDB_DB*   dbh  = (FFDB_DB*)dbhh;
+  FFDB_DBT** keys = (FFDB_DBT**)keyss;
+  FFDB_DBT** vals = (FFDB_DBT**)valss;
+  filedb_scan_pairs_t sp;
+
+  sp.keys = sp.vals = NULL;
+  sp.num = sp.max = 0;
+
+  if (ffdb_scan(dbh, filedb_scan_add_pair, &sp) != 0)
   {
-    fprintf(stderr, "%s:  create Cursor Error", __func__);
+    fprintf(stderr, "%s: scan Error", __func__);
     exit(1);
   }
-  
-  /* Remove the test space. The space within the key was not allocated, so do not need an additional free */
-  *num -= 1;
-  *keys = (FFDB_DBT*)realloc(*keys, (*num)*sizeof(FFDB_DBT));
-  if (*keys == NULL)
+
+  *keys = sp.keys;
+  *vals = sp.vals;
+  *num  = sp.num;
+}
+
+
+/*
+ * Return all keys, and all data if with_data is set, packed into
+ * one buffer each
+ */
+void
+filedb_get_all_packed(FILEDB_DB* dbhh, int with_data, FILEDB_PACKED* packed)
+{
+  FFDB_DB* dbh = (FFDB_DB*)dbhh;
+  ffdb_cursor_t* crp;
+  unsigned int hint;
+
+  crp = filedb_partition_cursor(dbh, 0, 1, &hint, __func__);
+  filedb_cursor_pack(crp, hint, with_data, packed);
+}
+
+
+/*
+ * Return the keys, and the data if with_data is set, of one partition
+ * of the buckets packed into one buffer each
+ */
+void
+filedb_get_partition_packed(FILEDB_DB* dbhh, unsigned int part, unsigned int nparts,
+			    int with_data, FILEDB_PACKED* packed)
+{
+  FFDB_DB* dbh = (FFDB_DB*)dbhh;
+  ffdb_cursor_t* crp;
+  unsigned int hint;
+
+  crp = filedb_partition_cursor(dbh, part, nparts, &hint, __func__);
+  filedb_cursor_pack(crp, hint, with_data, packed);
+}
+
+
+/*
+ * Return the keys from lo up to but not including hi in key order, and
+ * their data if with_data is set, packed into one buffer each
+ */
+int
+filedb_get_range_packed(FILEDB_DB* dbhh, const FILEDB_DBT* lo, const FILEDB_DBT* hi,
+			int with_data, FILEDB_PACKED* packed)
+{
+  FFDB_DB* dbh = (FFDB_DB*)dbhh;
+  ffdb_cursor_t* crp;
+
+  memset(packed, 0, sizeof(FILEDB_PACKED));
+  if (ffdb_cursor_ordered(dbh, &crp, (const FFDB_DBT*)lo, (const FFDB_DBT*)hi) != 0)
+    return -1;
+
+  /* No idea how many keys are in range: start small */
+  filedb_cursor_pack(crp, 64, with_data, packed);
+  return 0;
+}
+
+
+/*
+ * Return the keys starting with prefix in key order, and their data if
+ * with_data is set, packed into one buffer each
+ */
+int
+filedb_get_prefix_packed(FILEDB_DB* dbhh, const FILEDB_DBT* prefix,
+			 int with_data, FILEDB_PACKED* packed)
+{
+  FFDB_DB* dbh = (FFDB_DB*)dbhh;
+  ffdb_cursor_t* crp;
+
+  memset(packed, 0, sizeof(FILEDB_PACKED));
+  if (ffdb_cursor_prefix(dbh, &crp, (const FFDB_DBT*)prefix) != 0)
+    return -1;
+
+  filedb_cursor_pack(crp, 64, with_data, packed);
+  return 0;
+}
+
+
+/*
+ * Holding location of the packed pairs of a scan
+ */
+typedef struct _filedb_scan_packed_
+{
+  FILEDB_PACKED* packed;
+  unsigned long  kmax, vmax, omax;
+} filedb_scan_packed_t;
+
+static int
+filedb_scan_pack_pair(FFDB_DBT* key, FFDB_DBT* data, void* arg)
+{
+  filedb_scan_packed_t* sp = (filedb_scan_packed_t*)arg;
+  FILEDB_PACKED* packed = sp->packed;
+  unsigned long klen, vlen;
+
+  klen = packed->key_offs[packed->num];
+  vlen = packed->val_offs[packed->num];
+  packed->keys = (unsigned char*)filedb_grow(packed->keys, &sp->kmax, klen + key->size, 1, __func__);
+  packed->vals = (unsigned char*)filedb_grow(packed->vals, &sp->vmax, vlen + data->size, 1, __func__);
+  memcpy(packed->keys + klen, key->data, key->size);
+  memcpy(packed->vals + vlen, data->data, data->size);
+
+  /* Both offset arrays always have the same length */
+  packed->num += 1;
+  packed->key_offs = (unsigned long*)filedb_grow(packed->key_offs, &sp->omax, packed->num + 1,
+						 sizeof(unsigned long), __func__);
+  packed->val_offs = (unsigned long*)realloc(packed->val_offs, sp->omax*sizeof(unsigned long));
+  if (packed->val_offs == NULL)
   {
     fprintf(stderr, "%s: cannot create intermediate", __func__);
     exit(1);
   }
+  packed->key_offs[packed->num] = klen + key->size;
+  packed->val_offs[packed->num] = vlen + data->size;
+  return 0;
+}
+
 
-  *vals = (FFDB_DBT*)realloc(*vals, (*num)*sizeof(FFDB_DBT));
-  if (*vals == NULL)
+/*
+ * Return all keys & data packed into one buffer each in the order the
+ * data are stored in the file
+ */
+void
+filedb_scan_all_packed(FILEDB_DB* dbhh, FILEDB_PACKED* packed)
+{
+  FFDB_DB* dbh = (FFDB_DB*)dbhh;
+  filedb_scan_packed_t sp;
+  unsigned int hint;
+
+  hint = ffdb_num_keys(dbh);
+  sp.packed = packed;
+  sp.kmax = sp.vmax = sp.omax = 0;
+  packed->num  = 0;
+  packed->keys = (unsigned char*)filedb_grow(NULL, &sp.kmax, 32UL*hint + 1, 1, __func__);
+  packed->vals = (unsigned char*)filedb_grow(NULL, &sp.vmax, 64UL*hint + 1, 1, __func__);
+  packed->key_offs = (unsigned long*)filedb_grow(NULL, &sp.omax, hint + 1,
+						 sizeof(unsigned long), __func__);
+  packed->val_offs = (unsigned long*)malloc(sp.omax*sizeof(unsigned long));
+  if (packed->val_offs == NULL)
   {
-    fprintf(stderr, "%s: cannot create intermediate", __func__);
+    fprintf(stderr, "%s: cannot create initial space", __func__);
     exit(1);
   }
+  packed->key_offs[0] = packed->val_offs[0] = 0;
 
-  /* close cursor */
-  if (crp != NULL)
-    crp->close(crp);
+  if (ffdb_scan(dbh, filedb_scan_pack_pair, &sp) != 0)
+  {
+    fprintf(stderr, "%s: scan Error", __func__);
+    exit(1);
+  }
+}
+
+
+/*
+ * Release the buffers of packed keys & data
+ */
+void
+filedb_free_packed(FILEDB_PACKED* packed)
+{
+  free(packed->keys);
+  free(packed->key_offs);
+  free(packed->vals);
+  free(packed->val_offs);
+  packed->keys = packed->vals = NULL;
+  packed->key_offs = packed->val_offs = NULL;
+  packed->num = 0;
 }
 
 
@@ -489,6 +899,128 @@ int filedb_get_data(FILEDB_DB* dbhh, const FILEDB_DBT* key, FILEDB_DBT* data)
 }  
   
 
+/**
+ * get the length of the data for a key without reading the data
+ *
+ * @param dbh database pointer
+ * @key key associated with this data. This key must be string form
+ * @size the length of the data on return
+ *
+ * @return 0 on success. Otherwise failure
+ */
+int filedb_get_data_size(FILEDB_DB* dbhh, const FILEDB_DBT* key, unsigned int* size)
+{
+  FFDB_DB*  dbh    = (FFDB_DB*)dbhh;
+  FFDB_DBT* dbkey  = (FFDB_DBT*)key;
+
+  *size = 0;
+  return ffdb_get_size(dbh, dbkey, size);
+}
+
+
+/**
+ * get len bytes of the data for a key starting at byte offset
+ *
+ * @param dbh database pointer
+ * @key key associated with this data. This key must be string form
+ * @data data to be retrieved, malloced and to be freed by the caller
+ * @offset the first byte of the data
+ * @len number of bytes
+ *
+ * @return 0 on success. Otherwise failure
+ */
+int filedb_get_data_range(FILEDB_DB* dbhh, const FILEDB_DBT* key, FILEDB_DBT* data,
+			  unsigned int offset, unsigned int len)
+{
+  FFDB_DB*  dbh    = (FFDB_DB*)dbhh;
+  FFDB_DBT* dbkey  = (FFDB_DBT*)key;
+  FFDB_DBT* dbdata = (FFDB_DBT*)data;
+
+  /* Initialize */
+  data->data = 0;
+  data->size = 0;
+
+  return ffdb_get_range(dbh, dbkey, dbdata, offset, len);
+}
+
+
+/**
+ * get data for a key without copying it when the data lies on a single
+ * page. The data stays valid until the view is released
+ *
+ * @param dbh database pointer
+ * @key key associated with this data. This key must be string form
+ * @data data points into the database page or a copy held by the view
+ * @view view to be released by filedb_release_view
+ *
+ * @return 0 on success. Otherwise failure
+ */
+int filedb_get_view(FILEDB_DB* dbhh, const FILEDB_DBT* key, FILEDB_DBT* data,
+		    FILEDB_VIEW* view)
+{
+  FFDB_DB*  dbh    = (FFDB_DB*)dbhh;
+  FFDB_DBT* dbkey  = (FFDB_DBT*)key;
+  FFDB_DBT* dbdata = (FFDB_DBT*)data;
+
+  return ffdb_get_view(dbh, dbkey, dbdata, (ffdb_view_t*)view);
+}
+
+
+/**
+ * release a view obtained from filedb_get_view
+ *
+ * @param dbh database pointer
+ * @view the view
+ */
+void filedb_release_view(FILEDB_DB* dbhh, FILEDB_VIEW* view)
+{
+  FFDB_DB*  dbh    = (FFDB_DB*)dbhh;
+
+  ffdb_release_view(dbh, (ffdb_view_t*)view);
+}
+
+
+/**
+ * get data for many keys at once reading pages in ascending order
+ *
+ * @param dbh database pointer
+ * @keys n keys in string form
+ * @vals n data. The data of a key not found is empty. Caller has to free
+ * the data of each key found
+ * @n number of keys
+ * @nthreads number of threads reading the database
+ *
+ * @return 0 on success. 1 if some keys are not found. Otherwise failure
+ */
+int filedb_get_many(FILEDB_DB* dbhh, const FILEDB_DBT keys[], FILEDB_DBT vals[],
+		    unsigned int n, unsigned int nthreads)
+{
+  FFDB_DB*  dbh    = (FFDB_DB*)dbhh;
+
+  return ffdb_get_many(dbh, (const FFDB_DBT*)keys, (FFDB_DBT*)vals, n, nthreads);
+}
+
+
+/**
+ * Load key and data pairs into an empty database without splitting
+ * buckets
+ *
+ * @param dbh database pointer
+ * @keys n keys in string form
+ * @vals n data in string form
+ * @n number of pairs
+ *
+ * @return 0 on success. Otherwise failure
+ */
+int filedb_bulk_load(FILEDB_DB* dbhh, const FILEDB_DBT keys[], const FILEDB_DBT vals[],
+		     unsigned int n)
+{
+  FFDB_DB*  dbh    = (FFDB_DB*)dbhh;
+
+  return ffdb_bulk_load(dbh, (FFDB_DBT*)keys, (FFDB_DBT*)vals, n);
+}
+
+
 /**
  * Insert key and data pair in string format into the database
  *
@@ -507,3 +1039,62 @@ int filedb_insert_data(FILEDB_DB* dbhh, const FILEDB_DBT* key, const FILEDB_DBT*
   /* now it is time to insert */
   return dbh->put(dbh, dbkey, dbdata, 0);
 }
+
+/**
+ * Insert key and data pair with the data on the pages of a configuration
+ */
+int filedb_insert_config_data(FILEDB_DB* dbhh, const FILEDB_DBT* key,
+			      const FILEDB_DBT* data, unsigned int config)
+{
+  FFDB_DB*  dbh    = (FFDB_DB*)dbhh;
+  FFDB_DBT* dbkey  = (FFDB_DBT*)key;
+  FFDB_DBT* dbdata = (FFDB_DBT*)data;
+
+  return ffdb_put_config(dbh, dbkey, dbdata, config);
+}
+
+/**
+ * Overwrite part of the data for a key in place
+ */
+int filedb_update_data_range(FILEDB_DB* dbhh, const FILEDB_DBT* key,
+			     const FILEDB_DBT* data, unsigned int offset)
+{
+  FFDB_DB*  dbh    = (FFDB_DB*)dbhh;
+  FFDB_DBT* dbkey  = (FFDB_DBT*)key;
+  FFDB_DBT* dbdata = (FFDB_DBT*)data;
+
+  return ffdb_put_range(dbh, dbkey, dbdata, offset);
+}
+
+/**
+ * Delete key and data pair from the database
+ *
+ * @param dbh database pointer
+ * @key key to be deleted. This key must be string form
+ *
+ * @return 0 on success, 1 if the key is not in the database. 
+ * Otherwise failure
+ */
+int filedb_delete_data(FILEDB_DB* dbhh, const FILEDB_DBT* key)
+{
+  FFDB_DB*  dbh    = (FFDB_DB*)dbhh;
+  FFDB_DBT* dbkey  = (FFDB_DBT*)key;
+
+  return dbh->del(dbh, dbkey, 0);
+}
+
+/**
+ * Compact the database while it is open
+ *
+ * @param dbh database pointer
+ * @npages maximum number of pages to look at
+ *
+ * @return 1 if there are more pages to look at, 0 when the whole file
+ * has been compacted. Otherwise failure
+ */
+int filedb_compact(FILEDB_DB* dbhh, unsigned int npages)
+{
+  FFDB_DB*  dbh    = (FFDB_DB*)dbhh;
+
+  return ffdb_compact(dbh, npages);
+}
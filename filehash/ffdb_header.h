@@ -43,6 +43,27 @@ typedef struct {
 /* All configuration info */
 typedef void* FILEDB_ALL_CONFIG_INFO;
 
+/*
+ * A borrowed view of data, released by filedb_release_view
+ */
+typedef struct {
+  void *page;                          /* pinned data page     */
+  void *buf;                           /* malloced copy        */
+} FILEDB_VIEW;
+
+/*
+ * Many keys and data packed back to back into one buffer each.
+ * Item i is bytes offs[i] up to offs[i+1] of the buffer.
+ * Released by filedb_free_packed
+ */
+typedef struct {
+  unsigned char *keys;                 /* all keys             */
+  unsigned long *key_offs;             /* num + 1 key offsets  */
+  unsigned char *vals;                 /* all data or null     */
+  unsigned long *val_offs;             /* num + 1 data offsets */
+  unsigned int num;                    /* number of items      */
+} FILEDB_PACKED;
+
 /* Access method description structure. */
 typedef void* FILEDB_DB;
 
@@ -59,6 +80,22 @@ typedef struct {
 				  */
   unsigned int   userinfolen;    /* how many bytes for user information */
   unsigned int   numconfigs;     /* number of configurations */
+  int            ioengine;       /* page I/O engine: 0 auto, 1 sync, 2 io_uring */
+  int            orderedindex;   /* keep an ordered index of the keys of
+				  * a new database for range reads
+				  */
+  int            hashfunc;       /* hash function of a new database:
+				  * 0 default, 1 fnv, 2 wyhash
+				  */
+  int            compress;       /* codec of the data of a new database:
+				  * 0 none, 1 lz
+				  */
+  unsigned int   compressmin;    /* data shorter than this are stored
+				  * as they are, 0 for the default
+				  */
+  unsigned int   filterwidth;    /* element width of the data for the
+				  * shuffle filter, 0 for none
+				  */
 } FILEDB_OPENINFO;
 
 
@@ -96,6 +133,17 @@ extern int
 filedb_is_db_empty(FILEDB_DB* dbhh);
 
 
+/**
+ * Get number of keys in the database. Only the header is consulted
+ *
+ * @param dbhh pointer to underlying database
+ *
+ * @return number of keys
+ */
+extern unsigned int
+filedb_num_keys(const FILEDB_DB* dbhh);
+
+
 /**
  * Set a paticular configuration information
  * 
@@ -173,6 +221,33 @@ extern unsigned int
 filedb_get_num_configs(const FILEDB_DB* dbhh);
 
 
+/**
+ * Set the layout of the values of the configurations, one of
+ * FFDB_LAYOUT_KEY_MAJOR and FFDB_LAYOUT_CONFIG_MAJOR. It is kept in
+ * the information of each configuration, and set when the
+ * configurations are set
+ *
+ * @param dbh database pointer
+ * @param layout the layout
+ *
+ * @return 0 on success -1 on failure with a proper errno set
+ */
+extern int
+filedb_set_config_layout(FILEDB_DB* dbh, int layout);
+
+
+/**
+ * Get the layout of the values of the configurations
+ *
+ * @param dbh database pointer
+ *
+ * @return FFDB_LAYOUT_KEY_MAJOR or FFDB_LAYOUT_CONFIG_MAJOR, or -1 on
+ * failure
+ */
+extern int
+filedb_get_config_layout(const FILEDB_DB* dbh);
+
+
 /**
  * Set user information for the database
  *
@@ -233,6 +308,92 @@ extern void
 filedb_get_all_pairs(FILEDB_DB* dbhh, void* keyss, void* valss, unsigned int* num);
 
 
+/**
+ * Return the keys of one of nparts partitions of the buckets to vectors
+ * in binary form of strings. Partitions are disjoint and cover all keys,
+ * and each of them can be read by a different thread
+ */
+extern void
+filedb_get_partition_keys(FILEDB_DB* dbhh, unsigned int part, unsigned int nparts,
+			  void* keyss, unsigned int* num);
+
+
+/**
+ * Return the keys & data of one of nparts partitions of the buckets to
+ * vectors in binary form of strings. Partitions are disjoint and cover
+ * all pairs, and each of them can be read by a different thread
+ */
+extern void
+filedb_get_partition_pairs(FILEDB_DB* dbhh, unsigned int part, unsigned int nparts,
+			   void* keyss, void* valss, unsigned int* num);
+
+
+/**
+ * Return all keys & data to vectors in binary form of strings.
+ * The file is read front to back and pairs come in the order
+ * their data are stored, which is much faster than a cursor for
+ * large files
+ */
+extern void
+filedb_scan_all_pairs(FILEDB_DB* dbhh, void* keyss, void* valss, unsigned int* num);
+
+
+/**
+ * Return all keys, and all data if with_data is set, packed into
+ * one buffer each
+ */
+extern void
+filedb_get_all_packed(FILEDB_DB* dbhh, int with_data, FILEDB_PACKED* packed);
+
+
+/**
+ * Return the keys, and the data if with_data is set, of one of nparts
+ * partitions of the buckets packed into one buffer each
+ */
+extern void
+filedb_get_partition_packed(FILEDB_DB* dbhh, unsigned int part, unsigned int nparts,
+			    int with_data, FILEDB_PACKED* packed);
+
+
+/**
+ * Return all keys & data packed into one buffer each. Pairs come in
+ * the order their data are stored as in filedb_scan_all_pairs
+ */
+extern void
+filedb_scan_all_packed(FILEDB_DB* dbhh, FILEDB_PACKED* packed);
+
+
+/**
+ * Return the keys from lo up to but not including hi in key order, and
+ * their data if with_data is set, packed into one buffer each. A null
+ * lo or hi leaves the range open at that end. Keys are compared byte by
+ * byte.
+ *
+ * @return 0 on success, -1 if the database keeps no ordered key index
+ */
+extern int
+filedb_get_range_packed(FILEDB_DB* dbhh, const FILEDB_DBT* lo, const FILEDB_DBT* hi,
+			int with_data, FILEDB_PACKED* packed);
+
+
+/**
+ * Return the keys starting with prefix in key order, and their data if
+ * with_data is set, packed into one buffer each
+ *
+ * @return 0 on success, -1 if the database keeps no ordered key index
+ */
+extern int
+filedb_get_prefix_packed(FILEDB_DB* dbhh, const FILEDB_DBT* prefix,
+			 int with_data, FILEDB_PACKED* packed);
+
+
+/**
+ * Release the buffers of packed keys & data
+ */
+extern void
+filedb_free_packed(FILEDB_PACKED* packed);
+
+
 /**
  * get key and data pair from a database pointed by pointer dbh
  *
@@ -244,8 +405,98 @@ filedb_get_all_pairs(FILEDB_DB* dbhh, void* keyss, void* valss, unsigned int* nu
  */
 extern int
 filedb_get_data(FILEDB_DB* dbh, const FILEDB_DBT* key, FILEDB_DBT* data);
+
+
+/**
+ * get the length of the data for a key without reading the data
+ *
+ * @param dbh database pointer
+ * @key key associated with this data. This key must be string form
+ * @size the length of the data on return
+ *
+ * @return 0 on success, 1 if the key is not found. -1 on failure
+ */
+extern int
+filedb_get_data_size(FILEDB_DB* dbh, const FILEDB_DBT* key, unsigned int* size);
+
+
+/**
+ * get len bytes of the data for a key starting at byte offset. Only the
+ * pages holding these bytes are read
+ *
+ * @param dbh database pointer
+ * @key key associated with this data. This key must be string form
+ * @data data to be retrieved, malloced and to be freed by the caller
+ * @offset the first byte of the data
+ * @len number of bytes
+ *
+ * @return 0 on success, 1 if the key is not found. -1 on failure, with
+ * errno EINVAL if the bytes lie beyond the data
+ */
+extern int
+filedb_get_data_range(FILEDB_DB* dbh, const FILEDB_DBT* key, FILEDB_DBT* data,
+		      unsigned int offset, unsigned int len);
   
 
+/**
+ * get data for a key without copying it when the data lies on a single
+ * page. The data stays valid until the view is released
+ *
+ * @param dbh database pointer
+ * @key key associated with this data. This key must be string form
+ * @data data points into the database page or a copy held by the view
+ * @view view to be released by filedb_release_view
+ *
+ * @return 0 on success. Otherwise failure
+ */
+extern int
+filedb_get_view(FILEDB_DB* dbh, const FILEDB_DBT* key, FILEDB_DBT* data,
+		FILEDB_VIEW* view);
+
+
+/**
+ * release a view obtained from filedb_get_view
+ *
+ * @param dbh database pointer
+ * @view the view
+ */
+extern void
+filedb_release_view(FILEDB_DB* dbh, FILEDB_VIEW* view);
+
+
+/**
+ * get data for many keys at once reading pages in ascending order
+ *
+ * @param dbh database pointer
+ * @keys n keys in string form
+ * @vals n data. The data of a key not found is empty. Caller has to free
+ * the data of each key found
+ * @n number of keys
+ * @nthreads number of threads reading the database
+ *
+ * @return 0 on success. 1 if some keys are not found. Otherwise failure
+ */
+extern int
+filedb_get_many(FILEDB_DB* dbh, const FILEDB_DBT keys[], FILEDB_DBT vals[],
+		unsigned int n, unsigned int nthreads);
+
+
+/**
+ * Load key and data pairs into an empty database without splitting
+ * buckets
+ *
+ * @param dbh database pointer
+ * @keys n keys in string form
+ * @vals n data in string form
+ * @n number of pairs
+ *
+ * @return 0 on success. Otherwise failure
+ */
+extern int
+filedb_bulk_load(FILEDB_DB* dbh, const FILEDB_DBT keys[], const FILEDB_DBT vals[],
+		 unsigned int n);
+
+
 /**
  * Insert key and data pair in string format into the database
  *
@@ -258,6 +509,64 @@ filedb_get_data(FILEDB_DB* dbh, const FILEDB_DBT* key, FILEDB_DBT* data);
 extern int
 filedb_insert_data(FILEDB_DB* dbh, const FILEDB_DBT* key, const FILEDB_DBT* data);
 
+/**
+ * Insert key and data pair into the database, with the data placed on
+ * the data pages of configuration config
+ *
+ * @param dbh database pointer
+ * @key key associated with this data. This key must be string form
+ * @data data to be stored into the database
+ * @config the configuration number
+ *
+ * @return 0 on success. Otherwise failure
+ */
+extern int
+filedb_insert_config_data(FILEDB_DB* dbh, const FILEDB_DBT* key,
+			  const FILEDB_DBT* data, unsigned int config);
+
+/**
+ * Overwrite part of the data for a key in place. The length of the data
+ * stays the same and only the pages holding these bytes are written
+ *
+ * @param dbh database pointer
+ * @key key associated with this data. This key must be string form
+ * @data the new bytes
+ * @offset the first byte of the data to overwrite
+ *
+ * @return 0 on success, 1 if the key is not found. -1 on failure, with
+ * errno EINVAL if the bytes lie beyond the data
+ */
+extern int
+filedb_update_data_range(FILEDB_DB* dbh, const FILEDB_DBT* key,
+			 const FILEDB_DBT* data, unsigned int offset);
+
+/**
+ * Delete key and data pair from the database
+ *
+ * @param dbh database pointer
+ * @key key to be deleted. This key must be string form
+ *
+ * @return 0 on success, 1 if the key is not in the database. 
+ * Otherwise failure
+ */
+extern int
+filedb_delete_data(FILEDB_DB* dbh, const FILEDB_DBT* key);
+
+/**
+ * Compact the database while it is open: live data on mostly empty
+ * data pages are moved and free pages at the end of the file are
+ * given back
+ *
+ * @param dbh database pointer
+ * @npages maximum number of pages to look at. The next call continues
+ * where this one stopped
+ *
+ * @return 1 if there are more pages to look at, 0 when the whole file
+ * has been compacted. Otherwise failure
+ */
+extern int
+filedb_compact(FILEDB_DB* dbh, unsigned int npages);
+
 
 #ifdef __cplusplus
 };
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     Benchmark of the page I/O engines on a cold cache: a batched
+ *     lookup of random keys and the write back of the rewritten values
+ *
+ *     Build with: make iobench
+ *     Run with:   iobench [file [number of keys [value size]]]
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "ffdb_db.h"
+#include "ffdb_pageio.h"
+
+static double
+_now (void)
+{
+  struct timeval tv;
+  gettimeofday (&tv, 0);
+  return tv.tv_sec + tv.tv_usec * 1.0e-6;
+}
+
+static void
+_fill (char* buf, unsigned int i, unsigned int len)
+{
+  unsigned int j;
+
+  for (j = 0; j < len; j++)
+    buf[j] = (char)(i * 7 + j);
+}
+
+/**
+ * Drop the pages of the file from the operating system page cache
+ */
+static void
+_drop_cache (const char* fname)
+{
+  int fd;
+
+  fd = open (fname, O_RDONLY);
+  if (fd < 0)
+    return;
+  fdatasync (fd);
+  posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+  close (fd);
+}
+
+static void
+_info (FFDB_HASHINFO* info, int engine)
+{
+  memset (info, 0, sizeof(FFDB_HASHINFO));
+  info->bsize = 4096;
+  info->nbuckets = 1024;
+  info->cachesize = 256 * 1024 * 1024;
+  info->rearrangepages = 0;
+  info->userinfolen = 16;
+  info->numconfigs = 1;
+  info->ioengine = engine;
+}
+
+/**
+ * Look up nget random keys on a cold cache, then rewrite them all and
+ * write them back. Return 0 on success.
+ */
+static int
+_bench (const char* fname, int engine, unsigned int nkeys,
+	unsigned int nget, unsigned int vsize)
+{
+  FFDB_HASHINFO info;
+  FFDB_DB* db;
+  FFDB_DBT* keys;
+  FFDB_DBT* vals;
+  char* kbuf;
+  char* ref;
+  unsigned int i, k;
+  double start, tget, tsync;
+  int status, bad;
+
+  keys = (FFDB_DBT *)calloc (nget, sizeof(FFDB_DBT));
+  vals = (FFDB_DBT *)calloc (nget, sizeof(FFDB_DBT));
+  kbuf = (char *)malloc (nget * 16);
+  ref = (char *)malloc (vsize);
+  if (!keys || !vals || !kbuf || !ref) {
+    fprintf (stderr, "Cannot allocate benchmark buffers\n");
+    return 1;
+  }
+
+  srand (4321);
+  for (i = 0; i < nget; i++) {
+    k = (unsigned int)rand () % nkeys;
+    keys[i].data = kbuf + 16 * i;
+    keys[i].size = sprintf (keys[i].data, "key%u", k);
+  }
+
+  _drop_cache (fname);
+
+  _info (&info, engine);
+  db = ffdb_dbopen (fname, O_RDWR, 0644, &info);
+  if (!db) {
+    fprintf (stderr, "Cannot open %s\n", fname);
+    return 1;
+  }
+
+  start = _now ();
+  status = ffdb_get_many (db, keys, vals, nget, 1);
+  tget = _now () - start;
+
+  bad = (status != 0);
+  for (i = 0; i < nget; i++) {
+    k = (unsigned int)atoi ((char *)keys[i].data + 3);
+    _fill (ref, k, vsize);
+    if (vals[i].size != vsize || memcmp (vals[i].data, ref, vsize) != 0)
+      bad++;
+    /* rewrite the value so that its page is written back */
+    db->put (db, &keys[i], &vals[i], 0);
+  }
+
+  start = _now ();
+  db->sync (db, 0);
+  tsync = _now () - start;
+
+  db->close (db);
+
+  printf ("%10s %12.0f %14.1f %12.3f\n",
+	  (engine == FFDB_IO_URING) ? "io_uring" : "sync",
+	  nget / tget, nget * (double)vsize / tget / (1024.0 * 1024.0),
+	  tsync);
+
+  for (i = 0; i < nget; i++)
+    free (vals[i].data);
+  free (keys);
+  free (vals);
+  free (kbuf);
+  free (ref);
+
+  if (bad) {
+    fprintf (stderr, "%d values are wrong\n", bad);
+    return 1;
+  }
+  return 0;
+}
+
+int
+main (int argc, char** argv)
+{
+  const char* fname = "iobench.db";
+  unsigned int nkeys = 200000, vsize = 1000, nget, i;
+  FFDB_HASHINFO info;
+  FFDB_DB* db;
+  FFDB_DBT key, val;
+  ffdb_pageio_t* io;
+  char kbuf[16];
+  char* vbuf;
+  int round, have_uring;
+
+  if (argc > 1)
+    fname = argv[1];
+  if (argc > 2)
+    nkeys = atoi (argv[2]);
+  if (argc > 3)
+    vsize = atoi (argv[3]);
+  nget = nkeys / 10;
+  if (nkeys == 0 || vsize == 0) {
+    fprintf (stderr, "Usage: %s [file [number of keys [value size]]]\n",
+	     argv[0]);
+    return 1;
+  }
+
+  /* Find out whether io_uring can be used at all */
+  ffdb_pageio_create (&io, FFDB_IO_URING);
+  have_uring = (io->type == FFDB_IO_URING);
+  ffdb_pageio_close (io);
+  if (!have_uring)
+    printf ("io_uring is not available: both runs use synchronous I/O\n");
+
+  vbuf = (char *)malloc (vsize);
+  if (!vbuf) {
+    fprintf (stderr, "Cannot allocate value buffer\n");
+    return 1;
+  }
+
+  _info (&info, FFDB_IO_SYNC);
+  db = ffdb_dbopen (fname, O_RDWR | O_CREAT | O_TRUNC, 0644, &info);
+  if (!db) {
+    fprintf (stderr, "Cannot create %s\n", fname);
+    return 1;
+  }
+  for (i = 0; i < nkeys; i++) {
+    key.data = kbuf;
+    key.size = sprintf (kbuf, "key%u", i);
+    _fill (vbuf, i, vsize);
+    val.data = vbuf;
+    val.size = vsize;
+    if (db->put (db, &key, &val, 0) != 0) {
+      fprintf (stderr, "Cannot insert key %u\n", i);
+      return 1;
+    }
+  }
+  db->close (db);
+  free (vbuf);
+
+  printf ("%u keys of %u bytes, %u random lookups on a cold cache\n",
+	  nkeys, vsize, nget);
+  printf ("%10s %12s %14s %12s\n", "engine", "lookups/s", "MB/s", "sync (s)");
+  for (round = 0; round < 2; round++) {
+    if (_bench (fname, FFDB_IO_SYNC, nkeys, nget, vsize) != 0 ||
+	_bench (fname, FFDB_IO_URING, nkeys, nget, vsize) != 0)
+      return 1;
+  }
+
+  unlink (fname);
+  return 0;
+}
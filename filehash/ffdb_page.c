@@ -70,12 +70,16 @@
 #include "ffdb_page.h"
 #include "ffdb_hash.h"
 #include "ffdb_hash_func.h"
+#include "ffdb_codec.h"
 
 /**
  * get next data page number either a new or reuse from a free page
  */
 static pgno_t _ffdb_data_page (ffdb_htab_t* hashp, int new_page, int* reuse);
+static int _ffdb_current_data_page (ffdb_htab_t* hashp, pgno_t page);
 static pgno_t _ffdb_ovfl_page (ffdb_htab_t* hashp, int* reuse);
+static int _ffdb_delete_data (ffdb_htab_t* hashp, ffdb_datap_t* datap,
+			      pgno_t kpage, unsigned int kidx);
 
 #ifdef _FFDB_STATISTICS
 extern unsigned int hash_accesses, hash_collisions, hash_expansions, hash_overflows, hash_bigpages;
@@ -101,6 +105,10 @@ extern unsigned int hash_accesses, hash_collisions, hash_expansions, hash_overfl
     M_32_SWAP((header)->next);					\
     M_32_SWAP((header)->key_page);				\
     M_32_SWAP((header)->key_idx);				\
+    if (hashp->hdr.version >= FFDB_VERSION_CODEC) {		\
+      M_32_SWAP((header)->codec);				\
+      M_32_SWAP((header)->rawlen);				\
+    }								\
   }while(0)
 
 
@@ -121,7 +129,7 @@ extern unsigned int hash_accesses, hash_collisions, hash_expansions, hash_overfl
  * Swap page header in depending on what type of page
  */
 static void
-_ffdb_swap_page_metainfo_in (void *p)
+_ffdb_swap_page_metainfo_in (ffdb_htab_t* hashp, void *p)
 {
   unsigned int i, next, nelems;
   ffdb_data_header_t* header;
@@ -149,6 +157,8 @@ _ffdb_swap_page_metainfo_in (void *p)
       M_32_SWAP(KEY_OFF(p, i));
       M_32_SWAP(KEY_LEN(p, i));
       M_32_SWAP(DATAP_OFF(p, i));
+      if (hashp->hdr.version >= FFDB_VERSION_KEY_HASH)
+	M_32_SWAP(KEY_HASH(p, i));
       /* SWAP Data Pointer */
       M_DATAP_SWAP(DATAP(p, i));
     }
@@ -181,6 +191,13 @@ _ffdb_swap_page_metainfo_in (void *p)
     for (i = 0; i < NUM_ENT(p); i++) 
       M_CONFIG_INFO_SWAP(CONFIG_INFO(p, i));
     break;
+  case HASH_INDEX_PAGE:
+    next = PAGE_OVERHEAD;
+    for (i = 0; i < NUM_ENT(p); i++) {
+      M_32_SWAP(IDX_KEY_LEN(p, next));
+      next += IDX_ENTRY_SIZE(IDX_KEY_LEN(p, next));
+    }
+    break;
   default:
     break;
   }
@@ -241,6 +258,9 @@ _ffdb_init_page (ffdb_htab_t* hashp, void* p, pgno_t page,
     OFFSET(p) = 0;
     /* Not using offset: actually just pad */
     break;
+  case HASH_INDEX_PAGE:
+    OFFSET(p) = PAGE_OVERHEAD;
+    break;
   default:
     break;
   }
@@ -264,12 +284,12 @@ ffdb_pgin_routine (void* arg, pgno_t pgno, void* page)
 #if 0
   /* First swap the header to disk */
   if (hashp->mborder == LITTLE_ENDIAN) 
-    _ffdb_swap_page_metainfo_in (page);
+    _ffdb_swap_page_metainfo_in (hashp, page);
 #endif
 
 #if 1
   if (hashp->hdr.lorder != hashp->mborder)
-    _ffdb_swap_page_metainfo_in (page);  
+    _ffdb_swap_page_metainfo_in (hashp, page);  
 #endif
 
 #ifdef _FFDB_DEBUG
@@ -292,13 +312,40 @@ ffdb_pgin_routine (void* arg, pgno_t pgno, void* page)
   }
 }
 
+/**
+ * This is the routine called the first time a page of a memory mapped
+ * file is used. Pages needing byte swapping or initialization have to
+ * be read into the page cache instead.
+ */
+int
+ffdb_pgcheck_routine (void* arg, pgno_t pgno, void* page)
+{
+  ffdb_htab_t* hashp;
+  unsigned int chksum = 0;
+
+  hashp = (ffdb_htab_t *)arg;
+
+  if (hashp->hdr.lorder != hashp->mborder)
+    return -1;
+
+  if (PAGE_SIGN(page) != FFDB_PAGE_MAGIC)
+    return -1;
+
+  chksum = _ffdb_page_checksum (hashp, page);
+  if (chksum != CHKSUM(page)) {
+    fprintf (stderr, "Reading page %d checksum mismatch 0x%x (new) != 0x%x (on disk)\n", pgno, chksum, CHKSUM(page));
+    exit (123);
+  }
+  return 0;
+}
+
 /**
  * Swap page meta information out before this page is written to disk
  */
 static void
-_ffdb_swap_page_metainfo_out (void *p)
+_ffdb_swap_page_metainfo_out (ffdb_htab_t* hashp, void *p)
 {
-  unsigned int i, next;
+  unsigned int i, next, len;
   unsigned int type = TYPE(p);
   unsigned int num = NUM_ENT(p);
   ffdb_data_header_t* header;
@@ -327,6 +374,8 @@ _ffdb_swap_page_metainfo_out (void *p)
       M_32_SWAP(KEY_OFF(p, i));
       M_32_SWAP(KEY_LEN(p, i));
       M_32_SWAP(DATAP_OFF(p, i));
+      if (hashp->hdr.version >= FFDB_VERSION_KEY_HASH)
+	M_32_SWAP(KEY_HASH(p, i));
     }
     break;
   case HASH_DATA_PAGE:
@@ -358,6 +407,15 @@ _ffdb_swap_page_metainfo_out (void *p)
     for (i = 0; i < num; i++) 
       M_CONFIG_INFO_SWAP(CONFIG_INFO(p, i));
     break;
+  case HASH_INDEX_PAGE:
+    next = PAGE_OVERHEAD;
+    for (i = 0; i < num; i++) {
+      /* get the key length before swapping */
+      len = IDX_KEY_LEN(p, next);
+      M_32_SWAP(IDX_KEY_LEN(p, next));
+      next += IDX_ENTRY_SIZE(len);
+    }
+    break;
   default:
     break;
   }
@@ -381,12 +439,12 @@ ffdb_pgout_routine (void* arg, pgno_t pgno, void* page)
   /* First swap the header to disk */
 #if 0
   if (hashp->mborder == LITTLE_ENDIAN) 
-    _ffdb_swap_page_metainfo_out (page);
+    _ffdb_swap_page_metainfo_out (hashp, page);
 #endif
 
 #if 1
   if (hashp->hdr.lorder != hashp->mborder)
-    _ffdb_swap_page_metainfo_out (page);
+    _ffdb_swap_page_metainfo_out (hashp, page);
 #endif
 
   /* Need to calculte check sum here for different type of page */
@@ -408,106 +466,232 @@ ffdb_pgout_routine (void* arg, pgno_t pgno, void* page)
  * a new malloc is used, caller has to free. If val->data is not null,
  * a quick memcpy using val->size as the length.
  * @param datap data pointer containg information about data
+ * @param verify the page of the item is not pinned, so the data may
+ * have been moved by a writer. Check instead of assert.
+ *
+ * Encoded data are decoded, val holds the data as they were put.
  *
- * @return 0 on success, -1 otherwise
+ * @return 0 on success, -1 otherwise. return 1 if verify is set and the
+ * data does not belong to the item anymore. return FFDB_SPECIAL with
+ * the length of the data in val->size if the caller space is too small
  */
 static int
 _ffdb_get_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
-		FFDB_DBT* val, ffdb_datap_t* datap)
+		FFDB_DBT* val, ffdb_datap_t* datap, int verify)
 {
   pgno_t next, tp;
   void* pagep;
   ffdb_data_header_t* header;
-  unsigned int start, rlen, idx, copylen, newchksum;
+  unsigned int start, rlen, idx, copylen, newchksum, codec, len;
+  unsigned char* buf;
   int needfree = 0;
 
-  /* Get first page where the data item resides */
-  pagep = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 0, &tp);
+  /* Get first page where the data item resides: read only */
+  pagep = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 
+			 FFDB_PAGE_SHARED, &tp);
   if (!pagep) {
     fprintf (stderr, "Cannot get data page at %d \n", datap->first);
     return -1;
   }
   
+  /* Jump to the offset pointed by datap */
+  header = BIG_DATA_HEADER(pagep,datap->offset);
+
+  if (verify) {
+    if (datap->first != CURR_PGNO(pagep) || NUM_ENT(pagep) < 1 ||
+	header->len != datap->len || header->status != DATA_VALID ||
+	header->key_page != item->pgno || header->key_idx != item->pgndx) {
+      ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+      return 1;
+    }
+  }
+
   /* now do a quick sanity check */
   assert (datap->first == CURR_PGNO(pagep));
   assert (NUM_ENT(pagep) >= 1);
-
-  /* Jump to the offset pointed by datap */
-  header = BIG_DATA_HEADER(pagep,datap->offset);
  
   assert (header->len == datap->len);
   assert (header->status == DATA_VALID);
   assert (header->key_page == item->pgno);
   assert (header->key_idx == item->pgndx);
 
+  /* The caller gets the data as they were put */
+  codec = DATA_CODEC(header);
+  len = header->len;
+  if (codec != FFDB_CODEC_NONE)
+    rlen = header->rawlen;
+  else
+    rlen = len;
+
   /* Now check whether I have allocated space to data */
   if (val->data && val->size > 0) {
-    if (val->size < header->len) {
-      fprintf (stderr, "Warning: application allocated space %d < data size %d\n",
-	       val->size, header->len);
-      return -1;
+    if (val->size < rlen) {
+      /* Tell the caller how much space is needed */
+      val->size = rlen;
+      ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+      return FFDB_SPECIAL;
     }
     else
-      val->size = header->len;
+      val->size = rlen;
   }
   else {
-    val->data = (char *)malloc(header->len * sizeof (char));
-    val->size = header->len;
+    val->data = (char *)malloc((rlen > 0 ? rlen : 1) * sizeof (char));
+    val->size = rlen;
     needfree = 1;
   }
+
+  /* Encoded data are read into a buffer of their own first, filtered
+   * data are decompressed behind them
+   */
+  if (codec != FFDB_CODEC_NONE) {
+    idx = FFDB_CODEC_WIDTH(codec) ? val->size : 0;
+    if (!(buf = (unsigned char *)malloc (len + idx > 0 ? len + idx : 1))) {
+      ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+      goto fail;
+    }
+  }
+  else
+    buf = (unsigned char *)val->data;
   
   /* Now I am ready to copy */
-  rlen = val->size;
-  start = datap->offset + sizeof(ffdb_data_header_t);
+  rlen = len;
+  start = datap->offset + BIG_DATA_OVERHEAD;
   next = NEXT_PGNO(pagep);
+  /* An empty datum is done with its first page */
+  if (rlen == 0)
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
   while (rlen > 0) {
-    /* where copy starts in val->data */
-    idx = val->size - rlen;
+    /* where copy starts in buf */
+    idx = len - rlen;
     /* find out how many bytes of data to copy */
     if (start + rlen <= hashp->hdr.bsize) 
       copylen = rlen;
     else 
       copylen = hashp->hdr.bsize - start;
 
-    memcpy ((unsigned char *)val->data + idx, pagep + start, copylen);
+    memcpy (buf + idx, pagep + start, copylen);
     /* release this page */
     ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
 
     rlen -= copylen;
     if (rlen > 0) { /* multiple pages */
       /* get next page */
-      pagep = ffdb_get_page (hashp, next, HASH_DATA_PAGE, 0, &tp);
+      pagep = ffdb_get_page (hashp, next, HASH_DATA_PAGE, 
+			     FFDB_PAGE_SHARED, &tp);
       if (!pagep) {
 	fprintf (stderr, "Cannot get data page at %d\n", next);
-	val->size = 0;
-	if (needfree) {
-	  free (val->data);
-	  val->data = 0;
-	}
-	return -1;
+	goto fail;
       }
       start = BIG_PAGE_OVERHEAD;
       next = NEXT_PGNO(pagep);
     }
   }
+
+  /* Decode the data */
+  if (codec != FFDB_CODEC_NONE) {
+    if (__ffdb_lz_decompress (buf, len, 
+			      FFDB_CODEC_WIDTH(codec) ? buf + len : val->data,
+			      val->size) != 0) {
+      /* The data has been rewritten after the item was found */
+      if (verify)
+	goto changed;
+      fprintf (stderr, "Cannot decode data of %d bytes on page %d\n", 
+	       len, datap->first);
+      goto fail;
+    }
+    if (FFDB_CODEC_WIDTH(codec))
+      __ffdb_unshuffle (buf + len, val->size, FFDB_CODEC_WIDTH(codec), 
+			val->data);
+    free (buf);
+    buf = 0;
+  }
+
   /* Now item is copied, run check sum */
   newchksum = 0;
   newchksum = __ffdb_crc32_checksum (newchksum, val->data,
 				     val->size);
 
-  if (val->size == header->len) {
-    if (newchksum != datap->chksum) {
-      fprintf (stderr, "Val = %s size = %d\n", (char *)val->data, val->size);
-      fprintf (stderr, "Get data checksum mismatch 0x%x (calculated) != 0x%x (stored)\n", newchksum, datap->chksum);
-      if (needfree) {
-	free (val->data);
-	val->data = 0;
-      }
-      val->size = 0;
-      return -1;
-    }
+  if (newchksum != datap->chksum && verify) {
+    /* The data has been rewritten after the item was found */
+    goto changed;
+  }
+  if (newchksum != datap->chksum) {
+    fprintf (stderr, "Val = %s size = %d\n", (char *)val->data, val->size);
+    fprintf (stderr, "Get data checksum mismatch 0x%x (calculated) != 0x%x (stored)\n", newchksum, datap->chksum);
+    goto fail;
   }
   return 0;
+
+ changed:
+  if (codec != FFDB_CODEC_NONE && buf)
+    free (buf);
+  if (needfree) {
+    free (val->data);
+    val->data = 0;
+  }
+  val->size = 0;
+  return 1;
+
+ fail:
+  if (codec != FFDB_CODEC_NONE && buf)
+    free (buf);
+  if (needfree) {
+    free (val->data);
+    val->data = 0;
+  }
+  val->size = 0;
+  return -1;
+}
+
+/**
+ * Encode a datum with the codec of the database before it is put on
+ * data pages. Data shorter than the minimum length of the database and
+ * data that do not shrink by an eighth are kept as they are. The
+ * datum goes through the shuffle filter first if the database has an
+ * element width. The encoded bytes are in a buffer of the hash table,
+ * which is used by one writer at a time.
+ *
+ * @param hashp the pointer to hash table
+ * @param val   the datum
+ * @param enc   the bytes to store: the encoded datum or val itself
+ *
+ * @return the codec word the datum is encoded with
+ */
+static unsigned int
+_ffdb_encode_data (ffdb_htab_t* hashp, const FFDB_DBT* val, FFDB_DBT* enc)
+{
+  unsigned int cap, len, width, need;
+  unsigned char *buf, *src;
+
+  enc->data = val->data;
+  enc->size = val->size;
+  if (hashp->hdr.codec == FFDB_CODEC_NONE || val->size < hashp->hdr.codec_min)
+    return FFDB_CODEC_NONE;
+
+  /* The filtered datum goes behind the compressed one */
+  width = (hashp->hdr.codec_width > 1) ? hashp->hdr.codec_width : 0;
+  cap = val->size - val->size / 8;
+  need = width ? cap + val->size : cap;
+  if (hashp->codec_buflen < need) {
+    if (!(buf = (unsigned char *)realloc (hashp->codec_buf, need)))
+      return FFDB_CODEC_NONE;
+    hashp->codec_buf = buf;
+    hashp->codec_buflen = need;
+  }
+
+  src = (unsigned char *)val->data;
+  if (width) {
+    src = hashp->codec_buf + cap;
+    __ffdb_shuffle (val->data, val->size, width, src);
+  }
+
+  len = __ffdb_lz_compress (src, val->size, hashp->codec_buf, cap);
+  if (len == 0)
+    return FFDB_CODEC_NONE;
+
+  enc->data = hashp->codec_buf;
+  enc->size = len;
+  return FFDB_CODEC_WORD(FFDB_CODEC_LZ, width);
 }
 
 /**
@@ -516,7 +700,9 @@ _ffdb_get_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
  * @param hashp the pointer to hash table
  * @param key_page what page key is stored on
  * @param key_index index of this key on the key page
- * @param val   the pointer to the datum
+ * @param val   the pointer to the datum as it is stored
+ * @param codec the codec the datum is encoded with
+ * @param rawlen the length of the datum before encoding
  * @param pagep memory pointer of the beginning of the data page
  * @param dpage data page number
  * @datap datap regular hash data pointer residing on hash page
@@ -525,8 +711,8 @@ _ffdb_get_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
  */
 static int
 _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
-		const FFDB_DBT* val, void* mem, pgno_t pnum,
-		ffdb_datap_t* datap)
+		const FFDB_DBT* val, unsigned int codec, unsigned int rawlen,
+		void* mem, pgno_t pnum, ffdb_datap_t* datap)
 {
   unsigned int start, fspace, npages, idx, copylen;
   ffdb_data_header_t header;
@@ -567,8 +753,8 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
     NEXT_PGNO(mem) = cpage;
     PREV_PGNO(cpagep) = pnum;
 
-    /* Now free the old data page */
-    ffdb_put_page (hashp, mem, HASH_DATA_PAGE, 0);
+    /* Now free the old data page, which links to the new one */
+    ffdb_put_page (hashp, mem, HASH_DATA_PAGE, 1);
 
     /* update start value */
     start = HIGHEST_FREE(cpagep);
@@ -589,6 +775,8 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
   header.status = DATA_VALID;
   header.key_page = key_page;
   header.key_idx = key_index;
+  header.codec = codec;
+  header.rawlen = rawlen;
   header.next = 0;
 
   if (BIG_DATA_TOTAL_SIZE(val) <= fspace) {
@@ -629,8 +817,11 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
     /* Now copy data to each page */
     npages = 0;
     
-    /* get a free page or a new page */
-    /* fp is the first page of the chain */
+    /* each page is a free page or a new page. New pages follow each
+     * other, so that a part of the datum can be found without walking
+     * the chain. The datum is marked scattered when its pages do not
+     * follow each other.
+     * fp is the first page of the chain */
     reuse = 0;
     fp = currp = _ffdb_data_page (hashp, 1, &reuse);
     prevp = cpage;
@@ -664,8 +855,10 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
 	/* there is no space for another data */
 	HIGHEST_FREE(currpagep) = 0;
 	FIRST_DATA_POS(currpagep) = 0; 
-	/* we copy most of the rest of page */
+	/* we copy most of the rest of page, or the rest of the data */
 	copylen = hashp->hdr.bsize - BIG_PAGE_OVERHEAD;
+	if (copylen > rlen)
+	  copylen = rlen;
       }
 
       /* where to start copy the data */
@@ -683,6 +876,8 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
 	/* get next page number */
 	reuse = 0;
 	currp = _ffdb_data_page (hashp, 1, &reuse);
+	if (currp != fp + npages + 1)
+	  header.codec |= DATA_SCATTERED;
 
 	/* update next page number */
 	NEXT_PGNO(currpagep) = currp;
@@ -716,6 +911,7 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
   /* Update data header */
   datap->first = cpage;
   datap->offset = start;
+  datap->len = val->size;
   
   return 0;
 }
@@ -724,7 +920,9 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
  * Replace a data inside database data page
  *
  * @param hashp the usual pointer to the hash table
- * @param val the new value to replace old value
+ * @param val the new value to replace old value as it is stored
+ * @param codec the codec the new value is encoded with
+ * @param rawlen the length of the new value before encoding
  * @param mem the data page memory pointer (this is the first page)
  * @param pnum the data page page number
  * @param datap data pointer from ket page with all updated information
@@ -733,6 +931,7 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
  */
 static int
 _ffdb_replace_data (ffdb_htab_t* hashp, const FFDB_DBT* val,
+		    unsigned int codec, unsigned int rawlen,
 		    void* mem, pgno_t pnum,
 		    ffdb_datap_t* datap)
 {
@@ -747,6 +946,8 @@ _ffdb_replace_data (ffdb_htab_t* hashp, const FFDB_DBT* val,
 
   /* data header length need to be changed and header next stays the same */
   header->len = datap->len;
+  header->codec = codec | (header->codec & DATA_SCATTERED);
+  header->rawlen = rawlen;
 
   /* copy data on to data pages */
   fspace = hashp->hdr.bsize - datap->offset;
@@ -787,7 +988,7 @@ _ffdb_replace_data (ffdb_htab_t* hashp, const FFDB_DBT* val,
       }
 
       /* check whether data will fit this page */
-      if (rlen <= hashp->hdr.bsize - BIG_PAGE_OVERHEAD - BIG_DATA_OVERHEAD) 
+      if (rlen <= hashp->hdr.bsize - BIG_PAGE_OVERHEAD) 
 	copylen = rlen;
       else 
 	copylen = hashp->hdr.bsize - BIG_PAGE_OVERHEAD;
@@ -847,6 +1048,9 @@ _ffdb_update_data_info (ffdb_htab_t* hashp, ffdb_datap_t* datap,
 
 /**
  * Get a free page from free map page if there is one
+ * Pages freed at lower levels and the lowest page on a free map page
+ * are handed out first, which keeps pages at the end of the file free
+ * to be truncated
  * Return 0 when there is no free page
  */
 static pgno_t
@@ -854,11 +1058,14 @@ _ffdb_reuse_free_ovflpage (ffdb_htab_t* hashp)
 {
   pgno_t fpage, tp, num, np, nextp;
   void *fpagep;
-  unsigned int clevel = hashp->hdr.ovfl_point;
+  unsigned int clevel, i, low;
 
-  /* check current free page number at this level */
+  /* check current free page number at each level */
   num = 0;
-  if ((fpage = hashp->hdr.free_pages[clevel]) != INVALID_PGNO) {
+  for (clevel = 0; clevel <= hashp->hdr.ovfl_point && num == 0; clevel++) {
+    if ((fpage = hashp->hdr.free_pages[clevel]) == INVALID_PGNO) 
+      continue;
+
     fpagep = ffdb_get_page (hashp, fpage, HASH_FREE_PAGE, 0, &tp);
     if (!fpagep) {
       fprintf (stderr, "Fatal error: free map page at %d could not be found\n",
@@ -867,7 +1074,13 @@ _ffdb_reuse_free_ovflpage (ffdb_htab_t* hashp)
     }
 
     if ((np = NUM_FREE_PAGES(fpagep)) > 0) {
-      num = FREE_PAGE(fpagep, np - 1);
+      low = np - 1;
+      for (i = 0; i < np - 1; i++) {
+	if (FREE_PAGE(fpagep, i) < FREE_PAGE(fpagep, low))
+	  low = i;
+      }
+      num = FREE_PAGE(fpagep, low);
+      FREE_PAGE(fpagep, low) = FREE_PAGE(fpagep, np - 1);
       /* reduce number of free pages by one */
       NUM_FREE_PAGES(fpagep)--;
       ffdb_put_page (hashp, fpagep, HASH_FREE_PAGE, 1);
@@ -899,9 +1112,21 @@ _ffdb_reuse_free_ovflpage (ffdb_htab_t* hashp)
 
 
 
+/**
+ * Is a data page run entered that has no page yet. The run then starts
+ * on a new page
+ */
+static int
+_ffdb_run_without_page (ffdb_htab_t* hashp)
+{
+  return (hashp->curr_run >= 0 && hashp->curr_dpage == INVALID_PGNO &&
+	  hashp->main_dpage != INVALID_PGNO);
+}
+
 /**
  * Find out what is next data page number given current page number
- * We need first to check freed overflow pages
+ * We need first to check freed overflow pages, unless new_page is 2
+ * which asks for the page after the last page in use
  *
  * If there are somthing really wrong, the page released by this call
  * cannot be reclaimed. (We will live with the consequence)
@@ -915,6 +1140,13 @@ _ffdb_data_page (ffdb_htab_t* hashp, int new_page, int* reuse)
   unsigned int level = hashp->hdr.ovfl_point + 1;
 
   *reuse = 0;
+  /* A data page run starts on a page of its own */
+  if (_ffdb_run_without_page (hashp)) {
+    hashp->curr_dpage = hashp->main_dpage;
+    if (!new_page)
+      new_page = 2;
+  }
+
   if (hashp->curr_dpage == INVALID_PGNO) {
     /* The data page and overflow page starts at the following page number */
     BUCKET_TO_PAGE(hashp->hdr.high_mask, hashp->curr_dpage);
@@ -935,7 +1167,7 @@ _ffdb_data_page (ffdb_htab_t* hashp, int new_page, int* reuse)
   if (!new_page) 
     num = hashp->curr_dpage;
   else {
-    num = _ffdb_reuse_free_ovflpage (hashp);
+    num = (new_page == 1) ? _ffdb_reuse_free_ovflpage (hashp) : 0;
     if (num > 0) {
 #ifdef _FFDB_DEBUG
       fprintf (stderr, "Reuse previously freed overflow page %d\n", num);
@@ -967,7 +1199,8 @@ _ffdb_ovfl_page (ffdb_htab_t* hashp, int* reuse)
   unsigned int level = hashp->hdr.ovfl_point + 1;
 
   *reuse = 0;
-  if (hashp->curr_dpage == INVALID_PGNO) {
+  /* The page of a data page run is picked when data go there */
+  if (hashp->curr_dpage == INVALID_PGNO && !_ffdb_run_without_page (hashp)) {
     /* The data page and overflow page starts at the following page number */
     BUCKET_TO_PAGE(hashp->hdr.high_mask, hashp->curr_dpage);
     hashp->curr_dpage++;
@@ -1033,6 +1266,102 @@ ffdb_last_data_page (ffdb_htab_t* hashp, pgno_t start)
   return ret;
 }
 
+/**
+ * Send new data to the data page run of a configuration
+ */
+int
+ffdb_enter_data_run (ffdb_htab_t* hashp, unsigned int run)
+{
+  unsigned int i;
+  int reuse;
+  pgno_t page, tp;
+  void* pagep;
+
+  if (run >= hashp->hdr.num_cfigs) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* The first data page of a level is set up outside the runs, so that
+   * a run without a page can start on a new page after it
+   */
+  if (hashp->curr_dpage == INVALID_PGNO) {
+    page = _ffdb_data_page (hashp, 0, &reuse);
+    pagep = ffdb_get_page (hashp, page, HASH_DATA_PAGE, FFDB_CREATE, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get data page %d\n", page);
+      return -1;
+    }
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 1);
+  }
+
+  /* The runs start out without pages */
+  if (!hashp->run_dpages) {
+    hashp->run_dpages = (pgno_t *)malloc(hashp->hdr.num_cfigs * sizeof(pgno_t));
+    if (!hashp->run_dpages) {
+      fprintf (stderr, "Cannot allocate space for data page runs\n");
+      errno = ENOMEM;
+      return -1;
+    }
+    for (i = 0; i < hashp->hdr.num_cfigs; i++)
+      hashp->run_dpages[i] = INVALID_PGNO;
+    hashp->nruns = hashp->hdr.num_cfigs;
+  }
+
+  hashp->main_dpage = hashp->curr_dpage;
+  hashp->curr_dpage = hashp->run_dpages[run];
+  hashp->curr_run = run;
+  return 0;
+}
+
+/**
+ * Send new data back to the current data page
+ */
+void
+ffdb_leave_data_run (ffdb_htab_t* hashp)
+{
+  if (hashp->curr_run < 0)
+    return;
+
+  hashp->run_dpages[hashp->curr_run] = hashp->curr_dpage;
+  hashp->curr_dpage = hashp->main_dpage;
+  hashp->main_dpage = INVALID_PGNO;
+  hashp->curr_run = -1;
+}
+
+/**
+ * Start all data page runs over
+ */
+void
+ffdb_reset_data_runs (ffdb_htab_t* hashp)
+{
+  unsigned int i;
+
+  for (i = 0; i < hashp->nruns; i++)
+    hashp->run_dpages[i] = INVALID_PGNO;
+  hashp->main_dpage = INVALID_PGNO;
+}
+
+/**
+ * Is this page one new data go to: the current data page or the
+ * current page of a data page run
+ */
+static int
+_ffdb_current_data_page (ffdb_htab_t* hashp, pgno_t page)
+{
+  unsigned int i;
+
+  if (page == hashp->curr_dpage)
+    return 1;
+  if (hashp->curr_run >= 0 && page == hashp->main_dpage)
+    return 1;
+  for (i = 0; i < hashp->nruns; i++) {
+    if (page == hashp->run_dpages[i])
+      return 1;
+  }
+  return 0;
+}
+
 /**
  * Put a page back into pagepool
  */
@@ -1231,8 +1560,8 @@ _ffdb_free_ovflpage (ffdb_htab_t* hashp, void* memp, int isdoubling,
       NEXT_PGNO (fpagep) = xpage;
       PREV_PGNO (xpagep) = fpage;
 
-      /* release the previous page */
-      ffdb_put_page (hashp, fpagep, TYPE(fpagep), 0); 
+      /* release the previous page, which links to the new one */
+      ffdb_put_page (hashp, fpagep, TYPE(fpagep), 1); 
     }
   }
 }
@@ -1248,9 +1577,12 @@ ffdb_delete_page (ffdb_htab_t* hashp, void* pagep,
   if (addrtype == HASH_OVFL_PAGE) {
     _ffdb_free_ovflpage (hashp, pagep, isdoubling, &deleteit);
     if (deleteit) {
-      /* if this page need to be deleted */
+      /* if this page need to be deleted. The empty page is written out,
+       * so that compaction and the rearrangement on close, which go by
+       * the type of a page, do not take its old contents for live ones
+       */
       _ffdb_init_page (hashp, pagep, CURR_PGNO(pagep), HASH_DELETED_PAGE);
-      return ffdb_pagepool_delete (hashp->mp, pagep); 
+      return ffdb_put_page (hashp, pagep, HASH_DELETED_PAGE, 1);
     }
     else 
       return ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
@@ -1325,16 +1657,24 @@ int ffdb_find_item (ffdb_htab_t* hashp,
 		    ffdb_hent_t* item)
 {
   unsigned int i, found, done;
-  pgno_t nextp;
+  pgno_t nextp, prevp;
   unsigned int chksum = 0;
   FFDB_DBT ekey;
   unsigned char *ekdata = 0;
   ffdb_datap_t* datap = 0;
+  unsigned int pflags;
 
+  /* A lookup without data only reads pages, so the pages are shared
+   * with other readers. An insertion needs the pages exclusively.
+   */
+  if (val)
+    pflags = FFDB_PAGE_CREATE;
+  else
+    pflags = FFDB_PAGE_SHARED;
 
   /* first get page for this bucket */
   item->pagep = ffdb_get_page (hashp, item->bucket, HASH_BUCKET_PAGE,
-			       FFDB_PAGE_CREATE, &item->pgno);
+			       pflags, &item->pgno);
   if (item->pagep == 0) {
     fprintf (stderr, "Cannot get page for bucket %d\n", item->bucket);
     item->status = ITEM_ERROR;
@@ -1357,7 +1697,9 @@ int ffdb_find_item (ffdb_htab_t* hashp,
   if (NUM_ENT(item->pagep) == 0) { /* new page or nothing on it */
     item->pgndx = 0;
     item->status = ITEM_NO_MORE;
-    _ffdb_init_page (hashp, item->pagep, item->pgno, HASH_BUCKET_PAGE);
+    /* A shared page must not be changed */
+    if (val)
+      _ffdb_init_page (hashp, item->pagep, item->pgno, HASH_BUCKET_PAGE);
     return 0;
   }
 
@@ -1381,8 +1723,11 @@ int ffdb_find_item (ffdb_htab_t* hashp,
       /* get data for this index */
       datap = DATAP(item->pagep, i);
 
-      /* We do not allow duplicated keys */
-      if (hashp->h_compare(key, &ekey) == 0) {
+      /* We do not allow duplicated keys. Keys are compared only when
+       * their hash values are the same
+       */
+      if (KEY_HASH_MATCH(item->pagep, i, item->key_hash) &&
+	  hashp->h_compare(key, &ekey) == 0) {
 	found = 1;
 	break;
       }
@@ -1395,19 +1740,36 @@ int ffdb_find_item (ffdb_htab_t* hashp,
 	done = 1;
       else {
 	nextp = NEXT_PGNO(item->pagep);
+	prevp = item->pgno;
 
 	/* Put this page back */
 	ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
 
 	/* get the next page */
 	item->pagep = ffdb_get_page (hashp, nextp, HASH_OVFL_PAGE,
-				     0, &item->pgno);
+				     pflags & FFDB_PAGE_SHARED, &item->pgno);
 	if (item->pagep == 0) {
 	  fprintf (stderr, "Cannot get next page for bucket %d at page %d\n", 
 		   item->bucket, item->pgno);
 	  item->status = ITEM_ERROR;
 	  return -1;
 	}
+
+	/* The page has been freed or moved away after the previous page
+	 * was put back. Look at the chain of this bucket again
+	 */
+	if ((TYPE(item->pagep) != HASH_BUCKET_PAGE &&
+	     TYPE(item->pagep) != HASH_OVFL_PAGE) ||
+	    PREV_PGNO(item->pagep) != prevp) {
+	  ffdb_put_page (hashp, item->pagep, TYPE(item->pagep), 0);
+	  item->pagep = ffdb_get_page (hashp, item->bucket, HASH_BUCKET_PAGE,
+				       pflags, &item->pgno);
+	  if (item->pagep == 0) {
+	    fprintf (stderr, "Cannot get page for bucket %d\n", item->bucket);
+	    item->status = ITEM_ERROR;
+	    return -1;
+	  }
+	}
 #ifdef _FFDB_DEBUG
 	fprintf (stderr, "Could not find item on primary page, check next page at %d\n", nextp);
 #endif
@@ -1447,10 +1809,13 @@ int ffdb_get_item (ffdb_htab_t* hashp,
 #endif
 
   /* Now I have to hop to data page to get this data item */
-  status = _ffdb_get_data (hashp, item, val, datap);
+  status = _ffdb_get_data (hashp, item, val, datap, 0);
   if (status != 0) {
-    fprintf (stderr, "Cannot get data on page %d at offset %d\n",
-	     datap->first, datap->offset);
+    if (status != FFDB_SPECIAL)
+      fprintf (stderr, "Cannot get data on page %d at offset %d\n",
+	       datap->first, datap->offset);
+    if (freepage)
+      ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
     return status;
   }
 
@@ -1462,238 +1827,488 @@ int ffdb_get_item (ffdb_htab_t* hashp,
 }
 
 /**
- * Add a pair of key and data onto a page (hash page) represented by
- * page address and page number
+ * Get data of an item found earlier. The page of the item is not
+ * pinned anymore
  */
-static int
-_ffdb_add_item_on_page (ffdb_htab_t* hashp, void* pagep, pgno_t page,
-			FFDB_DBT* key, const FFDB_DBT* val,
-			unsigned int data_chksum)
+int ffdb_get_item_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			ffdb_datap_t* datap, FFDB_DBT* val)
 {
-  unsigned int n, off, soff;
-  ffdb_datap_t datap;
-  pgno_t dpage, fpage;
-  void* memp;
-  int status, reuse;
-  
-  n = NUM_ENT(pagep);
-  /* Find place to put the key */
-  off = OFFSET(pagep) - key->size + 1;
-  memmove (pagep + off, key->data, key->size);
+  val->data = 0;
+  val->size = 0;
 
-  /* Set Key Offset Value */
-  KEY_OFF(pagep, n) = off;
-  KEY_LEN(pagep, n) = key->size;
+  return _ffdb_get_data (hashp, item, val, datap, 1);
+}
 
-  /*  Find place to put data pointer value */
-  off -= sizeof(ffdb_datap_t);
-  soff = off;
-  /* I have to align this pointer to 4 byte boundary */
-  ALIGN_DATAP_OFFSET_VAL(off);
+/**
+ * Get the continuation page k (0 for the first) of a datum spanning
+ * several pages, whose first continuation page is first. Unless the
+ * datum is scattered its pages follow each other, so page first + k is
+ * tried and checked before the chain is walked. The walk is needed when
+ * the pages have been rearranged on close. The page is pinned with flags.
+ */
+static void*
+_ffdb_data_chain_page (ffdb_htab_t* hashp, pgno_t head, pgno_t first,
+		       unsigned int k, int scattered, unsigned int flags)
+{
+  pgno_t page, tp;
+  void* pagep = 0;
+
+  /* Only pages below the next page to be allocated are tried */
+  page = first + k;
+  if (!scattered && page < hashp->hdr.spares[hashp->hdr.ovfl_point + 1])
+    pagep = ffdb_get_page (hashp, page, HASH_DATA_PAGE, flags, &tp);
+  if (pagep) {
+    if (CURR_PGNO(pagep) == page && TYPE(pagep) == HASH_DATA_PAGE &&
+	PREV_PGNO(pagep) == (k == 0 ? head : page - 1))
+      return pagep;
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+  }
 
-  /* I will fill 0 to the gap of data and key */
-  /* ------off---soff-----000key */
-  if (off != soff) 
-    memset (pagep + off + sizeof(ffdb_datap_t), 0, soff - off);
+  page = first;
+  while (1) {
+    pagep = ffdb_get_page (hashp, page, HASH_DATA_PAGE, flags, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get data page at %d\n", page);
+      return 0;
+    }
+    if (k == 0)
+      return pagep;
+    page = NEXT_PGNO(pagep);
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+    k--;
+  }
+}
 
+/**
+ * Get a whole encoded datum of an item in place of a part of it. The
+ * page of the item is put back.
+ *
+ * @return 0 on success with the datum in all, which the caller frees,
+ * -1 on failure
+ */
+static int
+_ffdb_get_encoded_item (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			FFDB_DBT* all)
+{
+  ffdb_datap_t datap;
+  int status;
 
-  /* Here I have to figure out where to put the data */
-  reuse = 0;
-  fpage = _ffdb_data_page(hashp, 0, &reuse);
+  datap = *(DATAP(item->pagep, item->pgndx));
+  all->data = 0;
+  all->size = 0;
+  status = _ffdb_get_data (hashp, item, all, &datap, 0);
+  ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
 
-#ifdef _FFDB_DEBUG
-  fprintf (stderr, "Get data page %d to store data from hash page %d at level %d\n",
-	   fpage, page, hashp->hdr.ovfl_point);
-#endif
+  return (status == 0) ? 0 : -1;
+}
 
-  /* Now I need check this page: get this page first */
-  memp = ffdb_get_page (hashp, fpage, HASH_DATA_PAGE, FFDB_CREATE,
-			&dpage);
-  if (!memp) {
-    fprintf (stderr, "cannot get data page for at page number %d\n",
-	     dpage);
-    return -1;
-  }
-  
+/**
+ * Find out whether the data of an item are encoded, and their length
+ * before encoding. Only databases created with a codec are looked at.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int
+_ffdb_item_codec (ffdb_htab_t* hashp, ffdb_hent_t* item,
+		  unsigned int* codec, unsigned int* rawlen)
+{
+  ffdb_datap_t* datap;
+  ffdb_data_header_t* header;
+  void* pagep;
+  pgno_t tp;
 
-  /* Now Put data on this page: this data can expand multiple pages */
-  datap.first = fpage;
-  datap.offset = 0;
-  datap.len = val->size;
-  datap.chksum = data_chksum;
+  datap = DATAP(item->pagep, item->pgndx);
+  *codec = FFDB_CODEC_NONE;
+  *rawlen = datap->len;
+  if (hashp->hdr.codec == FFDB_CODEC_NONE)
+    return 0;
 
-  /* add data to data page provided key page and key index in the page
-   * datap offset and first page is updated in the add_data call 
-   */
-  status = _ffdb_add_data (hashp, page, n, val, memp, dpage, &datap);
-  if (status != 0) {
-    fprintf (stderr, "cannot put data into data page at page number %d\n",
-	     dpage);
+  pagep = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 
+			 FFDB_PAGE_SHARED, &tp);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get data page at %d \n", datap->first);
     return -1;
   }
-#ifdef _FFDB_DEBUG
-  fprintf (stderr, "Data len %d is stored at page %d offset %d checksum 0x%x\n",
-	   datap.len, datap.first, datap.offset, datap.chksum);
-#endif
-  memmove (pagep + off, &datap, sizeof(ffdb_datap_t));
-  DATAP_OFF(pagep, n) = off;
-
-  /* Update this page information */
-  NUM_ENT(pagep) = n + 1;
-  OFFSET(pagep) = off - 1;
+  header = BIG_DATA_HEADER(pagep,datap->offset);
+  assert (header->len == datap->len);
+  assert (header->status == DATA_VALID);
+  if (DATA_CODEC(header) != FFDB_CODEC_NONE) {
+    *codec = DATA_CODEC(header);
+    *rawlen = header->rawlen;
+  }
+  ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
 
   return 0;
 }
 
 /**
- * Replace a hash item on the page identified by item structure
- * Data can be only replaced when the new data has size <= the existing
- * data size
+ * Get len bytes of an item's data starting at byte offset. Only the
+ * data pages holding these bytes are read. Those pages are checked
+ * against their page checksums when they are read in, the checksum of
+ * the whole datum cannot be checked. Encoded data are decoded as a
+ * whole instead.
  */
-static int
-_ffdb_replace_item_on_page (ffdb_htab_t* hashp,
-			    FFDB_DBT* key, const FFDB_DBT* val,
-			    ffdb_hent_t* item)
+int ffdb_get_item_range (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			 FFDB_DBT* val, unsigned int offset,
+			 unsigned int len)
 {
-  int status;
+  pgno_t first, tp;
+  void* pagep;
   ffdb_datap_t* datap;
-  pgno_t dpage;
-  void* memp;
+  ffdb_data_header_t* header;
+  unsigned int start, hlen, cap, pos, idx, copylen, codec, rawlen;
+  FFDB_DBT all;
+  int needfree = 0, scattered;
 
-  /* Get current data pointer information of this key */
-  datap = DATAP (item->pagep, item->pgndx);
-  
-#ifdef _FFDB_DEBUG
-  fprintf (stderr, "Replace Key %s information: \n", (char *)key->data);
-  fprintf (stderr, "At first page %d\n", datap->first);
-  fprintf (stderr, "At offset %d\n", datap->offset);
-  fprintf (stderr, "Length of data %d\n", datap->len);
-  fprintf (stderr, "Checksum of data is 0x%x\n", datap->chksum);
-  fprintf (stderr, "With new data size of %d\n", val->size);
-  fprintf (stderr, "new check sum = 0x%x\n", item->data_chksum);
-#endif
-  if (val->size > datap->len) {
-    fprintf (stderr, "Replacement data size %d is larger than the existing data size %d\n", val->size, datap->len);
+  if (_ffdb_item_codec (hashp, item, &codec, &rawlen) != 0) {
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
     return -1;
   }
-  
-  /* Now I can put data on the page pointed by data pointer */
-  memp = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 0,
-			&dpage);
-  if (!memp) {
-    fprintf (stderr, "Cannot get data page %d to replace data at offset %d\n",	     datap->first, datap->offset);
+
+  datap = DATAP(item->pagep, item->pgndx);
+  if (offset > rawlen || len > rawlen - offset) {
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+    errno = EINVAL;
     return -1;
   }
 
-  /* Change data pointer value */
-  datap->len = val->size;
-  datap->chksum = item->data_chksum;
+  /* Now check whether I have allocated space to data */
+  if (val->data && val->size > 0) {
+    if (val->size < len) {
+      val->size = len;
+      ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+      return FFDB_SPECIAL;
+    }
+  }
+  else {
+    val->data = (char *)malloc(len > 0 ? len : 1);
+    needfree = 1;
+  }
+  val->size = len;
+
+  if (codec != FFDB_CODEC_NONE) {
+    if (_ffdb_get_encoded_item (hashp, item, &all) != 0) {
+      if (needfree) {
+	free (val->data);
+	val->data = 0;
+      }
+      val->size = 0;
+      return -1;
+    }
+    memcpy (val->data, (unsigned char *)all.data + offset, len);
+    free (all.data);
+    return 0;
+  }
+
+  /* The first page holds the data header and the start of the data */
+  pagep = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 
+			 FFDB_PAGE_SHARED, &tp);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get data page at %d \n", datap->first);
+    goto fail;
+  }
+  header = BIG_DATA_HEADER(pagep,datap->offset);
+  assert (header->len == datap->len);
+  assert (header->status == DATA_VALID);
+  assert (header->key_page == item->pgno);
+  assert (header->key_idx == item->pgndx);
 
-  status = _ffdb_replace_data (hashp, val, memp, dpage, datap);
+  start = datap->offset + BIG_DATA_OVERHEAD;
+  hlen = hashp->hdr.bsize - start;
+  if (hlen > datap->len)
+    hlen = datap->len;
+  first = NEXT_PGNO(pagep);
+  scattered = DATA_IS_SCATTERED(header);
 
-  if (status != 0) {
-    fprintf (stderr, "Cannot replace data of len %d on page %d at offset %d\n",
-	     datap->len, dpage, datap->offset);
-    return -1;
+  idx = 0;
+  if (offset < hlen) {
+    copylen = (len < hlen - offset) ? len : hlen - offset;
+    memcpy (val->data, (unsigned char *)pagep + start + offset, copylen);
+    idx = copylen;
   }
+  ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+
+  /* The rest comes from the pages following the first page */
+  cap = hashp->hdr.bsize - BIG_PAGE_OVERHEAD;
+  pagep = 0;
+  while (idx < len) {
+    pos = offset + idx - hlen;
+    if (!pagep)
+      pagep = _ffdb_data_chain_page (hashp, datap->first, first, pos / cap,
+				     scattered, FFDB_PAGE_SHARED);
+    else {
+      first = NEXT_PGNO(pagep);
+      ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+      pagep = ffdb_get_page (hashp, first, HASH_DATA_PAGE, 
+			     FFDB_PAGE_SHARED, &tp);
+    }
+    if (!pagep) 
+      goto fail;
+
+    copylen = cap - pos % cap;
+    if (copylen > len - idx)
+      copylen = len - idx;
+    memcpy ((unsigned char *)val->data + idx, 
+	    (unsigned char *)pagep + BIG_PAGE_OVERHEAD + pos % cap, copylen);
+    idx += copylen;
+  }
+  if (pagep)
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
 
+  ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
   return 0;
+
+ fail:
+  if (needfree) {
+    free (val->data);
+    val->data = 0;
+  }
+  val->size = 0;
+  ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+  return -1;
 }
 
+/**
+ * Copy len bytes from src over dst and advance crc, the crc without
+ * initial and final inversion, over the changed bits dst ^ src
+ */
+static unsigned int
+_ffdb_overwrite_bytes (unsigned char* dst, const unsigned char* src,
+		       unsigned int len, unsigned int crc)
+{
+  unsigned char delta[256];
+  unsigned int i, k, n;
+
+  for (i = 0; i < len; i += n) {
+    n = (len - i < sizeof(delta)) ? len - i : sizeof(delta);
+    for (k = 0; k < n; k++)
+      delta[k] = dst[i + k] ^ src[i + k];
+    crc = ~__ffdb_crc32_checksum (~crc, delta, n);
+  }
+  memcpy (dst, src, len);
+
+  return crc;
+}
 
 /**
- * Add a pair of key and data into the hash database
- *
- * The page associated with this pair should be cached
- *
+ * Overwrite val->size bytes of an item's data starting at byte offset.
+ * Only the data pages holding these bytes are read and written. The
+ * checksum of the whole datum is updated from the changed bits alone
+ * instead of the whole datum. The key page of the item has to be held
+ * exclusively, it is put back by the call. Encoded data are decoded,
+ * changed and stored again as a whole instead.
  */
-int ffdb_add_pair (ffdb_htab_t* hashp,
-		   FFDB_DBT* key, const FFDB_DBT* val,
-		   ffdb_hent_t* item, int replace)
+int ffdb_put_item_range (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			 const FFDB_DBT* val, unsigned int offset)
+{
+  pgno_t first, tp;
+  void* pagep;
+  ffdb_datap_t* datap;
+  ffdb_datap_t odatap;
+  ffdb_data_header_t* header;
+  unsigned int start, hlen, cap, pos, idx, copylen, crc, len, codec, rawlen;
+  FFDB_DBT key, all;
+  int status, scattered;
+
+  if (_ffdb_item_codec (hashp, item, &codec, &rawlen) != 0) {
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+    return -1;
+  }
+
+  datap = DATAP(item->pagep, item->pgndx);
+  len = val->size;
+  if (offset > rawlen || len > rawlen - offset) {
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (codec != FFDB_CODEC_NONE) {
+    odatap = *datap;
+    all.data = 0;
+    all.size = 0;
+    if (_ffdb_get_data (hashp, item, &all, &odatap, 0) != 0) {
+      ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+      return -1;
+    }
+    memcpy ((unsigned char *)all.data + offset, val->data, len);
+    key.data = KEY(item->pagep, item->pgndx);
+    key.size = KEY_LEN(item->pagep, item->pgndx);
+    item->data_chksum = __ffdb_crc32_checksum (0, all.data, all.size);
+    status = ffdb_add_pair (hashp, &key, &all, item, 1);
+    free (all.data);
+    return status;
+  }
+
+  /* The first page holds the data header and the start of the data */
+  pagep = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 0, &tp);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get data page at %d \n", datap->first);
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+    return -1;
+  }
+  header = BIG_DATA_HEADER(pagep,datap->offset);
+  assert (header->len == datap->len);
+  assert (header->status == DATA_VALID);
+  assert (header->key_page == item->pgno);
+  assert (header->key_idx == item->pgndx);
+
+  start = datap->offset + BIG_DATA_OVERHEAD;
+  hlen = hashp->hdr.bsize - start;
+  if (hlen > datap->len)
+    hlen = datap->len;
+  first = NEXT_PGNO(pagep);
+  scattered = DATA_IS_SCATTERED(header);
+
+  crc = 0;
+  idx = 0;
+  if (offset < hlen && len > 0) {
+    copylen = (len < hlen - offset) ? len : hlen - offset;
+    crc = _ffdb_overwrite_bytes ((unsigned char *)pagep + start + offset,
+				 (unsigned char *)val->data, copylen, crc);
+    idx = copylen;
+  }
+  ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, idx > 0);
+
+  /* The rest goes to the pages following the first page */
+  cap = hashp->hdr.bsize - BIG_PAGE_OVERHEAD;
+  pagep = 0;
+  while (idx < len) {
+    pos = offset + idx - hlen;
+    if (!pagep)
+      pagep = _ffdb_data_chain_page (hashp, datap->first, first, pos / cap,
+				     scattered, 0);
+    else {
+      first = NEXT_PGNO(pagep);
+      ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 1);
+      pagep = ffdb_get_page (hashp, first, HASH_DATA_PAGE, 0, &tp);
+    }
+    if (!pagep) {
+      ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+      return -1;
+    }
+
+    copylen = cap - pos % cap;
+    if (copylen > len - idx)
+      copylen = len - idx;
+    crc = _ffdb_overwrite_bytes ((unsigned char *)pagep + BIG_PAGE_OVERHEAD +
+				 pos % cap,
+				 (unsigned char *)val->data + idx, copylen, crc);
+    idx += copylen;
+  }
+  if (pagep)
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 1);
+
+  /* The changed bits are followed by the rest of the datum */
+  datap->chksum ^= __ffdb_crc32_shift (crc, datap->len - offset - len);
+  ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 1);
+
+  return 0;
+}
+
+/**
+ * Get the length of the data of an item before encoding
+ */
+int ffdb_get_item_size (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			unsigned int* size)
 {
+  unsigned int codec;
   int status;
-  if (!replace)
-    status = _ffdb_add_item_on_page (hashp, item->pagep, item->pgno,
-				     key, val, item->data_chksum);
-  else
-    status = _ffdb_replace_item_on_page (hashp, key, val, item);
 
-  if (status != 0) 
-    /* Now I do not need this page */
-    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
-  else
-    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 1);
+  status = _ffdb_item_codec (hashp, item, &codec, size);
+  ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
 
   return status;
 }
 
-
 /**
- * Add a pair to an overflow page
+ * Get a view of an item from database. The item contains page and index
+ * information obtained from ffdb_find_item call
  */
-int ffdb_add_ovflpage (ffdb_htab_t* hashp,
-		       FFDB_DBT* key, const FFDB_DBT* val,
-		       ffdb_hent_t* item)
+int ffdb_get_item_view (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			FFDB_DBT* val, void** page)
 {
-  pgno_t ovflpage, tp;
-  void*  opagep;
-  int    status, reuse;
+  int status;
+  pgno_t tp;
+  void* pagep;
+  ffdb_datap_t* datap;
+  ffdb_data_header_t* header;
+  unsigned int start, chksum;
 
-  /* Find out next overflow page number */
-  reuse = 0;
-  ovflpage = _ffdb_ovfl_page (hashp, &reuse);
-#ifdef _FFDB_DEBUG
-  fprintf (stderr, "Allocate an overflow page %d for primary page %d at level %d\n",
-	   ovflpage, item->pgno, hashp->hdr.ovfl_point);
-#endif
-  
-  /* Get this page and this page is initialized */
-  opagep = ffdb_get_page (hashp, ovflpage, HASH_OVFL_PAGE, FFDB_CREATE, &tp);
-  if (!opagep) {
-    fprintf (stderr, "Cannot get an over flow page %d for primary page %d\n",
-	     ovflpage, item->pgno);
-    /* Now I do not need this page */
-    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
-    return -1; 
+  *page = 0;
+  datap = DATAP(item->pagep, item->pgndx);
+  start = datap->offset + BIG_DATA_OVERHEAD;
+
+  /* A datum spanning several pages has to be copied */
+  if (start + datap->len > hashp->hdr.bsize) {
+  copy:
+    val->data = 0;
+    val->size = 0;
+    status = _ffdb_get_data (hashp, item, val, datap, 0);
+    if (status != 0) 
+      fprintf (stderr, "Cannot get data on page %d at offset %d\n",
+	       datap->first, datap->offset);
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+    return status;
   }
-  if (reuse)
-    _ffdb_init_page (hashp, opagep, ovflpage, HASH_OVFL_PAGE);
 
-#ifdef _FFDB_STATISTICS
-  hash_overflows++;
-#endif
-  
-  /* Set up page link */
-  NEXT_PGNO(item->pagep) = ovflpage;
-  PREV_PGNO(opagep) = item->pgno;
+  /* The data page stays pinned until the view is released */
+  pagep = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 
+			 FFDB_PAGE_SHARED, &tp);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get data page at %d \n", datap->first);
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+    return -1;
+  }
 
-  /* Add this pair to the new page */
-  status = _ffdb_add_item_on_page (hashp, opagep, ovflpage,
-				   key, val, item->data_chksum);
+  header = BIG_DATA_HEADER(pagep,datap->offset);
+  assert (header->len == datap->len);
+  assert (header->status == DATA_VALID);
+  assert (header->key_page == item->pgno);
+  assert (header->key_idx == item->pgndx);
 
-  if (status != 0) {
-    ffdb_put_page (hashp, opagep, HASH_OVFL_PAGE, 0);
-    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
+  /* So does an encoded datum */
+  if (DATA_CODEC(header) != FFDB_CODEC_NONE) {
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+    goto copy;
   }
-  else {
-    ffdb_put_page (hashp, opagep, HASH_OVFL_PAGE, 1);
-    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 1);
+
+  chksum = 0;
+  chksum = __ffdb_crc32_checksum (chksum, (unsigned char *)pagep + start,
+				  datap->len);
+  if (chksum != datap->chksum) {
+    fprintf (stderr, "Get data checksum mismatch 0x%x (calculated) != 0x%x (stored)\n", chksum, datap->chksum);
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+    return -1;
   }
+
+  val->data = (unsigned char *)pagep + start;
+  val->size = datap->len;
+  *page = pagep;
+
+  /* Now I do not need the key page */
+  ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+
   return 0;
 }
 
 /**
- * Just copy content of key and its associated data pointer to a page
- * at the right location
- * We already checked this page can fit this key and data pointer
+ * Add a pair of key and data onto a page (hash page) represented by
+ * page address and page number
  */
 static int
-_ffdb_write_key_datap_to_page (ffdb_htab_t* hashp, FFDB_DBT* key, 
-			       ffdb_datap_t *datap,
-			       void* pagep, pgno_t page)
+_ffdb_add_item_on_page (ffdb_htab_t* hashp, void* pagep, pgno_t page,
+			FFDB_DBT* key, unsigned int key_hash,
+			const FFDB_DBT* val, unsigned int data_chksum)
 {
   unsigned int n, off, soff;
-  int status;
+  ffdb_datap_t datap;
+  pgno_t dpage, fpage;
+  void* memp;
+  FFDB_DBT enc;
+  unsigned int codec;
+  int status, reuse;
   
   n = NUM_ENT(pagep);
   /* Find place to put the key */
@@ -1703,6 +2318,7 @@ _ffdb_write_key_datap_to_page (ffdb_htab_t* hashp, FFDB_DBT* key,
   /* Set Key Offset Value */
   KEY_OFF(pagep, n) = off;
   KEY_LEN(pagep, n) = key->size;
+  KEY_HASH(pagep, n) = key_hash;
 
   /*  Find place to put data pointer value */
   off -= sizeof(ffdb_datap_t);
@@ -1715,1179 +2331,3433 @@ _ffdb_write_key_datap_to_page (ffdb_htab_t* hashp, FFDB_DBT* key,
   if (off != soff) 
     memset (pagep + off + sizeof(ffdb_datap_t), 0, soff - off);
 
-  /* write data pointer value */
-  memmove (pagep + off, datap, sizeof(ffdb_datap_t));
-  DATAP_OFF(pagep, n) = off;
 
-  /* Need update data item information about key page and key index */
-  /* The data items are on data pages, this could be slow           */
-  status = _ffdb_update_data_info (hashp, datap, page, n);
+  /* Here I have to figure out where to put the data */
+  reuse = 0;
+  fpage = _ffdb_data_page(hashp, 0, &reuse);
 
-  /* Update this page information */
-  NUM_ENT(pagep) = n + 1;
-  OFFSET(pagep) = off - 1;
+#ifdef _FFDB_DEBUG
+  fprintf (stderr, "Get data page %d to store data from hash page %d at level %d\n",
+	   fpage, page, hashp->hdr.ovfl_point);
+#endif
 
-  return status;
-}
+  /* Now I need check this page: get this page first */
+  memp = ffdb_get_page (hashp, fpage, HASH_DATA_PAGE, FFDB_CREATE,
+			&dpage);
+  if (!memp) {
+    fprintf (stderr, "cannot get data page for at page number %d\n",
+	     dpage);
+    return -1;
+  }
+  
 
-/**
- * Add a pair of key and data pointer value to a bucket page
- * which could be the first of a few overflow pages
- *
- * The data pointer points to data pages that could be allocated
- * in previous levels
- */
-static int
-_ffdb_add_key_datap_to_bucket (ffdb_htab_t* hashp, FFDB_DBT* key, 
-			       ffdb_datap_t *datap, 
-			       unsigned int bucket)
-{
-  pgno_t page, ovflpage, nextpage, tp;
-  void *pagep, *opagep, *npagep;
-  int needovfl, reuse;
+  /* Now Put data on this page: this data can expand multiple pages */
+  datap.first = fpage;
+  datap.offset = 0;
+  datap.len = val->size;
+  datap.chksum = data_chksum;
 
-  /* First grab a page related to this bucket */
-  npagep = pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE, 
-				  FFDB_CREATE, &page);
-  if (!pagep) {
-    fprintf (stderr, "Cannot get page for bucket %d\n", bucket);
+  /* add data to data page provided key page and key index in the page
+   * datap offset, length and first page are updated in the add_data call 
+   */
+  codec = _ffdb_encode_data (hashp, val, &enc);
+  status = _ffdb_add_data (hashp, page, n, &enc, codec, val->size,
+			   memp, dpage, &datap);
+  if (status != 0) {
+    fprintf (stderr, "cannot put data into data page at page number %d\n",
+	     dpage);
     return -1;
   }
-
-  needovfl = 1;
-  nextpage = page;
-  while (npagep) {
-    /* check whether this pair should fit on this page */
-    /* the following macro does not care the data part */
-    if (PAIRFITS (npagep, key, dumb)) {
-      _ffdb_write_key_datap_to_page (hashp, key, datap, pagep, page);
-      needovfl = 0;
-      /* release this page */
-      ffdb_put_page (hashp, pagep, HASH_BUCKET_PAGE, 1);
-      /* I am done here */
-      npagep = 0;
-      needovfl = 0;
-    }
-    else {
-      nextpage = NEXT_PGNO (pagep);
-      if (nextpage == INVALID_PGNO)
-	npagep = 0;
-      else {
-	npagep = ffdb_get_page (hashp, nextpage, HASH_OVFL_PAGE, 0, &tp);
-	if (!npagep) {
-	  fprintf (stderr, "Cannot get overflow (expanded) page %d \n",
-		   nextpage);
-	  /* release the previous page */
-	  ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
-	  return -1;
-	}
-	/* release the previous page */
-	ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
-	
-	/* assign pointers */
-	pagep = npagep;
-	page = nextpage;
-      }
-    }
-  }
-      
-  if (needovfl) {
-    reuse = 0;
-    ovflpage = _ffdb_ovfl_page (hashp, &reuse);
 #ifdef _FFDB_DEBUG
-    fprintf (stderr, "Get an overflow page (expanded) %d for page %d\n",
-	     ovflpage, page);
-#endif
-    /* Get this page and this page is initialized */
-    opagep = ffdb_get_page (hashp, ovflpage, HASH_OVFL_PAGE,
-			    FFDB_CREATE, &tp);
-    if (!opagep) {
-      fprintf (stderr, "Cannot allocate expanded overflow page %d for page %d\n",
-	       ovflpage, page);
-      /* release the previous page */
-      ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
-      return -1;
-    }
-    if (reuse) 
-      _ffdb_init_page (hashp, opagep, ovflpage, HASH_OVFL_PAGE);
-
-#ifdef _FFDB_STATISTICS
-    hash_overflows++;
+  fprintf (stderr, "Data len %d is stored at page %d offset %d checksum 0x%x\n",
+	   datap.len, datap.first, datap.offset, datap.chksum);
 #endif
+  memmove (pagep + off, &datap, sizeof(ffdb_datap_t));
+  DATAP_OFF(pagep, n) = off;
 
-    /* set up correct link */
-    NEXT_PGNO (pagep) = ovflpage;
-    PREV_PGNO (opagep) = page;
-
-    /* release the previous page , but the head is changed so 
-     * we have to write it to disk
-     */
-    ffdb_put_page (hashp, pagep, TYPE(pagep), 1); 
-
-    /* add key and data pointer to this page */
-    _ffdb_write_key_datap_to_page (hashp, key, datap, opagep, ovflpage);
+  /* Update this page information */
+  NUM_ENT(pagep) = n + 1;
+  OFFSET(pagep) = off - 1;
 
-    /* release this page */
-    ffdb_put_page (hashp, opagep, HASH_OVFL_PAGE, 1);
-  }
   return 0;
 }
 
 /**
- * Split a bucket: this happens when a bucket is full. This bucket may not be 
- * splitted right away (overflow pages needed), but it will eventually 
- * will be splitted
+ * Move the data of an item stored as enc to the current data page and
+ * delete the old copy. The data pointer of the item is updated.
  */
-int 
-ffdb_split_bucket (ffdb_htab_t* hashp, unsigned int oldbucket,
-		   unsigned int newbucket, int isdoubling)
+static int
+_ffdb_relocate_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
+		     const FFDB_DBT* enc, unsigned int codec,
+		     unsigned int rawlen)
 {
-  unsigned int i;
-  FFDB_DBT key;
-  void *oldpagep, *temp_pagep;
-  pgno_t oldpage, nextpage, tp;
-  unsigned char *kdata = 0;
-  ffdb_datap_t* datap = 0;
-  int base_page = 1;
+  ffdb_datap_t* datap;
+  ffdb_datap_t odatap;
+  pgno_t dpage, fpage;
+  void* memp;
+  int reuse;
 
-  /* This page may not be in memory or in use so FFDB_CREATE flag has to be 
-   * used
-   */
-  oldpagep = ffdb_get_page (hashp, oldbucket, HASH_BUCKET_PAGE, FFDB_CREATE, &oldpage);
-  if (!oldpagep) {
-    fprintf (stderr, "Cannot find page for bucket %d\n", oldbucket);
+  datap = DATAP (item->pagep, item->pgndx);
+  odatap = *datap;
+
+  reuse = 0;
+  fpage = _ffdb_data_page (hashp, 0, &reuse);
+  memp = ffdb_get_page (hashp, fpage, HASH_DATA_PAGE, FFDB_CREATE, &dpage);
+  if (!memp) {
+    fprintf (stderr, "Cannot get data page %d to move data\n", fpage);
     return -1;
   }
+  if (_ffdb_add_data (hashp, item->pgno, item->pgndx, enc, codec, rawlen,
+		      memp, dpage, datap) != 0) {
+    *datap = odatap;
+    return -1;
+  }
+  datap->chksum = item->data_chksum;
 
-  /* get split buffer pointer */
-  temp_pagep = hashp->split_buf;
-  /* Copy the old page content to the temp page */
-  memcpy (temp_pagep, oldpagep, hashp->hdr.bsize);
-
-  /* reset the old page */
-  _ffdb_init_page (hashp, oldpagep, oldpage, HASH_BUCKET_PAGE);
-  ffdb_put_page (hashp, oldpagep, HASH_BUCKET_PAGE, 1);
+  /* The key points to the new copy before the old one is gone */
+  return _ffdb_delete_data (hashp, &odatap, item->pgno, item->pgndx);
+}
 
-  while (temp_pagep != 0) {
-    /* get key and data pointer value */
-    for (i = 0; i < NUM_ENT(temp_pagep); i++) {
-      kdata = KEY(temp_pagep, i);
-      key.data = kdata;
-      key.size = KEY_LEN(temp_pagep, i);
-      datap = DATAP(temp_pagep, i);
+/**
+ * Number of pages following the first data page a data item of len
+ * bytes at offset runs into
+ */
+static unsigned int
+_ffdb_data_next_pages (ffdb_htab_t* hashp, unsigned int offset,
+		       unsigned int len)
+{
+  unsigned int end, psize;
 
-      /* Now we need to put this key and data pointer pair */
-      if (_ffdb_call_hash (hashp, key.data, key.size) == oldbucket) 
-	/* this stays with old page without changing data pointer value */
-	_ffdb_add_key_datap_to_bucket (hashp, &key, datap, oldbucket);
-      else 
-	_ffdb_add_key_datap_to_bucket (hashp, &key, datap, newbucket);
-    }
-    
-    /* get next page number */
-    nextpage = NEXT_PGNO(temp_pagep);
-    
-    /* if this is the base page (regular hash page) */
-    if (base_page) 
-      base_page = 0;
-    else  /* free overflow page */ 
-      ffdb_delete_page (hashp, temp_pagep, HASH_OVFL_PAGE, isdoubling);
-    
-    if (nextpage != INVALID_PGNO) 
-      temp_pagep = ffdb_get_page (hashp, nextpage, HASH_OVFL_PAGE, 0, &tp);
-    else
-      break;
-  }
-  return 0;
+  end = offset + BIG_DATA_OVERHEAD + len;
+  if (end <= hashp->hdr.bsize)
+    return 0;
+  psize = hashp->hdr.bsize - BIG_PAGE_OVERHEAD;
+  return (end - hashp->hdr.bsize + psize - 1) / psize;
 }
 
-
 /**
- * Update Data Page Content when a key page are rearranged to fill gaps.
- * Inside the key page (overflow), there are datap value pointing to
- * data pages which contain key_page information for each data. These
- * key_page value need to be updated to the new location.
- * 
+ * Replace a hash item on the page identified by item structure
+ * Data are replaced in place when the new data stored are no longer
+ * than the existing data and need as many pages. Otherwise they are
+ * moved to the current data page, and the pages of the old data are
+ * freed when the old data are deleted.
  */
 static int
-_ffdb_update_data_pages_content (ffdb_htab_t* hashp, void *pagep, 
-				 pgno_t oldpage, pgno_t newpage,
-				 pgno_t oldfirst, pgno_t oldlast,
-				 pgno_t newfirst, pgno_t newlast)
+_ffdb_replace_item_on_page (ffdb_htab_t* hashp,
+			    FFDB_DBT* key, const FFDB_DBT* val,
+			    ffdb_hent_t* item)
 {
-  unsigned int i;
-  void* dpagep;
-  pgno_t dp;
-  ffdb_data_header_t *header = 0;
-  ffdb_datap_t* datap = 0;
-
-  for (i = 0; i < NUM_ENT(pagep); i++) {
-    datap = DATAP(pagep, i);
-
-    /* First check whether this data page pointed by datap->first
-     * is a page to be moved. If yes, we are doing nothing, since
-     * its key_page content is already updated when the data page
-     * is moved
-     */
-    if (datap->first >= newfirst && datap->first <= newlast)
-      continue;
+  int status;
+  ffdb_datap_t* datap;
+  pgno_t dpage;
+  void* memp;
+  FFDB_DBT enc;
+  unsigned int codec;
 
-    /* get data page pointed back by this pointer */
-    dpagep = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 0, &dp);
-    if (!dpagep) {
-      fprintf (stderr, "Cannot get data page %d pointed by overflow page %d item %d\n",
-	       datap->first, oldpage, i);
-      return -1;
-    }
-    
-    /* change information on the key page */
-    header = BIG_DATA_HEADER(dpagep, datap->offset);
+  /* Get current data pointer information of this key */
+  datap = DATAP (item->pagep, item->pgndx);
+  codec = _ffdb_encode_data (hashp, val, &enc);
+  
+#ifdef _FFDB_DEBUG
+  fprintf (stderr, "Replace Key %s information: \n", (char *)key->data);
+  fprintf (stderr, "At first page %d\n", datap->first);
+  fprintf (stderr, "At offset %d\n", datap->offset);
+  fprintf (stderr, "Length of data %d\n", datap->len);
+  fprintf (stderr, "Checksum of data is 0x%x\n", datap->chksum);
+  fprintf (stderr, "With new data size of %d\n", val->size);
+  fprintf (stderr, "new check sum = 0x%x\n", item->data_chksum);
+#endif
+  if (enc.size > datap->len ||
+      _ffdb_data_next_pages (hashp, datap->offset, enc.size) <
+      _ffdb_data_next_pages (hashp, datap->offset, datap->len))
+    return _ffdb_relocate_data (hashp, item, &enc, codec, val->size);
+  
+  /* Now I can put data on the page pointed by data pointer */
+  memp = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 0,
+			&dpage);
+  if (!memp) {
+    fprintf (stderr, "Cannot get data page %d to replace data at offset %d\n",	     datap->first, datap->offset);
+    return -1;
+  }
 
-    assert (header->key_page == oldpage);
+  /* Change data pointer value */
+  datap->len = enc.size;
+  datap->chksum = item->data_chksum;
 
-    /* key_page data item entry points to this new page */
-    header->key_page = newpage;
+  status = _ffdb_replace_data (hashp, &enc, codec, val->size, 
+			       memp, dpage, datap);
 
-    /* Put back the page */
-    ffdb_put_page (hashp, dpagep, TYPE(dpagep), 1);
+  if (status != 0) {
+    fprintf (stderr, "Cannot replace data of len %d on page %d at offset %d\n",
+	     datap->len, dpage, datap->offset);
+    return -1;
   }
+
   return 0;
 }
 
 
 /**
- * Update all Key Pages (either primary or overflow) content when a data page
- * is moved. The data page contains one or more key page information through
- * key_page field. A new hash key item is accessed through key_page and 
- * key_indx pair. The data pointer value (datap->first) of this hash item
- * has to be updated to the new page.
+ * Add a pair of key and data into the hash database
+ *
+ * The page associated with this pair should be cached
  *
- * If the key_page is also among pages that are moved, the data header's 
- * key_page will be updated to its new location.
  */
-static int
-_ffdb_update_key_pages_content (ffdb_htab_t* hashp, void *pagep, 
-				pgno_t oldpage, pgno_t newpage,
-				pgno_t oldfirst, pgno_t oldlast,
-				pgno_t newfirst, pgno_t newlast)
+int ffdb_add_pair (ffdb_htab_t* hashp,
+		   FFDB_DBT* key, const FFDB_DBT* val,
+		   ffdb_hent_t* item, int replace)
 {
-  unsigned int i, next;
-  void* kpagep;
-  pgno_t kp, newkp;
-  ffdb_data_header_t *header = 0;
-  ffdb_datap_t* datap = 0;
-
-  next = FIRST_DATA_POS(pagep);
-  for (i = 0; i < NUM_ENT(pagep); i++) {
-    header = BIG_DATA_HEADER(pagep, next);
+  int status;
+  if (!replace)
+    status = _ffdb_add_item_on_page (hashp, item->pagep, item->pgno,
+				     key, item->key_hash, val,
+				     item->data_chksum);
+  else
+    status = _ffdb_replace_item_on_page (hashp, key, val, item);
 
-    /* get key page pointed back by this header */
-    kpagep = ffdb_get_page (hashp, header->key_page, HASH_RAW_PAGE, 0, &kp);
-    if (!kpagep) {
-      fprintf (stderr, "Cannot get key page %d from data page %d item %d\n",
-	       header->key_page, oldpage, i);
-      return -1;
-    }
-    
-    /* change information on the key page */
-    datap = DATAP(kpagep, header->key_idx);
+  if (status != 0) 
+    /* Now I do not need this page */
+    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
+  else
+    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 1);
 
-#ifdef _FFDB_DEBUG
-    fprintf (stderr, "page %d Datap checksum = 0x%x header key = %d\n", oldpage,
-	     datap->chksum, header->key_page);
-#endif
+  return status;
+}
 
-    assert (datap->first == oldpage);
 
-    /* Key page data item entry points to this new page */
-    datap->first = newpage;
+/**
+ * Add a pair to an overflow page
+ */
+int ffdb_add_ovflpage (ffdb_htab_t* hashp,
+		       FFDB_DBT* key, const FFDB_DBT* val,
+		       ffdb_hent_t* item)
+{
+  pgno_t ovflpage, tp;
+  void*  opagep;
+  int    status, reuse;
 
-    /* Check whether the key page actually is going to be moved */
-    /* this works based on assumption data pages are moved first */
-    /* the data page entry points back to the new hash page that
-     * is going to be moved to newkp
-     */
-    if (header->key_page >= oldfirst && header->key_page <= oldlast) {
-      newkp = newfirst + (header->key_page - oldfirst);
+  /* Find out next overflow page number */
+  reuse = 0;
+  ovflpage = _ffdb_ovfl_page (hashp, &reuse);
 #ifdef _FFDB_DEBUG
-      fprintf (stderr, "Data Page %d contains hash key entry %d that moves to %d\n", oldpage, header->key_page, newkp);
+  fprintf (stderr, "Allocate an overflow page %d for primary page %d at level %d\n",
+	   ovflpage, item->pgno, hashp->hdr.ovfl_point);
 #endif
-      /* Now my header has to be changed to point to new page as well */
-      header->key_page = newkp;
-    }
-    
-    next = header->next;
+  
+  /* Get this page and this page is initialized */
+  opagep = ffdb_get_page (hashp, ovflpage, HASH_OVFL_PAGE, FFDB_CREATE, &tp);
+  if (!opagep) {
+    fprintf (stderr, "Cannot get an over flow page %d for primary page %d\n",
+	     ovflpage, item->pgno);
+    /* Now I do not need this page */
+    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
+    return -1; 
+  }
+  if (reuse)
+    _ffdb_init_page (hashp, opagep, ovflpage, HASH_OVFL_PAGE);
 
-    /* Put back the page */
-    ffdb_put_page (hashp, kpagep, TYPE(kpagep), 1);
+#ifdef _FFDB_STATISTICS
+  hash_overflows++;
+#endif
+  
+  /* Set up page link */
+  NEXT_PGNO(item->pagep) = ovflpage;
+  PREV_PGNO(opagep) = item->pgno;
+
+  /* Add this pair to the new page */
+  status = _ffdb_add_item_on_page (hashp, opagep, ovflpage,
+				   key, item->key_hash, val,
+				   item->data_chksum);
+
+  if (status != 0) {
+    ffdb_put_page (hashp, opagep, HASH_OVFL_PAGE, 0);
+    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
+  }
+  else {
+    ffdb_put_page (hashp, opagep, HASH_OVFL_PAGE, 1);
+    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 1);
   }
   return 0;
 }
 
 /**
- * Clean out range of pages from pagepool cache
- * @param hashp hashtable pointer
- * @param first the first page to be removed
- * @param last the last page to be removed
+ * Fill the empty page of a bucket with new pairs in one go
  */
-static void _ffdb_remove_pages (ffdb_htab_t* hashp, 
-				pgno_t first, pgno_t last)
+int ffdb_bulk_bucket (ffdb_htab_t* hashp, unsigned int bucket,
+		      FFDB_DBT keys[], const FFDB_DBT vals[],
+		      const unsigned int idx[],
+		      const unsigned int hashes[], unsigned int n)
 {
-  unsigned int numpages, i;
-  pgno_t page, tp;
-  void *pagep;
+  pgno_t page, ovflpage, tp;
+  void *pagep, *opagep;
+  FFDB_DBT *key;
+  const FFDB_DBT *val;
+  unsigned int i, chksum;
+  int reuse;
+
+  pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE, FFDB_CREATE, &page);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get page for bucket %d\n", bucket);
+    return -1;
+  }
+  /* A bucket page in a hole of the file is read in uninitialized */
+  if (NUM_ENT(pagep) == 0)
+    _ffdb_init_page (hashp, pagep, page, HASH_BUCKET_PAGE);
+
+  for (i = 0; i < n; i++) {
+    key = &keys[idx[i]];
+    val = &vals[idx[i]];
+
+    /* The page is full: go on with a new overflow page */
+    if (NUM_ENT(pagep) > 0 && !PAIRFITS(pagep, key, val)) {
+      reuse = 0;
+      ovflpage = _ffdb_ovfl_page (hashp, &reuse);
+      opagep = ffdb_get_page (hashp, ovflpage, HASH_OVFL_PAGE, 
+			      FFDB_CREATE, &tp);
+      if (!opagep) {
+	fprintf (stderr, "Cannot get an over flow page %d for page %d\n",
+		 ovflpage, page);
+	ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
+	return -1;
+      }
+      if (reuse)
+	_ffdb_init_page (hashp, opagep, ovflpage, HASH_OVFL_PAGE);
 
-  /* total number of pages to be removed */
-  numpages = last - first + 1;
+#ifdef _FFDB_STATISTICS
+      hash_overflows++;
+#endif
 
-  page = first;
-  for (i = 0; i < numpages; i++) {
-    pagep = ffdb_get_page (hashp, page, HASH_RAW_PAGE, 0, &tp);
-    if (!pagep) {
-      fprintf (stderr, "Warning: cannot find moved old page %d \n",
-	       page);
-      page++;
-      continue;
+      NEXT_PGNO(pagep) = ovflpage;
+      PREV_PGNO(opagep) = page;
+      ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
+      pagep = opagep;
+      page = ovflpage;
+    }
+
+    chksum = __ffdb_crc32_checksum (0, val->data, val->size);
+    if (_ffdb_add_item_on_page (hashp, pagep, page, key, hashes[i], val,
+				chksum) != 0) {
+      ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
+      return -1;
     }
-    if (ffdb_pagepool_delete (hashp->mp, pagep) != 0) 
-      fprintf (stderr, "Cannot delete a moved page %d\n", page);
-    page++;
   }
-}
-  
+  ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
 
+  return 0;
+}
 
 /**
- * Move pages when the file closes
- *
- * @param hashp hash table pointer
- * @param type this type of pages to be moved
- * @param oldfirst first page of old pages to be moved
- * @param oldlast the last page of old page to be moved
- * @param newfirst first page of new pages to move into
- * @param newlast last page of new pages to move into
- *
- * @return last page number on the linked list after successful move. 
- * If there is no data pages being moved, INVALID_PGNO is returned
+ * Just copy content of key and its associated data pointer to a page
+ * at the right location
+ * We already checked this page can fit this key and data pointer
  */
-static pgno_t
-_ffdb_move_pages (ffdb_htab_t* hashp, unsigned short type,
-		  pgno_t oldfirst, pgno_t oldlast,
-		  pgno_t newfirst, pgno_t newlast)
+static int
+_ffdb_write_key_datap_to_page (ffdb_htab_t* hashp, FFDB_DBT* key, 
+			       unsigned int key_hash, ffdb_datap_t *datap,
+			       void* pagep, pgno_t page)
 {
-  pgno_t dlast, page, rpage, tp;
-  pgno_t prevp, nextp;
-  unsigned int numpages, i;
-  void *pagep, *prevpagep, *nextpagep;
+  unsigned int n, off, soff;
+  int status;
+  
+  n = NUM_ENT(pagep);
+  /* Find place to put the key */
+  off = OFFSET(pagep) - key->size + 1;
+  memmove (pagep + off, key->data, key->size);
 
-  dlast = INVALID_PGNO;
-  /* Create page header array to keep track old page information */
-  numpages = oldlast - oldfirst + 1;
+  /* Set Key Offset Value */
+  KEY_OFF(pagep, n) = off;
+  KEY_LEN(pagep, n) = key->size;
+  KEY_HASH(pagep, n) = key_hash;
 
-  /* Now we can move pages */
-  page = oldfirst;
-  rpage = newfirst;
-  for (i = 0; i < numpages; i++) {
-    pagep = ffdb_get_page (hashp, page, HASH_RAW_PAGE, 0, &tp);
-    if (!pagep) {
-      fprintf (stderr, "Cannot grab old page %d to move to new page %d.\n",
-	       page, rpage);
-      return dlast;
-    }
+  /*  Find place to put data pointer value */
+  off -= sizeof(ffdb_datap_t);
+  soff = off;
+  /* I have to align this pointer to 4 byte boundary */
+  ALIGN_DATAP_OFFSET_VAL(off);
 
-    if (TYPE(pagep) != type) {
-      page++;
-      rpage++;
-      ffdb_put_page (hashp, pagep, HASH_RAW_PAGE, 0);
-      continue;
-    }
+  /* I will fill 0 to the gap of data and key */
+  /* ------off---soff-----000key */
+  if (off != soff) 
+    memset (pagep + off + sizeof(ffdb_datap_t), 0, soff - off);
 
-    /* Get its original previous and next page number */
-    nextp = NEXT_PGNO(pagep);
-    prevp = PREV_PGNO(pagep);
+  /* write data pointer value */
+  memmove (pagep + off, datap, sizeof(ffdb_datap_t));
+  DATAP_OFF(pagep, n) = off;
 
-    if (nextp != INVALID_PGNO) {
-      if (nextp < oldfirst || nextp > oldlast) {
-	/* The next page is not going to be moved, its previous link 
-	 * Should be updated
-	 */
-	nextpagep = ffdb_get_page (hashp, nextp, HASH_RAW_PAGE, 0, &tp);
-	if (!nextpagep) {
-	  fprintf (stderr, "Cannot get next page %d not in the moving list for page %d\n", nextp, page);
-	  ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
-	  return dlast;
-	}
+  /* Need update data item information about key page and key index */
+  /* The data items are on data pages, this could be slow           */
+  status = _ffdb_update_data_info (hashp, datap, page, n);
 
-	PREV_PGNO(nextpagep) = rpage;
-	ffdb_put_page (hashp, nextpagep, TYPE(nextpagep), 1);
-      }
-      else {
-	/* I have to update this page next link to a new page number */
-	NEXT_PGNO(pagep) = newfirst + (nextp - oldfirst);
-      }
-    }
-    else {
-      /* This is last data page in these moved page.
-       * update last new location of this page
-       */
-      if (type == HASH_DATA_PAGE)
-	dlast = rpage;
-    }
+  /* Update this page information */
+  NUM_ENT(pagep) = n + 1;
+  OFFSET(pagep) = off - 1;
 
+  return status;
+}
 
-    if (prevp != INVALID_PGNO) {
-      if (prevp < oldfirst || prevp > oldlast) {
-	/* The previous page is not going to be moved, its previous link 
-	 * Should be updated
-	 */
-	prevpagep = ffdb_get_page (hashp, prevp, HASH_RAW_PAGE, 0, &tp);
-	if (!prevpagep) {
-	  fprintf (stderr, "Cannot get previous page %d not in the moving list for page %d\n", prevp, page);
+/**
+ * Add a pair of key and data pointer value to a bucket page
+ * which could be the first of a few overflow pages
+ *
+ * The data pointer points to data pages that could be allocated
+ * in previous levels
+ */
+static int
+_ffdb_add_key_datap_to_bucket (ffdb_htab_t* hashp, FFDB_DBT* key, 
+			       unsigned int key_hash, ffdb_datap_t *datap, 
+			       unsigned int bucket)
+{
+  pgno_t page, ovflpage, nextpage, tp;
+  void *pagep, *opagep, *npagep;
+  int needovfl, reuse;
+
+  /* First grab a page related to this bucket */
+  npagep = pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE, 
+				  FFDB_CREATE, &page);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get page for bucket %d\n", bucket);
+    return -1;
+  }
+
+  needovfl = 1;
+  nextpage = page;
+  while (npagep) {
+    /* check whether this pair should fit on this page */
+    /* the following macro does not care the data part */
+    if (PAIRFITS (npagep, key, dumb)) {
+      _ffdb_write_key_datap_to_page (hashp, key, key_hash, datap, pagep, page);
+      needovfl = 0;
+      /* release this page */
+      ffdb_put_page (hashp, pagep, HASH_BUCKET_PAGE, 1);
+      /* I am done here */
+      npagep = 0;
+      needovfl = 0;
+    }
+    else {
+      nextpage = NEXT_PGNO (pagep);
+      if (nextpage == INVALID_PGNO)
+	npagep = 0;
+      else {
+	npagep = ffdb_get_page (hashp, nextpage, HASH_OVFL_PAGE, 0, &tp);
+	if (!npagep) {
+	  fprintf (stderr, "Cannot get overflow (expanded) page %d \n",
+		   nextpage);
+	  /* release the previous page */
 	  ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
-	  return dlast;
+	  return -1;
 	}
-
-	NEXT_PGNO(prevpagep) = rpage;
-	ffdb_put_page (hashp, prevpagep, TYPE(prevpagep), 1);
+	/* release the previous page */
+	ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+	
+	/* assign pointers */
+	pagep = npagep;
+	page = nextpage;
       }
-      else {
-	/* The previous link of this page has to be updated */
-	PREV_PGNO(pagep) = newfirst + (prevp - oldfirst);
+    }
+  }
+      
+  if (needovfl) {
+    reuse = 0;
+    ovflpage = _ffdb_ovfl_page (hashp, &reuse);
+#ifdef _FFDB_DEBUG
+    fprintf (stderr, "Get an overflow page (expanded) %d for page %d\n",
+	     ovflpage, page);
+#endif
+    /* Get this page and this page is initialized */
+    opagep = ffdb_get_page (hashp, ovflpage, HASH_OVFL_PAGE,
+			    FFDB_CREATE, &tp);
+    if (!opagep) {
+      fprintf (stderr, "Cannot allocate expanded overflow page %d for page %d\n",
+	       ovflpage, page);
+      /* release the previous page */
+      ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+      return -1;
+    }
+    if (reuse) 
+      _ffdb_init_page (hashp, opagep, ovflpage, HASH_OVFL_PAGE);
+
+#ifdef _FFDB_STATISTICS
+    hash_overflows++;
+#endif
+
+    /* set up correct link */
+    NEXT_PGNO (pagep) = ovflpage;
+    PREV_PGNO (opagep) = page;
+
+    /* release the previous page , but the head is changed so 
+     * we have to write it to disk
+     */
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 1); 
+
+    /* add key and data pointer to this page */
+    _ffdb_write_key_datap_to_page (hashp, key, key_hash, datap, opagep, ovflpage);
+
+    /* release this page */
+    ffdb_put_page (hashp, opagep, HASH_OVFL_PAGE, 1);
+  }
+  return 0;
+}
+
+/**
+ * Split a bucket: this happens when a bucket is full. This bucket may not be 
+ * splitted right away (overflow pages needed), but it will eventually 
+ * will be splitted
+ */
+int 
+ffdb_split_bucket (ffdb_htab_t* hashp, unsigned int oldbucket,
+		   unsigned int newbucket, int isdoubling)
+{
+  unsigned int i, khash;
+  FFDB_DBT key;
+  void *oldpagep, *temp_pagep;
+  pgno_t oldpage, nextpage, tp;
+  unsigned char *kdata = 0;
+  ffdb_datap_t* datap = 0;
+  int base_page = 1;
+
+  /* This page may not be in memory or in use so FFDB_CREATE flag has to be 
+   * used
+   */
+  oldpagep = ffdb_get_page (hashp, oldbucket, HASH_BUCKET_PAGE, FFDB_CREATE, &oldpage);
+  if (!oldpagep) {
+    fprintf (stderr, "Cannot find page for bucket %d\n", oldbucket);
+    return -1;
+  }
+
+  /* get split buffer pointer */
+  temp_pagep = hashp->split_buf;
+  /* Copy the old page content to the temp page */
+  memcpy (temp_pagep, oldpagep, hashp->hdr.bsize);
+
+  /* reset the old page */
+  _ffdb_init_page (hashp, oldpagep, oldpage, HASH_BUCKET_PAGE);
+  ffdb_put_page (hashp, oldpagep, HASH_BUCKET_PAGE, 1);
+
+  while (temp_pagep != 0) {
+    /* get key and data pointer value */
+    for (i = 0; i < NUM_ENT(temp_pagep); i++) {
+      kdata = KEY(temp_pagep, i);
+      key.data = kdata;
+      key.size = KEY_LEN(temp_pagep, i);
+      datap = DATAP(temp_pagep, i);
+      khash = KEY_HASH(temp_pagep, i);
+
+      /* Now we need to put this key and data pointer pair */
+      /* The stored hash value tells the new bucket without rehashing */
+      if (_ffdb_hash_bucket (hashp, khash) == oldbucket) 
+	/* this stays with old page without changing data pointer value */
+	_ffdb_add_key_datap_to_bucket (hashp, &key, khash, datap, oldbucket);
+      else 
+	_ffdb_add_key_datap_to_bucket (hashp, &key, khash, datap, newbucket);
+    }
+    
+    /* get next page number */
+    nextpage = NEXT_PGNO(temp_pagep);
+    
+    /* if this is the base page (regular hash page) */
+    if (base_page) 
+      base_page = 0;
+    else  /* free overflow page */ 
+      ffdb_delete_page (hashp, temp_pagep, HASH_OVFL_PAGE, isdoubling);
+    
+    if (nextpage != INVALID_PGNO) 
+      temp_pagep = ffdb_get_page (hashp, nextpage, HASH_OVFL_PAGE, 0, &tp);
+    else
+      break;
+  }
+  return 0;
+}
+
+/**
+ * Take a page out of the list of pages it is linked into by linking
+ * its previous and next pages to each other
+ */
+static int
+_ffdb_unlink_page (ffdb_htab_t* hashp, void* pagep)
+{
+  pgno_t page, prevp, nextp, tp;
+  void* lpagep;
+
+  page = CURR_PGNO(pagep);
+  prevp = PREV_PGNO(pagep);
+  nextp = NEXT_PGNO(pagep);
+
+  if (prevp != INVALID_PGNO) {
+    lpagep = ffdb_get_page (hashp, prevp, HASH_RAW_PAGE, 0, &tp);
+    if (!lpagep) {
+      fprintf (stderr, "Cannot get previous page %d of page %d\n",
+	       prevp, page);
+      return -1;
+    }
+    if (NEXT_PGNO(lpagep) == page) {
+      NEXT_PGNO(lpagep) = nextp;
+      ffdb_put_page (hashp, lpagep, TYPE(lpagep), 1);
+    }
+    else
+      ffdb_put_page (hashp, lpagep, TYPE(lpagep), 0);
+  }
+
+  if (nextp != INVALID_PGNO) {
+    lpagep = ffdb_get_page (hashp, nextp, HASH_RAW_PAGE, 0, &tp);
+    if (!lpagep) {
+      fprintf (stderr, "Cannot get next page %d of page %d\n",
+	       nextp, page);
+      return -1;
+    }
+    if (PREV_PGNO(lpagep) == page) {
+      PREV_PGNO(lpagep) = prevp;
+      ffdb_put_page (hashp, lpagep, TYPE(lpagep), 1);
+    }
+    else
+      ffdb_put_page (hashp, lpagep, TYPE(lpagep), 0);
+  }
+
+  PREV_PGNO(pagep) = NEXT_PGNO(pagep) = INVALID_PGNO;
+  return 0;
+}
+
+/**
+ * Check whether the data running into the beginning of a data page
+ * still belongs to a valid data item. The header of this data item
+ * is the last one on the closest previous page having data headers.
+ * A chain going back over more pages than the file has runs in a
+ * cycle, and the page is kept.
+ */
+static int
+_ffdb_data_tail_valid (ffdb_htab_t* hashp, void* pagep)
+{
+  pgno_t prevp, tp;
+  void* ppagep;
+  ffdb_data_header_t* header;
+  unsigned int i, off, nwalk;
+  int valid;
+
+  prevp = PREV_PGNO(pagep);
+  nwalk = 0;
+  while (prevp != INVALID_PGNO) {
+    if (++nwalk > hashp->mp->maxpgno + 1) {
+      fprintf (stderr, "Data pages before page %d run in a cycle\n",
+	       CURR_PGNO(pagep));
+      return 1;
+    }
+    ppagep = ffdb_get_page (hashp, prevp, HASH_DATA_PAGE, 
+			    FFDB_PAGE_SHARED, &tp);
+    if (!ppagep) {
+      fprintf (stderr, "Cannot get data page %d\n", prevp);
+      /* Keep the page when in doubt */
+      return 1;
+    }
+    if (TYPE(ppagep) != HASH_DATA_PAGE) {
+      ffdb_put_page (hashp, ppagep, TYPE(ppagep), 0);
+      return 0;
+    }
+
+    /* This page is the middle part of a data item */
+    if (NUM_ENT(ppagep) == 0 && FIRST_DATA_POS(ppagep) == 0) {
+      prevp = PREV_PGNO(ppagep);
+      ffdb_put_page (hashp, ppagep, HASH_DATA_PAGE, 0);
+      continue;
+    }
+
+    valid = 0;
+    if (NUM_ENT(ppagep) > 0) {
+      off = FIRST_DATA_POS(ppagep);
+      for (i = 1; i < NUM_ENT(ppagep); i++) 
+	off = BIG_DATA_HEADER(ppagep, off)->next;
+      header = BIG_DATA_HEADER(ppagep, off);
+      valid = (header->status == DATA_VALID &&
+	       off + BIG_DATA_OVERHEAD + header->len > hashp->hdr.bsize);
+    }
+    ffdb_put_page (hashp, ppagep, HASH_DATA_PAGE, 0);
+    return valid;
+  }
+  return 0;
+}
+
+/**
+ * Put back a data page after one data item on or through this page
+ * has been deleted. The page is freed if there are no valid data
+ * on it anymore.
+ *
+ * @param hashp the hash table pointer
+ * @param pagep the data page
+ * @param checktail check whether the data running into this page from
+ * the previous pages are valid. Otherwise these data are known to be
+ * the deleted ones
+ *
+ * @return 0 on success, otherwise failure
+ */
+static int
+_ffdb_release_data_page (ffdb_htab_t* hashp, void* pagep, int checktail)
+{
+  ffdb_data_header_t* header;
+  unsigned int i, next;
+
+  /* New data go onto the current data page */
+  if (_ffdb_current_data_page (hashp, CURR_PGNO(pagep)))
+    return ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 1);
+
+  next = FIRST_DATA_POS(pagep);
+  for (i = 0; i < NUM_ENT(pagep); i++) {
+    header = BIG_DATA_HEADER(pagep, next);
+    if (header->status == DATA_VALID)
+      return ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 1);
+    next = header->next;
+  }
+
+  if (checktail && FIRST_DATA_POS(pagep) != BIG_PAGE_OVERHEAD &&
+      _ffdb_data_tail_valid (hashp, pagep))
+    return ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 1);
+
+#ifdef _FFDB_DEBUG
+  fprintf (stderr, "Data page %d has no valid data, free it\n", 
+	   CURR_PGNO(pagep));
+#endif
+  if (_ffdb_unlink_page (hashp, pagep) != 0) 
+    return ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 1);
+
+  return ffdb_delete_page (hashp, pagep, HASH_OVFL_PAGE, 0);
+}
+
+/**
+ * Delete a data item pointed by a data pointer. The data header is
+ * marked invalid and the data pages holding only invalid data are
+ * returned to the free pages
+ *
+ * @param hashp the hash table pointer
+ * @param datap the data pointer of the key
+ * @param kpage the page the key is on
+ * @param kidx the index of the key on the key page
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int
+_ffdb_delete_data (ffdb_htab_t* hashp, ffdb_datap_t* datap,
+		   pgno_t kpage, unsigned int kidx)
+{
+  void* pagep;
+  pgno_t dpage, next;
+  ffdb_data_header_t* header;
+  unsigned int start, copylen, rlen;
+
+  pagep = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 0, &dpage);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get data page %d to delete data\n", 
+	     datap->first);
+    return -1;
+  }
+
+  header = BIG_DATA_HEADER(pagep, datap->offset);
+  if (header->status != DATA_VALID || header->key_page != kpage ||
+      header->key_idx != kidx) {
+    fprintf (stderr, "Data on page %d at offset %d does not belong to key %d on page %d\n", 
+	     dpage, datap->offset, kidx, kpage);
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+    return -1;
+  }
+  header->status = DATA_INVALID;
+
+  /* Find out how many bytes of this data are on the following pages */
+  start = datap->offset + BIG_DATA_OVERHEAD;
+  rlen = 0;
+  if (start + header->len > hashp->hdr.bsize)
+    rlen = start + header->len - hashp->hdr.bsize;
+  next = NEXT_PGNO(pagep);
+
+  if (_ffdb_release_data_page (hashp, pagep, 1) != 0)
+    return -1;
+
+  while (rlen > 0) {
+    pagep = ffdb_get_page (hashp, next, HASH_DATA_PAGE, 0, &dpage);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get data page %d to delete data\n", next);
+      return -1;
+    }
+    copylen = hashp->hdr.bsize - BIG_PAGE_OVERHEAD;
+    if (rlen < copylen)
+      copylen = rlen;
+    rlen -= copylen;
+    next = NEXT_PGNO(pagep);
+
+    /* The data running into this page is the deleted data */
+    if (_ffdb_release_data_page (hashp, pagep, 0) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+/**
+ * Delete the pair of key and data of an item found by ffdb_find_item
+ */
+int
+ffdb_delete_pair (ffdb_htab_t* hashp, ffdb_hent_t* item)
+{
+  void *pagep, *opagep, *npagep;
+  pgno_t page, opage, tp;
+  ffdb_datap_t datap;
+  unsigned int i, n, idx, end, gap, low;
+  int status = 0;
+
+  pagep = item->pagep;
+  page = item->pgno;
+  idx = item->pgndx;
+  n = NUM_ENT(pagep);
+
+  /* Data first while its header still points back to this key */
+  datap = *(DATAP(pagep, idx));
+  if (_ffdb_delete_data (hashp, &datap, page, idx) != 0) {
+    ffdb_put_page (hashp, pagep, HASH_BUCKET_PAGE, 0);
+    return -1;
+  }
+
+  /* Key and data pointer of entry idx are between the data pointer
+   * of entry idx and the data pointer of entry idx - 1. Entries after 
+   * idx are below them and move up to close the gap
+   */
+  end = (idx == 0) ? hashp->hdr.bsize : DATAP_OFF(pagep, idx - 1);
+  gap = end - DATAP_OFF(pagep, idx);
+  low = OFFSET(pagep) + 1;
+  memmove (pagep + low + gap, pagep + low, DATAP_OFF(pagep, idx) - low);
+  memset (pagep + low, 0, gap);
+  for (i = idx + 1; i < n; i++) {
+    KEY_OFF(pagep, i) += gap;
+    DATAP_OFF(pagep, i) += gap;
+  }
+  memmove (&KEY_OFF(pagep, idx), &KEY_OFF(pagep, idx + 1),
+	   (n - idx - 1) * PAIR_OVERHEAD);
+  NUM_ENT(pagep) = n - 1;
+  OFFSET(pagep) += gap;
+
+  /* Entries after idx have one index less now */
+  for (i = idx; i < n - 1; i++) {
+    if (_ffdb_update_data_info (hashp, DATAP(pagep, i), page, i) != 0)
+      status = -1;
+  }
+
+  if (NUM_ENT(pagep) > 0) {
+    ffdb_put_page (hashp, pagep, HASH_BUCKET_PAGE, 1);
+    return status;
+  }
+
+  if (PREV_PGNO(pagep) != INVALID_PGNO) {
+    /* An empty overflow page leaves the chain of this bucket */
+    if (_ffdb_unlink_page (hashp, pagep) != 0) {
+      ffdb_put_page (hashp, pagep, HASH_BUCKET_PAGE, 1);
+      return -1;
+    }
+    if (ffdb_delete_page (hashp, pagep, HASH_OVFL_PAGE, 0) != 0)
+      status = -1;
+    return status;
+  }
+
+  if (NEXT_PGNO(pagep) != INVALID_PGNO) {
+    /* A bucket page is never empty in front of overflow pages:
+     * lookups stop at an empty bucket page. Move the first
+     * overflow page onto the bucket page
+     */
+    opage = NEXT_PGNO(pagep);
+    opagep = ffdb_get_page (hashp, opage, HASH_OVFL_PAGE, 0, &tp);
+    if (!opagep) {
+      fprintf (stderr, "Cannot get overflow page %d of page %d\n",
+	       opage, page);
+      ffdb_put_page (hashp, pagep, HASH_BUCKET_PAGE, 1);
+      return -1;
+    }
+    memcpy (pagep, opagep, hashp->hdr.bsize);
+    TYPE(pagep) = HASH_BUCKET_PAGE;
+    CURR_PGNO(pagep) = page;
+    PREV_PGNO(pagep) = INVALID_PGNO;
+
+    for (i = 0; i < NUM_ENT(pagep); i++) {
+      if (_ffdb_update_data_info (hashp, DATAP(pagep, i), page, i) != 0)
+	status = -1;
+    }
+
+    if (NEXT_PGNO(pagep) != INVALID_PGNO) {
+      npagep = ffdb_get_page (hashp, NEXT_PGNO(pagep), HASH_OVFL_PAGE, 0, &tp);
+      if (!npagep) {
+	fprintf (stderr, "Cannot get overflow page %d of page %d\n",
+		 NEXT_PGNO(pagep), page);
+	status = -1;
+      }
+      else {
+	PREV_PGNO(npagep) = page;
+	ffdb_put_page (hashp, npagep, HASH_OVFL_PAGE, 1);
+      }
+    }
+    PREV_PGNO(opagep) = NEXT_PGNO(opagep) = INVALID_PGNO;
+    if (ffdb_delete_page (hashp, opagep, HASH_OVFL_PAGE, 0) != 0)
+      status = -1;
+  }
+
+  ffdb_put_page (hashp, pagep, HASH_BUCKET_PAGE, 1);
+  return status;
+}
+
+
+/**
+ * A live data item found on a data page being compacted
+ */
+typedef struct _ffdb_citem_ {
+  unsigned int offset;          /* offset of the data header */
+  pgno_t       kpage;           /* page of the key */
+  unsigned int kidx;            /* index of the key on its page */
+}ffdb_citem_t;
+
+/**
+ * Move a data item to the current data page and point its key to the
+ * new place. The old copy is deleted afterwards.
+ *
+ * @param hashp the hash table pointer
+ * @param dpage the data page the item is on
+ * @param offset offset of the data header on the data page
+ * @param kpage the page the key is on according to the data header
+ * @param kidx the index of the key according to the data header
+ *
+ * @return 0 on success, 1 if the item has changed since the data page
+ * was looked at, -1 on failure
+ */
+static int
+_ffdb_move_data (ffdb_htab_t* hashp, pgno_t dpage, unsigned int offset,
+		 pgno_t kpage, unsigned int kidx)
+{
+  void *kpagep, *memp;
+  pgno_t tp, fpage;
+  ffdb_datap_t odatap, ndatap;
+  ffdb_hent_t item;
+  FFDB_DBT val, enc;
+  unsigned int codec;
+  int status, reuse;
+
+  /* The key page is held the same way a writer holds it */
+  kpagep = ffdb_get_page (hashp, kpage, HASH_RAW_PAGE, 0, &tp);
+  if (!kpagep) {
+    fprintf (stderr, "Cannot get key page %d to move data\n", kpage);
+    return -1;
+  }
+  FFDB_LOCK (hashp->lock);
+
+  /* The key may have been deleted or moved in the mean time */
+  if ((TYPE(kpagep) != HASH_BUCKET_PAGE && TYPE(kpagep) != HASH_OVFL_PAGE) ||
+      kidx >= NUM_ENT(kpagep) || DATAP(kpagep, kidx)->first != dpage ||
+      DATAP(kpagep, kidx)->offset != offset) {
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+    return 1;
+  }
+  odatap = *(DATAP(kpagep, kidx));
+
+  item.pgno = kpage;
+  item.pgndx = kidx;
+  val.data = 0;
+  val.size = 0;
+  if ((status = _ffdb_get_data (hashp, &item, &val, &odatap, 1)) != 0) {
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+    return status;
+  }
+
+  /* Append the data to the current data page as an insert does */
+  reuse = 0;
+  fpage = _ffdb_data_page (hashp, 0, &reuse);
+  memp = ffdb_get_page (hashp, fpage, HASH_DATA_PAGE, FFDB_CREATE, &tp);
+  if (!memp) {
+    fprintf (stderr, "Cannot get data page %d to move data\n", fpage);
+    free (val.data);
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+    return -1;
+  }
+  ndatap = odatap;
+  codec = _ffdb_encode_data (hashp, &val, &enc);
+  status = _ffdb_add_data (hashp, kpage, kidx, &enc, codec, val.size,
+			   memp, tp, &ndatap);
+  free (val.data);
+  if (status != 0) {
+    fprintf (stderr, "Cannot move data of key %d on page %d\n", kidx, kpage);
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+    return -1;
+  }
+
+  /* The key points to the new copy before the old one is gone */
+  *(DATAP(kpagep, kidx)) = ndatap;
+  status = _ffdb_delete_data (hashp, &odatap, kpage, kidx);
+
+  FFDB_UNLOCK (hashp->lock);
+  ffdb_put_page (hashp, kpagep, TYPE(kpagep), 1);
+  return status;
+}
+
+/**
+ * Move an overflow page of a bucket to the lowest free page if that
+ * page is before the pages being emptied. The keys on this page are
+ * not changed, but their data headers point to the new page.
+ *
+ * @return 0 on success, 1 if the page is not moved, -1 on failure
+ */
+static int
+_ffdb_move_key_page (ffdb_htab_t* hashp, pgno_t page)
+{
+  void *pagep, *rpagep, *ppagep, *npagep;
+  pgno_t prevp, nextp, rpage, tp;
+  unsigned int i;
+  int status = 0;
+
+  pagep = ffdb_get_page (hashp, page, HASH_RAW_PAGE, 0, &tp);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get overflow page %d to move\n", page);
+    return -1;
+  }
+  FFDB_LOCK (hashp->lock);
+
+  /* Bucket pages stay where they are */
+  prevp = PREV_PGNO(pagep);
+  nextp = NEXT_PGNO(pagep);
+  if ((TYPE(pagep) != HASH_BUCKET_PAGE && TYPE(pagep) != HASH_OVFL_PAGE) ||
+      prevp == INVALID_PGNO) {
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+    return 1;
+  }
+
+  if ((rpage = _ffdb_reuse_free_ovflpage (hashp)) == 0) {
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+    return 1;
+  }
+  rpagep = ffdb_get_page (hashp, rpage, HASH_OVFL_PAGE, FFDB_CREATE, &tp);
+  if (!rpagep) {
+    fprintf (stderr, "Cannot get free page %d to move page %d\n", rpage, page);
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+    return -1;
+  }
+  if (rpage >= hashp->compact_limit) {
+    /* No free page before: give this one back */
+    _ffdb_init_page (hashp, rpagep, rpage, HASH_OVFL_PAGE);
+    ffdb_delete_page (hashp, rpagep, HASH_OVFL_PAGE, 0);
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+    return 1;
+  }
+
+  ppagep = ffdb_get_page (hashp, prevp, HASH_RAW_PAGE, 0, &tp);
+  if (!ppagep) {
+    fprintf (stderr, "Cannot get previous page %d of page %d\n", prevp, page);
+    ffdb_delete_page (hashp, rpagep, HASH_OVFL_PAGE, 0);
+    FFDB_UNLOCK (hashp->lock);
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+    return -1;
+  }
+  npagep = 0;
+  if (nextp != INVALID_PGNO) {
+    npagep = ffdb_get_page (hashp, nextp, HASH_RAW_PAGE, 0, &tp);
+    if (!npagep) {
+      fprintf (stderr, "Cannot get next page %d of page %d\n", nextp, page);
+      ffdb_put_page (hashp, ppagep, TYPE(ppagep), 0);
+      ffdb_delete_page (hashp, rpagep, HASH_OVFL_PAGE, 0);
+      FFDB_UNLOCK (hashp->lock);
+      ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+      return -1;
+    }
+  }
+
+  /* Copy the page and link the copy into the chain of the bucket */
+  memcpy (rpagep, pagep, hashp->hdr.bsize);
+  CURR_PGNO(rpagep) = rpage;
+  NEXT_PGNO(ppagep) = rpage;
+  ffdb_put_page (hashp, ppagep, TYPE(ppagep), 1);
+  if (npagep) {
+    PREV_PGNO(npagep) = rpage;
+    ffdb_put_page (hashp, npagep, TYPE(npagep), 1);
+  }
+
+  for (i = 0; i < NUM_ENT(rpagep); i++) {
+    if (_ffdb_update_data_info (hashp, DATAP(rpagep, i), rpage, i) != 0)
+      status = -1;
+  }
+  ffdb_put_page (hashp, rpagep, TYPE(rpagep), 1);
+
+  PREV_PGNO(pagep) = NEXT_PGNO(pagep) = INVALID_PGNO;
+  if (ffdb_delete_page (hashp, pagep, HASH_OVFL_PAGE, 0) != 0)
+    status = -1;
+
+  FFDB_UNLOCK (hashp->lock);
+  return status;
+}
+
+/**
+ * Compare two page numbers for qsort
+ */
+static int
+_ffdb_pgno_cmp (const void* a, const void* b)
+{
+  pgno_t pa = *(const pgno_t *)a;
+  pgno_t pb = *(const pgno_t *)b;
+
+  if (pa < pb)
+    return -1;
+  return (pa > pb) ? 1 : 0;
+}
+
+/**
+ * Give free pages at the end of the last level back to the file system.
+ * The free pages of this level, including free map pages, are gathered.
+ * Those running up to the last page are cut off the file and the rest
+ * are put on a new list of free pages.
+ *
+ * This routine is called with hashp->lock held
+ *
+ * @return number of pages cut off the file
+ */
+static unsigned int
+_ffdb_trim_free_pages (ffdb_htab_t* hashp)
+{
+  unsigned int level, i, n, num, max;
+  pgno_t fpage, next, first, end, newend, tp;
+  pgno_t *pages, *tpages;
+  void *fpagep;
+
+  level = hashp->hdr.ovfl_point;
+  end = hashp->hdr.spares[level + 1];
+  if (end == 0 || hashp->hdr.free_pages[level] == INVALID_PGNO)
+    return 0;
+
+  /* The first data page of this level stays */
+  BUCKET_TO_PAGE(hashp->hdr.high_mask, first);
+  first++;
+
+  n = max = 0;
+  pages = 0;
+  fpage = hashp->hdr.free_pages[level];
+  while (fpage != INVALID_PGNO) {
+    fpagep = ffdb_get_page (hashp, fpage, HASH_FREE_PAGE, 0, &tp);
+    if (!fpagep) {
+      fprintf (stderr, "Cannot get free map page %d\n", fpage);
+      free (pages);
+      return 0;
+    }
+    num = NUM_FREE_PAGES(fpagep);
+    if (n + num + 1 > max) {
+      max = 2 * (n + num + 1);
+      tpages = (pgno_t *)realloc (pages, max * sizeof(pgno_t));
+      if (!tpages) {
+	ffdb_put_page (hashp, fpagep, HASH_FREE_PAGE, 0);
+	free (pages);
+	return 0;
+      }
+      pages = tpages;
+    }
+    pages[n++] = fpage;
+    for (i = 0; i < num; i++)
+      pages[n++] = FREE_PAGE(fpagep, i);
+    next = NEXT_PGNO(fpagep);
+    ffdb_put_page (hashp, fpagep, HASH_FREE_PAGE, 0);
+    fpage = next;
+  }
+  qsort (pages, n, sizeof(pgno_t), _ffdb_pgno_cmp);
+
+  newend = end;
+  while (n > 0 && pages[n - 1] == newend - 1 && newend - 1 > first) {
+    n--;
+    newend--;
+  }
+  if (newend == end) {
+    free (pages);
+    return 0;
+  }
+
+  /* Cut the file first: nothing changes if a page is still in use */
+  hashp->hdr.spares[level + 1] = newend;
+  if (ffdb_reduce_filesize (hashp) != 0) {
+    hashp->hdr.spares[level + 1] = end;
+    free (pages);
+    return 0;
+  }
+
+  /* Free the remaining pages again, which builds a new list */
+  hashp->hdr.free_pages[level] = INVALID_PGNO;
+  for (i = 0; i < n; i++) {
+    fpagep = ffdb_get_page (hashp, pages[i], HASH_RAW_PAGE, 0, &tp);
+    if (!fpagep) {
+      fprintf (stderr, "Cannot get free page %d\n", pages[i]);
+      continue;
+    }
+    ffdb_delete_page (hashp, fpagep, HASH_OVFL_PAGE, 0);
+  }
+  free (pages);
+
+  return end - newend;
+}
+
+/**
+ * Count free pages of all levels including the free map pages
+ *
+ * This routine is called with hashp->lock held
+ */
+static unsigned int
+_ffdb_count_free_pages (ffdb_htab_t* hashp)
+{
+  unsigned int level, num;
+  pgno_t fpage, next, tp;
+  void* fpagep;
+
+  num = 0;
+  for (level = 0; level <= hashp->hdr.ovfl_point; level++) {
+    fpage = hashp->hdr.free_pages[level];
+    while (fpage != INVALID_PGNO) {
+      fpagep = ffdb_get_page (hashp, fpage, HASH_FREE_PAGE, 
+			      FFDB_PAGE_SHARED, &tp);
+      if (!fpagep) {
+	fprintf (stderr, "Cannot get free map page %d\n", fpage);
+	break;
+      }
+      num += NUM_FREE_PAGES(fpagep) + 1;
+      next = NEXT_PGNO(fpagep);
+      ffdb_put_page (hashp, fpagep, HASH_FREE_PAGE, 0);
+      fpage = next;
+    }
+  }
+  return num;
+}
+
+/**
+ * Close a current data page at or after the compaction limit
+ */
+static void
+_ffdb_close_data_page (ffdb_htab_t* hashp, pgno_t page)
+{
+  pgno_t tp;
+  void* pagep;
+
+  if (page == INVALID_PGNO || page < hashp->compact_limit)
+    return;
+
+  pagep = ffdb_get_page (hashp, page, HASH_DATA_PAGE, 0, &tp);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get current data page %d\n", page);
+    return;
+  }
+  /* No more data go onto this page */
+  HIGHEST_FREE(pagep) = 0;
+  ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 1);
+}
+
+/**
+ * Start a compaction pass. Pages at the end of the file, as many as
+ * there are free pages, are to be emptied into free pages below them.
+ * Only pages after the bucket pages of the last level can be cut off
+ * the file. A current data page among them, of the data page runs too,
+ * is closed, so that moved data go to lower pages.
+ *
+ * This routine is called with hashp->lock held
+ */
+static void
+_ffdb_start_compaction (ffdb_htab_t* hashp, pgno_t end)
+{
+  unsigned int nfree, i;
+  pgno_t first;
+
+  hashp->compact_limit = end;
+  nfree = _ffdb_count_free_pages (hashp);
+  if (nfree == 0 || nfree >= end)
+    return;
+  BUCKET_TO_PAGE(hashp->hdr.high_mask, first);
+  first++;
+  hashp->compact_limit = (end - nfree > first) ? end - nfree : first;
+
+  _ffdb_close_data_page (hashp, hashp->curr_dpage);
+  for (i = 0; i < hashp->nruns; i++)
+    _ffdb_close_data_page (hashp, hashp->run_dpages[i]);
+}
+
+/**
+ * Compact data pages. Live data on data pages which are mostly dead
+ * are moved to the current data page. The emptied pages go to the free
+ * pages, and free pages at the end of the file are cut off once all
+ * data pages have been looked at.
+ *
+ * Each call looks at up to npages pages, continuing where the previous
+ * call stopped. Only one item is moved at a time, so readers and
+ * writers keep going while the database is compacted.
+ */
+int
+ffdb_compact_pages (ffdb_htab_t* hashp, unsigned int npages)
+{
+  ffdb_citem_t* items;
+  ffdb_data_header_t* header;
+  pgno_t page, first, end, hfirst, hlast, tp;
+  unsigned int i, k, n, off, live, len, examined;
+  void* pagep;
+  int status;
+
+  items = (ffdb_citem_t *)malloc (hashp->hdr.bsize / BIG_DATA_OVERHEAD *
+				  sizeof(ffdb_citem_t));
+  if (!items) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  FFDB_LOCK (hashp->lock);
+  /* Pages from the first bucket page to the last page in use.
+   * Bucket pages not used yet on the last level are skipped
+   */
+  BUCKET_TO_PAGE(0, first);
+  BUCKET_TO_PAGE(hashp->hdr.max_bucket, hfirst);
+  hfirst++;
+  BUCKET_TO_PAGE(hashp->hdr.high_mask, hlast);
+  end = hashp->hdr.spares[hashp->hdr.ovfl_point + 1];
+  if (end == 0)
+    end = hfirst;
+
+  page = hashp->compact_page;
+  if (page < first || page >= end) {
+    page = first;
+    _ffdb_start_compaction (hashp, end);
+  }
+  FFDB_UNLOCK (hashp->lock);
+
+  status = 0;
+  examined = 0;
+  while (examined < npages && page < end && status >= 0) {
+    if (page >= hfirst && page <= hlast) {
+      page = hlast + 1;
+      continue;
+    }
+    examined++;
+
+    pagep = ffdb_get_page (hashp, page, HASH_RAW_PAGE, FFDB_PAGE_SHARED, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get page %d to compact\n", page);
+      status = -1;
+      break;
+    }
+
+    /* Overflow pages of buckets at the end are moved as a whole */
+    if (page >= hashp->compact_limit && 
+	(TYPE(pagep) == HASH_BUCKET_PAGE || TYPE(pagep) == HASH_OVFL_PAGE)) {
+      ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+      status = _ffdb_move_key_page (hashp, page);
+      page++;
+      continue;
+    }
+
+    /* Live bytes on this page and data headers of live items */
+    n = live = 0;
+    if (TYPE(pagep) == HASH_DATA_PAGE && NUM_ENT(pagep) > 0 &&
+	!_ffdb_current_data_page (hashp, page)) {
+      if (FIRST_DATA_POS(pagep) > BIG_PAGE_OVERHEAD)
+	live = FIRST_DATA_POS(pagep) - BIG_PAGE_OVERHEAD;
+      off = FIRST_DATA_POS(pagep);
+      for (i = 0; i < NUM_ENT(pagep); i++) {
+	header = BIG_DATA_HEADER(pagep, off);
+	if (header->status == DATA_VALID) {
+	  len = BIG_DATA_OVERHEAD + header->len;
+	  live += (off + len > hashp->hdr.bsize) ? hashp->hdr.bsize - off : len;
+	  items[n].offset = off;
+	  items[n].kpage = header->key_page;
+	  items[n].kidx = header->key_idx;
+	  n++;
+	}
+	off = header->next;
+      }
+      if (live * COMPACT_FRACTION >= hashp->hdr.bsize - BIG_PAGE_OVERHEAD &&
+	  page < hashp->compact_limit)
+	n = 0;
+    }
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+
+    for (k = 0; k < n && status >= 0; k++) 
+      status = _ffdb_move_data (hashp, page, items[k].offset,
+				items[k].kpage, items[k].kidx);
+    page++;
+  }
+  free (items);
+
+  if (status < 0) {
+    hashp->compact_page = page;
+    return -1;
+  }
+  if (page < end) {
+    hashp->compact_page = page;
+    return 1;
+  }
+
+  /* A pass is over */
+  hashp->compact_page = INVALID_PGNO;
+  FFDB_LOCK (hashp->lock);
+  _ffdb_trim_free_pages (hashp);
+  FFDB_UNLOCK (hashp->lock);
+
+  return 0;
+}
+
+
+/**
+ * Update Data Page Content when a key page are rearranged to fill gaps.
+ * Inside the key page (overflow), there are datap value pointing to
+ * data pages which contain key_page information for each data. These
+ * key_page value need to be updated to the new location.
+ * 
+ */
+static int
+_ffdb_update_data_pages_content (ffdb_htab_t* hashp, void *pagep, 
+				 pgno_t oldpage, pgno_t newpage,
+				 pgno_t oldfirst, pgno_t oldlast,
+				 pgno_t newfirst, pgno_t newlast)
+{
+  unsigned int i;
+  void* dpagep;
+  pgno_t dp;
+  ffdb_data_header_t *header = 0;
+  ffdb_datap_t* datap = 0;
+
+  for (i = 0; i < NUM_ENT(pagep); i++) {
+    datap = DATAP(pagep, i);
+
+    /* First check whether this data page pointed by datap->first
+     * is a page to be moved. If yes, we are doing nothing, since
+     * its key_page content is already updated when the data page
+     * is moved
+     */
+    if (datap->first >= newfirst && datap->first <= newlast)
+      continue;
+
+    /* get data page pointed back by this pointer */
+    dpagep = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 0, &dp);
+    if (!dpagep) {
+      fprintf (stderr, "Cannot get data page %d pointed by overflow page %d item %d\n",
+	       datap->first, oldpage, i);
+      return -1;
+    }
+    
+    /* change information on the key page */
+    header = BIG_DATA_HEADER(dpagep, datap->offset);
+
+    assert (header->key_page == oldpage);
+
+    /* key_page data item entry points to this new page */
+    header->key_page = newpage;
+
+    /* Put back the page */
+    ffdb_put_page (hashp, dpagep, TYPE(dpagep), 1);
+  }
+  return 0;
+}
+
+
+/**
+ * Update all Key Pages (either primary or overflow) content when a data page
+ * is moved. The data page contains one or more key page information through
+ * key_page field. A new hash key item is accessed through key_page and 
+ * key_indx pair. The data pointer value (datap->first) of this hash item
+ * has to be updated to the new page.
+ *
+ * If the key_page is also among pages that are moved, the data header's 
+ * key_page will be updated to its new location.
+ */
+static int
+_ffdb_update_key_pages_content (ffdb_htab_t* hashp, void *pagep, 
+				pgno_t oldpage, pgno_t newpage,
+				pgno_t oldfirst, pgno_t oldlast,
+				pgno_t newfirst, pgno_t newlast)
+{
+  unsigned int i, next;
+  void* kpagep;
+  pgno_t kp, newkp;
+  ffdb_data_header_t *header = 0;
+  ffdb_datap_t* datap = 0;
+
+  next = FIRST_DATA_POS(pagep);
+  for (i = 0; i < NUM_ENT(pagep); i++) {
+    header = BIG_DATA_HEADER(pagep, next);
+
+    /* A deleted data item has no key pointing to it */
+    if (header->status != DATA_VALID) {
+      next = header->next;
+      continue;
+    }
+
+    /* get key page pointed back by this header */
+    kpagep = ffdb_get_page (hashp, header->key_page, HASH_RAW_PAGE, 0, &kp);
+    if (!kpagep) {
+      fprintf (stderr, "Cannot get key page %d from data page %d item %d\n",
+	       header->key_page, oldpage, i);
+      return -1;
+    }
+    
+    /* change information on the key page */
+    datap = DATAP(kpagep, header->key_idx);
+
+#ifdef _FFDB_DEBUG
+    fprintf (stderr, "page %d Datap checksum = 0x%x header key = %d\n", oldpage,
+	     datap->chksum, header->key_page);
+#endif
+
+    assert (datap->first == oldpage);
+
+    /* Key page data item entry points to this new page */
+    datap->first = newpage;
+
+    /* Check whether the key page actually is going to be moved */
+    /* this works based on assumption data pages are moved first */
+    /* the data page entry points back to the new hash page that
+     * is going to be moved to newkp
+     */
+    if (header->key_page >= oldfirst && header->key_page <= oldlast) {
+      newkp = newfirst + (header->key_page - oldfirst);
+#ifdef _FFDB_DEBUG
+      fprintf (stderr, "Data Page %d contains hash key entry %d that moves to %d\n", oldpage, header->key_page, newkp);
+#endif
+      /* Now my header has to be changed to point to new page as well */
+      header->key_page = newkp;
+    }
+    
+    next = header->next;
+
+    /* Put back the page */
+    ffdb_put_page (hashp, kpagep, TYPE(kpagep), 1);
+  }
+  return 0;
+}
+
+/**
+ * Clean out range of pages from pagepool cache
+ * @param hashp hashtable pointer
+ * @param first the first page to be removed
+ * @param last the last page to be removed
+ */
+static void _ffdb_remove_pages (ffdb_htab_t* hashp, 
+				pgno_t first, pgno_t last)
+{
+  unsigned int numpages, i;
+  pgno_t page, tp;
+  void *pagep;
+
+  /* total number of pages to be removed */
+  numpages = last - first + 1;
+
+  page = first;
+  for (i = 0; i < numpages; i++) {
+    pagep = ffdb_get_page (hashp, page, HASH_RAW_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Warning: cannot find moved old page %d \n",
+	       page);
+      page++;
+      continue;
+    }
+    if (ffdb_pagepool_delete (hashp->mp, pagep) != 0) 
+      fprintf (stderr, "Cannot delete a moved page %d\n", page);
+    page++;
+  }
+}
+  
+
+
+/**
+ * Move pages when the file closes
+ *
+ * @param hashp hash table pointer
+ * @param type this type of pages to be moved
+ * @param oldfirst first page of old pages to be moved
+ * @param oldlast the last page of old page to be moved
+ * @param newfirst first page of new pages to move into
+ * @param newlast last page of new pages to move into
+ *
+ * @return last page number on the linked list after successful move. 
+ * If there is no data pages being moved, INVALID_PGNO is returned
+ */
+static pgno_t
+_ffdb_move_pages (ffdb_htab_t* hashp, unsigned short type,
+		  pgno_t oldfirst, pgno_t oldlast,
+		  pgno_t newfirst, pgno_t newlast)
+{
+  pgno_t dlast, page, rpage, tp;
+  pgno_t prevp, nextp;
+  unsigned int numpages, i;
+  void *pagep, *prevpagep, *nextpagep;
+
+  dlast = INVALID_PGNO;
+  /* Create page header array to keep track old page information */
+  numpages = oldlast - oldfirst + 1;
+
+  /* Now we can move pages */
+  page = oldfirst;
+  rpage = newfirst;
+  for (i = 0; i < numpages; i++) {
+    pagep = ffdb_get_page (hashp, page, HASH_RAW_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot grab old page %d to move to new page %d.\n",
+	       page, rpage);
+      return dlast;
+    }
+
+    if (TYPE(pagep) != type) {
+      page++;
+      rpage++;
+      ffdb_put_page (hashp, pagep, HASH_RAW_PAGE, 0);
+      continue;
+    }
+
+    /* Get its original previous and next page number */
+    nextp = NEXT_PGNO(pagep);
+    prevp = PREV_PGNO(pagep);
+
+    if (nextp != INVALID_PGNO) {
+      if (nextp < oldfirst || nextp > oldlast) {
+	/* The next page is not going to be moved, its previous link 
+	 * Should be updated
+	 */
+	nextpagep = ffdb_get_page (hashp, nextp, HASH_RAW_PAGE, 0, &tp);
+	if (!nextpagep) {
+	  fprintf (stderr, "Cannot get next page %d not in the moving list for page %d\n", nextp, page);
+	  ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+	  return dlast;
+	}
+
+	PREV_PGNO(nextpagep) = rpage;
+	ffdb_put_page (hashp, nextpagep, TYPE(nextpagep), 1);
+      }
+      else {
+	/* I have to update this page next link to a new page number */
+	NEXT_PGNO(pagep) = newfirst + (nextp - oldfirst);
+      }
+    }
+    else {
+      /* This is last data page in these moved page.
+       * update last new location of this page
+       */
+      if (type == HASH_DATA_PAGE)
+	dlast = rpage;
+    }
+
+
+    if (prevp != INVALID_PGNO) {
+      if (prevp < oldfirst || prevp > oldlast) {
+	/* The previous page is not going to be moved, its previous link 
+	 * Should be updated
+	 */
+	prevpagep = ffdb_get_page (hashp, prevp, HASH_RAW_PAGE, 0, &tp);
+	if (!prevpagep) {
+	  fprintf (stderr, "Cannot get previous page %d not in the moving list for page %d\n", prevp, page);
+	  ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+	  return dlast;
+	}
+
+	NEXT_PGNO(prevpagep) = rpage;
+	ffdb_put_page (hashp, prevpagep, TYPE(prevpagep), 1);
+      }
+      else {
+	/* The previous link of this page has to be updated */
+	PREV_PGNO(pagep) = newfirst + (prevp - oldfirst);
+      }
+    }
+    else if (type == HASH_INDEX_PAGE) {
+      /* The first index page is found from the header */
+      hashp->hdr.idx_page = rpage;
+    }
+
+    /* Now update current page number */
+    CURR_PGNO(pagep) = rpage;
+
+#ifdef _FFDB_DEBUG
+    fprintf (stderr, "Move old page type 0x%x %d to new page %d\n", type, page, rpage);
+#endif
+
+    /* Now update the hash data content on the primary pages
+     * pointed by key field of data on this page
+     */
+    if (type == HASH_DATA_PAGE) {
+      if (_ffdb_update_key_pages_content (hashp, pagep, page, rpage, 
+					  oldfirst, oldlast,
+					  newfirst, newlast) != 0) {
+	/* Release this page and update page number */
+	ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+	return dlast;
+      }
+#ifdef _FFDB_DEBUG
+      fprintf (stderr, "Update primary page for data page %d %d page = %d page sign = 0x%x\n", page, rpage, CURR_PGNO(pagep), PAGE_SIGN(pagep));
+#endif
+    }
+    else if (type == HASH_BUCKET_PAGE) {
+      /* Update the key page entry inside each data page pointed 
+       * by the overflow page. The data pages that have been moved
+       *will not be updated since they are updated by the above routine
+       */
+      if (_ffdb_update_data_pages_content (hashp, pagep, page, rpage,
+					   oldfirst, oldlast,
+					   newfirst, newlast) != 0) {
+	/* Release this page and update page number */
+	ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+	return dlast;
+      }
+#ifdef _FFDB_DEBUG
+      fprintf (stderr, "Update data page for primary page %d %d page = %d page sign = 0x%x\n", page, rpage, CURR_PGNO(pagep), PAGE_SIGN(pagep));
+#endif
+    }
+      
+
+    /* Release this page and update page number */
+    ffdb_pagepool_change_page (hashp->mp, pagep, CURR_PGNO(pagep));
+
+    /* update local variables */
+    rpage++;
+    page++;    
+  }
+    
+  return dlast;
+}
+
+/**
+ * Optional to reorganize the pages to fill holes left by 
+ * not fully using all buckets pages at a particular level
+ */
+int
+ffdb_rearrage_pages_on_close (ffdb_htab_t* hashp)
+{
+  pgno_t funused, lunused;
+  pgno_t dlast, dfirst;
+  unsigned int num_unused, num_pages;
+  unsigned int num_page_moved;
+
+  /* Find out how many pages are not used by reguler hash pages */
+  num_unused = hashp->hdr.high_mask - hashp->hdr.max_bucket;
+  if (num_unused == 0)
+    return 0;
+
+  /* First and last unused page */
+  BUCKET_TO_PAGE(hashp->hdr.max_bucket + 1, funused);
+  BUCKET_TO_PAGE(hashp->hdr.high_mask, lunused);
+#if 1
+  fprintf (stderr, "There are %d pages (buckets) not used starting at page %d and end at %d on last level %d\n",
+	   num_unused, funused, lunused, hashp->hdr.ovfl_point);
+#endif
+
+  /* This is the last page used so far */
+  dlast = hashp->hdr.spares[hashp->hdr.ovfl_point + 1] - 1;
+  assert (dlast > 0);
+  assert (dlast > lunused);
+
+#if 0
+  fprintf (stderr, "Last data page = %d\n", dlast);
+#endif
+
+  /* Now we need to figure out what pages to move
+   * These pages may contain overflow pages and data pages
+   * which require different treatment. We move data pages
+   * first
+   */
+  num_pages = dlast - lunused;
+  num_page_moved = (num_pages < num_unused) ? num_pages : num_unused;
+
+  /* First page to be moved */
+  dfirst = dlast - num_page_moved + 1;
+  /* Update last free page to be used */
+  lunused = funused + num_page_moved  - 1;
+
+#if 1
+  fprintf (stderr, "We are going to move %d pages from %d to %d to new pages from %d to %d\n", num_page_moved, dfirst, dlast, funused, lunused);
+#endif
+
+  /* move data pages first */
+  _ffdb_move_pages (hashp, HASH_DATA_PAGE, dfirst, dlast,
+		    funused, lunused);
+
+  /* move overflow page next */
+  _ffdb_move_pages (hashp, HASH_BUCKET_PAGE, dfirst, dlast,
+		    funused, lunused);
+
+  _ffdb_move_pages (hashp, HASH_FREE_PAGE, dfirst, dlast,
+		    funused, lunused);
+
+  _ffdb_move_pages (hashp, HASH_INDEX_PAGE, dfirst, dlast,
+		    funused, lunused);
+  ffdb_index_unload (hashp);
+
+  hashp->hdr.num_moved_pages = num_page_moved;
+
+  return 0;
+}
+
+
+/**
+ * Optional to reorganize the pages to move pages occuping
+ * reguler hash pages when the database expects new inserts
+ */
+int
+ffdb_rearrage_pages_on_open (ffdb_htab_t* hashp)
+{
+  pgno_t oldfirst, oldlast, newfirst, newlast;
+  pgno_t lastdpage;
+  unsigned int num_page_moved;
+
+  /* Check whether any pages has been moved when the database is closed */
+  if (hashp->hdr.num_moved_pages == 0)
+    return 0;
+  
+  if (hashp->hdr.max_bucket == hashp->hdr.high_mask) 
+    return 0;
+
+  /* We have not used every single hash bucket at the last level */
+  BUCKET_TO_PAGE(hashp->hdr.max_bucket + 1, oldfirst);
+
+  /* We will get number of moved page from meta header which
+   * records how many pages are moved when this file was closed
+   */
+  num_page_moved = hashp->hdr.num_moved_pages;
+  
+  oldlast = oldfirst + num_page_moved - 1;
+
+
+  /* We figure out where these page are going to */
+  newlast = hashp->hdr.spares[hashp->hdr.ovfl_point + 1] - 1;
+  newfirst = newlast - num_page_moved + 1;
+
+#if 1
+  fprintf (stderr, "Page can be moved starting at page %d and end at %d on last level %d to page %d to %d\n",
+	   oldfirst, oldlast, hashp->hdr.ovfl_point, newfirst, newlast);
+#endif
+
+
+  /* Move data pages first */
+  lastdpage = _ffdb_move_pages (hashp, HASH_DATA_PAGE, oldfirst, oldlast,
+				newfirst, newlast);
+
+  /* move overflow page next */
+  _ffdb_move_pages (hashp, HASH_BUCKET_PAGE, oldfirst, oldlast,
+		    newfirst, newlast);
+  
+  _ffdb_move_pages (hashp, HASH_FREE_PAGE, oldfirst, oldlast,
+		    newfirst, newlast);
+
+  _ffdb_move_pages (hashp, HASH_INDEX_PAGE, oldfirst, oldlast,
+		    newfirst, newlast);
+  ffdb_index_unload (hashp);
+
+  /* If there are no data pages moved, unlikely but possible */
+  if (lastdpage == INVALID_PGNO) 
+    hashp->curr_dpage = ffdb_last_data_page (hashp, newfirst - 1);
+
+  /* Reset the number of moved pages */
+  hashp->hdr.num_moved_pages = 0;
+
+  /* Clean out those pages from page cache to make memory
+   * the same as if there are no pages have been here
+   */
+  _ffdb_remove_pages (hashp, oldfirst, oldlast);
+
+  return 0;
+}
+
+
+int
+ffdb_reduce_filesize (ffdb_htab_t* hashp)
+{
+  pgno_t last;
+  off_t length;
+  int status;
+
+  /* This is the last page before all pages are moved */
+  last = hashp->hdr.spares[hashp->hdr.ovfl_point + 1] - 1;
+
+  /* The page pool is still open: it drops pages beyond the end */
+  if (hashp->mp) {
+    if ((status = ffdb_pagepool_truncate (hashp->mp, last + 1)) != 0) {
+      fprintf (stderr, "Cannot truncate database %s to %d pages\n",
+	       hashp->fname, last + 1);
+      return status;
+    }
+    return 0;
+  }
+
+  /* This is the last page after the pages are moved */
+  last = last - hashp->hdr.num_moved_pages;
+
+  /* Now we need to shrink the file size */
+  if (hashp->hdr.num_moved_pages > 0) {
+    length = (off_t)hashp->hdr.bsize * (last + 1);
+
+    if (ftruncate (hashp->fp, length) != 0) {
+      fprintf (stderr, "Cannot truncate database %s to length %lld\n",
+	       hashp->fname, length);
+      return errno;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Code related to configurations
+ */
+int 
+ffdb_set_configs (ffdb_htab_t* hashp, ffdb_all_config_info_t* configs)
+{
+  unsigned int i, k, cnum, numelems, tnums;
+  pgno_t page, tp;
+  void* pagep;
+  ffdb_config_info_t* cfig;
+
+  /* index into all configs */
+  cnum = 0;
+  /* total number of configurations */
+  tnums = hashp->hdr.num_cfigs;
+
+  page = hashp->hdr.cfig_page;
+  for (i = 0; i < hashp->hdr.cfig_npages; i++) {
+    pagep = ffdb_get_page (hashp, page, HASH_CONFIG_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get configuration page %d.\n", page);
+      return -1;
+    }
+    /* number of configurations on this page */
+    numelems = (hashp->hdr.bsize - PAGE_OVERHEAD)/(sizeof(ffdb_config_info_t));
+    if (numelems > tnums)
+      numelems = tnums;
+    NUM_ENT(pagep) = numelems;
+
+    for (k = 0; k < NUM_ENT(pagep); k++) {
+      cfig = CONFIG_INFO(pagep, k);
+      memcpy (cfig, &(configs->allconfigs[cnum++]),
+	      sizeof(ffdb_config_info_t));
+    }
+
+    /* release page */
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
+    page++;
+    tnums -= numelems;
+  }
+  return 0;
+}
+
+
+int 
+ffdb_get_configs (ffdb_htab_t* hashp, ffdb_all_config_info_t* configs)
+{
+  unsigned int i, k, cnum;
+  pgno_t page, tp;
+  void* pagep;
+  ffdb_config_info_t* cfig;
+
+  cnum = 0;
+  page = hashp->hdr.cfig_page;
+  for (i = 0; i < hashp->hdr.cfig_npages; i++) {
+    pagep = ffdb_get_page (hashp, page, HASH_CONFIG_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get configuration page %d.\n", page);
+      return -1;
+    }
+    
+    for (k = 0; k < NUM_ENT(pagep); k++) {
+      cfig = CONFIG_INFO(pagep, k);
+      memcpy (&(configs->allconfigs[cnum++]), cfig,
+	      sizeof(ffdb_config_info_t));
+    }
+
+    /* release page */
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+    page++;
+  }
+  return 0;
+}
+
+
+int 
+ffdb_set_config_info (ffdb_htab_t* hashp, ffdb_config_info_t* config)
+{
+  unsigned int i, k;
+  pgno_t page, tp;
+  void* pagep;
+  ffdb_config_info_t* cfig;
+
+  page = hashp->hdr.cfig_page;
+  for (i = 0; i < hashp->hdr.cfig_npages; i++) {
+    pagep = ffdb_get_page (hashp, page, HASH_CONFIG_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get configuration page %d.\n", page);
+      return -1;
+    }
+    
+    for (k = 0; k < NUM_ENT(pagep); k++) {
+      cfig = CONFIG_INFO(pagep, k);
+      if (cfig->index == config->index && cfig->config == config->config) {
+	memcpy (cfig, config, sizeof(ffdb_config_info_t));
+	ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
+	return 0;
+      }
+    }
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);    /* release page */
+    page++;
+  }
+  return -1;
+}
+
+
+int 
+ffdb_get_config_info (ffdb_htab_t* hashp, unsigned int confignum,
+		      ffdb_config_info_t* config)
+{
+  unsigned int i, k;
+  pgno_t page, tp;
+  void* pagep;
+  ffdb_config_info_t* cfig;
+
+  page = hashp->hdr.cfig_page;
+  for (i = 0; i < hashp->hdr.cfig_npages; i++) {
+    pagep = ffdb_get_page (hashp, page, HASH_CONFIG_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get configuration page %d.\n", page);
+      return -1;
+    }
+    
+    for (k = 0; k < NUM_ENT(pagep); k++) {
+      cfig = CONFIG_INFO(pagep, k);
+      if (cfig->config == confignum) {
+	memcpy (config, cfig, sizeof(ffdb_config_info_t));
+	ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+	return 0;
+      }
+    }
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);    /* release page */
+    page++;
+  }
+  return -1;
+}
+
+
+/**
+ * Set user meta information in the 2nd page
+ */
+int 
+ffdb_set_uinfo (ffdb_htab_t* hashp, unsigned char* data,
+		unsigned int len)
+{
+  unsigned int i, copylen, offset, idx, rlen;
+  pgno_t page, tp;
+  void* pagep;
+  
+  idx = 0;
+  rlen = len;
+  page = hashp->hdr.uinfo_page;
+  for (i = 0; i < hashp->hdr.uinfo_npages; i++) {
+    pagep = ffdb_get_page (hashp, page, HASH_UINFO_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get page %d to store user information.\n",
+	       page);
+      return -1;
+    }
+    if (i == 0) {
+      /* Set number of item to 1 on the first page */
+      NUM_ENT(pagep) = 1;
+      USER_DATA_LEN(pagep) = rlen;
+      if (rlen > hashp->hdr.bsize - PAGE_OVERHEAD - sizeof(unsigned int)) 
+	copylen = hashp->hdr.bsize - PAGE_OVERHEAD - sizeof(unsigned int);
+      else 
+	copylen = rlen;
+      offset = PAGE_OVERHEAD + sizeof(unsigned int);
+    }
+    else {
+      /* Set number of item to 0 on the other pages */
+      NUM_ENT(pagep) = 0;
+      if (rlen > hashp->hdr.bsize - PAGE_OVERHEAD) 
+	copylen = hashp->hdr.bsize - PAGE_OVERHEAD;
+      else
+	copylen = rlen;
+      offset = PAGE_OVERHEAD;
+    }
+    /* where to start copy from data */
+    idx = len - rlen;
+
+    memcpy ((unsigned char *)pagep + offset, &data[idx], copylen);
+
+    /* put page out */
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
+
+    rlen -= copylen;
+
+    page++;
+  }
+  return 0;
+}
+
+
+/**
+ * Get user meta information in the 2nd page
+ */
+int 
+ffdb_get_uinfo (ffdb_htab_t* hashp, unsigned char data[],
+		unsigned int *len)
+{
+  unsigned int i, copylen, offset, idx, rlen;
+  pgno_t page, tp;
+  void* pagep;
+  
+  idx = 0;
+  rlen = *len;
+  page = hashp->hdr.uinfo_page;
+  for (i = 0; i < hashp->hdr.uinfo_npages; i++) {
+    pagep = ffdb_get_page (hashp, page, HASH_UINFO_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get page %d to retrieve user information.\n",
+	       page);
+      return -1;
+    }
+    if (i == 0) {
+      if (*len < USER_DATA_LEN(pagep)) {
+	fprintf (stderr, "Error: provided user buffer size %d < stored data length %d.\n", *len, USER_DATA_LEN(pagep));
+	return -1;
+      }
+      *len = USER_DATA_LEN(pagep);
+      rlen = *len;
+
+      if (rlen > hashp->hdr.bsize - PAGE_OVERHEAD - sizeof(unsigned int)) 
+	copylen = hashp->hdr.bsize - PAGE_OVERHEAD - sizeof(unsigned int);
+      else 
+	copylen = rlen;
+      offset = PAGE_OVERHEAD + sizeof(unsigned int);
+    }
+    else {
+      if (rlen > hashp->hdr.bsize - PAGE_OVERHEAD) 
+	copylen = hashp->hdr.bsize - PAGE_OVERHEAD;
+      else
+	copylen = rlen;
+      offset = PAGE_OVERHEAD;
+    }
+    /* where to start copy from data */
+    idx = *len - rlen;
+
+    memcpy (&data[idx], (unsigned char *)pagep + offset, copylen);
+
+    /* put page out */
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+
+    rlen -= copylen;
+
+    page++;
+  }
+  return 0;
+}
+
+/**
+ * Buffers holding the key and the data handed to a scan routine
+ */
+typedef struct _ffdb_scan_buf_ {
+  FFDB_DBT     key;             /* key of the current pair */
+  unsigned int kmax;            /* space of the key buffer */
+  FFDB_DBT     val;             /* data of the current pair */
+  unsigned int vmax;            /* space of the data buffer */
+}ffdb_scan_buf_t;
+
+/**
+ * Make a scan buffer hold at least size bytes
+ *
+ * @return 0 on success, -1 when there is no memory
+ */
+static int
+_ffdb_scan_buffer (FFDB_DBT* buf, unsigned int* max, unsigned int size)
+{
+  void* data;
+
+  if (size <= *max)
+    return 0;
+  data = realloc (buf->data, size);
+  if (!data) {
+    errno = ENOMEM;
+    return -1;
+  }
+  buf->data = data;
+  *max = size;
+  return 0;
+}
+
+/**
+ * Hand a live data item found on a data page to a scan routine together
+ * with its key. The key is found through the back pointer in the data
+ * header and has to point at the item as well. The key and the data are
+ * copied into the buffers of the scan, which grow to the largest pair.
+ *
+ * @return 0 on success or when the item has changed since the data
+ * page was looked at, -1 on failure, otherwise the value returned by
+ * the scan routine
+ */
+static int
+_ffdb_scan_item (ffdb_htab_t* hashp, pgno_t dpage, ffdb_citem_t* citem,
+		 ffdb_scan_buf_t* sb, ffdb_scan_func_t func, void* arg)
+{
+  void* kpagep;
+  pgno_t tp;
+  ffdb_datap_t datap;
+  ffdb_hent_t item;
+  FFDB_DBT key, val;
+  int status;
+
+  kpagep = ffdb_get_page (hashp, citem->kpage, HASH_RAW_PAGE,
+			  FFDB_PAGE_SHARED, &tp);
+  if (!kpagep) {
+    fprintf (stderr, "Cannot get key page %d to scan\n", citem->kpage);
+    return -1;
+  }
+
+  /* The key may have been deleted or moved in the mean time */
+  if ((TYPE(kpagep) != HASH_BUCKET_PAGE && TYPE(kpagep) != HASH_OVFL_PAGE) ||
+      citem->kidx >= NUM_ENT(kpagep) ||
+      DATAP(kpagep, citem->kidx)->first != dpage ||
+      DATAP(kpagep, citem->kidx)->offset != citem->offset) {
+    ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+    return 0;
+  }
+  datap = *(DATAP(kpagep, citem->kidx));
+
+  key.size = KEY_LEN(kpagep, citem->kidx);
+  if (_ffdb_scan_buffer (&sb->key, &sb->kmax, key.size) != 0) {
+    ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+    return -1;
+  }
+  key.data = sb->key.data;
+  memcpy (key.data, KEY(kpagep, citem->kidx), key.size);
+  ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+
+  item.pgno = citem->kpage;
+  item.pgndx = citem->kidx;
+  val.data = sb->val.data;
+  val.size = sb->vmax;
+  status = _ffdb_get_data (hashp, &item, &val, &datap, 1);
+  if (status == FFDB_SPECIAL) {
+    /* The buffer is too small: val.size is the length of the data */
+    if (_ffdb_scan_buffer (&sb->val, &sb->vmax, val.size) != 0)
+      return -1;
+    val.data = sb->val.data;
+    val.size = sb->vmax;
+    status = _ffdb_get_data (hashp, &item, &val, &datap, 1);
+  }
+  if (status != 0)
+    return (status > 0) ? 0 : -1;
+
+  /* The key and the data stay with the scan and are reused */
+  return func (&key, &val, arg);
+}
+
+/**
+ * Scan all key and data pairs in the order their data are stored in the
+ * file. Pages are read front to back in batches of FFDB_IO_DEPTH pages.
+ * Each live data item is joined with its key through the back pointer
+ * in its data header.
+ */
+int
+ffdb_scan_pages (ffdb_htab_t* hashp, ffdb_scan_func_t func, void* arg)
+{
+  ffdb_citem_t* items;
+  ffdb_scan_buf_t sb;
+  ffdb_data_header_t* header;
+  pgno_t pgnos[FFDB_IO_DEPTH];
+  pgno_t page, first, end, hfirst, hlast, ra, tp;
+  unsigned int i, k, n, off;
+  void* pagep;
+  int status;
+
+  items = (ffdb_citem_t *)malloc (hashp->hdr.bsize / BIG_DATA_OVERHEAD *
+				  sizeof(ffdb_citem_t));
+  if (!items) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* Pairs on a single data page fit the buffers from the start */
+  memset (&sb, 0, sizeof (sb));
+  if (_ffdb_scan_buffer (&sb.key, &sb.kmax, hashp->hdr.bsize) != 0 ||
+      _ffdb_scan_buffer (&sb.val, &sb.vmax, hashp->hdr.bsize) != 0) {
+    free (sb.key.data);
+    free (items);
+    return -1;
+  }
+
+  /* The same pages compaction looks at: bucket pages not used yet on
+   * the last level are skipped
+   */
+  FFDB_LOCK (hashp->lock);
+  BUCKET_TO_PAGE(0, first);
+  BUCKET_TO_PAGE(hashp->hdr.max_bucket, hfirst);
+  hfirst++;
+  BUCKET_TO_PAGE(hashp->hdr.high_mask, hlast);
+  end = hashp->hdr.spares[hashp->hdr.ovfl_point + 1];
+  if (end == 0)
+    end = hfirst;
+  /* In a read only database the last pages stay where they were moved
+   * on close, onto the first bucket pages not used yet
+   */
+  if (hashp->hdr.num_moved_pages > 0) {
+    hfirst += hashp->hdr.num_moved_pages;
+    end -= hashp->hdr.num_moved_pages;
+  }
+  FFDB_UNLOCK (hashp->lock);
+
+  status = 0;
+  ra = first;
+  page = first;
+  while (page < end && status == 0) {
+    if (page >= hfirst && page <= hlast) {
+      page = hlast + 1;
+      continue;
+    }
+
+    /* Read the next batch of pages in one go */
+    if (page >= ra) {
+      n = 0;
+      for (ra = page; ra < end && n < FFDB_IO_DEPTH; ra++) {
+	if (ra < hfirst || ra > hlast)
+	  pgnos[n++] = ra;
+      }
+      ffdb_pagepool_prefetch (hashp->mp, pgnos, n);
+    }
+
+    pagep = ffdb_get_page (hashp, page, HASH_RAW_PAGE, FFDB_PAGE_SHARED, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get page %d to scan\n", page);
+      status = -1;
+      break;
+    }
+
+    /* Data headers of live items on this page */
+    n = 0;
+    if (TYPE(pagep) == HASH_DATA_PAGE) {
+      off = FIRST_DATA_POS(pagep);
+      for (i = 0; i < NUM_ENT(pagep) && off != 0; i++) {
+	header = BIG_DATA_HEADER(pagep, off);
+	if (header->status == DATA_VALID) {
+	  items[n].offset = off;
+	  items[n].kpage = header->key_page;
+	  items[n].kidx = header->key_idx;
+	  n++;
+	}
+	off = header->next;
       }
     }
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
 
-    /* Now update current page number */
-    CURR_PGNO(pagep) = rpage;
+    for (k = 0; k < n && status == 0; k++)
+      status = _ffdb_scan_item (hashp, page, &items[k], &sb, func, arg);
+    page++;
+  }
+  free (sb.key.data);
+  free (sb.val.data);
+  free (items);
 
-#ifdef _FFDB_DEBUG
-    fprintf (stderr, "Move old page type 0x%x %d to new page %d\n", type, page, rpage);
-#endif
+  return status;
+}
 
-    /* Now update the hash data content on the primary pages
-     * pointed by key field of data on this page
-     */
-    if (type == HASH_DATA_PAGE) {
-      if (_ffdb_update_key_pages_content (hashp, pagep, page, rpage, 
-					  oldfirst, oldlast,
-					  newfirst, newlast) != 0) {
-	/* Release this page and update page number */
-	ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
-	return dlast;
-      }
-#ifdef _FFDB_DEBUG
-      fprintf (stderr, "Update primary page for data page %d %d page = %d page sign = 0x%x\n", page, rpage, CURR_PGNO(pagep), PAGE_SIGN(pagep));
-#endif
+/***************************************************************************
+ *         Cursor related routines                                         *
+ ***************************************************************************/
+
+/**
+ * Last bucket walked by a cursor. The bucket range of a cursor may go
+ * past the last bucket of the table
+ */
+#define CURSOR_LAST_BUCKET(h,c)						\
+  (((c)->hi_bucket <= (h)->hdr.max_bucket) ? (c)->hi_bucket - 1 :	\
+   (h)->hdr.max_bucket)
+
+/**
+ * Read ahead bucket pages for a cursor that has just moved forward
+ * to a new bucket. Bucket pages of one split level are contiguous
+ * in the file, so the page pool reads most of them in a few requests.
+ */
+static void
+_ffdb_cursor_readahead (ffdb_htab_t* hashp, ffdb_crs_t* cursor)
+{
+  pgno_t pgnos[FFDB_CURSOR_RA_MAX];
+  pgno_t bucket, last;
+  unsigned int n;
+
+  /* The first step forward starts a new window */
+  if (cursor->ra_window == 0) {
+    cursor->ra_window = FFDB_CURSOR_RA_MIN;
+    cursor->ra_bucket = cursor->item.bucket + 1;
+  }
+  if (cursor->ra_bucket <= cursor->item.bucket)
+    cursor->ra_bucket = cursor->item.bucket + 1;
+
+  /* Read ahead again once half of the window is left */
+  last = CURSOR_LAST_BUCKET(hashp, cursor);
+  if (cursor->ra_bucket > last ||
+      cursor->item.bucket + cursor->ra_window / 2 < cursor->ra_bucket)
+    return;
+
+  n = 0;
+  for (bucket = cursor->ra_bucket;
+       n < cursor->ra_window && bucket <= last; bucket++)
+    BUCKET_TO_PAGE(bucket, pgnos[n++]);
+  cursor->ra_bucket = bucket;
+
+  if (cursor->ra_window < FFDB_CURSOR_RA_MAX)
+    cursor->ra_window *= 2;
+
+  ffdb_pagepool_prefetch (hashp->mp, pgnos, n);
+}
+
+/**
+ * Read ahead the pages a cursor needs for the key page it has just
+ * moved to: its overflow page and, if data is retrieved as well, the
+ * data pages of all its items.
+ */
+static void
+_ffdb_cursor_readahead_page (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+			     int data)
+{
+  pgno_t pgnos[FFDB_IO_DEPTH];
+  pgno_t pgno, last;
+  ffdb_datap_t* datap;
+  void* pagep = cursor->item.pagep;
+  unsigned int i, k, n;
+
+  n = 0;
+  if (NEXT_PGNO(pagep) != INVALID_PGNO)
+    pgnos[n++] = NEXT_PGNO(pagep);
+
+  if (data) {
+    for (i = 0; i < NUM_ENT(pagep) && n < FFDB_IO_DEPTH; i++) {
+      datap = DATAP(pagep, i);
+      /* Data of one item is mostly on consecutive pages */
+      last = datap->first + (datap->offset + BIG_DATA_OVERHEAD +
+			     datap->len) / hashp->hdr.bsize;
+      for (pgno = datap->first; pgno <= last && n < FFDB_IO_DEPTH; pgno++)
+	pgnos[n++] = pgno;
     }
-    else if (type == HASH_BUCKET_PAGE) {
-      /* Update the key page entry inside each data page pointed 
-       * by the overflow page. The data pages that have been moved
-       *will not be updated since they are updated by the above routine
-       */
-      if (_ffdb_update_data_pages_content (hashp, pagep, page, rpage,
-					   oldfirst, oldlast,
-					   newfirst, newlast) != 0) {
-	/* Release this page and update page number */
-	ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
-	return dlast;
-      }
-#ifdef _FFDB_DEBUG
-      fprintf (stderr, "Update data page for primary page %d %d page = %d page sign = 0x%x\n", page, rpage, CURR_PGNO(pagep), PAGE_SIGN(pagep));
-#endif
+  }
+
+  /* A single page is read just as fast when it is needed */
+  if (n < 2)
+    return;
+
+  qsort (pgnos, n, sizeof(pgno_t), _ffdb_pgno_cmp);
+  for (i = 1, k = 1; i < n; i++) {
+    if (pgnos[i] != pgnos[k - 1])
+      pgnos[k++] = pgnos[i];
+  }
+  ffdb_pagepool_prefetch (hashp->mp, pgnos, k);
+}
+
+/**
+ * Pin the first non-empty bucket page of a cursor walking forward from
+ * a bucket up to the last bucket, and put the cursor on its first item
+ */
+static int
+_ffdb_cursor_forward (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+		      pgno_t bucket, pgno_t last)
+{
+  pgno_t tp;
+
+  for (;;) {
+    cursor->item.pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE,
+					FFDB_PAGE_SHARED, &tp);
+    if (!(cursor->item.pagep)) {
+      fprintf (stderr, "Cannot get page for bucket %d for cursor.\n",
+	       bucket);
+      cursor->item.status = ITEM_ERROR;
+      return -1;
     }
-      
+    if (NUM_ENT(cursor->item.pagep) > 0)
+      break;
 
-    /* Release this page and update page number */
-    ffdb_pagepool_change_page (hashp->mp, pagep, CURR_PGNO(pagep));
+    /* Skip empty buckets */
+    ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
+    cursor->item.pagep = 0;
+    if (bucket >= last) {
+      /* End of buckets and we are done */
+      cursor->item.status = ITEM_NO_MORE;
+      return FFDB_NOT_FOUND;
+    }
+    bucket++;
+  }
+  cursor->item.bucket = bucket;
+  cursor->item.pgno = tp;
+  cursor->item.pgndx = 0;
+  cursor->item.status = ITEM_OK;
+  return 0;
+}
 
-    /* update local variables */
-    rpage++;
-    page++;    
+/**
+ * Pin the first non-empty bucket page of a cursor walking backward from
+ * a bucket down to the first bucket of the cursor, and put the cursor
+ * on its last item
+ */
+static int
+_ffdb_cursor_backward (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+		       pgno_t bucket)
+{
+  pgno_t tp;
+
+  for (;;) {
+    cursor->item.pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE,
+					FFDB_PAGE_SHARED, &tp);
+    if (!(cursor->item.pagep)) {
+      fprintf (stderr, "Cannot get page for bucket %d for cursor.\n",
+	       bucket);
+      cursor->item.status = ITEM_ERROR;
+      return -1;
+    }
+    if (NUM_ENT(cursor->item.pagep) > 0)
+      break;
+
+    /* Skip empty buckets */
+    ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
+    cursor->item.pagep = 0;
+    if (bucket <= cursor->lo_bucket) {
+      /* this is the first one and it is empty */
+      cursor->item.status = ITEM_NO_MORE;
+      return FFDB_NOT_FOUND;
+    }
+    bucket--;
   }
-    
-  return dlast;
+  cursor->item.bucket = bucket;
+  cursor->item.pgno = tp;
+  cursor->item.pgndx = NUM_ENT(cursor->item.pagep) - 1;
+  cursor->item.status = ITEM_OK;
+
+  /* Backward walks do not read ahead */
+  cursor->ra_window = 0;
+  return 0;
 }
 
 /**
- * Optional to reorganize the pages to fill holes left by 
- * not fully using all buckets pages at a particular level
+ * Remember where a cursor is and put its key page back, so that the
+ * page is not held while the caller is busy with something else.
+ * The key is kept to find the item again if the page is changed
+ * before the next call.
  */
-int
-ffdb_rearrage_pages_on_close (ffdb_htab_t* hashp)
+static void
+_ffdb_cursor_release (ffdb_htab_t* hashp, ffdb_crs_t* cursor)
 {
-  pgno_t funused, lunused;
-  pgno_t dlast, dfirst;
-  unsigned int num_unused, num_pages;
-  unsigned int num_page_moved;
+  void* pagep = cursor->item.pagep;
+  unsigned int len = KEY_LEN(pagep, cursor->item.pgndx);
+  unsigned char* buf;
+
+  if (len > cursor->key_max) {
+    buf = (unsigned char *)realloc (cursor->key, len);
+    if (buf) {
+      cursor->key = buf;
+      cursor->key_max = len;
+    }
+  }
+  if (len <= cursor->key_max) {
+    memcpy (cursor->key, KEY(pagep, cursor->item.pgndx), len);
+    cursor->key_len = len;
+  }
+  else
+    /* Without the key the item cannot be found again */
+    cursor->key_len = 0;
+  if (hashp->hdr.version >= FFDB_VERSION_KEY_HASH)
+    cursor->key_hash = KEY_HASH(pagep, cursor->item.pgndx);
+  else
+    cursor->key_hash = 0;
+  cursor->page_mod = ffdb_pagepool_page_mod (hashp->mp, pagep);
 
-  /* Find out how many pages are not used by reguler hash pages */
-  num_unused = hashp->hdr.high_mask - hashp->hdr.max_bucket;
-  if (num_unused == 0)
-    return 0;
+  ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+  cursor->item.pagep = 0;
+}
 
-  /* First and last unused page */
-  BUCKET_TO_PAGE(hashp->hdr.max_bucket + 1, funused);
-  BUCKET_TO_PAGE(hashp->hdr.high_mask, lunused);
-#if 1
-  fprintf (stderr, "There are %d pages (buckets) not used starting at page %d and end at %d on last level %d\n",
-	   num_unused, funused, lunused, hashp->hdr.ovfl_point);
-#endif
+/**
+ * Pin the key page of a cursor again. If the page has not been changed
+ * since the cursor left it, the cursor is still on its item. Otherwise
+ * the key of the cursor is looked for on the pages of its bucket. If
+ * the key is gone, the cursor starts over at its bucket.
+ *
+ * @param restart set if the cursor starts over at the first item of
+ * its bucket in the direction of the walk instead of its own item
+ *
+ * @return 0 on success, FFDB_NOT_FOUND if there is nothing left to
+ * walk and -1 on error
+ */
+static int
+_ffdb_cursor_repin (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+		    int forward, pgno_t last, int* restart)
+{
+  void* pagep;
+  pgno_t tp, nextp;
+  unsigned int i;
 
-  /* This is the last page used so far */
-  dlast = hashp->hdr.spares[hashp->hdr.ovfl_point + 1] - 1;
-  assert (dlast > 0);
-  assert (dlast > lunused);
+  *restart = 0;
 
-#if 0
-  fprintf (stderr, "Last data page = %d\n", dlast);
-#endif
+  pagep = ffdb_get_page (hashp, cursor->item.pgno, HASH_RAW_PAGE,
+			 FFDB_PAGE_SHARED, &tp);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get page %d for cursor.\n", cursor->item.pgno);
+    cursor->item.status = ITEM_ERROR;
+    return -1;
+  }
+  if (ffdb_pagepool_page_mod (hashp->mp, pagep) == cursor->page_mod) {
+    cursor->item.pagep = pagep;
+    return 0;
+  }
+  ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+
+  /* The page has been changed: look for the key in its bucket */
+  pagep = ffdb_get_page (hashp, cursor->item.bucket, HASH_BUCKET_PAGE,
+			 FFDB_PAGE_SHARED, &tp);
+  while (pagep) {
+    for (i = 0; i < NUM_ENT(pagep); i++) {
+      if (KEY_HASH_MATCH(pagep, i, cursor->key_hash) &&
+	  KEY_LEN(pagep, i) == cursor->key_len &&
+	  memcmp (KEY(pagep, i), cursor->key, cursor->key_len) == 0) {
+	cursor->item.pagep = pagep;
+	cursor->item.pgno = tp;
+	cursor->item.pgndx = i;
+	return 0;
+      }
+    }
+    nextp = NEXT_PGNO(pagep);
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+    if (nextp == INVALID_PGNO)
+      break;
+    pagep = ffdb_get_page (hashp, nextp, HASH_RAW_PAGE,
+			   FFDB_PAGE_SHARED, &tp);
+  }
+  if (!pagep) {
+    fprintf (stderr, "Cannot get page for bucket %d for cursor.\n",
+	     cursor->item.bucket);
+    cursor->item.status = ITEM_ERROR;
+    return -1;
+  }
 
-  /* Now we need to figure out what pages to move
-   * These pages may contain overflow pages and data pages
-   * which require different treatment. We move data pages
-   * first
-   */
-  num_pages = dlast - lunused;
-  num_page_moved = (num_pages < num_unused) ? num_pages : num_unused;
+  /* The key has been deleted or moved by a split */
+  *restart = 1;
+  if (forward)
+    return _ffdb_cursor_forward (hashp, cursor, cursor->item.bucket, last);
+  return _ffdb_cursor_backward (hashp, cursor, cursor->item.bucket);
+}
 
-  /* First page to be moved */
-  dfirst = dlast - num_page_moved + 1;
-  /* Update last free page to be used */
-  lunused = funused + num_page_moved  - 1;
+/**
+ * Get key and data of the item a cursor is on
+ */
+static int
+_ffdb_cursor_copy_item (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+			FFDB_DBT* key, FFDB_DBT* data)
+{
+  unsigned char* ekdata;
+  unsigned int   eksize;
 
-#if 1
-  fprintf (stderr, "We are going to move %d pages from %d to %d to new pages from %d to %d\n", num_page_moved, dfirst, dlast, funused, lunused);
-#endif
+  /* Get Key data and size */
+  ekdata = KEY(cursor->item.pagep, cursor->item.pgndx);
+  eksize = KEY_LEN(cursor->item.pagep, cursor->item.pgndx);
 
-  /* move data pages first */
-  _ffdb_move_pages (hashp, HASH_DATA_PAGE, dfirst, dlast,
-		    funused, lunused);
+  if (key->data && key->size > 0) {
+    /* User supplied space */
+    if (key->size < eksize) {
+      /* Tell the caller how much space is needed. The cursor stays
+       * on this item, so it can be read again with FFDB_CURRENT */
+      key->size = eksize;
+      return FFDB_SPECIAL;
+    }
+    else
+      key->size = eksize;
+  }
+  else {
+    key->data = (unsigned char *)malloc(eksize * sizeof(unsigned char));
+    key->size = eksize;
+  }
+  memcpy (key->data, ekdata, eksize);
 
-  /* move overflow page next */
-  _ffdb_move_pages (hashp, HASH_BUCKET_PAGE, dfirst, dlast,
-		    funused, lunused);
+  if (data) {
+    /* Get data for this key */
+    cursor->item.status = ITEM_OK;
+    cursor->item.key_off = KEY_OFF(cursor->item.pagep, cursor->item.pgndx);
+    cursor->item.key_len = eksize;
+    cursor->item.data_off = DATAP_OFF(cursor->item.pagep, cursor->item.pgndx);
 
-  _ffdb_move_pages (hashp, HASH_FREE_PAGE, dfirst, dlast,
-		    funused, lunused);
+    return ffdb_get_item (hashp, key, data, &cursor->item, 0);
+  }
+  return 0;
+}
 
-  hashp->hdr.num_moved_pages = num_page_moved;
+int 
+ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+			 FFDB_DBT* key, FFDB_DBT* data,
+			 unsigned int flags)
+{
+  pgno_t tp, nextp, last;
+  int status, restart;
+
+  last = CURSOR_LAST_BUCKET(hashp, cursor);
+  if ((flags == FFDB_FIRST || flags == FFDB_LAST) &&
+      cursor->lo_bucket > last) {
+    /* No bucket of the table is in the range of this cursor */
+    cursor->item.status = ITEM_NO_MORE;
+    return FFDB_NOT_FOUND;
+  }
+
+  /* A walk that has ended or failed stays there */
+  if ((flags == FFDB_NEXT || flags == FFDB_PREV || flags == FFDB_CURRENT) &&
+      cursor->item.status != ITEM_OK)
+    return FFDB_NOT_FOUND;
+
+  if (flags == FFDB_FIRST) {
+    /* A walk from the first bucket is sequential */
+    cursor->ra_window = 0;
+    if ((status = _ffdb_cursor_forward (hashp, cursor, cursor->lo_bucket,
+					last)) != 0)
+      return status;
+    _ffdb_cursor_readahead (hashp, cursor);
+    _ffdb_cursor_readahead_page (hashp, cursor, data != 0);
+  }
+  else if (flags == FFDB_LAST) {
+    if ((status = _ffdb_cursor_backward (hashp, cursor, last)) != 0)
+      return status;
+  }
+  else if (flags == FFDB_NEXT) {
+    if ((status = _ffdb_cursor_repin (hashp, cursor, 1, last,
+				      &restart)) != 0)
+      return status;
+
+    /* Otherwise the cursor has started over at an item not returned yet */
+    if (!restart) {
+      /* We have reached the last data on the key page */
+      if (cursor->item.pgndx == NUM_ENT(cursor->item.pagep) - 1) {
+	/* Get next page (overplow page) */
+	nextp = NEXT_PGNO(cursor->item.pagep);
+	/* put back this page */
+	ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
+	cursor->item.pagep = 0;
+	if (cursor->item.bucket >= last && nextp == INVALID_PGNO) {
+	  /* We are done */
+	  cursor->item.status = ITEM_NO_MORE;
+	  return FFDB_NOT_FOUND;
+	}
+	if (nextp == INVALID_PGNO) {
+	  /* next bucket */
+	  if ((status = _ffdb_cursor_forward (hashp, cursor,
+					      cursor->item.bucket + 1,
+					      last)) != 0)
+	    return status;
+	  _ffdb_cursor_readahead (hashp, cursor);
+	}
+	else {
+	  /* Get new page */
+	  cursor->item.pagep = ffdb_get_page (hashp, nextp, HASH_RAW_PAGE,
+					      FFDB_PAGE_SHARED, &tp);
+	  if (!cursor->item.pagep) {
+	    fprintf (stderr, "Cannot get page for next cursor bucket %d\n",
+		     cursor->item.bucket);
+	    cursor->item.status = ITEM_ERROR;
+	    return -1;
+	  }
+	  cursor->item.pgno = tp;
+	  cursor->item.pgndx = 0;
+	}
+	_ffdb_cursor_readahead_page (hashp, cursor, data != 0);
+      }
+      else {
+	/* Increase page index by one */
+	cursor->item.pgndx++;
+      }
+    }
+  }
+  else if (flags == FFDB_PREV) {
+    if ((status = _ffdb_cursor_repin (hashp, cursor, 0, last,
+				      &restart)) != 0)
+      return status;
+
+    if (!restart) {
+      /* We have reached the beginning of the key page */
+      if (cursor->item.pgndx == 0) {
+	/* Remember next page since we always go to the bucket page */
+	nextp = NEXT_PGNO(cursor->item.pagep);
+	/* put this page out */
+	ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
+	cursor->item.pagep = 0;
+	if (cursor->item.bucket <= cursor->lo_bucket && nextp == INVALID_PGNO) {
+	  /* We are done */
+	  cursor->item.status = ITEM_NO_MORE;
+	  return FFDB_NOT_FOUND;
+	}
+	if (nextp == INVALID_PGNO) {
+	  /* decrease bucket by one */
+	  if ((status = _ffdb_cursor_backward (hashp, cursor,
+					       cursor->item.bucket - 1)) != 0)
+	    return status;
+	}
+	else {
+	  /* Get next page */
+	  cursor->item.pagep = ffdb_get_page (hashp, nextp, HASH_RAW_PAGE,
+					      FFDB_PAGE_SHARED, &tp);
+	  if (!cursor->item.pagep) {
+	    fprintf (stderr, "Cannot get page for prev cursor bucket %d\n",
+		     cursor->item.bucket);
+	    cursor->item.status = ITEM_ERROR;
+	    return -1;
+	  }
+	  cursor->item.pgno = tp;
+	  cursor->item.pgndx = NUM_ENT(cursor->item.pagep) - 1;
+	  cursor->ra_window = 0;
+	}
+      }
+      else {
+	/* decrease page index by one */
+	cursor->item.pgndx--;
+      }
+    }
+  }
+  else if (flags == FFDB_CURRENT) {
+    /* Read the item the cursor is on once more */
+    if ((status = _ffdb_cursor_repin (hashp, cursor, 1, last,
+				      &restart)) != 0)
+      return status;
+  }
+  else {
+    fprintf (stderr, "Unsupported cursor flag %d\n", flags);
+    return -1;
+  }
 
-  return 0;
+  /* The page is put back until the next call */
+  status = _ffdb_cursor_copy_item (hashp, cursor, key, data);
+  _ffdb_cursor_release (hashp, cursor);
+  return status;
 }
 
+/************************************************************************
+ * Ordered key index                                                    *
+ ************************************************************************/
 
 /**
- * Optional to reorganize the pages to move pages occuping
- * reguler hash pages when the database expects new inserts
+ * Compare two keys byte by byte. A key sorts before a longer key
+ * starting with the same bytes
  */
-int
-ffdb_rearrage_pages_on_open (ffdb_htab_t* hashp)
+static int
+_ffdb_index_cmp (const unsigned char* a, unsigned int alen,
+		 const unsigned char* b, unsigned int blen)
 {
-  pgno_t oldfirst, oldlast, newfirst, newlast;
-  pgno_t lastdpage;
-  unsigned int num_page_moved;
+  unsigned int len;
+  int c;
 
-  /* Check whether any pages has been moved when the database is closed */
-  if (hashp->hdr.num_moved_pages == 0)
-    return 0;
-  
-  if (hashp->hdr.max_bucket == hashp->hdr.high_mask) 
+  len = (alen < blen) ? alen : blen;
+  if (len > 0 && (c = memcmp (a, b, len)) != 0)
+    return c;
+  if (alen == blen)
     return 0;
+  return (alen < blen) ? -1 : 1;
+}
 
-  /* We have not used every single hash bucket at the last level */
-  BUCKET_TO_PAGE(hashp->hdr.max_bucket + 1, oldfirst);
-
-  /* We will get number of moved page from meta header which
-   * records how many pages are moved when this file was closed
-   */
-  num_page_moved = hashp->hdr.num_moved_pages;
-  
-  oldlast = oldfirst + num_page_moved - 1;
-
-
-  /* We figure out where these page are going to */
-  newlast = hashp->hdr.spares[hashp->hdr.ovfl_point + 1] - 1;
-  newfirst = newlast - num_page_moved + 1;
-
-#if 1
-  fprintf (stderr, "Page can be moved starting at page %d and end at %d on last level %d to page %d to %d\n",
-	   oldfirst, oldlast, hashp->hdr.ovfl_point, newfirst, newlast);
-#endif
-
-
-  /* Move data pages first */
-  lastdpage = _ffdb_move_pages (hashp, HASH_DATA_PAGE, oldfirst, oldlast,
-				newfirst, newlast);
-
-  /* move overflow page next */
-  _ffdb_move_pages (hashp, HASH_BUCKET_PAGE, oldfirst, oldlast,
-		    newfirst, newlast);
-  
-  _ffdb_move_pages (hashp, HASH_FREE_PAGE, oldfirst, oldlast,
-		    newfirst, newlast);
-
-  /* If there are no data pages moved, unlikely but possible */
-  if (lastdpage == INVALID_PGNO) 
-    hashp->curr_dpage = ffdb_last_data_page (hashp, newfirst - 1);
-
-  /* Reset the number of moved pages */
-  hashp->hdr.num_moved_pages = 0;
-
-  /* Clean out those pages from page cache to make memory
-   * the same as if there are no pages have been here
-   */
-  _ffdb_remove_pages (hashp, oldfirst, oldlast);
-
+/**
+ * Insert an index page with its fence key at position pos of the
+ * index pages kept in memory
+ */
+static int
+_ffdb_index_add_fence (ffdb_htab_t* hashp, unsigned int pos, pgno_t page,
+		       const unsigned char* key, unsigned int len)
+{
+  ffdb_idx_fence_t* tfences;
+  unsigned char* tkey;
+  unsigned int max;
+
+  if (hashp->idx_npages == hashp->idx_max) {
+    max = 2 * hashp->idx_max + 16;
+    tfences = (ffdb_idx_fence_t *)realloc (hashp->idx_fences,
+					   max * sizeof(ffdb_idx_fence_t));
+    if (!tfences) {
+      errno = ENOMEM;
+      return -1;
+    }
+    hashp->idx_fences = tfences;
+    hashp->idx_max = max;
+  }
+  tkey = (unsigned char *)malloc (len > 0 ? len : 1);
+  if (!tkey) {
+    errno = ENOMEM;
+    return -1;
+  }
+  if (len > 0)
+    memcpy (tkey, key, len);
+
+  memmove (&hashp->idx_fences[pos + 1], &hashp->idx_fences[pos],
+	   (hashp->idx_npages - pos) * sizeof(ffdb_idx_fence_t));
+  hashp->idx_fences[pos].page = page;
+  hashp->idx_fences[pos].len = len;
+  hashp->idx_fences[pos].key = tkey;
+  hashp->idx_npages++;
   return 0;
 }
 
-
-void 
-ffdb_reduce_filesize (ffdb_htab_t* hashp)
+/**
+ * Remove the index page at position pos of the index pages kept in
+ * memory
+ */
+static void
+_ffdb_index_remove_fence (ffdb_htab_t* hashp, unsigned int pos)
 {
-  pgno_t last;
-  off_t length;
-
-  /* This is the last page before all pages are moved */
-  last = hashp->hdr.spares[hashp->hdr.ovfl_point + 1] - 1;
-
-  /* This is the last page after the pages are moved */
-  last = last - hashp->hdr.num_moved_pages;
+  free (hashp->idx_fences[pos].key);
+  memmove (&hashp->idx_fences[pos], &hashp->idx_fences[pos + 1],
+	   (hashp->idx_npages - pos - 1) * sizeof(ffdb_idx_fence_t));
+  hashp->idx_npages--;
+}
 
-  /* Now we need to shrink the file size */
-  if (hashp->hdr.num_moved_pages > 0) {
-    length = (off_t)hashp->hdr.bsize * (last + 1);
+/**
+ * Forget the index pages kept in memory
+ */
+void
+ffdb_index_unload (ffdb_htab_t* hashp)
+{
+  unsigned int i;
 
-    if (ftruncate (hashp->fp, length) != 0) {
-      fprintf (stderr, "Cannot truncate database %s to length %lld\n",
-	       hashp->fname, length);
-    }
-  }
+  for (i = 0; i < hashp->idx_npages; i++)
+    free (hashp->idx_fences[i].key);
+  free (hashp->idx_fences);
+  hashp->idx_fences = 0;
+  hashp->idx_npages = hashp->idx_max = 0;
 }
 
 /**
- * Code related to configurations
+ * Walk the chain of index pages once and keep each page with its
+ * first key in memory. An empty page keeps the fence key of the page
+ * before.
+ *
+ * This routine is called with hashp->lock held
  */
-int 
-ffdb_set_configs (ffdb_htab_t* hashp, ffdb_all_config_info_t* configs)
+static int
+_ffdb_index_load (ffdb_htab_t* hashp)
 {
-  unsigned int i, k, cnum, numelems, tnums;
-  pgno_t page, tp;
+  pgno_t page, next, tp;
   void* pagep;
-  ffdb_config_info_t* cfig;
+  unsigned char* key;
+  unsigned int len;
+  int status;
 
-  /* index into all configs */
-  cnum = 0;
-  /* total number of configurations */
-  tnums = hashp->hdr.num_cfigs;
+  if (hashp->idx_fences)
+    return 0;
 
-  page = hashp->hdr.cfig_page;
-  for (i = 0; i < hashp->hdr.cfig_npages; i++) {
-    pagep = ffdb_get_page (hashp, page, HASH_CONFIG_PAGE, 0, &tp);
+  page = hashp->hdr.idx_page;
+  while (page != INVALID_PGNO && page != 0) {
+    pagep = ffdb_get_page (hashp, page, HASH_INDEX_PAGE, FFDB_PAGE_SHARED,
+			   &tp);
     if (!pagep) {
-      fprintf (stderr, "Cannot get configuration page %d.\n", page);
+      fprintf (stderr, "Cannot get index page %d\n", page);
+      ffdb_index_unload (hashp);
       return -1;
     }
-    /* number of configurations on this page */
-    numelems = (hashp->hdr.bsize - PAGE_OVERHEAD)/(sizeof(ffdb_config_info_t));
-    if (numelems > tnums)
-      numelems = tnums;
-    NUM_ENT(pagep) = numelems;
-
-    for (k = 0; k < NUM_ENT(pagep); k++) {
-      cfig = CONFIG_INFO(pagep, k);
-      memcpy (cfig, &(configs->allconfigs[cnum++]),
-	      sizeof(ffdb_config_info_t));
+    if (NUM_ENT(pagep) > 0) {
+      key = IDX_KEY(pagep, PAGE_OVERHEAD);
+      len = IDX_KEY_LEN(pagep, PAGE_OVERHEAD);
     }
-
-    /* release page */
-    ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
-    page++;
-    tnums -= numelems;
+    else if (hashp->idx_npages > 0) {
+      key = hashp->idx_fences[hashp->idx_npages - 1].key;
+      len = hashp->idx_fences[hashp->idx_npages - 1].len;
+    }
+    else {
+      key = 0;
+      len = 0;
+    }
+    status = _ffdb_index_add_fence (hashp, hashp->idx_npages, page, key, len);
+    next = NEXT_PGNO(pagep);
+    ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 0);
+    if (status != 0) {
+      ffdb_index_unload (hashp);
+      return -1;
+    }
+    page = next;
   }
   return 0;
 }
 
+/**
+ * Position of the index page a key belongs to, which is the last page
+ * whose fence key is not after the key. There is at least one page.
+ */
+static unsigned int
+_ffdb_index_fence (ffdb_htab_t* hashp, const unsigned char* key,
+		   unsigned int len)
+{
+  unsigned int lo, hi, mid;
+
+  /* The first page takes all keys before the fence of the second */
+  lo = 1;
+  hi = hashp->idx_npages;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (_ffdb_index_cmp (hashp->idx_fences[mid].key, 
+			 hashp->idx_fences[mid].len, key, len) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - 1;
+}
 
-int 
-ffdb_get_configs (ffdb_htab_t* hashp, ffdb_all_config_info_t* configs)
+/**
+ * Find the first key on an index page which is not before a key.
+ * Return its position on the page with its offset in off, and set
+ * found if it is the same key.
+ */
+static unsigned int
+_ffdb_index_locate (void* pagep, const unsigned char* key, unsigned int len,
+		    unsigned int* off, int* found)
 {
-  unsigned int i, k, cnum;
-  pgno_t page, tp;
-  void* pagep;
-  ffdb_config_info_t* cfig;
+  unsigned int i, o;
+  int c;
 
-  cnum = 0;
-  page = hashp->hdr.cfig_page;
-  for (i = 0; i < hashp->hdr.cfig_npages; i++) {
-    pagep = ffdb_get_page (hashp, page, HASH_CONFIG_PAGE, 0, &tp);
-    if (!pagep) {
-      fprintf (stderr, "Cannot get configuration page %d.\n", page);
-      return -1;
-    }
-    
-    for (k = 0; k < NUM_ENT(pagep); k++) {
-      cfig = CONFIG_INFO(pagep, k);
-      memcpy (&(configs->allconfigs[cnum++]), cfig,
-	      sizeof(ffdb_config_info_t));
+  *found = 0;
+  o = PAGE_OVERHEAD;
+  for (i = 0; i < NUM_ENT(pagep); i++) {
+    c = _ffdb_index_cmp (IDX_KEY(pagep, o), IDX_KEY_LEN(pagep, o), key, len);
+    if (c >= 0) {
+      *found = (c == 0);
+      break;
     }
-
-    /* release page */
-    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
-    page++;
+    o += IDX_ENTRY_SIZE(IDX_KEY_LEN(pagep, o));
   }
-  return 0;
+  *off = o;
+  return i;
 }
 
+/**
+ * Write a key at offset off of a buffer laid out as an index page
+ */
+static void
+_ffdb_index_put_key (unsigned char* p, unsigned int off, const FFDB_DBT* key)
+{
+  IDX_KEY_LEN(p, off) = key->size;
+  if (key->size > 0)
+    memcpy (IDX_KEY(p, off), key->data, key->size);
+}
 
-int 
-ffdb_set_config_info (ffdb_htab_t* hashp, ffdb_config_info_t* config)
+/**
+ * Allocate and initialize a new index page
+ */
+static void*
+_ffdb_index_new_page (ffdb_htab_t* hashp, pgno_t* page)
 {
-  unsigned int i, k;
-  pgno_t page, tp;
+  pgno_t tp;
   void* pagep;
-  ffdb_config_info_t* cfig;
+  int reuse;
 
-  page = hashp->hdr.cfig_page;
-  for (i = 0; i < hashp->hdr.cfig_npages; i++) {
-    pagep = ffdb_get_page (hashp, page, HASH_CONFIG_PAGE, 0, &tp);
-    if (!pagep) {
-      fprintf (stderr, "Cannot get configuration page %d.\n", page);
-      return -1;
-    }
-    
-    for (k = 0; k < NUM_ENT(pagep); k++) {
-      cfig = CONFIG_INFO(pagep, k);
-      if (cfig->index == config->index && cfig->config == config->config) {
-	memcpy (cfig, config, sizeof(ffdb_config_info_t));
-	ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
-	return 0;
-      }
-    }
-    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);    /* release page */
-    page++;
+  *page = _ffdb_ovfl_page (hashp, &reuse);
+  pagep = ffdb_get_page (hashp, *page, HASH_INDEX_PAGE, FFDB_CREATE, &tp);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get a new index page %d\n", *page);
+    return 0;
   }
-  return -1;
+  _ffdb_init_page (hashp, pagep, *page, HASH_INDEX_PAGE);
+  return pagep;
 }
 
-
-int 
-ffdb_get_config_info (ffdb_htab_t* hashp, unsigned int confignum,
-		      ffdb_config_info_t* config)
+/**
+ * Split a full index page while a key is added. The new page goes
+ * right after the page in the chain. 
+ *
+ * @param pos position of the page among the index pages
+ * @param n position of the new key on the page
+ * @param off offset of the new key on the page
+ */
+static int
+_ffdb_index_split (ffdb_htab_t* hashp, void* pagep, unsigned int pos,
+		   unsigned int n, unsigned int off, const FFDB_DBT* key)
 {
-  unsigned int i, k;
-  pgno_t page, tp;
-  void* pagep;
-  ffdb_config_info_t* cfig;
+  void *npagep, *xpagep;
+  pgno_t npage, tp;
+  unsigned char* buf;
+  unsigned int total, num, esize, i, o;
 
-  page = hashp->hdr.cfig_page;
-  for (i = 0; i < hashp->hdr.cfig_npages; i++) {
-    pagep = ffdb_get_page (hashp, page, HASH_CONFIG_PAGE, 0, &tp);
-    if (!pagep) {
-      fprintf (stderr, "Cannot get configuration page %d.\n", page);
+  if (!(npagep = _ffdb_index_new_page (hashp, &npage))) {
+    ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 0);
+    return -1;
+  }
+
+  esize = IDX_ENTRY_SIZE(key->size);
+  if (n == NUM_ENT(pagep) && NEXT_PGNO(pagep) == INVALID_PGNO) {
+    /* A key after all keys starts a new last page on its own, so that
+     * keys added in ascending order leave full pages behind */
+    _ffdb_index_put_key (npagep, PAGE_OVERHEAD, key);
+    NUM_ENT(npagep) = 1;
+    OFFSET(npagep) = PAGE_OVERHEAD + esize;
+  }
+  else {
+    /* The keys with the new key among them are halved by bytes. Each
+     * page keeps at least one key */
+    total = OFFSET(pagep) - PAGE_OVERHEAD + esize;
+    num = NUM_ENT(pagep) + 1;
+    buf = (unsigned char *)malloc (total);
+    if (!buf) {
+      errno = ENOMEM;
+      ffdb_delete_page (hashp, npagep, HASH_OVFL_PAGE, 0);
+      ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 0);
       return -1;
     }
-    
-    for (k = 0; k < NUM_ENT(pagep); k++) {
-      cfig = CONFIG_INFO(pagep, k);
-      if (cfig->config == confignum) {
-	memcpy (config, cfig, sizeof(ffdb_config_info_t));
-	ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
-	return 0;
-      }
+    memcpy (buf, (unsigned char *)pagep + PAGE_OVERHEAD, off - PAGE_OVERHEAD);
+    _ffdb_index_put_key (buf, off - PAGE_OVERHEAD, key);
+    memcpy (buf + off - PAGE_OVERHEAD + esize, (unsigned char *)pagep + off,
+	    OFFSET(pagep) - off);
+
+    i = o = 0;
+    do {
+      o += IDX_ENTRY_SIZE(IDX_KEY_LEN(buf, o));
+      i++;
+    } while (i < num - 1 && o < total / 2);
+
+    memcpy ((unsigned char *)pagep + PAGE_OVERHEAD, buf, o);
+    NUM_ENT(pagep) = i;
+    OFFSET(pagep) = PAGE_OVERHEAD + o;
+    memcpy ((unsigned char *)npagep + PAGE_OVERHEAD, buf + o, total - o);
+    NUM_ENT(npagep) = num - i;
+    OFFSET(npagep) = PAGE_OVERHEAD + total - o;
+    free (buf);
+  }
+
+  /* Link the new page into the chain */
+  NEXT_PGNO(npagep) = NEXT_PGNO(pagep);
+  PREV_PGNO(npagep) = CURR_PGNO(pagep);
+  if (NEXT_PGNO(pagep) != INVALID_PGNO) {
+    xpagep = ffdb_get_page (hashp, NEXT_PGNO(pagep), HASH_INDEX_PAGE, 0, &tp);
+    if (!xpagep) {
+      fprintf (stderr, "Cannot get index page %d after page %d\n",
+	       NEXT_PGNO(pagep), CURR_PGNO(pagep));
+      ffdb_put_page (hashp, npagep, HASH_INDEX_PAGE, 0);
+      ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 0);
+      return -1;
     }
-    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);    /* release page */
-    page++;
+    PREV_PGNO(xpagep) = npage;
+    ffdb_put_page (hashp, xpagep, HASH_INDEX_PAGE, 1);
   }
-  return -1;
-}
+  NEXT_PGNO(pagep) = npage;
+
+  /* The pages are right on disk. The pages in memory are loaded again
+   * if they cannot be kept up */
+  if (_ffdb_index_add_fence (hashp, pos + 1, npage, 
+			     IDX_KEY(npagep, PAGE_OVERHEAD),
+			     IDX_KEY_LEN(npagep, PAGE_OVERHEAD)) != 0)
+    ffdb_index_unload (hashp);
 
+  ffdb_put_page (hashp, npagep, HASH_INDEX_PAGE, 1);
+  ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 1);
+  return 0;
+}
 
 /**
- * Set user meta information in the 2nd page
+ * Add a key to the ordered key index
  */
-int 
-ffdb_set_uinfo (ffdb_htab_t* hashp, unsigned char* data,
-		unsigned int len)
+int
+ffdb_index_insert (ffdb_htab_t* hashp, const FFDB_DBT* key)
 {
-  unsigned int i, copylen, offset, idx, rlen;
   pgno_t page, tp;
   void* pagep;
-  
-  idx = 0;
-  rlen = len;
-  page = hashp->hdr.uinfo_page;
-  for (i = 0; i < hashp->hdr.uinfo_npages; i++) {
-    pagep = ffdb_get_page (hashp, page, HASH_UINFO_PAGE, 0, &tp);
+  unsigned int pos, n, off, esize;
+  int found;
+
+  if (hashp->hdr.idx_page == 0)
+    return 0;
+  if (_ffdb_index_load (hashp) != 0)
+    return -1;
+
+  if (hashp->idx_npages == 0) {
+    /* The first key: the index gets its first page */
+    if (!(pagep = _ffdb_index_new_page (hashp, &page)))
+      return -1;
+    hashp->hdr.idx_page = page;
+    if (_ffdb_index_add_fence (hashp, 0, page, key->data, key->size) != 0)
+      ffdb_index_unload (hashp);
+    pos = 0;
+  }
+  else {
+    pos = _ffdb_index_fence (hashp, key->data, key->size);
+    page = hashp->idx_fences[pos].page;
+    pagep = ffdb_get_page (hashp, page, HASH_INDEX_PAGE, 0, &tp);
     if (!pagep) {
-      fprintf (stderr, "Cannot get page %d to store user information.\n",
-	       page);
+      fprintf (stderr, "Cannot get index page %d\n", page);
       return -1;
     }
-    if (i == 0) {
-      /* Set number of item to 1 on the first page */
-      NUM_ENT(pagep) = 1;
-      USER_DATA_LEN(pagep) = rlen;
-      if (rlen > hashp->hdr.bsize - PAGE_OVERHEAD - sizeof(unsigned int)) 
-	copylen = hashp->hdr.bsize - PAGE_OVERHEAD - sizeof(unsigned int);
-      else 
-	copylen = rlen;
-      offset = PAGE_OVERHEAD + sizeof(unsigned int);
-    }
-    else {
-      /* Set number of item to 0 on the other pages */
-      NUM_ENT(pagep) = 0;
-      if (rlen > hashp->hdr.bsize - PAGE_OVERHEAD) 
-	copylen = hashp->hdr.bsize - PAGE_OVERHEAD;
-      else
-	copylen = rlen;
-      offset = PAGE_OVERHEAD;
-    }
-    /* where to start copy from data */
-    idx = len - rlen;
+  }
 
-    memcpy ((unsigned char *)pagep + offset, &data[idx], copylen);
+  n = _ffdb_index_locate (pagep, key->data, key->size, &off, &found);
+  if (found) 
+    return ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 0);
 
-    /* put page out */
-    ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
+  esize = IDX_ENTRY_SIZE(key->size);
+  if (OFFSET(pagep) + esize > hashp->hdr.bsize) 
+    return _ffdb_index_split (hashp, pagep, pos, n, off, key);
 
-    rlen -= copylen;
+  memmove ((unsigned char *)pagep + off + esize, 
+	   (unsigned char *)pagep + off, OFFSET(pagep) - off);
+  _ffdb_index_put_key (pagep, off, key);
+  NUM_ENT(pagep)++;
+  OFFSET(pagep) += esize;
+  return ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 1);
+}
 
-    page++;
+/**
+ * Remove a key from the ordered key index
+ */
+int
+ffdb_index_delete (ffdb_htab_t* hashp, const FFDB_DBT* key)
+{
+  pgno_t page, prevp, nextp, tp;
+  void *pagep, *xpagep;
+  unsigned int pos, off, esize;
+  int found;
+
+  if (hashp->hdr.idx_page == 0)
+    return 0;
+  if (_ffdb_index_load (hashp) != 0)
+    return -1;
+  if (hashp->idx_npages == 0)
+    return 0;
+
+  pos = _ffdb_index_fence (hashp, key->data, key->size);
+  page = hashp->idx_fences[pos].page;
+  pagep = ffdb_get_page (hashp, page, HASH_INDEX_PAGE, 0, &tp);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get index page %d\n", page);
+    return -1;
   }
-  return 0;
+  _ffdb_index_locate (pagep, key->data, key->size, &off, &found);
+  if (!found)
+    return ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 0);
+
+  esize = IDX_ENTRY_SIZE(IDX_KEY_LEN(pagep, off));
+  memmove ((unsigned char *)pagep + off, 
+	   (unsigned char *)pagep + off + esize, OFFSET(pagep) - off - esize);
+  NUM_ENT(pagep)--;
+  OFFSET(pagep) -= esize;
+
+  /* The first page stays even when it is empty */
+  if (NUM_ENT(pagep) > 0 || pos == 0)
+    return ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 1);
+
+  /* An empty page is taken out of the chain and freed */
+  prevp = PREV_PGNO(pagep);
+  nextp = NEXT_PGNO(pagep);
+  xpagep = ffdb_get_page (hashp, prevp, HASH_INDEX_PAGE, 0, &tp);
+  if (!xpagep) {
+    fprintf (stderr, "Cannot get index page %d before page %d\n", prevp, page);
+    return ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 1);
+  }
+  NEXT_PGNO(xpagep) = nextp;
+  ffdb_put_page (hashp, xpagep, HASH_INDEX_PAGE, 1);
+  if (nextp != INVALID_PGNO) {
+    xpagep = ffdb_get_page (hashp, nextp, HASH_INDEX_PAGE, 0, &tp);
+    if (!xpagep) {
+      fprintf (stderr, "Cannot get index page %d after page %d\n", nextp, page);
+      ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 1);
+      return -1;
+    }
+    PREV_PGNO(xpagep) = prevp;
+    ffdb_put_page (hashp, xpagep, HASH_INDEX_PAGE, 1);
+  }
+  _ffdb_index_remove_fence (hashp, pos);
+
+  PREV_PGNO(pagep) = NEXT_PGNO(pagep) = INVALID_PGNO;
+  return ffdb_delete_page (hashp, pagep, HASH_OVFL_PAGE, 0);
 }
 
+/**
+ * Copy a key into the cursor as the key the cursor is on
+ */
+static int
+_ffdb_index_keep_key (ffdb_crs_t* cursor, const unsigned char* key,
+		      unsigned int len)
+{
+  unsigned char* tkey;
+
+  if (len > cursor->key_max) {
+    tkey = (unsigned char *)realloc (cursor->key, len);
+    if (!tkey) {
+      errno = ENOMEM;
+      return -1;
+    }
+    cursor->key = tkey;
+    cursor->key_max = len;
+  }
+  if (len > 0)
+    memcpy (cursor->key, key, len);
+  cursor->key_len = len;
+  return 0;
+}
 
 /**
- * Get user meta information in the 2nd page
+ * Find the key next to a key in the index and copy it into the cursor.
+ * With dir > 0 this is the first key after the key, with dir == 0 the
+ * first key not before the key and with dir < 0 the last key before
+ * the key. A null key is before all keys walking forward and after all
+ * keys walking backward.
+ *
+ * This routine is called with hashp->lock held
+ *
+ * @return 0 on success, FFDB_NOT_FOUND if there is no such key, -1 on
+ * failure
  */
-int 
-ffdb_get_uinfo (ffdb_htab_t* hashp, unsigned char data[],
-		unsigned int *len)
+static int
+_ffdb_index_seek (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+		  const unsigned char* key, unsigned int len, int dir)
 {
-  unsigned int i, copylen, offset, idx, rlen;
-  pgno_t page, tp;
+  pgno_t tp;
   void* pagep;
-  
-  idx = 0;
-  rlen = *len;
-  page = hashp->hdr.uinfo_page;
-  for (i = 0; i < hashp->hdr.uinfo_npages; i++) {
-    pagep = ffdb_get_page (hashp, page, HASH_UINFO_PAGE, 0, &tp);
+  unsigned int pos, n, i, off;
+  int found, status;
+
+  if (_ffdb_index_load (hashp) != 0)
+    return -1;
+  if (hashp->idx_npages == 0)
+    return FFDB_NOT_FOUND;
+
+  if (key)
+    pos = _ffdb_index_fence (hashp, key, len);
+  else
+    pos = (dir >= 0) ? 0 : hashp->idx_npages - 1;
+
+  for (;;) {
+    pagep = ffdb_get_page (hashp, hashp->idx_fences[pos].page, 
+			   HASH_INDEX_PAGE, FFDB_PAGE_SHARED, &tp);
     if (!pagep) {
-      fprintf (stderr, "Cannot get page %d to retrieve user information.\n",
-	       page);
+      fprintf (stderr, "Cannot get index page %d\n", 
+	       hashp->idx_fences[pos].page);
       return -1;
     }
-    if (i == 0) {
-      if (*len < USER_DATA_LEN(pagep)) {
-	fprintf (stderr, "Error: provided user buffer size %d < stored data length %d.\n", *len, USER_DATA_LEN(pagep));
-	return -1;
-      }
-      *len = USER_DATA_LEN(pagep);
-      rlen = *len;
 
-      if (rlen > hashp->hdr.bsize - PAGE_OVERHEAD - sizeof(unsigned int)) 
-	copylen = hashp->hdr.bsize - PAGE_OVERHEAD - sizeof(unsigned int);
-      else 
-	copylen = rlen;
-      offset = PAGE_OVERHEAD + sizeof(unsigned int);
+    if (dir >= 0) {
+      n = 0;
+      off = PAGE_OVERHEAD;
+      if (key) {
+	n = _ffdb_index_locate (pagep, key, len, &off, &found);
+	if (found && dir > 0) {
+	  off += IDX_ENTRY_SIZE(IDX_KEY_LEN(pagep, off));
+	  n++;
+	}
+      }
+      if (n < NUM_ENT(pagep)) 
+	break;
     }
     else {
-      if (rlen > hashp->hdr.bsize - PAGE_OVERHEAD) 
-	copylen = hashp->hdr.bsize - PAGE_OVERHEAD;
-      else
-	copylen = rlen;
-      offset = PAGE_OVERHEAD;
+      n = NUM_ENT(pagep);
+      if (key)
+	n = _ffdb_index_locate (pagep, key, len, &off, &found);
+      if (n > 0) {
+	/* Keys differ in length, so the key before is found from the front */
+	off = PAGE_OVERHEAD;
+	for (i = 0; i < n - 1; i++)
+	  off += IDX_ENTRY_SIZE(IDX_KEY_LEN(pagep, off));
+	break;
+      }
     }
-    /* where to start copy from data */
-    idx = *len - rlen;
 
-    memcpy (&data[idx], (unsigned char *)pagep + offset, copylen);
-
-    /* put page out */
-    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+    /* Nothing on this page: the key is on a page further on */
+    ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 0);
+    if ((dir >= 0 && pos == hashp->idx_npages - 1) || (dir < 0 && pos == 0))
+      return FFDB_NOT_FOUND;
+    pos = (dir >= 0) ? pos + 1 : pos - 1;
+    key = 0;
+  }
 
-    rlen -= copylen;
+  status = _ffdb_index_keep_key (cursor, IDX_KEY(pagep, off),
+				 IDX_KEY_LEN(pagep, off));
+  ffdb_put_page (hashp, pagep, HASH_INDEX_PAGE, 0);
+  return status;
+}
 
-    page++;
-  }
-  return 0;
+/**
+ * Whether the key the cursor is on lies in [lo, hi) of the cursor
+ */
+static int
+_ffdb_index_in_range (ffdb_crs_t* cursor)
+{
+  if (cursor->lo.data &&
+      _ffdb_index_cmp (cursor->key, cursor->key_len, 
+		       cursor->lo.data, cursor->lo.size) < 0)
+    return 0;
+  if (cursor->hi.data &&
+      _ffdb_index_cmp (cursor->key, cursor->key_len, 
+		       cursor->hi.data, cursor->hi.size) >= 0)
+    return 0;
+  return 1;
 }
 
-/***************************************************************************
- *         Cursor related routines                                         *
- ***************************************************************************/
-int 
-ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
-			 FFDB_DBT* key, FFDB_DBT* data,
-			 unsigned int flags)
+int
+ffdb_index_cursor_find (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+			FFDB_DBT* key, FFDB_DBT* data,
+			unsigned int flags)
 {
-  pgno_t bucket, tp, nextp;
-  unsigned char* ekdata;
-  unsigned int   eksize;
+  ffdb_hent_t item;
+  FFDB_DBT ckey;
+  int status;
 
-  if (flags == FFDB_FIRST) {
-    if (cursor->item.pagep) {
-      /* need to release the previous page */
-      ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
-      cursor->item.pagep = 0;
-    }
-      
-    bucket = 0;
-    cursor->item.pagep = ffdb_get_page (hashp, bucket,
-					HASH_BUCKET_PAGE, 0, &tp);
-    if (!(cursor->item.pagep)) {
-      fprintf (stderr, "Cannot get page for the first bucket\n");
-      cursor->item.status = ITEM_ERROR;
+  /* A walk that has ended or failed stays there */
+  if ((flags == FFDB_NEXT || flags == FFDB_PREV || flags == FFDB_CURRENT) &&
+      cursor->item.status != ITEM_OK)
+    return FFDB_NOT_FOUND;
+
+  for (;;) {
+    FFDB_LOCK (hashp->lock);
+    if (flags == FFDB_FIRST) 
+      status = _ffdb_index_seek (hashp, cursor, cursor->lo.data, 
+				 cursor->lo.size, 0);
+    else if (flags == FFDB_LAST)
+      status = _ffdb_index_seek (hashp, cursor, cursor->hi.data, 
+				 cursor->hi.size, -1);
+    else if (flags == FFDB_NEXT)
+      status = _ffdb_index_seek (hashp, cursor, cursor->key, 
+				 cursor->key_len, 1);
+    else if (flags == FFDB_PREV)
+      status = _ffdb_index_seek (hashp, cursor, cursor->key, 
+				 cursor->key_len, -1);
+    else if (flags == FFDB_CURRENT)
+      status = 0;
+    else {
+      FFDB_UNLOCK (hashp->lock);
+      fprintf (stderr, "Unsupported cursor flag %d\n", flags);
       return -1;
     }
-    /* Skip empty buckets */
-    while (NUM_ENT(cursor->item.pagep) == 0 && 
-	   bucket <= hashp->hdr.max_bucket) {
-      ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
-      /* Get next bucket */
-      cursor->item.pagep = 0;
-      bucket++;
-
-      cursor->item.pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE, 
-					  0, &tp);
-      if (!(cursor->item.pagep)) {
-	fprintf (stderr, "Cannot get page for bucket %d for cursor.\n",
-		 bucket);
-	cursor->item.status = ITEM_ERROR;
-	return -1;
-      }
-    }
-    if (bucket > hashp->hdr.max_bucket) {
-      /* empty database */
-      ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
+    FFDB_UNLOCK (hashp->lock);
+
+    if (status == FFDB_NOT_FOUND || 
+	(status == 0 && !_ffdb_index_in_range (cursor))) {
       cursor->item.status = ITEM_NO_MORE;
-      cursor->item.pagep = 0;
       return FFDB_NOT_FOUND;
     }
-    cursor->item.bucket = bucket;
-    cursor->item.pgno = tp;
-    cursor->item.pgndx = 0;
-    cursor->item.status = ITEM_OK;
-  }
-  else if (flags == FFDB_LAST) {
-    if (cursor->item.pagep) {
-      ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
-      cursor->item.pagep = 0;
-    }
-    bucket = hashp->hdr.max_bucket;
-    
-    cursor->item.pagep = ffdb_get_page (hashp, bucket,
-					HASH_BUCKET_PAGE, 0, &tp);
-    if (!(cursor->item.pagep)) {
-      fprintf (stderr, "Cannot get page for the last bucket\n");
+    if (status != 0) {
       cursor->item.status = ITEM_ERROR;
       return -1;
     }
-    /* Skip empty buckets */
-    while (NUM_ENT(cursor->item.pagep) == 0) {
-      ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
-      /* Get next bucket */
-      cursor->item.pagep = 0;
-      bucket--;
-
-      cursor->item.pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE, 
-					  0, &tp);
-      if (!(cursor->item.pagep)) {
-	fprintf (stderr, "Cannot get page for bucket %d for cursor.\n",
-		 bucket);
-	cursor->item.status = ITEM_ERROR;
-	return -1;
-      }
-      if (bucket == 0 && NUM_ENT(cursor->item.pagep) == 0) {
-	/* this is the last one and it is empty */
-	ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
-	cursor->item.status = ITEM_NO_MORE;
-	cursor->item.pagep = 0;
-	return FFDB_NOT_FOUND;
-      }
-    }
-
-    cursor->item.pgno = tp;
-    cursor->item.bucket = bucket;    
-    cursor->item.pgndx = NUM_ENT(cursor->item.pagep) - 1;
     cursor->item.status = ITEM_OK;
-  }
-  else if (flags == FFDB_NEXT) {
-    /* We have reached the last data on the key page */
-    if (cursor->item.pgndx == NUM_ENT(cursor->item.pagep) - 1) {
-      /* Get next page (overplow page) */
-      nextp = NEXT_PGNO(cursor->item.pagep);
-      /* put back this page */
-      ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
-      if (cursor->item.bucket >= hashp->hdr.max_bucket &&
-	  nextp == INVALID_PGNO) {
-	/* We are done */
-	cursor->item.status = ITEM_NO_MORE;
-	cursor->item.pagep = 0;
-	return FFDB_NOT_FOUND;
-      }
-      if (nextp == INVALID_PGNO) {
-	/* Increase bucket by one: next bucket */
-	cursor->item.bucket++;
-	/* Get new page */
-	cursor->item.pagep = ffdb_get_page (hashp, cursor->item.bucket,
-					    HASH_BUCKET_PAGE, 0, &tp);
-
-	if (!(cursor->item.pagep)) {
-	  fprintf (stderr, "Cannot get page for bucket %d for cursor.\n",
-		   cursor->item.bucket);
-	  cursor->item.status = ITEM_ERROR;
-	  return -1;
-	}
 
-	/* Skip empty buckets */
-	while (NUM_ENT(cursor->item.pagep) == 0) {
-	  ffdb_put_page (hashp, cursor->item.pagep, 
-			 TYPE(cursor->item.pagep), 0);
-	  if (cursor->item.bucket == hashp->hdr.max_bucket) {
-	    cursor->item.pagep = 0;
-	    /* End of buckets and we are done */
-	    cursor->item.status = ITEM_NO_MORE;
-	    return FFDB_NOT_FOUND;
-	  }
-	  /* Get next bucket */
-	  cursor->item.pagep = 0;
-	  cursor->item.bucket++;
-
-	  cursor->item.pagep = ffdb_get_page (hashp, cursor->item.bucket, 
-					      HASH_BUCKET_PAGE, 0, &tp);
-	  if (!(cursor->item.pagep)) {
-	    fprintf (stderr, "Cannot get page for bucket %d for cursor.\n",
-		     cursor->item.bucket);
-	    cursor->item.status = ITEM_ERROR;
-	    return -1;
-	  }
-	}
-      }
-      else {
-	/* Get new page */
-	cursor->item.pagep = ffdb_get_page (hashp, nextp,
-					    HASH_RAW_PAGE, 0, &tp);
-	if (!cursor->item.pagep) {
-	  fprintf (stderr, "Cannot get page for next cursor bucket %d\n",
-		   cursor->item.bucket);
-	  cursor->item.status = ITEM_ERROR;
-	  return -1;
-	}
-      }
-      cursor->item.pgno = tp;
-      cursor->item.pgndx = 0;
-      cursor->item.status = ITEM_OK;
-    }
-    else {
-      /* Increase page index by one */
-      cursor->item.pgndx++;
+    /* Look the key up in the hash table */
+    ckey.data = cursor->key;
+    ckey.size = cursor->key_len;
+    memset (&item, 0, sizeof (ffdb_hent_t));
+    item.seek_size = PAIRSIZE(&ckey, data);
+    item.key_hash = hashp->hash (ckey.data, ckey.size);
+    item.bucket = _ffdb_hash_bucket (hashp, item.key_hash);
+    if (ffdb_find_item (hashp, &ckey, 0, &item) != 0) {
+      cursor->item.status = ITEM_ERROR;
+      return -1;
     }
-  }
-  else if (flags == FFDB_PREV) {
-    /* We have reached the beginning of the key page */
-    if (cursor->item.pgndx == 0) {
-      /* Remember next page since we always go to the bucket page */
-      nextp = NEXT_PGNO(cursor->item.pagep);
-      /* put this page out */
-      ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
-      if (cursor->item.bucket == 0 && nextp == INVALID_PGNO) {
-	/* We are done */
-	cursor->item.status = ITEM_NO_MORE;
-	cursor->item.pagep = 0;
-	return FFDB_NOT_FOUND;
-      }
-      if (nextp == INVALID_PGNO) {
-	/* decrease bucket by one */
-	cursor->item.bucket--;
-	/* Get new page */
-	cursor->item.pagep = ffdb_get_page (hashp, cursor->item.bucket,
-					    HASH_BUCKET_PAGE, 0, &tp);
-
-
-	/* Skip empty buckets */
-	while (NUM_ENT(cursor->item.pagep) == 0) {
-	  ffdb_put_page (hashp, cursor->item.pagep, 
-			 TYPE(cursor->item.pagep), 0);
-	  if (cursor->item.bucket == 0) {
-	    /* this is the last one and it is empty */
-	    cursor->item.status = ITEM_NO_MORE;
-	    cursor->item.pagep = 0;
-	    return FFDB_NOT_FOUND;
-	  }
-
-	  /* Get next bucket */
-	  cursor->item.pagep = 0;
-	  cursor->item.bucket--;
-
-	  cursor->item.pagep = ffdb_get_page (hashp, cursor->item.bucket, 
-					      HASH_BUCKET_PAGE, 0, &tp);
-	  if (!(cursor->item.pagep)) {
-	    fprintf (stderr, "Cannot get page for bucket %d for cursor.\n",
-		     cursor->item.bucket);
-	    cursor->item.status = ITEM_ERROR;
-	    return -1;
-	  }
+    if (item.status == ITEM_OK)
+      break;
 
-	}
-      }
-      else {
-	/* Get next page */
-	cursor->item.pagep = ffdb_get_page (hashp, nextp,
-					    HASH_RAW_PAGE, 0, &tp);
-	if (!cursor->item.pagep) {
-	  fprintf (stderr, "Cannot get page for prev cursor bucket %d\n",
-		   cursor->item.bucket);
-	  cursor->item.status = ITEM_ERROR;
-	  return -1;
-	}
-      }
-      cursor->item.pgno = tp;
-      cursor->item.status = ITEM_OK;
-      cursor->item.pgndx = NUM_ENT(cursor->item.pagep) - 1;
-    }
-    else {
-      /* decrease page index by one */
-      cursor->item.pgndx--;
-    }
-  }
-  else {
-    fprintf (stderr, "Unsupported cursor flag %d\n", flags);
-    return -1;
+    /* The key has been deleted since: go on to the key after it */
+    ffdb_release_item (hashp, &item);
+    if (flags == FFDB_FIRST || flags == FFDB_CURRENT)
+      flags = FFDB_NEXT;
+    else if (flags == FFDB_LAST)
+      flags = FFDB_PREV;
   }
 
-  /* Get Key data and size */
-  ekdata = KEY(cursor->item.pagep, cursor->item.pgndx);
-  eksize = KEY_LEN(cursor->item.pagep, cursor->item.pgndx);
-
   if (key->data && key->size > 0) {
     /* User supplied space */
-    if (key->size < eksize) {
-      fprintf (stderr, "Warning: application provided key space %d < key stored on disk with size %d\n",
-	       key->size, eksize);
-      return -1;
+    if (key->size < ckey.size) {
+      /* The cursor stays on this key for FFDB_CURRENT */
+      key->size = ckey.size;
+      ffdb_release_item (hashp, &item);
+      return FFDB_SPECIAL;
     }
-    else
-      key->size = eksize;
+    key->size = ckey.size;
   }
   else {
-    key->data = (unsigned char *)malloc(eksize * sizeof(unsigned char));
-    key->size = eksize;
+    key->data = (unsigned char *)malloc(ckey.size > 0 ? ckey.size : 1);
+    key->size = ckey.size;
   }
-  memcpy (key->data, ekdata, eksize);
-
-  if (data) {
-    /* Get data for this key */
-    cursor->item.status = ITEM_OK;
-    cursor->item.key_off = KEY_OFF(cursor->item.pagep, cursor->item.pgndx);
-    cursor->item.key_len = eksize;
-    cursor->item.data_off = DATAP_OFF(cursor->item.pagep, cursor->item.pgndx);
+  if (ckey.size > 0)
+    memcpy (key->data, ckey.data, ckey.size);
 
-    return ffdb_get_item (hashp, key, data, &cursor->item, 0);
+  if (!data) {
+    ffdb_release_item (hashp, &item);
+    return 0;
   }
-  return 0;
+  /* The page is put back by the call */
+  return ffdb_get_item (hashp, &ckey, data, &item, 1);
 }
 
 /**
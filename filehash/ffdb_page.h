@@ -111,10 +111,17 @@ typedef struct _ffdb_datap_
  * 28   key offset 0            4       pgno_t          KEY_OFF(P, I)
  * 32   key len 0               4       pgno_t          KEY_LEN(P, I)
  * 36   data offset 0           4       pgno_t          DATA_OFF(P, I)
- * 40   key  offset 1           4       pgno_t          KEY_OFF(P, I)
- * 44   key  len 1              4       pgno_t          KEY_LEN(P, I)
- * 48   data offset 1           4       pgno_t          DATA_OFF(P, I)
+ * 40   key hash 0              4       pgno_t          KEY_HASH(P, I)
+ * 44   key  offset 1           4       pgno_t          KEY_OFF(P, I)
+ * 48   key  len 1              4       pgno_t          KEY_LEN(P, I)
+ * 52   data offset 1           4       pgno_t          DATA_OFF(P, I)
+ * 56   key hash 1              4       pgno_t          KEY_HASH(P, I)
  * ...etc...
+ *
+ * The key hash is the full hash value of the key before it is masked
+ * into a bucket number. A lookup compares the hash values first and
+ * only compares keys when the hash values are the same. A bucket split
+ * finds the new bucket of a key from its hash value as well.
  */
 /* Indices (in bytes) of the beginning of each of these entries */
 #define I_CURR_PGNO      0
@@ -133,9 +140,15 @@ typedef struct _ffdb_datap_
 /* Overhead is everything prior to the first key/data pair. */
 #define PAGE_OVERHEAD	(I_HF_OFFSET + sizeof(pgno_t))
 
-/* overhead for one key and one data: two offsets + one key len */
+/* overhead for one key and one data: two offsets + one key len + key hash */
 /* Here is the reason limiting page size: the offset is a unsigned short */
-#define PAIR_OVERHEAD (3*sizeof(pgno_t))
+#define FFDB_PAIR_OVERHEAD (4*sizeof(pgno_t))
+
+/* Files before FFDB_VERSION_KEY_HASH have no key hash in a slot */
+#define FFDB_PAIR_OVERHEAD_V5 (3*sizeof(pgno_t))
+
+/* overhead of a slot of the file of hashp */
+#define PAIR_OVERHEAD (hashp->pair_overhead)
 
 /* macro to retrive a value of Type Y from page P at offset F */
 #define FIND_VALUE(P, T, F) (((T *)((unsigned char *)(P) + F))[0])
@@ -159,13 +172,22 @@ typedef struct _ffdb_datap_
 /* retrive key/data pair offsets and data for a given index */
 /* value of data pointer offset has to be aligned to 4 byte boundary */
 #define DATAP_OFF(P, N) \
-  FIND_VALUE(P,pgno_t, PAGE_OVERHEAD + N * PAIR_OVERHEAD + 2*sizeof(pgno_t))
+  FIND_VALUE(P,pgno_t, PAGE_OVERHEAD + (N) * PAIR_OVERHEAD + 2*sizeof(pgno_t))
 #define KEY_OFF(P, N) \
-  FIND_VALUE(P,pgno_t, PAGE_OVERHEAD + N * PAIR_OVERHEAD)
+  FIND_VALUE(P,pgno_t, PAGE_OVERHEAD + (N) * PAIR_OVERHEAD)
 #define KEY_LEN(P, N) \
-  FIND_VALUE(P,pgno_t, PAGE_OVERHEAD + N * PAIR_OVERHEAD + sizeof(pgno_t))
+  FIND_VALUE(P,pgno_t, PAGE_OVERHEAD + (N) * PAIR_OVERHEAD + sizeof(pgno_t))
+#define KEY_HASH(P, N) \
+  FIND_VALUE(P,pgno_t, PAGE_OVERHEAD + (N) * PAIR_OVERHEAD + 3*sizeof(pgno_t))
 
 
+/**
+ * Whether the key with index N on page P may be a key of full hash
+ * value H. Files without the key hash in a slot compare all keys.
+ */
+#define KEY_HASH_MATCH(P, N, H) \
+  (hashp->hdr.version < FFDB_VERSION_KEY_HASH || KEY_HASH((P), (N)) == (H))
+
 /* Key value with index N on page P */
 #define KEY(P, N)   (((unsigned char *)(P) + KEY_OFF((P), (N))))
 /* Data pointer value with index N on page P */
@@ -243,6 +265,8 @@ typedef struct _ffdb_datap_
  *            next              4       pgno_t
  *            key_page          4       pgno_t
  *            key_idx           4       pgno_t
+ *            codec             4       FFDB_CODEC_WORD
+ *            raw length        4       pgno_t
  *      data
  *
  * When a page has been used, highest free byte = 0
@@ -265,8 +289,16 @@ typedef struct _ffdb_data_header_
   pgno_t  next;               /* next data item on this page       */
   pgno_t  key_page;           /* page number where the key resides */
   pgno_t  key_idx;            /* index within the key page to find key */
+  unsigned int codec;         /* encoding, FFDB_CODEC_WORD and flags */
+  pgno_t  rawlen;             /* length of the data before encoding */
 }ffdb_data_header_t;
 
+/**
+ * Files before FFDB_VERSION_CODEC have the data headers without the
+ * codec and the raw length
+ */
+#define FFDB_DATA_OVERHEAD_V8   (5*sizeof(pgno_t))
+
 #define I_FIRST_DATA_POS   28
 
 #define FIRST_DATA_POS(P)	(FIND_VALUE((P), pgno_t, I_FIRST_DATA_POS))
@@ -277,9 +309,30 @@ typedef struct _ffdb_data_header_
 #define BIG_PAGE_OVERHEAD	(I_FIRST_DATA_POS + sizeof(pgno_t))
 
 /**
- * Big data header
+ * Big data header of the file of hashp
  */
-#define BIG_DATA_OVERHEAD       (sizeof(ffdb_data_header_t))
+#define BIG_DATA_OVERHEAD       (hashp->dhdr_size)
+
+/**
+ * Flag in the codec word of a data header whose continuation pages do
+ * not follow each other
+ */
+#define DATA_SCATTERED 0x10000
+
+/**
+ * The codec word of a data header, FFDB_CODEC_NONE in files without it
+ */
+#define DATA_CODEC(header) \
+  (hashp->hdr.version < FFDB_VERSION_CODEC ? FFDB_CODEC_NONE : \
+   ((header)->codec & ~DATA_SCATTERED))
+
+/**
+ * Whether the continuation pages of a data header have to be found by
+ * walking the chain. Files without the codec word may reuse any free page.
+ */
+#define DATA_IS_SCATTERED(header) \
+  (hashp->hdr.version < FFDB_VERSION_CODEC || \
+   ((header)->codec & DATA_SCATTERED) != 0)
 
 /**
  * Total big data size including header information
@@ -291,6 +344,12 @@ typedef struct _ffdb_data_header_
  */
 #define BIG_DATA_HEADER(P,offset) ((ffdb_data_header_t *)(((unsigned char *)(P) + (offset))))
 
+/**
+ * Data pages holding less than 1/COMPACT_FRACTION of live data are
+ * emptied by compaction
+ */
+#define COMPACT_FRACTION 2
+
 /**
  * A single key must be fit into a page
  * we are not dealing with the case that a single key cannot be fit
@@ -337,6 +396,7 @@ typedef struct _ffdb_data_header_
 #define HASH_UINFO_PAGE      0x4001
 #define HASH_CONFIG_PAGE     0x5001
 #define HASH_FREE_PAGE       0x6001
+#define HASH_INDEX_PAGE      0x7001
 #define HASH_DELETED_PAGE    0x8001
 #define HASH_RAW_PAGE        0xffee
 
@@ -373,11 +433,48 @@ typedef struct _ffdb_data_header_
  */
 #define CONFIG_INFO(P, N) ((ffdb_config_info_t *)((unsigned char *)(P) + PAGE_OVERHEAD + (N) * sizeof(ffdb_config_info_t)))
 
+/**
+ * Ordered key index page format
+ *
+ * ---- ------------------      ------  --------        --------------
+ * 0    current page number     4       pgno_t          CURR_PGNO(p)
+ * 4    previous page number    4       pgno_t          PREV_PGNO(P)
+ * 8    next page number        4       pgno_t          NEXT_PGNO(P)
+ * 12   page signature          4       pgno_t          PAGE_SIGN(P)
+ * 16   # keys on page          2       indx_t          NUM_ENT(P)
+ * 18   page type               2       indx_t          TYPE(P)
+ * 20   check sum (crc)         4       pgno_t          CHKSUM(P)
+ * 24   first free byte         4       pgno_t          OFFSET(P)
+ * 28   key len 0               4       pgno_t          IDX_KEY_LEN(P, 28)
+ * 32   key 0                                           IDX_KEY(P, 28)
+ *      key len 1 at the next 4 byte boundary
+ * ...etc...
+ *
+ * Keys are stored back to back in ascending order. Keys are compared
+ * byte by byte, and a key sorts before a longer key starting with the
+ * same bytes. Index pages are chained in key order through their
+ * previous and next page numbers. Keys are found in the hash table
+ * from there, so index pages do not change when buckets are split or
+ * data are moved.
+ */
+#define IDX_KEY_LEN(P, O) (FIND_VALUE((P), pgno_t, (O)))
+#define IDX_KEY(P, O) ((unsigned char *)(P) + (O) + sizeof(pgno_t))
+#define IDX_ENTRY_SIZE(L) \
+  (sizeof(pgno_t) + (((L) + ADDR_ALIGNMENT - 1) & ~(ADDR_ALIGNMENT - 1)))
+
+/**
+ * At least four keys fit on an index page, so that a split page
+ * always has room for one more key
+ */
+#define FFDB_MAX_INDEX_KEYSIZE(h) \
+  (((h)->hdr.bsize - PAGE_OVERHEAD) / 4 - sizeof(pgno_t))
+
 /**
  * Page in and out routines
  */
 extern void ffdb_pgin_routine (void* arg, pgno_t pgno, void* page);
 extern void ffdb_pgout_routine (void* arg, pgno_t pgno, void* page);
+extern int  ffdb_pgcheck_routine (void* arg, pgno_t pgno, void* page);
 
 
 
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     Page I/O engines: synchronous positional I/O and io_uring
+ *
+ *     The io_uring engine talks to the kernel through the system calls
+ *     directly, so no extra library is needed to link against.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#ifdef __linux
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#define _FFDB_HAVE_URING
+#endif
+#endif
+
+#include "ffdb_db.h"
+#include "ffdb_pageio.h"
+
+/**
+ * Run one request with a single system call
+ */
+static ssize_t
+_ffdb_pageio_sync_one (int fd, ffdb_ioreq_t* req)
+{
+  ssize_t ret;
+
+  if (req->write)
+    ret = pwritev (fd, req->iov, req->iovcnt, req->offset);
+  else
+    ret = preadv (fd, req->iov, req->iovcnt, req->offset);
+  return (ret < 0) ? -errno : ret;
+}
+
+static int
+_ffdb_pageio_sync_submit (ffdb_pageio_t* io, int fd,
+			  ffdb_ioreq_t* reqs, unsigned int num)
+{
+  unsigned int i;
+
+  for (i = 0; i < num; i++)
+    reqs[i].result = _ffdb_pageio_sync_one (fd, &reqs[i]);
+  return 0;
+}
+
+static void
+_ffdb_pageio_sync_close (ffdb_pageio_t* io)
+{
+  /* nothing to release */
+}
+
+
+#ifdef _FFDB_HAVE_URING
+
+/**
+ * Submission and completion rings shared with the kernel
+ */
+typedef struct _ffdb_uring_
+{
+  int                  fd;
+  unsigned int         entries;
+  unsigned int*        sq_head;
+  unsigned int*        sq_tail;
+  unsigned int*        sq_mask;
+  unsigned int*        sq_array;
+  unsigned int*        cq_head;
+  unsigned int*        cq_tail;
+  unsigned int*        cq_mask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  void*                sq_ptr;
+  size_t               sq_len;
+  void*                cq_ptr;
+  size_t               cq_len;
+  size_t               sqes_len;
+  pthread_mutex_t      lock;    /* one batch in the rings at a time */
+}ffdb_uring_t;
+
+static void
+_ffdb_uring_unmap (ffdb_uring_t* ring)
+{
+  if (ring->sqes)
+    munmap (ring->sqes, ring->sqes_len);
+  if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+    munmap (ring->cq_ptr, ring->cq_len);
+  if (ring->sq_ptr)
+    munmap (ring->sq_ptr, ring->sq_len);
+  close (ring->fd);
+}
+
+/**
+ * Set up the rings
+ * @return 0 on success, otherwise errno
+ */
+static int
+_ffdb_uring_setup (ffdb_uring_t* ring, unsigned int entries)
+{
+  struct io_uring_params p;
+  char* sq;
+  char* cq;
+
+  memset (ring, 0, sizeof(ffdb_uring_t));
+  memset (&p, 0, sizeof(p));
+  ring->fd = syscall (__NR_io_uring_setup, entries, &p);
+  if (ring->fd < 0)
+    return errno;
+
+  ring->entries = p.sq_entries;
+  ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_len > ring->sq_len)
+      ring->sq_len = ring->cq_len;
+    ring->cq_len = ring->sq_len;
+  }
+
+  ring->sq_ptr = mmap (0, ring->sq_len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED) {
+    ring->sq_ptr = 0;
+    goto fail;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring->cq_ptr = ring->sq_ptr;
+  else {
+    ring->cq_ptr = mmap (0, ring->cq_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ring->fd,
+			 IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED) {
+      ring->cq_ptr = 0;
+      goto fail;
+    }
+  }
+
+  ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap (0, ring->sqes_len,
+					    PROT_READ | PROT_WRITE,
+					    MAP_SHARED | MAP_POPULATE,
+					    ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = 0;
+    goto fail;
+  }
+
+  sq = (char *)ring->sq_ptr;
+  cq = (char *)ring->cq_ptr;
+  ring->sq_head = (unsigned int *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+  ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  return pthread_mutex_init (&ring->lock, 0);
+
+ fail:
+  _ffdb_uring_unmap (ring);
+  return ENOMEM;
+}
+
+/**
+ * Queue requests, tell the kernel and wait for all of them to complete
+ * num is not larger than the number of ring entries
+ */
+static int
+_ffdb_uring_run (ffdb_uring_t* ring, int fd, ffdb_ioreq_t* reqs,
+		 unsigned int num)
+{
+  struct io_uring_sqe* sqe;
+  struct io_uring_cqe* cqe;
+  unsigned int i, tail, head, idx, submitted, done;
+  int ret;
+
+  tail = *ring->sq_tail;
+  for (i = 0; i < num; i++) {
+    idx = tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset (sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = reqs[i].write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)reqs[i].iov;
+    sqe->len = reqs[i].iovcnt;
+    sqe->off = reqs[i].offset;
+    sqe->user_data = i;
+    ring->sq_array[idx] = idx;
+    tail++;
+  }
+  __atomic_store_n (ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+  submitted = done = 0;
+  while (done < num) {
+    ret = syscall (__NR_io_uring_enter, ring->fd, num - submitted,
+		   1, IORING_ENTER_GETEVENTS, 0, 0);
+    if (ret < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+	continue;
+      return -1;
+    }
+    submitted += ret;
+
+    head = *ring->cq_head;
+    while (head != __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE)) {
+      cqe = &ring->cqes[head & *ring->cq_mask];
+      reqs[cqe->user_data].result = cqe->res;
+      head++;
+      done++;
+    }
+    __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+  return 0;
+}
+
+static int
+_ffdb_pageio_uring_submit (ffdb_pageio_t* io, int fd,
+			   ffdb_ioreq_t* reqs, unsigned int num)
+{
+  ffdb_uring_t* ring = (ffdb_uring_t *)io->internal;
+  unsigned int i, n;
+  int ret = 0;
+
+  pthread_mutex_lock (&ring->lock);
+  for (i = 0; i < num && ret == 0; i += n) {
+    n = num - i;
+    if (n > ring->entries)
+      n = ring->entries;
+    ret = _ffdb_uring_run (ring, fd, &reqs[i], n);
+  }
+  pthread_mutex_unlock (&ring->lock);
+
+  /* The ring is broken: finish the batch one request at a time */
+  if (ret != 0) {
+    fprintf (stderr, "ffdb_pageio: io_uring error %d, using synchronous I/O\n",
+	     errno);
+    for (i = 0; i < num; i++)
+      reqs[i].result = _ffdb_pageio_sync_one (fd, &reqs[i]);
+  }
+  return 0;
+}
+
+static void
+_ffdb_pageio_uring_close (ffdb_pageio_t* io)
+{
+  ffdb_uring_t* ring = (ffdb_uring_t *)io->internal;
+
+  _ffdb_uring_unmap (ring);
+  pthread_mutex_destroy (&ring->lock);
+  free (ring);
+}
+#endif
+
+
+/**
+ * Create a page I/O engine
+ */
+int
+ffdb_pageio_create (ffdb_pageio_t** io, int type)
+{
+  ffdb_pageio_t* p;
+#ifdef _FFDB_HAVE_URING
+  ffdb_uring_t* ring;
+#endif
+
+  *io = 0;
+  p = (ffdb_pageio_t *)calloc (1, sizeof(ffdb_pageio_t));
+  if (!p)
+    return ENOMEM;
+
+#ifdef _FFDB_HAVE_URING
+  if (type == FFDB_IO_URING || type == FFDB_IO_AUTO) {
+    ring = (ffdb_uring_t *)malloc (sizeof(ffdb_uring_t));
+    if (ring && _ffdb_uring_setup (ring, FFDB_IO_DEPTH) == 0) {
+      p->type = FFDB_IO_URING;
+      p->name = "io_uring";
+      p->submit = _ffdb_pageio_uring_submit;
+      p->close = _ffdb_pageio_uring_close;
+      p->internal = ring;
+      *io = p;
+      return 0;
+    }
+    free (ring);
+  }
+#endif
+
+  /* io_uring is either not asked for or not available */
+  p->type = FFDB_IO_SYNC;
+  p->name = "sync";
+  p->submit = _ffdb_pageio_sync_submit;
+  p->close = _ffdb_pageio_sync_close;
+  *io = p;
+  return 0;
+}
+
+/**
+ * Read or write a batch of requests and wait for all of them
+ */
+int
+ffdb_pageio_submit (ffdb_pageio_t* io, int fd,
+		    ffdb_ioreq_t* reqs, unsigned int num)
+{
+  ffdb_ioreq_t rest;
+  struct iovec iov[FFDB_IO_DEPTH];
+  size_t want, skip;
+  ssize_t n;
+  unsigned int i;
+  int j, ret = 0;
+
+  if (num == 0)
+    return 0;
+
+  io->submit (io, fd, reqs, num);
+
+  /**
+   * The kernel may transfer less than asked for. Continue short
+   * transfers synchronously until they are done or the end of
+   * file is reached.
+   */
+  for (i = 0; i < num; i++) {
+    if (reqs[i].result < 0) {
+      ret = -1;
+      continue;
+    }
+    want = 0;
+    for (j = 0; j < reqs[i].iovcnt; j++)
+      want += reqs[i].iov[j].iov_len;
+
+    while (reqs[i].result > 0 && (size_t)reqs[i].result < want) {
+      /* build the buffers not transferred yet */
+      skip = reqs[i].result;
+      rest.iovcnt = 0;
+      for (j = 0; j < reqs[i].iovcnt && rest.iovcnt < FFDB_IO_DEPTH; j++) {
+	if (skip >= reqs[i].iov[j].iov_len) {
+	  skip -= reqs[i].iov[j].iov_len;
+	  continue;
+	}
+	iov[rest.iovcnt].iov_base = (char *)reqs[i].iov[j].iov_base + skip;
+	iov[rest.iovcnt].iov_len = reqs[i].iov[j].iov_len - skip;
+	rest.iovcnt++;
+	skip = 0;
+      }
+      rest.iov = iov;
+      rest.write = reqs[i].write;
+      rest.offset = reqs[i].offset + reqs[i].result;
+
+      n = _ffdb_pageio_sync_one (fd, &rest);
+      if (n < 0) {
+	reqs[i].result = n;
+	ret = -1;
+      }
+      else if (n == 0)
+	break;
+      else
+	reqs[i].result += n;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Release an engine
+ */
+void
+ffdb_pageio_close (ffdb_pageio_t* io)
+{
+  if (io) {
+    io->close (io);
+    free (io);
+  }
+}
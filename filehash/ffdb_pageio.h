@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     Page I/O engines used by the page pool to read and write
+ *     many pages at once
+ *
+ *     The synchronous engine does one positional read or write after
+ *     another. The io_uring engine keeps all requests of a batch in
+ *     flight at once. If io_uring is not available, the synchronous
+ *     engine is used instead.
+ *
+ */
+#ifndef _FFDB_PAGE_IO_H
+#define _FFDB_PAGE_IO_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * Maximum number of requests an engine keeps in flight
+ */
+#define FFDB_IO_DEPTH            64
+
+/**
+ * One read or write request of a batch
+ */
+typedef struct _ffdb_ioreq_
+{
+  struct iovec*  iov;           /* buffers to read into or write from */
+  int            iovcnt;        /* number of buffers                  */
+  int            write;         /* 1: write, 0: read                  */
+  off_t          offset;        /* file offset                        */
+  ssize_t        result;        /* bytes transferred or -errno        */
+}ffdb_ioreq_t;
+
+/**
+ * Page I/O engine
+ */
+typedef struct _ffdb_pageio_
+{
+  int            type;          /* FFDB_IO_SYNC or FFDB_IO_URING */
+  const char*    name;
+  /* run num requests and wait until all of them are done */
+  int  (*submit) (struct _ffdb_pageio_* io, int fd,
+		  ffdb_ioreq_t* reqs, unsigned int num);
+  void (*close)  (struct _ffdb_pageio_* io);
+  void*          internal;      /* engine private data */
+}ffdb_pageio_t;
+
+#ifdef _cplusplus
+extern "C" {
+#endif
+
+/**
+ * Create a page I/O engine
+ *
+ * @param io returned engine
+ * @param type FFDB_IO_SYNC, FFDB_IO_URING or FFDB_IO_AUTO. An io_uring
+ * engine that cannot be set up falls back to the synchronous engine.
+ * @return 0 on success, otherwise errno
+ */
+extern int
+ffdb_pageio_create (ffdb_pageio_t** io, int type);
+
+/**
+ * Read or write a batch of requests and wait for all of them
+ *
+ * Each request is carried out completely unless the end of file is
+ * reached or an error occurs. The number of bytes transferred or
+ * -errno is left in the result of each request.
+ *
+ * @return 0 if all requests were carried out without error, otherwise -1
+ */
+extern int
+ffdb_pageio_submit (ffdb_pageio_t* io, int fd,
+		    ffdb_ioreq_t* reqs, unsigned int num);
+
+/**
+ * Release an engine
+ */
+extern void
+ffdb_pageio_close (ffdb_pageio_t* io);
+
+#ifdef _cplusplus
+};
+#endif
+
+#endif
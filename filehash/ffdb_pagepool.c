@@ -65,6 +65,8 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
 #ifndef __USE_LARGEFILE64
 #define __USE_LARGEFILE64
@@ -125,10 +127,31 @@ void ffdb_dump_stack (void)
 
 
 /**
- * Flush out some pages in order of page numbers
+ * Flush out some pages of a stripe in order of page numbers.
+ * If the stripe is null, pages of all stripes are flushed
  */
 static int 
-_ffdb_pagepool_sync_i (ffdb_pagepool_t* pgp, unsigned int numpages);
+_ffdb_pagepool_sync_i (ffdb_pagepool_t* pgp, ffdb_stripe_t* sp,
+		       unsigned int numpages);
+
+/**
+ * Find the stripe a page number belongs to
+ */
+#define FFDB_STRIPE(pgp,pgno) (&((pgp)->stripes[FFDB_STRIPEKEY(pgno)]))
+
+/**
+ * States of a page of a memory mapped file
+ */
+#define FFDB_MAP_UNCHECKED 0
+#define FFDB_MAP_INPLACE   1
+#define FFDB_MAP_CACHED    2
+
+/**
+ * Whether a page memory lives inside the file mapping
+ */
+#define _FFDB_PAGE_MAPPED(pgp,mem)					\
+  ((pgp)->mapaddr && (char *)(mem) >= (pgp)->mapaddr &&			\
+   (char *)(mem) < (pgp)->mapaddr + (pgp)->maplen)
 
 /* Test for valid page sizes. */
 #define	IS_VALID_PAGESIZE(x)						\
@@ -256,7 +279,7 @@ _ffdb_slist_merge_sort (ffdb_slh_t* head)
 /*
  * _ffdb_pagepool_write
  *	Write a dirty page to disk.
- * This routine is called with page being locked
+ * This routine is called with the stripe lock of the page being held
  */
 static int
 _ffdb_pagepool_write(ffdb_pagepool_t* pgp, 
@@ -276,29 +299,109 @@ _ffdb_pagepool_write(ffdb_pagepool_t* pgp,
 
   offset =  (off_t)pgp->pagesize * bp->pgno;
 
-  if (lseek(pgp->fd, offset, SEEK_SET) != offset) 
+  /* Other stripes may write at the same time: no shared file offset */
+  if ((nbytes = pwrite(pgp->fd, bp->page, pgp->pagesize, offset)) != pgp->pagesize)
     ret = -1;
-  else {
-    if ((nbytes = write(pgp->fd, bp->page, pgp->pagesize)) != pgp->pagesize) 
-      ret = -1;
-  }
 
   if (ret == 0)
     FFDB_FLAG_CLR(bp->flags, FFDB_PAGE_DIRTY);
 
+  /* Tell readers of this stripe the disk content has changed */
+  FFDB_STRIPE(pgp, bp->pgno)->wgen++;
+
   /* Update how many pages this file holds now */
+  FFDB_LOCK(pgp->lock);
   if (bp->pgno >= pgp->npages) {
     pgp->npages = bp->pgno + 1;
   }
+  FFDB_UNLOCK(pgp->lock);
 
   return ret;
 }
 
 
+/**
+ * Write dirty pages sorted by page number to disk. Pages with
+ * consecutive page numbers go out in a single vectored write, and
+ * all writes are handed to the I/O engine as one batch.
+ * This routine is called with the stripe locks of all pages being held
+ */
+static int
+_ffdb_pagepool_write_batch (ffdb_pagepool_t* pgp, ffdb_bkt_t** bps,
+			    unsigned int num)
+{
+  ffdb_ioreq_t* reqs;
+  struct iovec* iov;
+  unsigned int i, j, k, nreqs, nclean;
+  int ret = 0;
+
+  reqs = (ffdb_ioreq_t *)malloc (num * sizeof(ffdb_ioreq_t));
+  iov = (struct iovec *)malloc (num * sizeof(struct iovec));
+  if (!reqs || !iov) {
+    fprintf (stderr, "ffdb_pagepool_sync: cannot allocate space for %d write requests\n", num);
+    free (reqs);
+    free (iov);
+    return -1;
+  }
+
+  nreqs = 0;
+  for (i = 0; i < num; i++) {
+#ifdef _FFDB_STATISTICS
+    ++pgp->pagewrite;
+#endif
+    /* Run through the user's filter. */
+    if (pgp->pgout)
+      (pgp->pgout)(pgp->pgcookie, bps[i]->pgno, bps[i]->page);
+
+    iov[i].iov_base = bps[i]->page;
+    iov[i].iov_len = pgp->pagesize;
+
+    if (nreqs > 0 && reqs[nreqs - 1].iovcnt < FFDB_WRITEV_MAX &&
+	bps[i - 1]->pgno + 1 == bps[i]->pgno)
+      reqs[nreqs - 1].iovcnt++;
+    else {
+      reqs[nreqs].iov = &iov[i];
+      reqs[nreqs].iovcnt = 1;
+      reqs[nreqs].write = 1;
+      reqs[nreqs].offset = (off_t)pgp->pagesize * bps[i]->pgno;
+      reqs[nreqs].result = 0;
+      nreqs++;
+    }
+  }
+
+  ffdb_pageio_submit (pgp->io, pgp->fd, reqs, nreqs);
+
+  /* Pages written out completely are clean now */
+  i = 0;
+  for (j = 0; j < nreqs; j++) {
+    nclean = (reqs[j].result > 0) ? reqs[j].result / pgp->pagesize : 0;
+    if (nclean < reqs[j].iovcnt) {
+      fprintf (stderr, "ffdb_pagepool_sync: writing pages %d to %d error.\n",
+	       bps[i]->pgno, bps[i + reqs[j].iovcnt - 1]->pgno);
+      ret = -1;
+    }
+    for (k = 0; k < reqs[j].iovcnt; k++, i++) {
+      if (k < nclean)
+	FFDB_FLAG_CLR(bps[i]->flags, FFDB_PAGE_DIRTY);
+      /* Tell readers of this stripe the disk content has changed */
+      FFDB_STRIPE(pgp, bps[i]->pgno)->wgen++;
+    }
+  }
+
+  FFDB_LOCK(pgp->lock);
+  if (bps[num - 1]->pgno >= pgp->npages)
+    pgp->npages = bps[num - 1]->pgno + 1;
+  FFDB_UNLOCK(pgp->lock);
+
+  free (reqs);
+  free (iov);
+  return ret;
+}
+
 /*
  * _ffdb_clean_page_ondisk
  *	Clean a page on disk
- * 
+ * This routine is called with the stripe lock of the page being held
  */
 static int
 _ffdb_clean_page_ondisk (ffdb_pagepool_t* pgp, pgno_t num)
@@ -321,12 +424,10 @@ _ffdb_clean_page_ondisk (ffdb_pagepool_t* pgp, pgno_t num)
 
   offset =  (off_t)pgp->pagesize * num;
 
-  if (lseek(pgp->fd, offset, SEEK_SET) != offset) 
+  if ((nbytes = pwrite(pgp->fd, cleanbuf, pgp->pagesize, offset)) != pgp->pagesize)
     ret = -1;
-  else {
-    if ((nbytes = write(pgp->fd, cleanbuf, pgp->pagesize)) != pgp->pagesize) 
-      ret = -1;
-  }
+
+  FFDB_STRIPE(pgp, num)->wgen++;
 
   /* free memory */
   free (cleanbuf);
@@ -334,18 +435,157 @@ _ffdb_clean_page_ondisk (ffdb_pagepool_t* pgp, pgno_t num)
   return ret;
 }
 
+/**
+ * The shared pins each thread holds, see ffdb_shared_pins_t
+ */
+static pthread_key_t  _ffdb_shared_key;
+static pthread_once_t _ffdb_shared_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Free the shared pin list of a thread when it exits
+ */
+static void
+_ffdb_shared_pins_free (void* arg)
+{
+  ffdb_shared_pins_t* pins = (ffdb_shared_pins_t *)arg;
+
+  free (pins->bps);
+  free (pins);
+}
+
+static void
+_ffdb_shared_pins_init (void)
+{
+  pthread_key_create (&_ffdb_shared_key, _ffdb_shared_pins_free);
+}
+
+/**
+ * Get the shared pin list of the calling thread, creating it if asked
+ */
+static ffdb_shared_pins_t *
+_ffdb_shared_pins (int create)
+{
+  ffdb_shared_pins_t* pins;
+
+  pthread_once (&_ffdb_shared_once, _ffdb_shared_pins_init);
+  pins = (ffdb_shared_pins_t *)pthread_getspecific (_ffdb_shared_key);
+  if (!pins && create) {
+    pins = (ffdb_shared_pins_t *)calloc (1, sizeof(ffdb_shared_pins_t));
+    if (!pins) {
+      fprintf (stderr, "_ffdb_shared_pins: cannot allocate space for shared pins\n");
+      abort ();
+    }
+    pthread_setspecific (_ffdb_shared_key, pins);
+  }
+  return pins;
+}
+
+/**
+ * Does the calling thread hold a shared pin on this bucket
+ */
+static int
+_ffdb_shared_pins_held (ffdb_bkt_t* bp)
+{
+  ffdb_shared_pins_t* pins = _ffdb_shared_pins (0);
+  unsigned int i;
+
+  if (!pins)
+    return 0;
+  for (i = 0; i < pins->num; i++) {
+    if (pins->bps[i] == bp)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Record a shared pin of the calling thread on this bucket
+ */
+static void
+_ffdb_shared_pins_add (ffdb_bkt_t* bp)
+{
+  ffdb_shared_pins_t* pins = _ffdb_shared_pins (1);
+
+  if (pins->num == pins->max) {
+    pins->max = (pins->max == 0) ? 8 : 2 * pins->max;
+    pins->bps = (ffdb_bkt_t **)realloc (pins->bps,
+					pins->max * sizeof(ffdb_bkt_t *));
+    if (!pins->bps) {
+      fprintf (stderr, "_ffdb_shared_pins_add: cannot allocate space for shared pins\n");
+      abort ();
+    }
+  }
+  pins->bps[pins->num++] = bp;
+}
+
+/**
+ * Forget one shared pin of the calling thread on this bucket
+ */
+static void
+_ffdb_shared_pins_del (ffdb_bkt_t* bp)
+{
+  ffdb_shared_pins_t* pins = _ffdb_shared_pins (0);
+  unsigned int i;
+
+  if (!pins)
+    return;
+  for (i = pins->num; i > 0; i--) {
+    if (pins->bps[i - 1] == bp) {
+      pins->bps[i - 1] = pins->bps[--pins->num];
+      return;
+    }
+  }
+}
+
+/**
+ * Turn the pin of a freshly obtained bucket into a shared pin if
+ * a reader asked for it. A shared page has no owner.
+ *
+ * This routine is called when the stripe lock of this bucket is held
+ */
+static void
+_ffdb_pagepool_share_bkt (ffdb_bkt_t* bp, unsigned int flags)
+{
+  if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_SHARED)) {
+    FFDB_FLAG_SET(bp->flags, FFDB_PAGE_SHARED);
+    bp->readers = 1;
+    FFDB_THREAD_NULL(bp->owner);
+    _ffdb_shared_pins_add (bp);
+  }
+}
+
+/**
+ * Wake up the first thread waiting on a page. The caller has
+ * just made this page available.
+ *
+ * This routine is called when the stripe lock of this bucket is held
+ */
+static ffdb_bkt_waiter_t *
+_ffdb_pagepool_wakeup_waiter (ffdb_bkt_t* bp)
+{
+  ffdb_bkt_waiter_t* sleeper = 0;
+
+  if (bp->waiters > 0) {
+    sleeper = FFDB_CIRCLEQ_LAST(&bp->wqh);
+    sleeper->wakeup = 0xdeafbeaf;
+  }
+  return sleeper;
+}
+
 /**
  * Get a page from cache when the page is not used by a thread
  * @param pgp pagepool pointer
+ * @param sp the stripe to take the bucket from
  * @param bkt a new pointer to a bucket
  * @return 0 on success, -1 return no bucket can be reused. otherwise
  * error on flushing the unused page
  * Upon returning of this routine, the reused bucket's pinned flag is set
  *
- * This routine is called when pgp->lock is held
+ * This routine is called when sp->lock is held
  */
 static int
-_ffdb_pagepool_reuse_bkt (ffdb_pagepool_t* pgp, ffdb_bkt_t** retbp)
+_ffdb_pagepool_reuse_bkt (ffdb_pagepool_t* pgp, ffdb_stripe_t* sp,
+			  ffdb_bkt_t** retbp)
 {
   struct _ffdb_hqh *head;
   int ret = 0;
@@ -357,7 +597,7 @@ _ffdb_pagepool_reuse_bkt (ffdb_pagepool_t* pgp, ffdb_bkt_t** retbp)
   /**
    * Sanity check: LRU queues should not be empty
    */
-  if (FFDB_CIRCLEQ_EMPTY(&pgp->lqh)) {
+  if (FFDB_CIRCLEQ_EMPTY(&sp->lqh)) {
     fprintf (stderr, "_ffdb_pagepool_bkt: LRU queue is empty. Quit!\n");
     abort ();
   }
@@ -365,7 +605,7 @@ _ffdb_pagepool_reuse_bkt (ffdb_pagepool_t* pgp, ffdb_bkt_t** retbp)
   /**
    * Walk the LRU queue now
    */
-  FFDB_CIRCLEQ_FOREACH(bp, &pgp->lqh, lq) {
+  FFDB_CIRCLEQ_FOREACH(bp, &sp->lqh, lq) {
 
     reusepage = 0;
       
@@ -400,13 +640,14 @@ _ffdb_pagepool_reuse_bkt (ffdb_pagepool_t* pgp, ffdb_bkt_t** retbp)
 	/* Remove from the hash and lru queues. */
 	head = &pgp->hqh[FFDB_HASHKEY(bp->pgno)];
 	FFDB_CIRCLEQ_REMOVE(head, bp, hq);
-	FFDB_CIRCLEQ_REMOVE(&pgp->lqh, bp, lq);
+	FFDB_CIRCLEQ_REMOVE(&sp->lqh, bp, lq);
 #if 0
 	fprintf (stderr, "Reuse remove page number %d\n", bp->pgno);
 #endif
 
 	bp->ref = 0;
 	bp->waiters = 0;
+	bp->readers = 0;
 	bp->flags = 0;
 	bp->owner = FFDB_THREAD_ID;
 
@@ -429,9 +670,9 @@ _ffdb_pagepool_reuse_bkt (ffdb_pagepool_t* pgp, ffdb_bkt_t** retbp)
   /* Now flush out some fraction of pages to speed up performance */
   if (needwrite) {
 #ifdef _FFDB_DEBUG
-    fprintf (stderr, "Flush %d pages out\n", pgp->maxcache/FFDB_WRITE_FRAC);
+    fprintf (stderr, "Flush %d pages out\n", sp->maxcache/FFDB_WRITE_FRAC);
 #endif
-    _ffdb_pagepool_sync_i (pgp, pgp->maxcache/FFDB_WRITE_FRAC);
+    _ffdb_pagepool_sync_i (pgp, sp, sp->maxcache/FFDB_WRITE_FRAC);
   }
 
   return ret;
@@ -445,10 +686,10 @@ _ffdb_pagepool_reuse_bkt (ffdb_pagepool_t* pgp, ffdb_bkt_t** retbp)
  * When this routine is one, the newly found (created) bucket should have
  * its pinned flag set
  *
- * This routine is called when the pgp->lock is held
+ * This routine is called when the sp->lock is held
  */
 static ffdb_bkt_t *
-_ffdb_pagepool_new_bkt (ffdb_pagepool_t* pgp)
+_ffdb_pagepool_new_bkt (ffdb_pagepool_t* pgp, ffdb_stripe_t* sp)
 {
   ffdb_bkt_t *bp = 0;
 
@@ -463,11 +704,12 @@ _ffdb_pagepool_new_bkt (ffdb_pagepool_t* pgp)
 #ifdef _FFDB_STATISTICS
   ++pgp->pagealloc;
 #endif
-  ++pgp->curcache;
+  ++sp->curcache;
 
   bp->page = (char *)bp + sizeof(ffdb_bkt_t);
   bp->ref = 0;
   bp->waiters = 0;
+  bp->readers = 0;
   bp->flags = 0;
   bp->owner = FFDB_THREAD_ID;
 
@@ -480,6 +722,83 @@ _ffdb_pagepool_new_bkt (ffdb_pagepool_t* pgp)
   return (bp);
 }
 
+/**
+ * Get a bucket for a new page in a stripe: either reuse a bucket of
+ * this stripe or allocate a new one.
+ *
+ * This routine is called when the sp->lock is held
+ */
+static ffdb_bkt_t *
+_ffdb_pagepool_get_bkt (ffdb_pagepool_t* pgp, ffdb_stripe_t* sp)
+{
+  int status;
+  ffdb_bkt_t *bp = 0;
+
+  if (sp->curcache > sp->maxcache) {
+    /**
+     * If the cache is max'd out, walk the lru list for a buffer we
+     * can flush.  If we find one, write it (if necessary) and take it
+     * off any lists.  If we don't find anything we grow the cache anyway.
+     * The cache never shrinks.
+     */
+    status = _ffdb_pagepool_reuse_bkt (pgp, sp, &bp);
+    if (status == -1) {
+      /* cannot find page to reuse */
+      bp = _ffdb_pagepool_new_bkt (pgp, sp);
+    }
+  }
+  else
+    bp = _ffdb_pagepool_new_bkt (pgp, sp);
+
+  /* A page read into the cache may differ from any copy seen before */
+  if (bp)
+    bp->mod = ++sp->mgen;
+
+  return bp;
+}
+
+/**
+ * Lock every stripe of the page pool. Stripes are always locked in
+ * the same order to avoid deadlocks.
+ */
+static void
+_ffdb_pagepool_lock_all (ffdb_pagepool_t* pgp)
+{
+  int i;
+
+  for (i = 0; i < FFDB_NSTRIPES; i++)
+    FFDB_LOCK(pgp->stripes[i].lock);
+}
+
+/**
+ * Unlock every stripe of the page pool
+ */
+static void
+_ffdb_pagepool_unlock_all (ffdb_pagepool_t* pgp)
+{
+  int i;
+
+  for (i = FFDB_NSTRIPES - 1; i >= 0; i--)
+    FFDB_UNLOCK(pgp->stripes[i].lock);
+}
+
+/**
+ * Split maximum number of cached pages among all stripes
+ */
+static void
+_ffdb_pagepool_set_maxcache (ffdb_pagepool_t* pgp, pgno_t maxcache)
+{
+  int i;
+  pgno_t smax;
+
+  pgp->maxcache = maxcache;
+  smax = maxcache / FFDB_NSTRIPES;
+  if (smax == 0)
+    smax = 1;
+  for (i = 0; i < FFDB_NSTRIPES; i++)
+    pgp->stripes[i].maxcache = smax;
+}
+
 /**
  * Create ffdb_pagepool handle used by all threads of a process
  */
@@ -502,7 +821,6 @@ ffdb_pagepool_create (ffdb_pagepool_t** pgp, unsigned int flags)
   /**
    * Initialize LRU and hash table
    */
-  FFDB_CIRCLEQ_INIT (&(p->lqh));
   for (i = 0; i < FFDB_HASHSIZE; i++) 
     FFDB_CIRCLEQ_INIT (&(p->hqh[i]));  
 
@@ -514,6 +832,26 @@ ffdb_pagepool_create (ffdb_pagepool_t** pgp, unsigned int flags)
     return ret;
   }
 
+  for (i = 0; i < FFDB_NSTRIPES; i++) {
+    FFDB_CIRCLEQ_INIT (&(p->stripes[i].lqh));
+    if ((ret = FFDB_LOCK_INIT (p->stripes[i].lock)) != 0) {
+      while (--i >= 0)
+	FFDB_LOCK_FINI (p->stripes[i].lock);
+      FFDB_LOCK_FINI (p->lock);
+      free (p);
+      return ret;
+    }
+  }
+
+  /* Pages are read and written synchronously until asked otherwise */
+  if ((ret = ffdb_pageio_create (&p->io, FFDB_IO_SYNC)) != 0) {
+    for (i = 0; i < FFDB_NSTRIPES; i++)
+      FFDB_LOCK_FINI (p->stripes[i].lock);
+    FFDB_LOCK_FINI (p->lock);
+    free (p);
+    return ret;
+  }
+
   *pgp = p;
   return 0;
 }
@@ -542,7 +880,7 @@ ffdb_pagepool_open (ffdb_pagepool_t* pgp,
   /**
    * first check open flags
    */
-  unsigned int ok_flags = FFDB_CREATE | FFDB_RDONLY | FFDB_DIRECT;
+  unsigned int ok_flags = FFDB_CREATE | FFDB_RDONLY | FFDB_DIRECT | FFDB_NOMMAP;
   if (FFDB_FLAG_ISSET(flags, ~ok_flags)) {
     fprintf (stderr, "ffdb_pagepool_open wrong flags specification\n");
     goto openerr;
@@ -612,7 +950,7 @@ ffdb_pagepool_open (ffdb_pagepool_t* pgp,
   /* Set up some attribute of ffdb_pagepool structure */
   pgp->fd = fd;
   pgp->close_fd = 1;
-  pgp->maxcache = maxcache;
+  _ffdb_pagepool_set_maxcache (pgp, maxcache);
   pgp->pagesize = pagesize;
   
   /* number of pages I am holding */
@@ -697,7 +1035,7 @@ ffdb_pagepool_open_fd (ffdb_pagepool_t* pgp,
   /* Set up some attribute of ffdb_pagepool structure */
   pgp->fd = fd;
   pgp->close_fd = 0;
-  pgp->maxcache = maxcache;
+  _ffdb_pagepool_set_maxcache (pgp, maxcache);
   pgp->pagesize = pagesize;
 
   /* number of pages I am holding */
@@ -715,14 +1053,44 @@ ffdb_pagepool_open_fd (ffdb_pagepool_t* pgp,
   return errno;
 }
 
+
+/**
+ * Look up a page in the hash chain
+ *
+ * This routine is called when the stripe lock of this page is held
+ */
+static ffdb_bkt_t *
+_ffdb_pagepool_find_bkt (ffdb_pagepool_t* pgp, pgno_t pageno)
+{
+  ffdb_bkt_t* bp;
+  struct _ffdb_hqh *head;
+
+  head = &pgp->hqh[FFDB_HASHKEY(pageno)];
+  FFDB_CIRCLEQ_FOREACH(bp, head, hq) {
+    if (bp->pgno == pageno)
+      return bp;
+  }
+  return 0;
+}
+
 /**
  * Get a new page from the back source file
+ *
+ * The stripe lock is given up while the page is read from the file,
+ * so that other threads can use the cache in the mean time.
+ *
+ * @return 0 on success, 1 if another thread has brought this page
+ * into the cache while it was read. Otherwise errno is returned.
+ *
+ * This routine is called when the sp->lock is held and returns with
+ * sp->lock held
  */
 static int
-_ffdb_pagepool_load_new_page (ffdb_pagepool_t* pgp, pgno_t pageno,
-			      unsigned int flags, void** mem)
+_ffdb_pagepool_load_new_page (ffdb_pagepool_t* pgp, ffdb_stripe_t* sp,
+			      pgno_t pageno, unsigned int flags, void** mem)
 {
-  int status, nbytes;
+  int nbytes, err;
+  unsigned int wgen;
   off_t off;
   struct _ffdb_hqh *head;
   ffdb_bkt_t* bp = 0;
@@ -733,23 +1101,7 @@ _ffdb_pagepool_load_new_page (ffdb_pagepool_t* pgp, pgno_t pageno,
    * and return.
    *
    */
-  if (pgp->curcache > pgp->maxcache) {
-    /**
-     * If the cache is max'd out, walk the lru list for a buffer we
-     * can flush.  If we find one, write it (if necessary) and take it
-     * off any lists.  If we don't find anything we grow the cache anyway.
-     * The cache never shrinks.
-     */
-    status = _ffdb_pagepool_reuse_bkt (pgp, &bp);
-    if (status == -1) {
-      /* cannot find page to reuse */
-      bp = _ffdb_pagepool_new_bkt (pgp);
-    }
-  }
-  else 
-    bp = _ffdb_pagepool_new_bkt (pgp);
-
-
+  bp = _ffdb_pagepool_get_bkt (pgp, sp);
   if (!bp) {
     /* This has to be successful. This is a new page */
     fprintf (stderr, "ffdb_pagepool_load_new_page: cannot get new page of page number %d\n", pageno);
@@ -757,31 +1109,56 @@ _ffdb_pagepool_load_new_page (ffdb_pagepool_t* pgp, pgno_t pageno,
   }
   
   /**
-   * The obtained bucket has pinned flag set, we own this page.
-   * It is time to populate this page using back file
+   * The obtained bucket has pinned flag set and it is not on any
+   * queue, so nobody else can see it. Populate this page from the
+   * back file without holding the lock. If a page of this stripe is
+   * written out while we are reading, the read is done again since
+   * it may have picked up old content.
    */
   off = (off_t)pgp->pagesize * (pageno);
-  if (lseek (pgp->fd, off, SEEK_SET) != off) {
-    fprintf (stderr, "ffdb_pagepool_load_new_page: cannot seek to a right position.\n");
-    return errno;
-  }
-  nbytes = read (pgp->fd, bp->page, pgp->pagesize);
-  if (nbytes != pgp->pagesize && nbytes > 0) {
-    fprintf (stderr, "ffdb_pagepool_load_new_page: cannot read back end file\n");
-    return errno;
-  }
-  else if (nbytes == 0) 
-    memset (bp->page, 0, pgp->pagesize);
+  do {
+    wgen = sp->wgen;
+    FFDB_UNLOCK(sp->lock);
+
+    nbytes = pread (pgp->fd, bp->page, pgp->pagesize, off);
+    if (nbytes < 0 || (nbytes != pgp->pagesize && nbytes > 0)) {
+      err = errno;
+      fprintf (stderr, "ffdb_pagepool_load_new_page: cannot read back end file\n");
+      FFDB_LOCK(sp->lock);
+      --sp->curcache;
+      free (bp);
+      return err;
+    }
+    else if (nbytes == 0)
+      memset (bp->page, 0, pgp->pagesize);
+
+    FFDB_LOCK(sp->lock);
 
 #ifdef _FFDB_STATISTICS
-  ++pgp->pageread;
+    ++pgp->pageread;
 #endif
 
+    /* Some other thread has loaded this page while I was reading */
+    if (_ffdb_pagepool_find_bkt (pgp, pageno) != 0) {
+      --sp->curcache;
+      free (bp);
+      return 1;
+    }
+  } while (wgen != sp->wgen);
+
+  /**
+   * Check whether page in callback routine. This is done after we know
+   * the content is not torn by a concurrent write.
+   */
+  if (pgp->pgin)
+    (pgp->pgin)(pgp->pgcookie, pageno, bp->page);
+
   /* Set page number */
   bp->pgno = pageno;
   bp->owner = FFDB_THREAD_ID;
   bp->ref = 1;
   bp->waiters = 0;
+  _ffdb_pagepool_share_bkt (bp, flags);
 
   /* Change flags of this page since I own this page now */
   if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_DIRTY) ||
@@ -795,67 +1172,65 @@ _ffdb_pagepool_load_new_page (ffdb_pagepool_t* pgp, pgno_t pageno,
 
   /* insert this page into LRU and hash bucket */
   head = &pgp->hqh[FFDB_HASHKEY(bp->pgno)];
-#if 0
-  {
-    ffdb_bkt_t* bk;
-    FFDB_CIRCLEQ_FOREACH(bk, head, hq) {
-      if (bk->pgno == bp->pgno) {
-	fprintf (stderr, "Hash has this page %d alreay\n", bp->pgno);
-	pause ();
-      }
-    }
-
-    FFDB_CIRCLEQ_FOREACH(bk, &pgp->lqh, lq) {
-      if (bk->pgno == bp->pgno) {
-	fprintf (stderr, "LRU has this page %d alreay\n", bp->pgno);
-	pause ();
-      }
-    } 
-  }
-#endif
-
   FFDB_CIRCLEQ_INSERT_HEAD(head, bp, hq);
-  FFDB_CIRCLEQ_INSERT_TAIL(&pgp->lqh, bp, lq);
+  FFDB_CIRCLEQ_INSERT_TAIL(&sp->lqh, bp, lq);
 #if 0
   fprintf (stderr, "Load page insert pageno %d\n", bp->pgno);
 #endif
 
-  /**
-   * Check whether page in callback routine 
-   */
-  if (pgp->pgin) {
-    (pgp->pgin)(pgp->pgcookie, bp->pgno, bp->page);
-  }
-
   return 0;
 }
 				
 				
+/**
+ * Assign a page number to a new page
+ * @param pgp pagepool pointer
+ * @param pageno address of either requested page number or retured page number
+ * @param flags request flags.  if flags = FFDB_PAGE_REQUEST, page number
+ * stored in pageno is used. Otherwise a new page number is returned.
+ *
+ * This code takes the pgp->lock
+ */
+static void
+_ffdb_pagepool_alloc_pgno (ffdb_pagepool_t* pgp, pgno_t* pageno,
+			   unsigned int flags)
+{
+  FFDB_LOCK(pgp->lock);
+  if (pgp->maxpgno == FFDB_MAX_PAGE_NUMBER) {
+    (void)fprintf(stderr, "ffdb_pagepool_new_page: page allocation overflow.\n");
+    abort();
+  }
+
+  if (FFDB_FLAG_ISSET (flags, FFDB_PAGE_REQUEST)) {
+    /* new pages can be less than last page because there may be holes */
+    if (*pageno > pgp->maxpgno)
+      pgp->maxpgno = *pageno;
+  } else {
+    pgp->maxpgno++;
+    *pageno = pgp->maxpgno;
+  }
+  FFDB_UNLOCK(pgp->lock);
+}
+
 
 /**
  * Create a new page not from the back source file
  * @param pgp pagepool pointer
- * @param pageno address of either requested page number or retured page number
- * @param flags request flags.  if flags = FFDB_PAGE_REQUEST, page 
- * will be created using  page number stored in pageno. If flags = 0, 
- * page will be created and new pagenumber is returned.
+ * @param sp the stripe this page belongs to
+ * @param pageno page number of the new page, assigned by
+ * _ffdb_pagepool_alloc_pgno
  * @param mem returned memory address of this page
  * @return 0 on success, otherwise return either errno or -1.
  *
- * This code should be called with lock held
+ * This code should be called with sp->lock held
  */
 static int
-_ffdb_pagepool_new_page_i (ffdb_pagepool_t* pgp, pgno_t* pageno,
-			   unsigned int flags,  void** mem)
+_ffdb_pagepool_new_page_i (ffdb_pagepool_t* pgp, ffdb_stripe_t* sp,
+			   pgno_t pageno, unsigned int flags,  void** mem)
 {
-  int status;
   struct _ffdb_hqh *head;
   ffdb_bkt_t *bp = 0;
 
-  if (pgp->maxpgno == FFDB_MAX_PAGE_NUMBER) {
-    (void)fprintf(stderr, "ffdb_pagepool_new_page: page allocation overflow.\n");
-    abort();
-  }
 #ifdef _FFDB_STATISTICS
   ++pgp->pagenew;
 #endif
@@ -866,21 +1241,7 @@ _ffdb_pagepool_new_page_i (ffdb_pagepool_t* pgp, pgno_t* pageno,
    * and return.
    *
    */
-  if (pgp->curcache > pgp->maxcache) {
-    /**
-     * If the cache is max'd out, walk the lru list for a buffer we
-     * can flush.  If we find one, write it (if necessary) and take it
-     * off any lists.  If we don't find anything we grow the cache anyway.
-     * The cache never shrinks.
-     */
-    status = _ffdb_pagepool_reuse_bkt (pgp, &bp);
-    if (status == -1) {
-      /* cannot find page to reuse */
-      bp = _ffdb_pagepool_new_bkt (pgp);
-    }
-  }
-  else
-    bp = _ffdb_pagepool_new_bkt (pgp);
+  bp = _ffdb_pagepool_get_bkt (pgp, sp);
 
   /**
    * If we do not have a page, we return -1
@@ -889,20 +1250,13 @@ _ffdb_pagepool_new_page_i (ffdb_pagepool_t* pgp, pgno_t* pageno,
     fprintf (stderr, "_ffdb_pagepool_new_page_i: cannot find a new page\n");
     return -1;
   }
-  if (FFDB_FLAG_ISSET (flags, FFDB_PAGE_REQUEST)) {
-    bp->pgno = *pageno;
-    /* new pages can be less than last page because there may be holes */
-    if (bp->pgno > pgp->maxpgno) 
-      pgp->maxpgno = bp->pgno;
-  } else {
-    pgp->maxpgno++;
-    bp->pgno = *pageno = pgp->maxpgno;
-  }
+  bp->pgno = pageno;
 
   /* Now we have one thread holding this page */
   bp->ref = 1;
   /* now assign my thread to owner */
   bp->owner = FFDB_THREAD_ID;
+  _ffdb_pagepool_share_bkt (bp, flags);
 
   if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_DIRTY) ||
       FFDB_FLAG_ISSET(flags, FFDB_PAGE_EDIT))
@@ -913,26 +1267,8 @@ _ffdb_pagepool_new_page_i (ffdb_pagepool_t* pgp, pgno_t* pageno,
 
 
   head = &pgp->hqh[FFDB_HASHKEY(bp->pgno)];
-#if 0
-  {
-    ffdb_bkt_t* bk;
-    FFDB_CIRCLEQ_FOREACH(bk, head, hq) {
-      if (bk->pgno == bp->pgno) {
-	fprintf (stderr, "Hash has this page %d alreay\n", bp->pgno);
-	pause ();
-      }
-    }
-
-    FFDB_CIRCLEQ_FOREACH(bk, &pgp->lqh, lq) {
-      if (bk->pgno == bp->pgno) {
-	fprintf (stderr, "LRU has this page %d alreay\n", bp->pgno);
-	pause ();
-      }
-    } 
-  }
-#endif
   FFDB_CIRCLEQ_INSERT_HEAD(head, bp, hq);
-  FFDB_CIRCLEQ_INSERT_TAIL(&pgp->lqh, bp, lq);
+  FFDB_CIRCLEQ_INSERT_TAIL(&sp->lqh, bp, lq);
 
   *mem = bp->page;
 
@@ -954,19 +1290,60 @@ ffdb_pagepool_new_page (ffdb_pagepool_t* pgp, pgno_t* pageno,
 			unsigned int flags, void** mem)
 {
   int status;
+  ffdb_stripe_t* sp;
 
   *mem = 0;
-  FFDB_LOCK(pgp->lock);
-  status = _ffdb_pagepool_new_page_i (pgp, pageno, flags, mem);
-  FFDB_UNLOCK(pgp->lock);
+  _ffdb_pagepool_alloc_pgno (pgp, pageno, flags);
+
+  sp = FFDB_STRIPE(pgp, *pageno);
+  FFDB_LOCK(sp->lock);
+  status = _ffdb_pagepool_new_page_i (pgp, sp, *pageno, flags, mem);
+  FFDB_UNLOCK(sp->lock);
   
   return status;
 }
 
+/**
+ * Get a page of a memory mapped file. The page is checked by the
+ * user supplied check routine the first time it is used. Two threads
+ * may both check a page at first, which is harmless since the check
+ * does not change the page.
+ *
+ * @return 0 if the page is used in place. Otherwise return -1 and
+ * the page has to come from the cache.
+ */
+static int
+_ffdb_pagepool_get_mapped_page (ffdb_pagepool_t* pgp, pgno_t pageno,
+				void** mem)
+{
+  char *page;
+
+  if (pageno >= pgp->npages)
+    return -1;
+
+  page = pgp->mapaddr + (size_t)pageno * pgp->pagesize;
+  if (pgp->mapstate[pageno] == FFDB_MAP_UNCHECKED) {
+    if (pgp->pgcheck && (pgp->pgcheck)(pgp->pgcookie, pageno, page) != 0)
+      pgp->mapstate[pageno] = FFDB_MAP_CACHED;
+    else
+      pgp->mapstate[pageno] = FFDB_MAP_INPLACE;
+  }
+  if (pgp->mapstate[pageno] == FFDB_MAP_CACHED)
+    return -1;
+
+#ifdef _FFDB_STATISTICS
+  pgp->pageget++;
+#endif
+  *mem = page;
+  return 0;
+}
+
+
 /**
  * Get a cached page from the page poll
- * There will be no difference of treatment on the thread getting
- * this page, i.e. readonly or write
+ * A page is pinned exclusively by one thread unless FFDB_PAGE_SHARED
+ * is requested, in which case any number of readers can pin the page
+ * at the same time.
  * flags can be 0 or OR'ING the following values
  * FFDB_PAGE_CREATE if the specified page does not exist, create it.
  * FFDB_PAGE_DIRTY  this page will be modified before leaving the cache
@@ -974,27 +1351,27 @@ ffdb_pagepool_new_page (ffdb_pagepool_t* pgp, pgno_t* pageno,
  * number to the memory location of the pagno
  * FFDB_NEW create a new page in the file, and copy its page number into the
  * the memory localtion of the pageno.
+ * FFDB_PAGE_SHARED pin this page for reading together with other readers
  *
  * Since each page is locked by checking whether pinned flag is set,
  * so as long as pinned flag is changed, one is ok to modify other
  * attribute of the page
+ *
+ * Only the stripe of the requested page is locked, and the lock is
+ * given up while a missing page is read from the file.
  */
 int
 ffdb_pagepool_get_page (ffdb_pagepool_t* pgp, pgno_t* pageno,
 			unsigned int flags, void** mem)
 {
-  int ret, found;
+  int ret, create;
   ffdb_bkt_t* bp;
+  ffdb_stripe_t* sp;
   struct _ffdb_hqh *head;
 
   /* Set memory pointer to NULL */
   *mem = 0;
 
-  FFDB_LOCK (pgp->lock);
-#ifdef _FFDB_STATISTICS
-  pgp->pageget++;
-#endif
-
   /**
    * Check flag for consistence
    */
@@ -1002,10 +1379,23 @@ ffdb_pagepool_get_page (ffdb_pagepool_t* pgp, pgno_t* pageno,
     if (FFDB_FLAG_ISSET(pgp->fileflags, FFDB_RDONLY)) {
 	fprintf (stderr, "ffdb_pagepool_get: DIRTY_PAGE flag cannot be used on readonly file.\n");
 	errno = EINVAL;
-	FFDB_UNLOCK (pgp->lock);
 	return errno;
       }
   }
+
+  if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_SHARED) &&
+      (FFDB_FLAG_ISSET(flags, FFDB_PAGE_DIRTY) ||
+       FFDB_FLAG_ISSET(flags, FFDB_PAGE_EDIT))) {
+    fprintf (stderr, "ffdb_pagepool_get: PAGE_SHARED flag cannot be used with DIRTY_PAGE flag.\n");
+    errno = EINVAL;
+    return errno;
+  }
+
+  /**
+   * A memory mapped file is read only: hand out the page in place
+   */
+  if (pgp->mapaddr && _ffdb_pagepool_get_mapped_page (pgp, *pageno, mem) == 0)
+    return 0;
   
   /**
    * Handle the case of new page
@@ -1015,179 +1405,206 @@ ffdb_pagepool_get_page (ffdb_pagepool_t* pgp, pgno_t* pageno,
     if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_CREATE)) {
 	fprintf (stderr, "ffdb_pagepool_get: PAGE_NEW flag cannot be used with PAGE_CREATE flag\n");
 	errno = EINVAL;
-	FFDB_UNLOCK (pgp->lock);
 	return errno;
     }
     fprintf (stderr, "calling new page i for page number %p\n", pageno);
-    ret = _ffdb_pagepool_new_page_i (pgp, pageno, flags, mem);
-    FFDB_UNLOCK (pgp->lock);    
-    return ret;
+    return ffdb_pagepool_new_page (pgp, pageno, flags, mem);
   }
 
-#if 0
-  {
-    ffdb_bkt_t* bk;
-
-    head = &pgp->hqh[FFDB_HASHKEY(*pageno)];
-    FFDB_CIRCLEQ_FOREACH(bk, head, hq) {
-      if (bk->pgno == *pageno ) {
-	fprintf (stderr, "Hash has this page %d alreay 0x%x\n", *pageno,
-		 bk->page);
-      }
-    }
-
-    FFDB_CIRCLEQ_FOREACH(bk, &pgp->lqh, lq) {
-      if (bk->pgno == *pageno) {
-	fprintf (stderr, "LRU has this page %d alreay 0x%x\n", *pageno,
-		 bk->page);
-      }
-    } 
-  }
+  sp = FFDB_STRIPE(pgp, *pageno);
+  FFDB_LOCK (sp->lock);
+#ifdef _FFDB_STATISTICS
+  pgp->pageget++;
 #endif
 
   /**
    * Try to find a page from existing cache. This page has to be
    * not pinned by other threads
    */
-  found = 0;
   head = &pgp->hqh[FFDB_HASHKEY(*pageno)];
-  FFDB_CIRCLEQ_FOREACH(bp, head, hq) {
-    if (bp->pgno == *pageno) {
-      found = 1;
-      break;
+  while ((bp = _ffdb_pagepool_find_bkt (pgp, *pageno)) == 0) {
+#ifdef _FFDB_STATISTICS  
+    pgp->cachemiss++;
+#endif
+    /* We have not found a page with this page number, therefore
+     * we have to create new pages using the pagenumber
+     */
+    /**
+     * We cannot find this page with provided page number
+     * if flag FFDB_PAGE_CREATE is set, we have to create this page
+     */
+    create = 0;
+    if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_CREATE)) {
+      FFDB_LOCK(pgp->lock);
+      create = (*pageno >= pgp->npages);
+      FFDB_UNLOCK(pgp->lock);
+    }
+
+    if (create) {
+      _ffdb_pagepool_alloc_pgno (pgp, pageno, flags | FFDB_PAGE_REQUEST);
+      ret = _ffdb_pagepool_new_page_i (pgp, sp, *pageno, flags, mem);
+    }
+    else {
+      ret = _ffdb_pagepool_load_new_page (pgp, sp, *pageno, flags, mem);
+      /* Some other thread got this page first: look it up again */
+      if (ret == 1)
+	continue;
     }
+
+    FFDB_UNLOCK (sp->lock);
+
+    return ret;
   }
 
-#ifdef _FFDB_STATISTICS  
-  if (found)
-    pgp->cachehit++;
-  else
-    pgp->cachemiss++;
+#ifdef _FFDB_STATISTICS
+  pgp->cachehit++;
 #endif
 
-  if (found) { /* Now I am still holding the lock */
+  /* Now I am still holding the lock */
 #ifdef _FFDB_DEBUG
-    fprintf (stderr, "Found page %d in pagepool at memory 0x%x\n", *pageno,
-	     bp->page);
+  fprintf (stderr, "Found page %d in pagepool at memory 0x%x\n", *pageno,
+	   bp->page);
 #endif
+  /**
+   * If I am the owner, the bp will be returned
+   */
+  if (FFDB_THREAD_SAME(bp->owner, FFDB_THREAD_ID)) {
+    FFDB_FLAG_SET(bp->flags, FFDB_PAGE_PINNED);
+    bp->ref++;
+  }
+  else if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_SHARED) &&
+	   FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_SHARED) &&
+	   (bp->waiters == 0 || _ffdb_shared_pins_held (bp))) {
     /**
-     * If I am the owner, the bp will be returned
+     * Other readers are holding this page, join them unless a
+     * writer is waiting. A reader holding this page already joins
+     * anyway since the writer waits for it.
      */
-    if (FFDB_THREAD_SAME(bp->owner, FFDB_THREAD_ID)) {
-      FFDB_FLAG_SET(bp->flags, FFDB_PAGE_PINNED);
-      bp->ref++;
+    bp->readers++;
+    bp->ref++;
+    _ffdb_shared_pins_add (bp);
+  }
+  else {
+    ffdb_bkt_waiter_t* fw = 0;
+
+    /**
+     * A reader of this page asking for an exclusive pin would wait
+     * for itself
+     */
+    if (!FFDB_FLAG_ISSET(flags, FFDB_PAGE_SHARED) &&
+	FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_SHARED) &&
+	_ffdb_shared_pins_held (bp)) {
+      FFDB_UNLOCK (sp->lock);
+      fprintf (stderr, "ffdb_pagepool_get_page: page %d is pinned shared by this thread and cannot be pinned exclusively.\n", *pageno);
+      errno = EDEADLK;
+      return errno;
     }
-    else {
-      /**
-       * A different thread try to access this page
-       */
-      if (bp->waiters > 0 || FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_PINNED)) {
-	/* Create a waiter for this page */
-	ffdb_bkt_waiter_t *waiter;
-	ffdb_bkt_waiter_t* fw = 0;
-
-	waiter = (ffdb_bkt_waiter_t *)malloc(sizeof(ffdb_bkt_waiter_t));
-	if (!waiter) {
-	  fprintf (stderr, "ffdb_pagepool_get: cannot allocate space for waiter object\n");
-	  abort ();
-	}
-	waiter->wakeup = 0;
-	waiter->bp = bp;
-	FFDB_COND_INIT(waiter->cv);
-	bp->waiters++;
-	FFDB_CIRCLEQ_INSERT_HEAD(&bp->wqh, waiter, q);
-	
-	/* Now this waiter is waiting for the page */
-	while (waiter->wakeup == 0) 
-	  FFDB_COND_WAIT(waiter->cv, pgp->lock);
-	
-	/* Now waiter is done, we should have the page now */
-	fw = FFDB_CIRCLEQ_LAST(&bp->wqh);
-	if (fw != waiter) {
-	  fprintf (stderr, "ffdb_pagepool_get_page: waiter wakeup with wrong waiter pointer\n");
-	  abort ();
-	}
-	/* remove this from queue */
-	FFDB_CIRCLEQ_REMOVE(&bp->wqh, waiter, q);
 
-	bp->waiters--;
+    /**
+     * A different thread try to access this page
+     */
+    if (bp->waiters > 0 || FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_PINNED)) {
+      /* Create a waiter for this page */
+      ffdb_bkt_waiter_t *waiter;
+
+      waiter = (ffdb_bkt_waiter_t *)malloc(sizeof(ffdb_bkt_waiter_t));
+      if (!waiter) {
+	fprintf (stderr, "ffdb_pagepool_get: cannot allocate space for waiter object\n");
+	abort ();
+      }
+      waiter->wakeup = 0;
+      waiter->shared = FFDB_FLAG_ISSET(flags, FFDB_PAGE_SHARED) ? 1 : 0;
+      waiter->bp = bp;
+      FFDB_COND_INIT(waiter->cv);
+      bp->waiters++;
+      FFDB_CIRCLEQ_INSERT_HEAD(&bp->wqh, waiter, q);
+
+      /* Now this waiter is waiting for the page */
+      while (waiter->wakeup == 0)
+	FFDB_COND_WAIT(waiter->cv, sp->lock);
+
+      /* Now waiter is done, we should have the page now */
+      fw = FFDB_CIRCLEQ_LAST(&bp->wqh);
+      if (fw != waiter) {
+	fprintf (stderr, "ffdb_pagepool_get_page: waiter wakeup with wrong waiter pointer\n");
+	abort ();
+      }
+      /* remove this from queue */
+      FFDB_CIRCLEQ_REMOVE(&bp->wqh, waiter, q);
+
+      bp->waiters--;
 
-      	/* Destroy the conditional variable */
-	FFDB_COND_FINI(waiter->cv);
+      /* Destroy the conditional variable */
+      FFDB_COND_FINI(waiter->cv);
 
-	free (waiter);
+      free (waiter);
+    }
+    /* Now I have grabed the page */
+    bp->ref++;
+
+    if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_SHARED)) {
+      /* I am a reader: there is no owner of a shared page */
+      if (FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_SHARED))
+	bp->readers++;
+      else {
+	FFDB_THREAD_NULL(bp->owner);
+	bp->readers = 1;
+	FFDB_FLAG_SET(bp->flags, FFDB_PAGE_SHARED);
       }
-      /* Now I have grabed the page */
-      bp->ref++;
+      FFDB_FLAG_SET(bp->flags, FFDB_PAGE_PINNED);
+      _ffdb_shared_pins_add (bp);
 
+      /* Readers waiting right behind me can share this page as well */
+      fw = FFDB_CIRCLEQ_EMPTY(&bp->wqh) ? 0 : FFDB_CIRCLEQ_LAST(&bp->wqh);
+      if (fw && fw->shared && fw->wakeup == 0) {
+	fw->wakeup = 0xdeafbeaf;
+	FFDB_COND_SIGNAL(fw->cv);
+      }
+    }
+    else {
       /* Now set owner of this page */
       bp->owner = FFDB_THREAD_ID;
 
-      /* Now I get hold of this page */      
+      /* Now I get hold of this page */
       FFDB_FLAG_SET(bp->flags, FFDB_PAGE_PINNED);
     }
+  }
 
-    /* Change flags of this page since I own this page now */
-    if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_DIRTY) ||
-	FFDB_FLAG_ISSET(flags, FFDB_PAGE_EDIT))
-      FFDB_FLAG_SET(bp->flags, FFDB_PAGE_DIRTY);
-  
-    if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_LOCKED))
-      FFDB_FLAG_SET(bp->flags, FFDB_PAGE_LOCKED);
-  
-    *mem = bp->page; 
-    
-    /**
-     * The following removal and reinsert must be done at the same 
-     * time.
-     * If the item is removed first, the lock is given up when 
-     * a thread is waiting on the conditional variable.
-     * Another thread come in to request the same page, it will not
-     * find the page and will create a new page with the same page
-     * number. One will have two entries in the hash and LRU with
-     * the same page number
-     */
+  /* Change flags of this page since I own this page now */
+  if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_DIRTY) ||
+      FFDB_FLAG_ISSET(flags, FFDB_PAGE_EDIT))
+    FFDB_FLAG_SET(bp->flags, FFDB_PAGE_DIRTY);
 
-    /* remove this page from hash and LRU */
-    FFDB_CIRCLEQ_REMOVE(head, bp, hq);
-    FFDB_CIRCLEQ_REMOVE(&pgp->lqh, bp, lq);
-    /* We found this page in the cache so we have to 
-     * move this page to the head of the hash chain and the tail of the
-     * lru chain
-     */
-    FFDB_CIRCLEQ_INSERT_HEAD(head, bp, hq);
-    FFDB_CIRCLEQ_INSERT_TAIL(&pgp->lqh, bp, lq);
-#if 0
-    fprintf (stderr, "Insert pageno %d\n", bp->pgno);
-#endif
+  if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_LOCKED))
+    FFDB_FLAG_SET(bp->flags, FFDB_PAGE_LOCKED);
 
-    FFDB_UNLOCK(pgp->lock);
-    return 0;
-  }
-  else {
-    /* We have not found a page with this page number, therefore
-     * we have to create new pages using the pagenumber
-     */
-    /**
-     * We cannot find this page with provided page number
-     * if flag FFDB_PAGE_CREATE is set, we have to create this page
-     */
-    if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_CREATE) &&
-	*pageno >= pgp->npages ) {
-      ret = _ffdb_pagepool_new_page_i (pgp, pageno, 
-				       flags | FFDB_PAGE_REQUEST, mem);
-    }
-    else {
-      ret = _ffdb_pagepool_load_new_page (pgp, *pageno, flags, mem);
-    }
+  *mem = bp->page;
 
+  /**
+   * The following removal and reinsert must be done at the same
+   * time.
+   * If the item is removed first, the lock is given up when
+   * a thread is waiting on the conditional variable.
+   * Another thread come in to request the same page, it will not
+   * find the page and will create a new page with the same page
+   * number. One will have two entries in the hash and LRU with
+   * the same page number
+   */
 
-    FFDB_UNLOCK (pgp->lock);
+  /* remove this page from hash and LRU */
+  FFDB_CIRCLEQ_REMOVE(head, bp, hq);
+  FFDB_CIRCLEQ_REMOVE(&sp->lqh, bp, lq);
+  /* We found this page in the cache so we have to
+   * move this page to the head of the hash chain and the tail of the
+   * lru chain
+   */
+  FFDB_CIRCLEQ_INSERT_HEAD(head, bp, hq);
+  FFDB_CIRCLEQ_INSERT_TAIL(&sp->lqh, bp, lq);
+#if 0
+  fprintf (stderr, "Insert pageno %d\n", bp->pgno);
+#endif
 
-    return ret;
-  }
-  /* Should never get here */
-  fprintf (stderr, "ffdb_pagepool_get_page: should not get here\n");
+  FFDB_UNLOCK(sp->lock);
   return 0;
 }
 
@@ -1207,14 +1624,27 @@ ffdb_pagepool_put_page (ffdb_pagepool_t* pgp, void* mem,
 			unsigned int flags)
 {
   ffdb_bkt_t* bp;
+  ffdb_stripe_t* sp;
   ffdb_bkt_waiter_t* sleeper = 0;
 
-  FFDB_LOCK(pgp->lock);
+  /* Pages of a mapped file are never pinned */
+  if (_FFDB_PAGE_MAPPED(pgp, mem)) {
+    if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_DIRTY)) {
+      fprintf (stderr, "ffdb_pagepool_put_page: mapped file page cannot be dirty.\n");
+      abort ();
+    }
+    return 0;
+  }
+
+  bp = (ffdb_bkt_t *)((char *)mem - sizeof (ffdb_bkt_t));
+
+  /* The page number cannot change while I am holding this page */
+  sp = FFDB_STRIPE(pgp, bp->pgno);
+
+  FFDB_LOCK(sp->lock);
 #ifdef _FFDB_STATISTICS
   pgp->pageput++;
 #endif
-  
-  bp = (ffdb_bkt_t *)((char *)mem - sizeof (ffdb_bkt_t));
 
   if (!FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_PINNED)) {
     fprintf (stderr, "ffdb_pagepool_put_page: page %d is not pinned.\n",
@@ -1239,6 +1669,28 @@ ffdb_pagepool_put_page (ffdb_pagepool_t* pgp, void* mem,
    * Derefence the page
    */
   bp->ref--;
+
+  /**
+   * A shared page stays pinned until the last reader is gone
+   */
+  if (FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_SHARED)) {
+    if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_DIRTY)) {
+      fprintf (stderr, "ffdb_pagepool_put_page: page %d is shared and cannot be dirty.\n",
+	       bp->pgno);
+      abort ();
+    }
+    _ffdb_shared_pins_del (bp);
+    if (--bp->readers > 0) {
+      FFDB_UNLOCK(sp->lock);
+      return 0;
+    }
+    FFDB_FLAG_CLR(bp->flags, FFDB_PAGE_SHARED);
+  }
+  else {
+    /* The owner of an exclusive pin may have changed the page */
+    bp->mod = ++sp->mgen;
+  }
+
   /*
    * I am giving up the ownership
    */
@@ -1249,12 +1701,9 @@ ffdb_pagepool_put_page (ffdb_pagepool_t* pgp, void* mem,
    */
   FFDB_FLAG_CLR(bp->flags, FFDB_PAGE_PINNED);
 
-  if (bp->waiters > 0) {
-    sleeper = FFDB_CIRCLEQ_LAST(&bp->wqh);
-    sleeper->wakeup = 0xdeafbeaf;
-  }
+  sleeper = _ffdb_pagepool_wakeup_waiter (bp);
 
-  FFDB_UNLOCK(pgp->lock);
+  FFDB_UNLOCK(sp->lock);
 
   /* bp->waiters will not be changed until other threads are waken up */
 #if 0
@@ -1266,6 +1715,24 @@ ffdb_pagepool_put_page (ffdb_pagepool_t* pgp, void* mem,
 }
 
 
+/**
+ * Get the modification counter of a pinned page
+ */
+unsigned long
+ffdb_pagepool_page_mod (ffdb_pagepool_t* pgp, void* mem)
+{
+  ffdb_bkt_t* bp;
+
+  /* A mapped file is read only and never changes */
+  if (_FFDB_PAGE_MAPPED(pgp, mem))
+    return 0;
+
+  /* The counter only changes when a pin is released */
+  bp = (ffdb_bkt_t *)((char *)mem - sizeof (ffdb_bkt_t));
+  return bp->mod;
+}
+
+
 /**
  * Put a page back into the cache so that other threads can access this page
  * with new page number for this page
@@ -1284,14 +1751,34 @@ ffdb_pagepool_change_page (ffdb_pagepool_t* pgp, void* mem,
 {
   struct _ffdb_hqh* head;
   ffdb_bkt_t* bp;
+  ffdb_stripe_t *osp, *nsp;
   unsigned int oldpagenum;
 
-  FFDB_LOCK(pgp->lock);
+  if (_FFDB_PAGE_MAPPED(pgp, mem)) {
+    fprintf (stderr, "ffdb_pagepool_change_page: file is memory mapped read only.\n");
+    errno = EINVAL;
+    return -1;
+  }
+
+  bp = (ffdb_bkt_t *)((char *)mem - sizeof (ffdb_bkt_t));
+
+  /* Both stripes are locked, lower one first */
+  osp = FFDB_STRIPE(pgp, bp->pgno);
+  nsp = FFDB_STRIPE(pgp, newpagenum);
+  if (osp < nsp) {
+    FFDB_LOCK(osp->lock);
+    FFDB_LOCK(nsp->lock);
+  }
+  else if (osp > nsp) {
+    FFDB_LOCK(nsp->lock);
+    FFDB_LOCK(osp->lock);
+  }
+  else
+    FFDB_LOCK(osp->lock);
+
 #ifdef _FFDB_STATISTICS
   pgp->pagechange++;
 #endif
-  
-  bp = (ffdb_bkt_t *)((char *)mem - sizeof (ffdb_bkt_t));
 
   if (!FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_PINNED)) {
     fprintf (stderr, "ffdb_pagepool_put_page: page %d is not pinned.\n",
@@ -1308,7 +1795,9 @@ ffdb_pagepool_change_page (ffdb_pagepool_t* pgp, void* mem,
    */
   if (bp->waiters > 0) {
     fprintf (stderr, "ffdb_pagepool_change: page %d has waiters\n",bp->pgno);
-    FFDB_UNLOCK(pgp->lock);
+    FFDB_UNLOCK(osp->lock);
+    if (nsp != osp)
+      FFDB_UNLOCK(nsp->lock);
     
     ffdb_pagepool_put_page (pgp, mem, 0);
     return EAGAIN;
@@ -1334,7 +1823,8 @@ ffdb_pagepool_change_page (ffdb_pagepool_t* pgp, void* mem,
 
   /* Remove from the hash and lru queues. */
   FFDB_CIRCLEQ_REMOVE(head, bp, hq);
-  FFDB_CIRCLEQ_REMOVE(&pgp->lqh, bp, lq);
+  FFDB_CIRCLEQ_REMOVE(&osp->lqh, bp, lq);
+  --osp->curcache;
 
   /**
    * Remember old pagenumber
@@ -1345,6 +1835,7 @@ ffdb_pagepool_change_page (ffdb_pagepool_t* pgp, void* mem,
    * Change page number
    */
   bp->pgno = newpagenum;
+  bp->mod = ++nsp->mgen;
 
   /*
    * I am giving up the ownership
@@ -1361,47 +1852,46 @@ ffdb_pagepool_change_page (ffdb_pagepool_t* pgp, void* mem,
    */
   head = &pgp->hqh[FFDB_HASHKEY(bp->pgno)];
   FFDB_CIRCLEQ_INSERT_HEAD(head, bp, hq);
-  FFDB_CIRCLEQ_INSERT_TAIL(&pgp->lqh, bp, lq);
+  FFDB_CIRCLEQ_INSERT_TAIL(&nsp->lqh, bp, lq);
+  ++nsp->curcache;
 
   /**
    * Change number of pages if pages are moved back
    */
+  FFDB_LOCK(pgp->lock);
   if (newpagenum >= pgp->npages) {
     pgp->npages = newpagenum + 1;
 #if 0
     fprintf (stderr, "reset number of pages = %d\n", pgp->npages);
 #endif
   }
+  FFDB_UNLOCK(pgp->lock);
 
   /**
    * Clean out old disk content
    */
   _ffdb_clean_page_ondisk (pgp, oldpagenum);
 
-  FFDB_UNLOCK(pgp->lock);
+  FFDB_UNLOCK(osp->lock);
+  if (nsp != osp)
+    FFDB_UNLOCK(nsp->lock);
   return 0;
 }
 
 /**
- * Flush number of pages to disk
- * If numpages == 0, flush all dirty pages to disk
+ * Add dirty pages of a stripe that nobody is using to a single list
+ * Return number of pages added
  */
-static int
-_ffdb_pagepool_sync_i (ffdb_pagepool_t* pgp, unsigned int numpages)
+static unsigned int
+_ffdb_pagepool_collect_dirty (ffdb_stripe_t* sp, ffdb_slh_t* slh,
+			      unsigned int numpages)
 {
   unsigned int num;
   ffdb_bkt_t* bp;
   ffdb_sbkt_t* sbp;
-  ffdb_sbkt_t* next;
-  ffdb_slh_t slh;
-  FFDB_SLIST_INIT (&slh);
 
-  /* Walk through every bucket and check whether it is pinned
-   * If it is not pinned and it is dirty, I will sort these pages
-   * according to page number
-   */
   num = 0;
-  FFDB_CIRCLEQ_FOREACH(bp, &pgp->lqh, lq){
+  FFDB_CIRCLEQ_FOREACH(bp, &sp->lqh, lq){
     if (!FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_PINNED) &&
 	bp->waiters == 0 && 
 	FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_DIRTY)) {
@@ -1413,12 +1903,45 @@ _ffdb_pagepool_sync_i (ffdb_pagepool_t* pgp, unsigned int numpages)
       }
       _ffdb_shallow_copy_bk (sbp, bp);
       /* add this to the list */
-      FFDB_SLIST_INSERT_HEAD (&slh, sbp, sl);
+      FFDB_SLIST_INSERT_HEAD (slh, sbp, sl);
       num++;
       if (numpages > 0 && num >= numpages)
 	break;
     }
   }
+  return num;
+}
+
+/**
+ * Flush number of pages to disk
+ * If numpages == 0, flush all dirty pages to disk
+ *
+ * If sp is not null, only pages of this stripe are flushed and
+ * sp->lock is held. Otherwise the locks of all stripes are held.
+ */
+static int
+_ffdb_pagepool_sync_i (ffdb_pagepool_t* pgp, ffdb_stripe_t* sp,
+		       unsigned int numpages)
+{
+  int i, ret;
+  unsigned int num, ndirty;
+  ffdb_sbkt_t* sbp;
+  ffdb_sbkt_t* next;
+  ffdb_bkt_t** bps;
+  ffdb_slh_t slh;
+  FFDB_SLIST_INIT (&slh);
+
+  /* Walk through every bucket and check whether it is pinned
+   * If it is not pinned and it is dirty, I will sort these pages
+   * according to page number
+   */
+  if (sp)
+    num = _ffdb_pagepool_collect_dirty (sp, &slh, numpages);
+  else {
+    num = 0;
+    for (i = 0; i < FFDB_NSTRIPES; i++)
+      num += _ffdb_pagepool_collect_dirty (&pgp->stripes[i], &slh, 0);
+  }
 
 #ifdef _FFDB_DEBUG
   fprintf (stderr, "Flushed %d pages out\n", num);
@@ -1428,19 +1951,23 @@ _ffdb_pagepool_sync_i (ffdb_pagepool_t* pgp, unsigned int numpages)
   _ffdb_slist_merge_sort (&slh);
 
   /* Now walk through the sorted list, and dump pages to the back end file */
+  ret = 0;
+  bps = 0;
+  if (num > 0) {
+    bps = (ffdb_bkt_t **)malloc (num * sizeof(ffdb_bkt_t *));
+    if (!bps) {
+      fprintf (stderr, "ffdb_pagepool_sync: cannot allocate space for %d pages.\n", num);
+      abort ();
+    }
+  }
+  ndirty = 0;
   sbp = FFDB_SLIST_FIRST(&slh);
   next = 0;
   while (sbp) {
     next = FFDB_SLIST_NEXT(sbp, sl);
 
-    if (FFDB_FLAG_ISSET(sbp->bp->flags, FFDB_PAGE_DIRTY)) {
-
-      if (_ffdb_pagepool_write (pgp, sbp->bp) != 0) {
-	fprintf (stderr, "ffdb_pagepool_sync: writing page %d error.\n",
-		 sbp->bp->pgno);
-	return -1;
-      }
-    }
+    if (FFDB_FLAG_ISSET(sbp->bp->flags, FFDB_PAGE_DIRTY))
+      bps[ndirty++] = sbp->bp;
 #ifdef _FFDB_STATISTICS
     ++pgp->pageflush;
 #endif
@@ -1450,7 +1977,11 @@ _ffdb_pagepool_sync_i (ffdb_pagepool_t* pgp, unsigned int numpages)
     sbp = next;
   }
 
-  return 0;
+  if (ndirty > 0)
+    ret = _ffdb_pagepool_write_batch (pgp, bps, ndirty);
+  free (bps);
+
+  return ret;
 }
 
 
@@ -1465,11 +1996,11 @@ ffdb_pagepool_sync (ffdb_pagepool_t* pgp)
 {
   int ret;
 
-  FFDB_LOCK (pgp->lock);
+  _ffdb_pagepool_lock_all (pgp);
 
-  ret = _ffdb_pagepool_sync_i (pgp, 0);
+  ret = _ffdb_pagepool_sync_i (pgp, 0, 0);
 
-  FFDB_UNLOCK (pgp->lock);
+  _ffdb_pagepool_unlock_all (pgp);
 
   return ret;
 }
@@ -1488,29 +2019,44 @@ ffdb_pagepool_sync (ffdb_pagepool_t* pgp)
 int
 ffdb_pagepool_close (ffdb_pagepool_t* pgp)
 {
+  int i;
   ffdb_bkt_t* bp;
+  ffdb_stripe_t* sp;
 
   /* First Sync Everything to disk */
   ffdb_pagepool_sync (pgp);
 
-  FFDB_LOCK(pgp->lock);
+  _ffdb_pagepool_lock_all (pgp);
   
   /* Free Every BUCKET */
-  bp = FFDB_CIRCLEQ_FIRST(&pgp->lqh);  
-  while (!FFDB_CIRCLEQ_EMPTY(&pgp->lqh)) {
-    FFDB_CIRCLEQ_REMOVE(&pgp->lqh, bp, lq);
+  for (i = 0; i < FFDB_NSTRIPES; i++) {
+    sp = &pgp->stripes[i];
+    bp = FFDB_CIRCLEQ_FIRST(&sp->lqh);
+    while (!FFDB_CIRCLEQ_EMPTY(&sp->lqh)) {
+      FFDB_CIRCLEQ_REMOVE(&sp->lqh, bp, lq);
+
+      free (bp);
+      bp = FFDB_CIRCLEQ_FIRST(&sp->lqh);
+    }
+  }
 
-    free (bp);
-    bp = FFDB_CIRCLEQ_FIRST(&pgp->lqh);  
+  /* release memory mapped file */
+  if (pgp->mapaddr) {
+    munmap (pgp->mapaddr, pgp->maplen);
+    free (pgp->mapstate);
   }
 
   /* close file descriptor */
   if (pgp->close_fd)
     close (pgp->fd);
+
+  ffdb_pageio_close (pgp->io);
   
-  FFDB_UNLOCK(pgp->lock);  
+  _ffdb_pagepool_unlock_all (pgp);
 
   /* destroy lock */
+  for (i = 0; i < FFDB_NSTRIPES; i++)
+    FFDB_LOCK_FINI(pgp->stripes[i].lock);
   FFDB_LOCK_FINI(pgp->lock);
 
   free (pgp);
@@ -1529,15 +2075,22 @@ ffdb_pagepool_delete (ffdb_pagepool_t* pgp, void* mem)
 {
   struct _ffdb_hqh* head;
   ffdb_bkt_t* bp;
+  ffdb_stripe_t* sp;
   int ret = 0;
 
-  /* I have to lock this routine to prevent race condition
-   * to ffdb_pagepool_find
-   */
-  FFDB_LOCK(pgp->lock);
+  if (_FFDB_PAGE_MAPPED(pgp, mem)) {
+    fprintf (stderr, "ffdb_pagepool_delete: file is memory mapped read only.\n");
+    return -1;
+  }
 
   /* first get the page bucket pointer of this memory */
   bp = (ffdb_bkt_t *)((char *)mem - sizeof(ffdb_bkt_t));
+  sp = FFDB_STRIPE(pgp, bp->pgno);
+
+  /* I have to lock this routine to prevent race condition
+   * to ffdb_pagepool_find
+   */
+  FFDB_LOCK(sp->lock);
 
   /* only thread holding this page can delete this page, and no other
    * threads waiting on this page 
@@ -1555,7 +2108,7 @@ ffdb_pagepool_delete (ffdb_pagepool_t* pgp, void* mem)
      */
     if (bp->waiters > 0) {
       fprintf (stderr, "ffdb_pagepool_delete: page %d has waiters\n",bp->pgno);
-      FFDB_UNLOCK(pgp->lock);
+      FFDB_UNLOCK(sp->lock);
       return EAGAIN;
     }
     
@@ -1563,7 +2116,7 @@ ffdb_pagepool_delete (ffdb_pagepool_t* pgp, void* mem)
     if (FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_DIRTY)) {
       if (_ffdb_pagepool_write (pgp, bp) != 0) {
 	fprintf (stderr, "ffdb_pagepool_delete: page %d is dirty and flush it to disk encountered error.\n", bp->pgno);
-	FFDB_UNLOCK(pgp->lock);
+	FFDB_UNLOCK(sp->lock);
 	return errno;
       }
     }
@@ -1571,12 +2124,12 @@ ffdb_pagepool_delete (ffdb_pagepool_t* pgp, void* mem)
     /* Remove from the hash and lru queues. */
 
     FFDB_CIRCLEQ_REMOVE(head, bp, hq);
-    FFDB_CIRCLEQ_REMOVE(&pgp->lqh, bp, lq);
+    FFDB_CIRCLEQ_REMOVE(&sp->lqh, bp, lq);
 
     /* Decrease number of pages in the cache */
-    --pgp->curcache;
+    --sp->curcache;
 
-    FFDB_UNLOCK(pgp->lock);
+    FFDB_UNLOCK(sp->lock);
     /* free memory */
     free(bp); 
 
@@ -1584,13 +2137,272 @@ ffdb_pagepool_delete (ffdb_pagepool_t* pgp, void* mem)
   else {
     fprintf (stderr, "ffdb_pagepool_delete: other threads are still using this page %d ref = %d\n", bp->pgno, bp->ref);
 
-    FFDB_UNLOCK(pgp->lock);
+    FFDB_UNLOCK(sp->lock);
 
     ret = -1;
   }
   return ret;
 }
 
+/**
+ * Shrink the back end file to a number of pages. Cached copies of
+ * the pages beyond the new end are dropped without writing them out
+ */
+int
+ffdb_pagepool_truncate (ffdb_pagepool_t* pgp, pgno_t npages)
+{
+  struct _ffdb_hqh* head;
+  ffdb_bkt_t *bp, *next;
+  ffdb_stripe_t* sp;
+  int i, ret = 0;
+
+  if (pgp->mapaddr) {
+    fprintf (stderr, "ffdb_pagepool_truncate: file is memory mapped read only.\n");
+    return EINVAL;
+  }
+
+  _ffdb_pagepool_lock_all (pgp);
+
+  /* Nothing is dropped if anyone is using a page going away */
+  for (i = 0; i < FFDB_NSTRIPES && ret == 0; i++) {
+    sp = &pgp->stripes[i];
+    FFDB_CIRCLEQ_FOREACH(bp, &sp->lqh, lq) {
+      if (bp->pgno >= npages &&
+	  (FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_PINNED) || bp->waiters > 0)) {
+	ret = EBUSY;
+	break;
+      }
+    }
+  }
+  if (ret != 0) {
+    _ffdb_pagepool_unlock_all (pgp);
+    return ret;
+  }
+
+  FFDB_LOCK(pgp->lock);
+  if (ftruncate (pgp->fd, (off_t)pgp->pagesize * npages) != 0) {
+    ret = errno;
+    FFDB_UNLOCK(pgp->lock);
+    _ffdb_pagepool_unlock_all (pgp);
+    return ret;
+  }
+  pgp->npages = npages;
+  if (pgp->maxpgno > npages)
+    pgp->maxpgno = npages;
+  FFDB_UNLOCK(pgp->lock);
+
+  for (i = 0; i < FFDB_NSTRIPES; i++) {
+    sp = &pgp->stripes[i];
+    bp = FFDB_CIRCLEQ_FIRST(&sp->lqh);
+    while (bp != (void *)&sp->lqh) {
+      next = FFDB_CIRCLEQ_NEXT(bp, lq);
+      if (bp->pgno >= npages) {
+	head = &pgp->hqh[FFDB_HASHKEY(bp->pgno)];
+	FFDB_CIRCLEQ_REMOVE(head, bp, hq);
+	FFDB_CIRCLEQ_REMOVE(&sp->lqh, bp, lq);
+	--sp->curcache;
+	free (bp);
+      }
+      bp = next;
+    }
+  }
+
+  _ffdb_pagepool_unlock_all (pgp);
+  return 0;
+}
+
+/**
+ * Choose the engine used to read and write batches of pages.
+ * This is done before threads start using the page pool.
+ */
+int
+ffdb_pagepool_ioengine (ffdb_pagepool_t* pgp, int type)
+{
+  ffdb_pageio_t* io;
+  ffdb_pageio_t* old;
+  int ret;
+
+  if ((ret = ffdb_pageio_create (&io, type)) != 0)
+    return ret;
+
+  _ffdb_pagepool_lock_all (pgp);
+  old = pgp->io;
+  pgp->io = io;
+  _ffdb_pagepool_unlock_all (pgp);
+
+  ffdb_pageio_close (old);
+  return 0;
+}
+
+/**
+ * Bring pages not in the cache into the cache ahead of their use
+ *
+ * Buckets for the missing pages are taken off the free list first.
+ * Like in _ffdb_pagepool_load_new_page they are on no queue while
+ * the pages are read, so nobody else can see them. Afterwards they
+ * are put into the cache unpinned, unless another thread has loaded
+ * the same page or a page of the stripe was written out meanwhile.
+ */
+int
+ffdb_pagepool_prefetch (ffdb_pagepool_t* pgp, const pgno_t* pgnos,
+			unsigned int num)
+{
+  ffdb_bkt_t* bps[FFDB_IO_DEPTH];
+  unsigned int wgens[FFDB_IO_DEPTH];
+  struct iovec iov[FFDB_IO_DEPTH];
+  ffdb_ioreq_t reqs[FFDB_IO_DEPTH];
+  struct _ffdb_hqh *head;
+  ffdb_stripe_t* sp;
+  ffdb_bkt_t* bp;
+  pgno_t npages, limit;
+  unsigned int i, j, k, l, nbps, nreqs;
+  ssize_t got;
+  size_t off;
+  int loaded = 0;
+
+  /* The operating system reads ahead pages of a mapped file */
+  if (pgp->mapaddr) {
+    for (i = 0; i < num; i++) {
+      off = (size_t)pgp->pagesize * pgnos[i];
+      if (off + pgp->pagesize <= pgp->maplen)
+	madvise (pgp->mapaddr + off, pgp->pagesize, MADV_WILLNEED);
+    }
+    return 0;
+  }
+
+  /* Do not push out the pages prefetched by this call */
+  FFDB_LOCK(pgp->lock);
+  npages = pgp->npages;
+  limit = pgp->maxcache / 2;
+  FFDB_UNLOCK(pgp->lock);
+  if (num > limit)
+    num = limit;
+
+  i = 0;
+  while (i < num) {
+    /* Take buckets for pages missing from the cache */
+    nbps = 0;
+    for (; i < num && nbps < FFDB_IO_DEPTH; i++) {
+      if (pgnos[i] >= npages)
+	continue;
+      sp = FFDB_STRIPE(pgp, pgnos[i]);
+      FFDB_LOCK(sp->lock);
+      if (_ffdb_pagepool_find_bkt (pgp, pgnos[i]) == 0 &&
+	  (bp = _ffdb_pagepool_get_bkt (pgp, sp)) != 0) {
+	bp->pgno = pgnos[i];
+	wgens[nbps] = sp->wgen;
+	bps[nbps++] = bp;
+      }
+      FFDB_UNLOCK(sp->lock);
+    }
+    if (nbps == 0)
+      continue;
+
+    /* Adjacent pages are read by a single request */
+    nreqs = 0;
+    for (j = 0; j < nbps; j++) {
+      iov[j].iov_base = bps[j]->page;
+      iov[j].iov_len = pgp->pagesize;
+      if (nreqs > 0 && bps[j - 1]->pgno + 1 == bps[j]->pgno)
+	reqs[nreqs - 1].iovcnt++;
+      else {
+	reqs[nreqs].iov = &iov[j];
+	reqs[nreqs].iovcnt = 1;
+	reqs[nreqs].write = 0;
+	reqs[nreqs].offset = (off_t)pgp->pagesize * bps[j]->pgno;
+	reqs[nreqs].result = 0;
+	nreqs++;
+      }
+    }
+
+    ffdb_pageio_submit (pgp->io, pgp->fd, reqs, nreqs);
+
+    /* Pages read completely go into the cache, the rest is dropped */
+    j = 0;
+    for (k = 0; k < nreqs; k++) {
+      got = reqs[k].result;
+      for (l = 0; l < reqs[k].iovcnt; l++, j++) {
+	bp = bps[j];
+	sp = FFDB_STRIPE(pgp, bp->pgno);
+	FFDB_LOCK(sp->lock);
+#ifdef _FFDB_STATISTICS
+	++pgp->pageread;
+#endif
+	if (got >= (ssize_t)pgp->pagesize && wgens[j] == sp->wgen &&
+	    _ffdb_pagepool_find_bkt (pgp, bp->pgno) == 0) {
+	  if (pgp->pgin)
+	    (pgp->pgin)(pgp->pgcookie, bp->pgno, bp->page);
+	  FFDB_THREAD_NULL(bp->owner);
+	  bp->ref = 0;
+	  bp->waiters = 0;
+	  bp->readers = 0;
+	  bp->flags = FFDB_PAGE_VALID;
+
+	  head = &pgp->hqh[FFDB_HASHKEY(bp->pgno)];
+	  FFDB_CIRCLEQ_INSERT_HEAD(head, bp, hq);
+	  FFDB_CIRCLEQ_INSERT_TAIL(&sp->lqh, bp, lq);
+	  loaded++;
+	}
+	else {
+	  --sp->curcache;
+	  free (bp);
+	}
+	FFDB_UNLOCK(sp->lock);
+	got -= pgp->pagesize;
+      }
+    }
+  }
+
+  return loaded;
+}
+
+/**
+ * Map the back end file of a read only page pool into memory
+ */
+int
+ffdb_pagepool_mmap (ffdb_pagepool_t* pgp, ffdb_pgcheckfunc_t pgcheck)
+{
+  void *addr;
+  size_t len;
+  int ret = 0;
+
+  FFDB_LOCK(pgp->lock);
+  if (pgp->mapaddr) {
+    FFDB_UNLOCK(pgp->lock);
+    return 0;
+  }
+
+  /* Only read only files can be mapped: pages are never written */
+  if (!FFDB_FLAG_ISSET(pgp->fileflags, FFDB_RDONLY) ||
+      FFDB_FLAG_ISSET(pgp->fileflags, FFDB_NOMMAP) ||
+      pgp->fd == -1 || pgp->npages == 0) {
+    FFDB_UNLOCK(pgp->lock);
+    return EINVAL;
+  }
+  len = (size_t)pgp->npages * pgp->pagesize;
+
+  pgp->mapstate = (unsigned char *)calloc (pgp->npages, sizeof(unsigned char));
+  if (!pgp->mapstate) {
+    FFDB_UNLOCK(pgp->lock);
+    return ENOMEM;
+  }
+
+  addr = mmap (0, len, PROT_READ, MAP_SHARED, pgp->fd, 0);
+  if (addr == MAP_FAILED) {
+    ret = errno;
+    free (pgp->mapstate);
+    pgp->mapstate = 0;
+    FFDB_UNLOCK(pgp->lock);
+    return ret;
+  }
+  pgp->mapaddr = (char *)addr;
+  pgp->maplen = len;
+  pgp->pgcheck = pgcheck;
+
+  FFDB_UNLOCK(pgp->lock);
+  return 0;
+}
+
 /**
  * User supplied filter code
  */
@@ -1614,17 +2426,25 @@ void
 ffdb_pagepool_stat (ffdb_pagepool_t* pgp)
 {
   ffdb_bkt_t *bp;
-  int cnt;
+  int cnt, i;
+  pgno_t curcache;
   char *sep;
   ffdb_sbkt_t* sbp;
   ffdb_sbkt_t* next;
   ffdb_slh_t slh;
   FFDB_SLIST_INIT (&slh);
 
+  curcache = 0;
+  for (i = 0; i < FFDB_NSTRIPES; i++)
+    curcache += pgp->stripes[i].curcache;
+
   fprintf(stderr, "%u pages in the file\n", pgp->npages);
+  if (pgp->mapaddr)
+    fprintf(stderr, "file is memory mapped (%lu bytes)\n",
+	    (unsigned long)pgp->maplen);
   fprintf(stderr,
 		"page size %u, cacheing %u pages of %u page max cache\n",
-		pgp->pagesize, pgp->curcache, pgp->maxcache);
+		pgp->pagesize, curcache, pgp->maxcache);
   fprintf(stderr, "%u page puts, %u page gets, %u page new\n",
 		pgp->pageput, pgp->pageget, pgp->pagenew);
   fprintf(stderr, "%u page allocs, %u page reuse, %u page swap, %u page flushes\n",
@@ -1639,16 +2459,18 @@ ffdb_pagepool_stat (ffdb_pagepool_t* pgp)
   
   sep = "";
   cnt = 0;
-  FFDB_CIRCLEQ_FOREACH(bp, &pgp->lqh, lq) {
-    /* insert this bucket into a single linked list */
-    sbp = (ffdb_sbkt_t *)malloc(sizeof(ffdb_sbkt_t));
-    if (!sbp) {
-      fprintf (stderr, "ffdb_pagepool_sync: cannot allocate space for single list element.\n");
-      abort ();
+  for (i = 0; i < FFDB_NSTRIPES; i++) {
+    FFDB_CIRCLEQ_FOREACH(bp, &pgp->stripes[i].lqh, lq) {
+      /* insert this bucket into a single linked list */
+      sbp = (ffdb_sbkt_t *)malloc(sizeof(ffdb_sbkt_t));
+      if (!sbp) {
+	fprintf (stderr, "ffdb_pagepool_sync: cannot allocate space for single list element.\n");
+	abort ();
+      }
+      _ffdb_shallow_copy_bk (sbp, bp);
+      /* add this to the list */
+      FFDB_SLIST_INSERT_HEAD (&slh, sbp, sl);
     }
-    _ffdb_shallow_copy_bk (sbp, bp);
-    /* add this to the list */
-    FFDB_SLIST_INSERT_HEAD (&slh, sbp, sl);
   }
   /* Do a merge sort on the list slh according to pageno */
   _ffdb_slist_merge_sort (&slh);
@@ -1664,6 +2486,8 @@ ffdb_pagepool_stat (ffdb_pagepool_t* pgp)
       fprintf(stderr, "d");
     if (sbp->bp->flags & FFDB_PAGE_PINNED)
       fprintf(stderr, "P");
+    if (sbp->bp->flags & FFDB_PAGE_SHARED)
+      fprintf(stderr, "S");
     if (sbp->bp->flags & FFDB_PAGE_LOCKED)
       fprintf(stderr, "L");
     if (++cnt == 10) {
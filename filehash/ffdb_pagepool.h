@@ -56,6 +56,7 @@
 #include <pthread.h>
 
 #include "ffdb_cq.h"
+#include "ffdb_pageio.h"
 
 /**
  * Some commonly used macros
@@ -93,6 +94,12 @@
  */
 #define FFDB_WRITE_FRAC           5
 
+/**
+ * Maximum number of adjacent dirty pages written out by
+ * a single vectored write when the cache is synced
+ */
+#define FFDB_WRITEV_MAX           64
+
 
 /*
  * Common flags --
@@ -125,6 +132,8 @@
 					   specific page number. */
 #define	FFDB_PAGE_NEXT	    0x00004000  /* Allocate a new page with
 					   next page number. */
+#define	FFDB_PAGE_SHARED    0x00008000  /* Pin page shared with other
+					   readers (read only access) */
 
 
 
@@ -149,6 +158,15 @@
 #define	FFDB_HASHSIZE	16384
 #define	FFDB_HASHKEY(pgno)	((pgno - 1 + FFDB_HASHSIZE) % FFDB_HASHSIZE)
 
+/*
+ * The hash chains are partitioned into stripes. Each stripe has its own
+ * lock, LRU chain and share of the cache, so threads working on pages of
+ * different stripes do not contend with each other. Consecutive pages
+ * fall into different stripes.
+ */
+#define	FFDB_NSTRIPES	64
+#define	FFDB_STRIPEKEY(pgno)	(FFDB_HASHKEY(pgno) % FFDB_NSTRIPES)
+
 /**
  * Forward decleration of structure
  */
@@ -160,6 +178,7 @@ struct _ffdb_bkt;
 typedef struct _ffdb_bkt_waiter {
   FFDB_CIRCLEQ_ENTRY(_ffdb_bkt_waiter) q; /* pointer inside waiter queue */
   int wakeup;                             /* flag for conditional variable */
+  int shared;                             /* waiting for a shared pin     */
   struct _ffdb_bkt* bp;                   /* which bucket we are waiting  */
   pthread_cond_t cv;                      /* conditional variable         */
 }ffdb_bkt_waiter_t;
@@ -175,10 +194,23 @@ typedef struct _ffdb_bkt {
   pgno_t   pgno;		                       /* page number */
   unsigned int ref;                                    /* how many using it */
   unsigned int waiters; 		               /* number of waiters */
+  unsigned int readers;                                /* shared pin holders */
   unsigned int flags;		                       /* flags (state)*/
+  unsigned long mod;                                   /* modification counter */
   pthread_t    owner;			               /* owner of this page */
 } ffdb_bkt_t;
 
+/**
+ * The shared pins held by a thread. A thread already holding a shared
+ * pin on a page pins it again without queueing behind waiting writers,
+ * which would wait for this thread in turn
+ */
+typedef struct _ffdb_shared_pins {
+  unsigned int num;                                    /* pins held */
+  unsigned int max;                                    /* room in bps */
+  ffdb_bkt_t** bps;                                    /* pinned buckets */
+}ffdb_shared_pins_t;
+
 /**
  * The bucket structure for sorting and flushing to disk purpose
  */
@@ -197,16 +229,36 @@ typedef FFDB_SLIST_HEAD(_ffdb_slh, _ffdb_sbkt) ffdb_slh_t;
  */
 typedef void (*ffdb_pgiofunc_t) (void* arg, pgno_t pgno, void* mem);
 
+/**
+ * Check routine for a page of a memory mapped file.
+ * It returns 0 if the page can be used in place, otherwise the page
+ * has to be read into the cache and go through the page in routine.
+ */
+typedef int (*ffdb_pgcheckfunc_t) (void* arg, pgno_t pgno, void* mem);
 
 
+
+/*
+ * A stripe of the page pool: all buckets whose page numbers hash into
+ * this stripe are on its LRU queue and are protected by its lock.
+ */
+typedef struct _ffdb_stripe_
+{
+  FFDB_CIRCLEQ_HEAD(_ffdb_lqh, _ffdb_bkt) lqh; /* lru queue head */
+  pgno_t	curcache;		/* current number of cached pages */
+  pgno_t	maxcache;		/* max number of cached pages */
+  unsigned int  wgen;                   /* bumped on every page write */
+  unsigned long mgen;                   /* source of page modification counters */
+  pthread_mutex_t lock;
+}ffdb_stripe_t;
+
 /*
  * The memory page pool structure keeping track of number pages and so on
  */
 typedef struct _ffdb_pagepool_
 {
-  FFDB_CIRCLEQ_HEAD(_ffdb_lqh, _ffdb_bkt) lqh; /* lru queue head */
   FFDB_CIRCLEQ_HEAD(_ffdb_hqh, _ffdb_bkt) hqh[FFDB_HASHSIZE]; /* hash queue array */
-  pgno_t	curcache;		/* current number of cached pages */
+  ffdb_stripe_t stripes[FFDB_NSTRIPES]; /* independently locked stripes */
   pgno_t	maxcache;		/* max number of cached pages */
   pgno_t	npages;			/* number of pages in the file */
   pgno_t	maxpgno;		/* maximum pages number in use */
@@ -219,6 +271,12 @@ typedef struct _ffdb_pagepool_
   /* page out conversion routine */
   ffdb_pgiofunc_t pgout;
   void	*pgcookie;		       /* cookie for page in/out routines */
+  /* read only files can be memory mapped instead of cached */
+  char          *mapaddr;               /* start of the mapped file */
+  size_t         maplen;                /* length of the mapping */
+  unsigned char *mapstate;              /* state of each mapped page */
+  ffdb_pgcheckfunc_t pgcheck;           /* page check routine */
+  ffdb_pageio_t *io;                    /* engine for batches of page I/O */
 #ifdef _FFDB_STATISTICS
   unsigned int	cachehit;
   unsigned int	cachemiss;
@@ -234,7 +292,7 @@ typedef struct _ffdb_pagepool_
   unsigned int	pagewrite;
   unsigned int  pagewait;
 #endif  
-  pthread_mutex_t lock;
+  pthread_mutex_t lock;                 /* protects npages, maxpgno, fd */
 }ffdb_pagepool_t;
 
 #ifdef _cplusplus
@@ -257,7 +315,8 @@ ffdb_pagepool_create (ffdb_pagepool_t** pagepool,
  *
  * @param filename a backend filename
  * @param flags must be zero or by bitwise OR'ing together one or
- * more of the following value: FFDB_CREATE, FFDB_DIRECT, FFDB_RDONLY
+ * more of the following value: FFDB_CREATE, FFDB_DIRECT, FFDB_RDONLY,
+ * FFDB_NOMMAP
  * @param mode the same as chmod call 
  * @param pagesize a fixed page size to use. This must be power of two
  * @param maxcache how many pages to keep in the page cache poll
@@ -312,7 +371,12 @@ ffdb_pagepool_new_page (ffdb_pagepool_t* pgp, pgno_t* pageno,
  * Get a page from the cache poll backed by the file. 
  * If the file is not yet created, a new page
  * will be allocated and eventually written back to the file. Once this
- * page is claimed by a thread, other threads cannot access this thread.
+ * page is claimed by a thread, other threads cannot access this thread,
+ * unless the page is pinned with FFDB_PAGE_SHARED. A shared pin can be
+ * held by many reader threads at the same time, but excludes any
+ * exclusive pin until the last reader puts the page back. New readers
+ * queue behind a waiting writer unless they hold the page already.
+ * A pin is put back by the thread that got it.
  *
  * @param pgp cache page pool pointer
  * @param pageno requested page number
@@ -324,8 +388,12 @@ ffdb_pagepool_new_page (ffdb_pagepool_t* pgp, pgno_t* pageno,
  * number to the memory location of the pagno
  * FFDB_NEW create a new page in the file, and copy its page number into the
  * the memory localtion of the pageno.
+ * FFDB_PAGE_SHARED pin this page for reading only. This flag cannot be
+ * used together with FFDB_PAGE_DIRTY or FFDB_PAGE_EDIT.
  * @param mem returned memory address of this page.
- * @return 0 on success. Otherwise return errno
+ * @return 0 on success. Otherwise return errno, which is EDEADLK when
+ * the calling thread holds a shared pin on a page it asks to pin
+ * exclusively
  *
  */
 extern int
@@ -351,6 +419,21 @@ ffdb_pagepool_put_page (ffdb_pagepool_t* pgp, void* mem,
 
 
 
+/**
+ * Get the modification counter of a page. The counter changes whenever
+ * an exclusive pin of the page is released or the page is read into
+ * the cache again, so a page with the same counter at two times has not
+ * been modified in between. The caller has to hold a pin of the page.
+ *
+ * @param pgp cache page pool pointer
+ * @param mem user cached page memory
+ *
+ * @return modification counter of the page
+ */
+extern unsigned long
+ffdb_pagepool_page_mod (ffdb_pagepool_t* pgp, void* mem);
+
+
 /**
  * Put a page back into the cache so that other threads can access this page
  * with new page number for this page
@@ -403,6 +486,18 @@ extern int
 ffdb_pagepool_delete (ffdb_pagepool_t* pgp, void* mem);
 
 
+/**
+ * Shrink the back end file to a number of pages. The pages beyond the
+ * new end must not be used anymore. Their cached copies are thrown away
+ * @param pgp cache page poll pointer
+ * @param npages number of pages left in the file
+ * @return 0 on success. EBUSY if some thread still holds a page beyond
+ * the new end, and nothing is changed. Otherwise errno of ftruncate
+ */
+extern int
+ffdb_pagepool_truncate (ffdb_pagepool_t* pgp, pgno_t npages);
+
+
   /**
    * Add user callback to page in/out from a backend file
    * @param pgp a pagepool pointer
@@ -415,6 +510,52 @@ ffdb_pagepool_filter (ffdb_pagepool_t* pgp, ffdb_pgiofunc_t pgin,
 		      ffdb_pgiofunc_t pgout, void* cookie);
 
 
+/**
+ * Choose the engine used to read and write batches of pages
+ * @param pgp cache page poll pointer
+ * @param type FFDB_IO_AUTO, FFDB_IO_SYNC or FFDB_IO_URING. If io_uring
+ * cannot be used, the synchronous engine is chosen instead
+ * @return 0 on success, otherwise errno
+ */
+extern int
+ffdb_pagepool_ioengine (ffdb_pagepool_t* pgp, int type);
+
+
+/**
+ * Bring pages not in the cache into the cache ahead of their use.
+ * All missing pages are read as a single batch by the I/O engine.
+ * Pages already cached, pages beyond the end of the file and
+ * pages over half of the cache size are skipped.
+ *
+ * @param pgp cache page poll pointer
+ * @param pgnos page numbers, preferably in ascending order
+ * @param num number of page numbers
+ * @return number of pages read into the cache, or -1 on error
+ */
+extern int
+ffdb_pagepool_prefetch (ffdb_pagepool_t* pgp, const pgno_t* pgnos,
+			unsigned int num);
+
+
+/**
+ * Map the back end file of a read only page pool into memory.
+ * Afterwards pages are returned straight from the mapping and the
+ * operating system page cache is the only cache of these pages.
+ * Pages rejected by the check routine and pages beyond the end of
+ * the file are still read into the cache.
+ *
+ * @param pgp a pagepool pointer opened on a read only file
+ * @param pgcheck a function called once for each page when the page is
+ * used for the first time. It must not modify the page. It is called
+ * with the cookie given to ffdb_pagepool_filter
+ *
+ * @return 0 if the file is mapped. Otherwise errno is returned, and
+ * the pagepool keeps caching pages as before.
+ */
+extern int
+ffdb_pagepool_mmap (ffdb_pagepool_t* pgp, ffdb_pgcheckfunc_t pgcheck);
+
+
 /**
  * Simple utility to dump stack trace
  * Now it only has implementation on linux
@@ -0,0 +1,599 @@
+/*
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     Regression tests of the library. Each test works on a database
+ *     of its own in the current directory and removes it when it is
+ *     done.
+ *
+ *     Build and run with: make test
+ *     Run with:           ffdb_test [test name]
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ffdb_db.h"
+
+#define TEST_DB "ffdb_test.db"
+
+static unsigned int _seed;
+
+static unsigned int
+_rand (void)
+{
+  _seed = _seed * 1103515245u + 12345u;
+  return _seed >> 8;
+}
+
+static void
+_info (FFDB_HASHINFO* info, unsigned int bsize, unsigned long cachesize)
+{
+  memset (info, 0, sizeof(FFDB_HASHINFO));
+  info->bsize = bsize;
+  info->nbuckets = 16;
+  info->cachesize = cachesize;
+}
+
+/**
+ * Values the database is expected to hold, by key number. A key not
+ * in the database has no value
+ */
+typedef struct _test_vals_
+{
+  unsigned int nkeys;
+  unsigned char** vals;
+  unsigned int* lens;
+}test_vals_t;
+
+static void
+_vals_init (test_vals_t* tv, unsigned int nkeys)
+{
+  tv->nkeys = nkeys;
+  tv->vals = (unsigned char **)calloc (nkeys, sizeof(unsigned char *));
+  tv->lens = (unsigned int *)calloc (nkeys, sizeof(unsigned int));
+  if (!tv->vals || !tv->lens) {
+    fprintf (stderr, "Cannot allocate test values\n");
+    exit (1);
+  }
+}
+
+static void
+_vals_fini (test_vals_t* tv)
+{
+  unsigned int i;
+
+  for (i = 0; i < tv->nkeys; i++)
+    free (tv->vals[i]);
+  free (tv->vals);
+  free (tv->lens);
+}
+
+static void
+_key (FFDB_DBT* key, char* kbuf, unsigned int i)
+{
+  key->data = kbuf;
+  key->size = sprintf (kbuf, "key%06u", i);
+}
+
+/**
+ * Check that every key has its expected value. Return the number of
+ * keys that do not
+ */
+static int
+_vals_check (FFDB_DB* db, test_vals_t* tv)
+{
+  FFDB_DBT key, data;
+  char kbuf[32];
+  unsigned int i;
+  int ret, bad = 0;
+
+  for (i = 0; i < tv->nkeys; i++) {
+    _key (&key, kbuf, i);
+    data.data = 0;
+    data.size = 0;
+    ret = db->get (db, &key, &data, 0);
+    if (!tv->vals[i]) {
+      if (ret != FFDB_NOT_FOUND) {
+	fprintf (stderr, "Deleted key %u is found\n", i);
+	bad++;
+      }
+      if (ret == 0)
+	free (data.data);
+      continue;
+    }
+    if (ret != 0) {
+      fprintf (stderr, "Key %u is not found\n", i);
+      bad++;
+      continue;
+    }
+    if (data.size != tv->lens[i] ||
+	memcmp (data.data, tv->vals[i], data.size) != 0) {
+      fprintf (stderr, "Key %u has a wrong value\n", i);
+      bad++;
+    }
+    free (data.data);
+  }
+  return bad;
+}
+
+/**
+ * Put, delete and partly overwrite values of random lengths spanning
+ * several pages, and compact the database every now and then. The
+ * cache holds a small part of the database, so pages are written out
+ * and read back all the time
+ */
+static int
+_churn (int codec, unsigned int seed)
+{
+  FFDB_HASHINFO info;
+  FFDB_DB* db;
+  FFDB_DBT key, data;
+  test_vals_t tv;
+  unsigned char buf[4096];
+  char kbuf[32];
+  unsigned int round, op, i, k, len, off, r;
+  int bad = 0;
+
+  _seed = seed;
+  _info (&info, 512, 1024 * 1024);
+  info.compress = codec;
+  info.orderedindex = (codec != FFDB_CODEC_NONE);
+  db = ffdb_dbopen (TEST_DB, O_RDWR | O_CREAT | O_TRUNC, 0644, &info);
+  if (!db) {
+    fprintf (stderr, "Cannot create %s\n", TEST_DB);
+    return 1;
+  }
+  _vals_init (&tv, 3000);
+
+  for (round = 0; round < 8 && !bad; round++) {
+    for (op = 0; op < 3000 && !bad; op++) {
+      k = _rand () % tv.nkeys;
+      r = _rand () % 10;
+      _key (&key, kbuf, k);
+      if (r < 5) {
+	/* Values of few distinct bytes, so that the codec shrinks them */
+	len = 1 + _rand () % 4000;
+	tv.vals[k] = (unsigned char *)realloc (tv.vals[k], len);
+	for (i = 0; i < len; i++)
+	  tv.vals[k][i] = (unsigned char)(_rand () & 7);
+	tv.lens[k] = len;
+	data.data = tv.vals[k];
+	data.size = len;
+	if (db->put (db, &key, &data, 0) != 0) {
+	  fprintf (stderr, "Cannot put key %u\n", k);
+	  bad++;
+	}
+      }
+      else if (r < 8) {
+	if (db->del (db, &key, 0) != (tv.vals[k] ? 0 : FFDB_NOT_FOUND)) {
+	  fprintf (stderr, "Cannot delete key %u\n", k);
+	  bad++;
+	}
+	free (tv.vals[k]);
+	tv.vals[k] = 0;
+      }
+      else if (tv.vals[k]) {
+	off = _rand () % tv.lens[k];
+	len = 1 + _rand () % (tv.lens[k] - off);
+	for (i = 0; i < len; i++)
+	  buf[i] = tv.vals[k][off + i] = (unsigned char)(_rand () & 7);
+	data.data = buf;
+	data.size = len;
+	if (ffdb_put_range (db, &key, &data, off) != 0) {
+	  fprintf (stderr, "Cannot put %u bytes at %u of key %u\n", len, off, k);
+	  bad++;
+	}
+      }
+
+      if (op % 500 == 0) {
+	while ((r = ffdb_compact (db, 64)) == 1)
+	  ;
+	if (r != 0) {
+	  fprintf (stderr, "Cannot compact the database\n");
+	  bad++;
+	}
+      }
+    }
+    if (!bad)
+      bad = _vals_check (db, &tv);
+  }
+  db->close (db);
+
+  /* The data pages are found again after a reopen */
+  if (!bad) {
+    db = ffdb_dbopen (TEST_DB, O_RDWR, 0644, 0);
+    if (!db) {
+      fprintf (stderr, "Cannot open %s\n", TEST_DB);
+      bad++;
+    }
+    else {
+      bad = _vals_check (db, &tv);
+      db->close (db);
+    }
+  }
+
+  _vals_fini (&tv);
+  unlink (TEST_DB);
+  return bad;
+}
+
+static int
+_test_churn (void)
+{
+  return _churn (FFDB_CODEC_NONE, 7) + _churn (FFDB_CODEC_NONE, 1);
+}
+
+static int
+_test_churn_codec (void)
+{
+  return _churn (FFDB_CODEC_LZ, 7) + _churn (FFDB_CODEC_LZ, 1);
+}
+
+/**
+ * Empty values are read and then written over like any other value,
+ * next to values on the same data page
+ */
+static int
+_test_empty_value (void)
+{
+  FFDB_HASHINFO info;
+  FFDB_DB* db;
+  FFDB_DBT key, data;
+  test_vals_t tv;
+  char kbuf[32];
+  unsigned int i, k;
+  int bad = 0;
+
+  _info (&info, 4096, 1024 * 1024);
+  db = ffdb_dbopen (TEST_DB, O_RDWR | O_CREAT | O_TRUNC, 0644, &info);
+  if (!db) {
+    fprintf (stderr, "Cannot create %s\n", TEST_DB);
+    return 1;
+  }
+  _vals_init (&tv, 64);
+
+  for (k = 0; k < tv.nkeys && !bad; k++) {
+    /* An empty value and a get of it */
+    _key (&key, kbuf, k);
+    tv.vals[k] = (unsigned char *)malloc (1);
+    tv.lens[k] = 0;
+    data.data = tv.vals[k];
+    data.size = 0;
+    if (db->put (db, &key, &data, 0) != 0) {
+      fprintf (stderr, "Cannot put an empty value for key %u\n", k);
+      bad++;
+      break;
+    }
+    bad = _vals_check (db, &tv);
+
+    /* Every value of the keys so far written over */
+    for (i = 0; i <= k && !bad; i++) {
+      _key (&key, kbuf, i);
+      tv.lens[i] = (i + k) % 3 == 0 ? 0 : 1 + (i + k) % 50;
+      tv.vals[i] = (unsigned char *)realloc (tv.vals[i], tv.lens[i] + 1);
+      memset (tv.vals[i], 'a' + i % 26, tv.lens[i]);
+      data.data = tv.vals[i];
+      data.size = tv.lens[i];
+      if (db->put (db, &key, &data, 0) != 0) {
+	fprintf (stderr, "Cannot replace the value of key %u\n", i);
+	bad++;
+      }
+    }
+    if (!bad)
+      bad = _vals_check (db, &tv);
+  }
+
+  /* and deleted */
+  for (k = 0; k < tv.nkeys && !bad; k += 2) {
+    _key (&key, kbuf, k);
+    if (db->del (db, &key, 0) != 0) {
+      fprintf (stderr, "Cannot delete key %u\n", k);
+      bad++;
+    }
+    free (tv.vals[k]);
+    tv.vals[k] = 0;
+  }
+  if (!bad)
+    bad = _vals_check (db, &tv);
+
+  db->close (db);
+  _vals_fini (&tv);
+  unlink (TEST_DB);
+  return bad;
+}
+
+/**
+ * Give every key a new value of maxlen bytes, or of 1 to maxlen bytes
+ * when any is set. Return the number of failed puts
+ */
+static int
+_vals_put_all (FFDB_DB* db, test_vals_t* tv, unsigned int maxlen, int any)
+{
+  FFDB_DBT key, data;
+  char kbuf[32];
+  unsigned int k;
+  int bad = 0;
+
+  for (k = 0; k < tv->nkeys && !bad; k++) {
+    _key (&key, kbuf, k);
+    tv->lens[k] = any ? 1 + _rand () % maxlen : maxlen;
+    tv->vals[k] = (unsigned char *)realloc (tv->vals[k], tv->lens[k]);
+    memset (tv->vals[k], 'a' + _rand () % 26, tv->lens[k]);
+    data.data = tv->vals[k];
+    data.size = tv->lens[k];
+    if (db->put (db, &key, &data, 0) != 0) {
+      fprintf (stderr, "Cannot put %u bytes for key %u\n", tv->lens[k], k);
+      bad++;
+    }
+  }
+  return bad;
+}
+
+/**
+ * Size of the database file after all cached pages are written
+ */
+static off_t
+_file_size (FFDB_DB* db)
+{
+  struct stat st;
+
+  db->sync (db, 0);
+  if (stat (TEST_DB, &st) != 0)
+    return 0;
+  return st.st_size;
+}
+
+/**
+ * Values written over by shorter values running over fewer pages and
+ * then by long values again do not leave pages behind
+ */
+static int
+_test_shrink_replace (void)
+{
+  FFDB_HASHINFO info;
+  FFDB_DB* db;
+  test_vals_t tv;
+  off_t fsize, nsize;
+  unsigned int round;
+  int bad = 0;
+
+  _seed = 11;
+  _info (&info, 4096, 4 * 1024 * 1024);
+  db = ffdb_dbopen (TEST_DB, O_RDWR | O_CREAT | O_TRUNC, 0644, &info);
+  if (!db) {
+    fprintf (stderr, "Cannot create %s\n", TEST_DB);
+    return 1;
+  }
+  _vals_init (&tv, 500);
+  bad = _vals_put_all (db, &tv, 20000, 0);
+  fsize = _file_size (db);
+
+  for (round = 0; round < 10 && !bad; round++) {
+    bad = _vals_put_all (db, &tv, 20000, 1);
+    if (!bad)
+      bad = _vals_check (db, &tv);
+    if (!bad)
+      bad = _vals_put_all (db, &tv, 20000, 0);
+    nsize = _file_size (db);
+    if (!bad && nsize > fsize + fsize / 4) {
+      fprintf (stderr, "File grows from %ld to %ld bytes in round %u\n",
+	       (long)fsize, (long)nsize, round);
+      bad++;
+    }
+  }
+  if (!bad)
+    bad = _vals_check (db, &tv);
+
+  db->close (db);
+  _vals_fini (&tv);
+  unlink (TEST_DB);
+  return bad;
+}
+
+/**
+ * Compaction after values are written over by much shorter values
+ * gives the pages they no longer use back to the file system
+ */
+static int
+_test_shrink_compact (void)
+{
+  FFDB_HASHINFO info;
+  FFDB_DB* db;
+  test_vals_t tv;
+  off_t fsize, nsize;
+  int r, bad = 0;
+
+  _seed = 13;
+  _info (&info, 4096, 4 * 1024 * 1024);
+  db = ffdb_dbopen (TEST_DB, O_RDWR | O_CREAT | O_TRUNC, 0644, &info);
+  if (!db) {
+    fprintf (stderr, "Cannot create %s\n", TEST_DB);
+    return 1;
+  }
+  _vals_init (&tv, 500);
+  bad = _vals_put_all (db, &tv, 20000, 0);
+  fsize = _file_size (db);
+
+  /* A quarter of the data are left */
+  if (!bad)
+    bad = _vals_put_all (db, &tv, 10000, 1);
+  while (!bad && (r = ffdb_compact (db, 64)) == 1)
+    ;
+  if (!bad && r != 0) {
+    fprintf (stderr, "Cannot compact the database\n");
+    bad++;
+  }
+  nsize = _file_size (db);
+  if (!bad && nsize > fsize / 2) {
+    fprintf (stderr, "File of %ld bytes is %ld bytes after compaction\n",
+	     (long)fsize, (long)nsize);
+    bad++;
+  }
+  if (!bad)
+    bad = _vals_check (db, &tv);
+
+  db->close (db);
+  _vals_fini (&tv);
+  unlink (TEST_DB);
+  return bad;
+}
+
+/**
+ * Pairs seen by a scan and how many of them have the expected value
+ */
+typedef struct _scan_count_
+{
+  test_vals_t* tv;
+  unsigned int npairs;
+  unsigned int nright;
+}scan_count_t;
+
+static int
+_scan_pair (FFDB_DBT* key, FFDB_DBT* data, void* arg)
+{
+  scan_count_t* sc = (scan_count_t *)arg;
+  unsigned int k;
+
+  sc->npairs++;
+  if (key->size == 9 && sscanf ((char *)key->data + 3, "%6u", &k) == 1 &&
+      k < sc->tv->nkeys && sc->tv->vals[k] && 
+      data->size == sc->tv->lens[k] &&
+      memcmp (data->data, sc->tv->vals[k], data->size) == 0)
+    sc->nright++;
+  return 0;
+}
+
+/**
+ * A scan of a read only database finds all pairs, also those on the
+ * pages moved onto unused bucket pages when the database was closed
+ */
+static int
+_test_scan_rearranged (void)
+{
+  FFDB_HASHINFO info;
+  FFDB_DB* db;
+  FFDB_DBT key, data;
+  test_vals_t tv;
+  scan_count_t sc;
+  char kbuf[32];
+  unsigned int k, pass;
+  int bad = 0;
+
+  _seed = 5;
+  _info (&info, 512, 1024 * 1024);
+  info.rearrangepages = 1;
+  db = ffdb_dbopen (TEST_DB, O_RDWR | O_CREAT | O_TRUNC, 0644, &info);
+  if (!db) {
+    fprintf (stderr, "Cannot create %s\n", TEST_DB);
+    return 1;
+  }
+  _vals_init (&tv, 1609);
+  for (k = 0; k < tv.nkeys && !bad; k++) {
+    _key (&key, kbuf, k);
+    tv.lens[k] = 1 + _rand () % 1500;
+    tv.vals[k] = (unsigned char *)malloc (tv.lens[k]);
+    memset (tv.vals[k], 'a' + k % 26, tv.lens[k]);
+    data.data = tv.vals[k];
+    data.size = tv.lens[k];
+    if (db->put (db, &key, &data, 0) != 0) {
+      fprintf (stderr, "Cannot put key %u\n", k);
+      bad++;
+    }
+  }
+  db->close (db);
+
+  /* Read only first, where the moved pages stay, then for writing */
+  for (pass = 0; pass < 2 && !bad; pass++) {
+    _info (&info, 512, 1024 * 1024);
+    info.rearrangepages = 1;
+    db = ffdb_dbopen (TEST_DB, pass == 0 ? O_RDONLY : O_RDWR, 0644, &info);
+    if (!db) {
+      fprintf (stderr, "Cannot open %s\n", TEST_DB);
+      bad++;
+      break;
+    }
+    sc.tv = &tv;
+    sc.npairs = sc.nright = 0;
+    if (ffdb_scan (db, _scan_pair, &sc) != 0 || 
+	sc.npairs != ffdb_num_keys (db) || sc.nright != tv.nkeys) {
+      fprintf (stderr, "Scan finds %u pairs, %u of them right, of %u\n",
+	       sc.npairs, sc.nright, ffdb_num_keys (db));
+      bad++;
+    }
+    db->close (db);
+  }
+
+  _vals_fini (&tv);
+  unlink (TEST_DB);
+  return bad;
+}
+
+
+typedef struct _ffdb_test_
+{
+  const char* name;
+  int (*func) (void);
+}ffdb_test_t;
+
+static ffdb_test_t _tests[] = {
+  {"churn", _test_churn},
+  {"churn_codec", _test_churn_codec},
+  {"empty_value", _test_empty_value},
+  {"scan_rearranged", _test_scan_rearranged},
+  {"shrink_replace", _test_shrink_replace},
+  {"shrink_compact", _test_shrink_compact},
+  {0, 0}
+};
+
+int
+main (int argc, char** argv)
+{
+  unsigned int i;
+  int failed = 0, ran = 0;
+
+  for (i = 0; _tests[i].name; i++) {
+    if (argc > 1 && strcmp (argv[1], _tests[i].name) != 0)
+      continue;
+    ran++;
+    if (_tests[i].func () != 0) {
+      printf ("%-24s FAILED\n", _tests[i].name);
+      failed++;
+    }
+    else
+      printf ("%-24s ok\n", _tests[i].name);
+    fflush (stdout);
+  }
+
+  if (ran == 0) {
+    fprintf (stderr, "Usage: %s [test name]\n", argv[0]);
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
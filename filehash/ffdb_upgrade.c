@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     Copy a database of an earlier version into a new database of the
+ *     current version. Files of earlier versions are only opened read
+ *     only by the library. The new database keeps the page size, the
+ *     hash function, the ordered index, the codec, the user information
+ *     and the configurations of the old one, so it holds the same keys
+ *     in the same buckets. The old file is left as it is.
+ *
+ *     Build with: make upgrade
+ *     Run with:   ffdb_upgrade old_file new_file
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "ffdb_db.h"
+#include "ffdb_pagepool.h"
+#include "ffdb_page.h"
+#include "ffdb_hash.h"
+
+/**
+ * Destination of the copied pairs
+ */
+typedef struct _upgrade_arg_
+{
+  FFDB_DB* dbp;                 /* new database                  */
+  unsigned int numconfigs;      /* number of configurations      */
+  int config_major;             /* values stored per config      */
+  unsigned int count;           /* pairs copied so far           */
+}upgrade_arg_t;
+
+/**
+ * Put a pair of the old database into the new one. In the config
+ * major layout the leading four bytes of a key are the big-endian
+ * number of its configuration, which puts the value on the data pages
+ * of that configuration again.
+ */
+static int
+_upgrade_pair (FFDB_DBT* key, FFDB_DBT* data, void* arg)
+{
+  upgrade_arg_t* up = (upgrade_arg_t *)arg;
+  unsigned char* k = (unsigned char *)key->data;
+  unsigned int config;
+  int ret;
+
+  if (up->config_major && key->size >= 4) {
+    config = ((unsigned int)k[0] << 24) | ((unsigned int)k[1] << 16) |
+      ((unsigned int)k[2] << 8) | (unsigned int)k[3];
+    if (config < up->numconfigs)
+      ret = ffdb_put_config (up->dbp, key, data, config);
+    else
+      ret = up->dbp->put (up->dbp, key, data, 0);
+  }
+  else
+    ret = up->dbp->put (up->dbp, key, data, 0);
+
+  if (ret != 0) {
+    fprintf (stderr, "Cannot put pair %u into the new database: %s\n",
+	     up->count, strerror (errno));
+    return -1;
+  }
+  up->count++;
+  return 0;
+}
+
+int
+main (int argc, char** argv)
+{
+  FFDB_DB *odbp, *ndbp;
+  ffdb_htab_t* ohashp;
+  FFDB_HASHINFO openinfo;
+  ffdb_stat_t st;
+  ffdb_all_config_info_t configs;
+  upgrade_arg_t up;
+  unsigned char* uinfo;
+  unsigned int ulen;
+  struct stat sb;
+  int version, ret;
+
+  if (argc != 3) {
+    fprintf (stderr, "Usage: %s old_file new_file\n", argv[0]);
+    return 1;
+  }
+
+  if (stat (argv[2], &sb) == 0) {
+    fprintf (stderr, "%s exists already, will not overwrite it\n", argv[2]);
+    return 1;
+  }
+
+  odbp = ffdb_dbopen (argv[1], O_RDONLY, 0644, 0);
+  if (!odbp) {
+    fprintf (stderr, "Cannot open database %s: %s\n", argv[1],
+	     strerror (errno));
+    return 1;
+  }
+  ohashp = (ffdb_htab_t *)odbp->internal;
+  version = ohashp->hdr.version;
+  ffdb_stat (odbp, &st);
+
+  memset (&openinfo, 0, sizeof (openinfo));
+  openinfo.bsize = st.bsize;
+  openinfo.nbuckets = st.nbuckets;
+  openinfo.cachesize = 64*1024*1024;
+  openinfo.userinfolen = ffdb_max_user_info_len (odbp);
+  openinfo.numconfigs = st.numconfigs;
+  openinfo.orderedindex = (ohashp->hdr.idx_page != 0);
+  openinfo.hashfunc = ohashp->hdr.hash_func;
+  openinfo.compress = ohashp->hdr.codec;
+  openinfo.compressmin = ohashp->hdr.codec_min;
+  openinfo.filterwidth = ohashp->hdr.codec_width;
+
+  ndbp = ffdb_dbopen (argv[2], O_RDWR | O_CREAT | O_EXCL, 0644, &openinfo);
+  if (!ndbp) {
+    fprintf (stderr, "Cannot create database %s: %s\n", argv[2],
+	     strerror (errno));
+    odbp->close (odbp);
+    return 1;
+  }
+
+  /* User information */
+  ulen = openinfo.userinfolen;
+  uinfo = (unsigned char *)malloc (ulen > 0 ? ulen : 1);
+  if (ffdb_get_user_info (odbp, uinfo, &ulen) == 0 && ulen > 0)
+    ffdb_set_user_info (ndbp, uinfo, ulen);
+  free (uinfo);
+
+  /* Configurations, which keep their layout in their types */
+  memset (&up, 0, sizeof (up));
+  configs.numconfigs = 0;
+  configs.allconfigs = 0;
+  if (st.numconfigs > 0 && ffdb_get_all_configs (odbp, &configs) == 0) {
+    if (ffdb_set_all_configs (ndbp, &configs) != 0)
+      fprintf (stderr, "Cannot copy the configurations: %s\n",
+	       strerror (errno));
+    up.config_major = (configs.numconfigs > 0 &&
+		       configs.allconfigs[0].type == FFDB_LAYOUT_CONFIG_MAJOR);
+    free (configs.allconfigs);
+  }
+
+  /* All pairs in the order their data are stored */
+  up.dbp = ndbp;
+  up.numconfigs = st.numconfigs;
+  ret = ffdb_scan (odbp, _upgrade_pair, &up);
+
+  if (ret == 0 && up.count != st.nkeys) {
+    fprintf (stderr, "Copied %u pairs of %u\n", up.count, st.nkeys);
+    ret = -1;
+  }
+
+  ndbp->close (ndbp);
+  odbp->close (odbp);
+
+  if (ret != 0) {
+    fprintf (stderr, "Upgrade of %s failed, %s is incomplete\n",
+	     argv[1], argv[2]);
+    return 1;
+  }
+
+  fprintf (stderr, "Upgraded %s of version %d to %s of version %d with %u keys\n",
+	   argv[1], version, argv[2], FFDB_HASHVERSION, up.count);
+  return 0;
+}
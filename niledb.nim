@@ -17,6 +17,8 @@
 import niledb/private/ffdb_header
 include niledb/private/niledb_internal
 import tables, os
+when compileOption("threads"):
+  import threadpool, cpuinfo
 import 
   serializetools/serializebin, serializetools/serialstring
 
@@ -96,6 +98,26 @@ proc disablePageMove*(filedb: var ConfDataStoreDB) =
   filedb.options.rearrangepages = 0
 
 
+proc enableOrderedIndex*(filedb: var ConfDataStoreDB) =
+  ## Keep an ordered index of the keys for range and prefix reads
+  ##
+  ## This only takes effect when the database is created
+  filedb.options.orderedindex = 1
+
+
+proc enableCompression*(filedb: var ConfDataStoreDB; minSize = 0;
+                        elementSize = 0) =
+  ## Compress the values of at least ``minSize`` bytes, or of the
+  ## default size if 0. Values that do not compress are stored as they are
+  ##
+  ## Values that are arrays of numbers of ``elementSize`` bytes, like
+  ## 8 for ``float64`` and 16 for ``Complex64``, are shuffled by byte first,
+  ## which lets them compress much better
+  ##
+  ## This only takes effect when the database is created
+  enableCompression(filedb.options, minSize, elementSize)
+
+
 proc setMaxUserInfoLen*(filedb: var ConfDataStoreDB; len: int) =
   ## Set and get maximum user information length
   filedb.options.userinfolen = cuint(len)
@@ -107,6 +129,12 @@ proc getMaxUserInfoLen*(filedb: ConfDataStoreDB): int {.noSideEffect.} =
   return int(filedb_max_user_info_len(filedb.dbh))
 
 
+proc numKeys*(filedb: ConfDataStoreDB): int =
+  ## Number of keys in the database, read from the header
+  if filedb.dbh == nil: return 0
+  return int(filedb_num_keys(filedb.dbh))
+
+
 proc open*(filedb: var ConfDataStoreDB; file: string; open_flags: cint; mode: cint): int =
   ## ``file``: open filename holding all data and keys.
   ## ``open_flags``: can be regular UNIX file open flags such as: O_RDONLY, O_RDWR, O_TRUNC
@@ -149,12 +177,47 @@ proc insert*[K,D](filedb: var ConfDataStoreDB; key: K; data: D): int =
 
 proc insert*[K,D](filedb: var ConfDataStoreDB; kv: Table[K,D]): int =
   ## Insert a table of key/value pairs `kv` into the database
+  ##
+  ## An empty database is sized for the whole table and loaded in one pass
+  if isDBEmpty(filedb.dbh):
+    var keyObjs = newSeqOfCap[string](kv.len)
+    var dataObjs = newSeqOfCap[string](kv.len)
+    for k,v in pairs(kv):
+      keyObjs.add(serializeBinary(k))
+      dataObjs.add(serializeBinary(v))
+    return bulkInsertBinary(filedb.dbh, keyObjs, dataObjs)
+
   result = 0
   for k,v in pairs(kv):
     let ret = filedb.insert(k,v)
     if ret != 0: return ret
 
 
+proc delete*[K](filedb: var ConfDataStoreDB; key: K): int =
+  ## Delete a `key` and its data from the database
+  ## The space taken by the data is reused by later insertions
+  ##
+  ## @return 0 on success, 1 if the key is not found, -1 on failure
+  var keyObj = serializeBinary(key)
+  return deleteBinary(filedb.dbh, keyObj)
+
+
+proc compact*(filedb: var ConfDataStoreDB; npages: int = 0): int =
+  ## Compact the database while readers keep using it. Live data on
+  ## mostly empty data pages are moved, and free pages at the end of
+  ## the file are cut off once every page has been looked at.
+  ## Up to `npages` pages are looked at, and the next call continues
+  ## where this one stopped. With `npages` 0 a whole pass is done
+  ##
+  ## @return 1 if there are more pages to look at, 0 when a pass is done,
+  ## -1 on failure
+  if npages > 0:
+    return int(filedb_compact(filedb.dbh, cuint(npages)))
+  result = 1
+  while result == 1:
+    result = int(filedb_compact(filedb.dbh, cuint(1024)))
+
+
 proc getBinary*(filedb: ConfDataStoreDB; key: string; data: var string): int =
   ## Get `data` for a given `key`
   ## return 0 on success, otherwise the key not found
@@ -172,14 +235,16 @@ proc get*[K,D](filedb: ConfDataStoreDB; key: K; data: var D): int =
   # Convert key to a string
   var keyObj = serializeBinary(key)
 
-  # Output
-  var dataObj: string
-  let ret = getBinary(filedb.dbh, keyObj, dataObj)
-  if ret == 0:
-    # convert object into a string
-    data = deserializeBinary[D](dataObj)
+  # Deserialize directly off the database page
+  return getDeserialized[D](filedb.dbh, keyObj, data)
+
 
-  return int(ret)
+proc get*[K,D](filedb: ConfDataStoreDB; keys: seq[K]; data: var seq[D]; nthreads: int = 1): int =
+  ## Get `data` for all `keys` at once. The keys are looked up in the
+  ## order of their pages on disk and spread over `nthreads` threads.
+  ## return 0 on success, otherwise some keys are not found and their
+  ## data are left at the default value
+  return getMany[K,D](filedb.dbh, keys, data, nthreads)
 
 
 proc `[]`*[K](filedb: ConfDataStoreDB; key: K): string =
@@ -204,6 +269,34 @@ proc allBinaryPairs*(filedb: ConfDataStoreDB): seq[tuple[key:string,val:string]]
   return allBinaryPairs(filedb.dbh)
 
 
+proc rangeBinaryKeys*(filedb: ConfDataStoreDB; lo, hi: string): seq[string] =
+  ## Return the keys from `lo` up to but not including `hi` in byte
+  ## order. An empty bound leaves the range open at that end
+  var lo = lo
+  var hi = hi
+  return rangeBinaryKeys(filedb.dbh, lo, hi)
+
+
+proc rangeBinaryPairs*(filedb: ConfDataStoreDB; lo, hi: string): seq[tuple[key:string,val:string]] =
+  ## Return the key/value pairs from `lo` up to but not including `hi`
+  ## in byte order of the keys
+  var lo = lo
+  var hi = hi
+  return rangeBinaryPairs(filedb.dbh, lo, hi)
+
+
+proc prefixBinaryKeys*(filedb: ConfDataStoreDB; prefix: string): seq[string] =
+  ## Return the keys starting with `prefix` in byte order
+  var prefix = prefix
+  return prefixBinaryKeys(filedb.dbh, prefix)
+
+
+proc prefixBinaryPairs*(filedb: ConfDataStoreDB; prefix: string): seq[tuple[key:string,val:string]] =
+  ## Return the key/value pairs whose keys start with `prefix` in byte order
+  var prefix = prefix
+  return prefixBinaryPairs(filedb.dbh, prefix)
+
+
 proc allKeys*[K](filedb: ConfDataStoreDB): seq[K] =
   ## Return all available keys to user
   return allKeys[K](filedb.dbh)
@@ -220,6 +313,52 @@ proc allPairs*[K,D](filedb: ConfDataStoreDB): Table[K,D] =
     result[deserializeBinary[K](all_pairs[i].key)] = deserializeBinary[D](all_pairs[i].val)
 
 
+when compileOption("threads"):
+  proc partitionKeys[K](dbh: ptr FILEDB_DB; part, nparts: int): seq[K] =
+    ## Read and deserialize the keys of one partition of the buckets
+    let keys = partitionBinaryKeys(dbh, part, nparts)
+    newSeq[K](result, keys.len)
+    for i in 0..keys.len-1:
+      result[i] = deserializeBinary[K](keys[i])
+
+
+  proc partitionPairs[K,D](dbh: ptr FILEDB_DB; part, nparts: int): seq[tuple[key:K,val:D]] =
+    ## Read and deserialize the pairs of one partition of the buckets
+    let all_pairs = partitionBinaryPairs(dbh, part, nparts)
+    newSeq[tuple[key:K,val:D]](result, all_pairs.len)
+    for i in 0..all_pairs.len-1:
+      result[i] = (deserializeBinary[K](all_pairs[i].key), deserializeBinary[D](all_pairs[i].val))
+
+
+  proc parallelKeys*[K](filedb: ConfDataStoreDB; nthreads: int = countProcessors()): seq[K] =
+    ## Return all available keys to user. The buckets are split into
+    ## `nthreads` partitions, each read and deserialized by its own thread.
+    ## Needs --threads:on
+    let nparts = max(1, nthreads)
+    var flows = newSeq[FlowVar[seq[K]]](nparts)
+    for p in 0..nparts-1:
+      flows[p] = spawn partitionKeys[K](filedb.dbh, p, nparts)
+
+    result = @[]
+    for p in 0..nparts-1:
+      result.add(^flows[p])
+
+
+  proc parallelPairs*[K,D](filedb: ConfDataStoreDB; nthreads: int = countProcessors()): Table[K,D] =
+    ## Return a table of all pairs of keys and values. The buckets are split
+    ## into `nthreads` partitions, each read and deserialized by its own thread.
+    ## Needs --threads:on
+    let nparts = max(1, nthreads)
+    var flows = newSeq[FlowVar[seq[tuple[key:K,val:D]]]](nparts)
+    for p in 0..nparts-1:
+      flows[p] = spawn partitionPairs[K,D](filedb.dbh, p, nparts)
+
+    result = initTable[K,D]()
+    for p in 0..nparts-1:
+      for kv in (^flows[p]):
+        result[kv.key] = kv.val
+
+
 #[
 proc flush*(filedb: var ConfDataStoreDB) =
   ## Flush database in memory to disk
@@ -264,16 +403,63 @@ type
     empty:     bool                           ## is db initialized?
     filename:  string                         ## database name
     allcfgs:   seq[string]                    ## info on the configs in use
+    layout:    cint                           ## layout of the values of the configurations
     options:   FILEDB_OPENINFO                ## all open options
     dbh:       ptr FILEDB_DB                  ## opened database handle
 
 
+proc configMajor(filedb: AllConfDataStoreDB): bool {.noSideEffect.} =
+  ## Is the value of each configuration of a key stored on its own
+  return filedb.layout == FFDB_LAYOUT_CONFIG_MAJOR
+
+
+proc configKey(cfg: int; keyObj: string): string =
+  ## Key of the value of configuration `cfg` of a binary key in the
+  ## config major layout. The configuration number goes ahead of the
+  ## key in 4 big-endian bytes, so the keys of one configuration share
+  ## a prefix and keep the byte order of the keys
+  result = newString(4)
+  result[0] = char((cfg shr 24) and 0xff)
+  result[1] = char((cfg shr 16) and 0xff)
+  result[2] = char((cfg shr 8) and 0xff)
+  result[3] = char(cfg and 0xff)
+  result.add(keyObj)
+
+
+proc userKeys(keyObjs: seq[string]): seq[string] =
+  ## The binary keys of the users out of the keys of a config major
+  ## database, one for the value of the first configuration of each
+  let first = configKey(0, "")
+  result = @[]
+  for k in items(keyObjs):
+    if k.len >= 4 and k[0..3] == first:
+      result.add(k[4..^1])
+
+
+proc getAllBinary(filedb: AllConfDataStoreDB; keyObj: var string; data: var string): int =
+  ## Get the data of all configurations for a binary key as one string
+  ## in either layout
+  ## return 0 on success, otherwise the key not found
+  if not filedb.configMajor:
+    return getBinary(filedb.dbh, keyObj, data)
+
+  data = ""
+  var dbd: string
+  for n in 0..filedb.nbins-1:
+    var ck = configKey(n, keyObj)
+    let ret = getBinary(filedb.dbh, ck, dbd)
+    if ret != 0: return ret
+    data.add(dbd)
+  return 0
+
+
 proc newAllConfDataStoreDB*(): AllConfDataStoreDB =
   ## Empty constructor for a multi-configuration data store
   result.options = newDataStoreDB()
   result.empty = true
   result.nbins = 0
   result.bytesize = 0
+  result.layout = FFDB_LAYOUT_KEY_MAJOR
   #  the other elements will be arranged by file hash package
   
 
@@ -283,6 +469,7 @@ proc newAllConfDataStoreDB*(num: int): AllConfDataStoreDB =
   result.empty = true
   result.nbins = num
   result.bytesize = 0
+  result.layout = FFDB_LAYOUT_KEY_MAJOR
   #result.allcfgs = newSeq[Filedb_all_config_info_t](num)
   
 
@@ -334,6 +521,36 @@ proc disablePageMove*(filedb: var AllConfDataStoreDB) =
   filedb.options.rearrangepages = 0
 
 
+proc enableOrderedIndex*(filedb: var AllConfDataStoreDB) =
+  ## Keep an ordered index of the keys for range and prefix reads
+  ##
+  ## This only takes effect when the database is created
+  filedb.options.orderedindex = 1
+
+
+proc enableCompression*(filedb: var AllConfDataStoreDB; minSize = 0;
+                        elementSize = 0) =
+  ## Compress the values of at least ``minSize`` bytes, or of the
+  ## default size if 0. Values that do not compress are stored as they are
+  ##
+  ## Values that are arrays of numbers of ``elementSize`` bytes, like
+  ## 8 for ``float64`` and 16 for ``Complex64``, are shuffled by byte first,
+  ## which lets them compress much better
+  ##
+  ## This only takes effect when the database is created
+  enableCompression(filedb.options, minSize, elementSize)
+
+
+proc enableConfigMajor*(filedb: var AllConfDataStoreDB) =
+  ## Store the value of each configuration of a key on its own, on data
+  ## pages holding values of this configuration only. Reading one
+  ## configuration of many keys then touches few pages, at the cost of
+  ## a lookup per configuration when all configurations of a key are read
+  ##
+  ## This only takes effect when the database is created
+  filedb.layout = FFDB_LAYOUT_CONFIG_MAJOR
+
+
 proc setMaxUserInfoLen*(filedb: var AllConfDataStoreDB; len: int) =
   ## Set and get maximum user information length
   filedb.options.userinfolen = cuint(len)
@@ -358,6 +575,14 @@ proc getMaxNumberConfigs*(filedb: AllConfDataStoreDB): int {.noSideEffect.} =
   return int(filedb_get_num_configs(filedb.dbh))
 
 
+proc numKeys*(filedb: AllConfDataStoreDB): int =
+  ## Number of keys in the database, read from the header
+  if filedb.dbh == nil: return 0
+  if filedb.configMajor and filedb.nbins > 0:
+    return int(filedb_num_keys(filedb.dbh)) div filedb.nbins
+  return int(filedb_num_keys(filedb.dbh))
+
+
 proc open*(filedb: var AllConfDataStoreDB; file: string; open_flags: cint; mode: cint): int =
   ## Open
   ## ``file`` filename holding all data and keys
@@ -404,6 +629,11 @@ proc open*(filedb: var AllConfDataStoreDB; file: string; open_flags: cint; mode:
       if filedb_set_all_configs(filedb.dbh, ffs, cuint(filedb.nbins)) != 0:
         quit("Error setting all configs")
       deallocCStringArray(ffs)
+
+    # The layout is kept with the configs
+    if filedb.configMajor:
+      if filedb_set_config_layout(filedb.dbh, filedb.layout) != 0:
+        quit("Error setting the layout of the configs")
   else:
     # Read and possibly check the number of configs
     let nfound = int(filedb_get_num_configs(filedb.dbh))
@@ -413,6 +643,10 @@ proc open*(filedb: var AllConfDataStoreDB; file: string; open_flags: cint; mode:
       if nfound != filedb.nbins:
         quit("Number of configs in EDB= " & $nfound & " does not agree the desired val= " & $filedb.nbins)
 
+    filedb.layout = filedb_get_config_layout(filedb.dbh)
+    if filedb.layout < 0:
+      quit("Error reading the layout of the configs")
+
   return 0
 
 
@@ -439,6 +673,16 @@ proc insert*[K,D](filedb: var AllConfDataStoreDB; key: K; data: seq[D]): int =
   # Set bytesize if not already set
   if filedb.bytesize == 0:
     filedb.bytesize = dstr.len
+
+  # Each configuration goes onto the pages of its own
+  if filedb.configMajor:
+    for i in 0..filedb.nbins-1:
+      if i > 0:
+        dstr = serializeBinary(data[i])
+      var ck = configKey(i, keyObj)
+      let ret = insertConfigBinary(filedb.dbh, ck, dstr, i)
+      if ret != 0: return ret
+    return 0
  
   # Convert data into binary form
   for i in 1..filedb.nbins-1:
@@ -469,7 +713,7 @@ proc get*[K,D](filedb: var AllConfDataStoreDB; key: K; data: var seq[D]): int =
   var dataObj: string
 
   # now retrieve data from database
-  let ret = getBinary(filedb.dbh, keyObj, dataObj)
+  let ret = filedb.getAllBinary(keyObj, dataObj)
   if ret != 0: return ret
 
   # Check
@@ -502,11 +746,138 @@ proc get*[K,D](filedb: var AllConfDataStoreDB; key: K; data: var seq[D]): int =
 
 
 
+proc getConfigs*[K,D](filedb: var AllConfDataStoreDB; key: K; indices: seq[int]; data: var seq[D]): int =
+  ## Get the data of the configurations ``indices`` for a given key.
+  ## Only the bytes of these configurations are read from the database
+  ## ``key`` user supplied key
+  ## ``data`` after the call holds one element per index
+  ## Return 0 on success, otherwise the key not found
+  var keyObj = serializeBinary(key)
+
+  # Each configuration is a value of its own
+  if filedb.configMajor:
+    newSeq[D](data, indices.len)
+    var dbd: string
+    for i in 0..indices.len-1:
+      if indices[i] < 0 or indices[i] >= filedb.nbins:
+        quit("Get: configuration " & $indices[i] & " out of range of nbins= " & $filedb.nbins)
+
+      var ck = configKey(indices[i], keyObj)
+      let ret = getBinary(filedb.dbh, ck, dbd)
+      if ret != 0: return ret
+      data[i] = deserializeBinary[D](dbd)
+    return 0
+
+  # The byte size of a configuration comes from the length of the data
+  if filedb.bytesize == 0:
+    var size: int
+    let ret = getBinarySize(filedb.dbh, keyObj, size)
+    if ret != 0: return ret
+
+    if (size mod filedb.nbins) != 0:
+      echo "Get: data size not multiple of num configs"
+      return -1
+    filedb.bytesize = size div filedb.nbins
+
+  newSeq[D](data, indices.len)
+  var dbd: string
+  for i in 0..indices.len-1:
+    if indices[i] < 0 or indices[i] >= filedb.nbins:
+      quit("Get: configuration " & $indices[i] & " out of range of nbins= " & $filedb.nbins)
+
+    let ret = getBinaryRange(filedb.dbh, keyObj, indices[i]*filedb.bytesize, filedb.bytesize, dbd)
+    if ret != 0: return ret
+    data[i] = deserializeBinary[D](dbd)
+
+
+proc getConfig*[K,D](filedb: var AllConfDataStoreDB; key: K; cfg: int; data: var D): int =
+  ## Get the data of configuration ``cfg`` for a given key. Only the
+  ## bytes of this configuration are read from the database
+  ## Return 0 on success, otherwise the key not found
+  var res: seq[D]
+  result = filedb.getConfigs(key, @[cfg], res)
+  if result == 0:
+    data = res[0]
+
+
+proc getConfig*[K,D](filedb: var AllConfDataStoreDB; keys: seq[K]; cfg: int; data: var seq[D]): int =
+  ## Get the data of configuration ``cfg`` for each of ``keys``. With
+  ## the config major layout these values sit on the data pages of this
+  ## configuration alone, so few pages are read
+  ## ``data`` after the call holds one element per key
+  ## Return 0 on success, otherwise the first key not found
+  newSeq[D](data, keys.len)
+  for i in 0..keys.len-1:
+    let ret = filedb.getConfig(keys[i], cfg, data[i])
+    if ret != 0: return ret
+
+
+proc updateConfigs*[K,D](filedb: var AllConfDataStoreDB; key: K; indices: seq[int]; data: seq[D]): int =
+  ## Overwrite the data of the configurations ``indices`` for a key that
+  ## already holds all configurations. Only the bytes of these
+  ## configurations are written, so configurations can be stored as they
+  ## come in without rewriting the whole value
+  ## ``key`` user supplied key
+  ## ``data`` one element per index
+  ## Return 0 on success, 1 if the key is not found, -1 on failure
+  if data.len != indices.len:
+    quit("Update: number of data elements= " & $data.len & "  not same as number of indices= " & $indices.len)
+
+  var keyObj = serializeBinary(key)
+
+  # The byte size of a configuration comes from the length of the data
+  if filedb.bytesize == 0:
+    var size: int
+    var ck = if filedb.configMajor: configKey(0, keyObj) else: keyObj
+    let ret = getBinarySize(filedb.dbh, ck, size)
+    if ret != 0: return ret
+
+    if filedb.configMajor:
+      size = size * filedb.nbins
+    if (size mod filedb.nbins) != 0:
+      echo "Update: data size not multiple of num configs"
+      return -1
+    filedb.bytesize = size div filedb.nbins
+
+  for i in 0..indices.len-1:
+    if indices[i] < 0 or indices[i] >= filedb.nbins:
+      quit("Update: configuration " & $indices[i] & " out of range of nbins= " & $filedb.nbins)
+
+    var dstr = serializeBinary(data[i])
+    if dstr.len != filedb.bytesize:
+      echo "Update: bytesize of data not compatible with the data in this DB"
+      return -1
+
+    # The whole value of a configuration is overwritten in place, so it
+    # stays on the pages of its configuration
+    if filedb.configMajor:
+      var ck = configKey(indices[i], keyObj)
+      let ret = updateBinaryRange(filedb.dbh, ck, 0, dstr)
+      if ret != 0: return ret
+      continue
+
+    let ret = updateBinaryRange(filedb.dbh, keyObj, indices[i]*filedb.bytesize, dstr)
+    if ret != 0: return ret
+
+
+proc updateConfig*[K,D](filedb: var AllConfDataStoreDB; key: K; cfg: int; data: D): int =
+  ## Overwrite the data of configuration ``cfg`` for a key that already
+  ## holds all configurations. Only the bytes of this configuration are
+  ## written
+  ## Return 0 on success, 1 if the key is not found, -1 on failure
+  return filedb.updateConfigs(key, @[cfg], @[data])
+
+
 proc `[]`*[K](filedb: AllConfDataStoreDB; key: K): string =
   ## Get data for a given key
   ## @param key user supplied key
   ## @return data on success, otherwise abort
-  return filedb.dbh[key]
+  if not filedb.configMajor:
+    return filedb.dbh[key]
+
+  var keyObj = serializeBinary(key)
+  if filedb.getAllBinary(keyObj, result) != 0:
+    quit("Error retrieving key = " & $key)
 
 
 proc exist*[K](filedb: AllConfDataStoreDB; key: K): bool =
@@ -514,6 +885,10 @@ proc exist*[K](filedb: AllConfDataStoreDB; key: K): bool =
   ## @param key a key object
   ## @return true if the answer is yes
   echo "In allconf exist: key= ", key
+  if filedb.configMajor:
+    var ck = configKey(0, serializeBinary(key))
+    var size: int
+    return getBinarySize(filedb.dbh, ck, size) == 0
   return exist[K](filedb.dbh, key)
 
 
@@ -521,20 +896,83 @@ proc allBinaryKeys*(filedb: AllConfDataStoreDB): seq[string] =
   ## Return all available keys to user
   ## ``keys`` user suppled an empty vector which is populated
   ## by keys after this call.
+  if filedb.configMajor:
+    return userKeys(allBinaryKeys(filedb.dbh))
   return allBinaryKeys(filedb.dbh)
 
 
+proc withAllConfigs(filedb: AllConfDataStoreDB; keyObjs: seq[string]): seq[tuple[key:string,val:string]] =
+  ## Pair each binary key of a config major database with the data of
+  ## all its configurations
+  newSeq[tuple[key:string,val:string]](result, keyObjs.len)
+  for i in 0..keyObjs.len-1:
+    var keyObj = keyObjs[i]
+    var dataObj: string
+    if filedb.getAllBinary(keyObj, dataObj) != 0:
+      quit("Error retrieving all configurations of a key")
+    result[i] = (keyObjs[i], dataObj)
+
+
 proc allBinaryPairs*(filedb: AllConfDataStoreDB): seq[tuple[key:string,val:string]] =
   ## Return all available key/value pairs to user
   ## ``keys`` user suppled an empty vector which is populated
   ## by keys after this call.
+  if filedb.configMajor:
+    return filedb.withAllConfigs(filedb.allBinaryKeys)
   return allBinaryPairs(filedb.dbh)
 
 
+proc rangeBinaryKeys*(filedb: AllConfDataStoreDB; lo, hi: string): seq[string] =
+  ## Return the keys from `lo` up to but not including `hi` in byte
+  ## order. An empty bound leaves the range open at that end
+  var lo = lo
+  var hi = hi
+  if filedb.configMajor:
+    # Stay within the keys of the first configuration
+    lo = configKey(0, lo)
+    hi = if hi.len == 0: configKey(1, "") else: configKey(0, hi)
+    return userKeys(rangeBinaryKeys(filedb.dbh, lo, hi))
+  return rangeBinaryKeys(filedb.dbh, lo, hi)
+
+
+proc rangeBinaryPairs*(filedb: AllConfDataStoreDB; lo, hi: string): seq[tuple[key:string,val:string]] =
+  ## Return the key/value pairs from `lo` up to but not including `hi`
+  ## in byte order of the keys
+  if filedb.configMajor:
+    return filedb.withAllConfigs(filedb.rangeBinaryKeys(lo, hi))
+  var lo = lo
+  var hi = hi
+  return rangeBinaryPairs(filedb.dbh, lo, hi)
+
+
+proc prefixBinaryKeys*(filedb: AllConfDataStoreDB; prefix: string): seq[string] =
+  ## Return the keys starting with `prefix` in byte order
+  var prefix = prefix
+  if filedb.configMajor:
+    prefix = configKey(0, prefix)
+    return userKeys(prefixBinaryKeys(filedb.dbh, prefix))
+  return prefixBinaryKeys(filedb.dbh, prefix)
+
+
+proc prefixBinaryPairs*(filedb: AllConfDataStoreDB; prefix: string): seq[tuple[key:string,val:string]] =
+  ## Return the key/value pairs whose keys start with `prefix` in byte order
+  if filedb.configMajor:
+    return filedb.withAllConfigs(filedb.prefixBinaryKeys(prefix))
+  var prefix = prefix
+  return prefixBinaryPairs(filedb.dbh, prefix)
+
+
 proc allKeys*[K](filedb: AllConfDataStoreDB): seq[K] =
   ## Return all available keys to user
   ## ``keys`` user suppled an empty vector which is populated
   ## by keys after this call.
+  if filedb.configMajor:
+    let all_keys = filedb.allBinaryKeys
+    newSeq[K](result, all_keys.len)
+    for i in 0..all_keys.len-1:
+      result[i] = deserializeBinary[K](all_keys[i])
+    return
+
   # Grab all the binary keys
   return allKeys[K](filedb.dbh)
 
@@ -577,6 +1015,68 @@ proc allPairs*[K,D](filedb: var AllConfDataStoreDB): Table[K,seq[D]] =
     inc(nn)
 
 
+when compileOption("threads"):
+  proc partitionEnsembles[K,D](dbh: ptr FILEDB_DB; part, nparts, nbins: int): seq[tuple[key:K,val:seq[D]]] =
+    ## Read the pairs of one partition of the buckets and deserialize
+    ## the data of each of the `nbins` configurations
+    let all_pairs = partitionBinaryPairs(dbh, part, nparts)
+    newSeq[tuple[key:K,val:seq[D]]](result, all_pairs.len)
+    for i in 0..all_pairs.len-1:
+      if (all_pairs[i].val.len mod nbins) != 0:
+        quit("Get: data size not multiple of num configs")
+
+      let bsize = all_pairs[i].val.len div nbins
+      var data = newSeq[D](nbins)
+      for n in 0..nbins-1:
+        var dbd = newString(bsize)
+        copyMem(addr(dbd[0]), unsafeAddr(all_pairs[i].val[n*bsize]), bsize)
+        data[n] = deserializeBinary[D](dbd)
+
+      result[i] = (deserializeBinary[K](all_pairs[i].key), data)
+
+
+  proc parallelKeys*[K](filedb: AllConfDataStoreDB; nthreads: int = countProcessors()): seq[K] =
+    ## Return all available keys to user. The buckets are split into
+    ## `nthreads` partitions, each read and deserialized by its own thread.
+    ## Needs --threads:on
+    if filedb.configMajor:
+      return allKeys[K](filedb)
+
+    let nparts = max(1, nthreads)
+    var flows = newSeq[FlowVar[seq[K]]](nparts)
+    for p in 0..nparts-1:
+      flows[p] = spawn partitionKeys[K](filedb.dbh, p, nparts)
+
+    result = @[]
+    for p in 0..nparts-1:
+      result.add(^flows[p])
+
+
+  proc parallelPairs*[K,D](filedb: AllConfDataStoreDB; nthreads: int = countProcessors()): Table[K,seq[D]] =
+    ## Return all pairs of keys and values in a table. The buckets are split
+    ## into `nthreads` partitions, each read and deserialized by its own thread.
+    ## Needs --threads:on
+    ## NOTE: expects the data payload (the seq[D]) to be the same
+    ## size for each configuration
+    if filedb.nbins == 0:
+      quit("AllConf not initialized with number of configs")
+
+    # The configurations of a key are spread over the buckets
+    if filedb.configMajor:
+      var db = filedb
+      return allPairs[K,D](db)
+
+    let nparts = max(1, nthreads)
+    var flows = newSeq[FlowVar[seq[tuple[key:K,val:seq[D]]]]](nparts)
+    for p in 0..nparts-1:
+      flows[p] = spawn partitionEnsembles[K,D](filedb.dbh, p, nparts, filedb.nbins)
+
+    result = initTable[K,seq[D]]()
+    for p in 0..nparts-1:
+      for kv in (^flows[p]):
+        result[kv.key] = kv.val
+
+
 #[
 proc flush*(filedb: var AllConfDataStoreDB) =
   ## Flush database in memory to disk
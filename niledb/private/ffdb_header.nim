@@ -45,6 +45,29 @@ type
 type
   FILEDB_ALL_CONFIG_INFO* = pointer
 
+## 
+##  A borrowed view of data, released by filedb_release_view
+## 
+
+type
+  FILEDB_VIEW* {.importc: "FILEDB_VIEW", header: "ffdb_header.h".} = object
+    page* {.importc: "page".}: pointer ##  pinned data page
+    buf* {.importc: "buf".}: pointer ##  malloced copy
+
+## 
+##  Many keys and data packed back to back into one buffer each.
+##  Item i is bytes offs[i] up to offs[i+1] of the buffer.
+##  Released by filedb_free_packed
+## 
+
+type
+  FILEDB_PACKED* {.importc: "FILEDB_PACKED", header: "ffdb_header.h".} = object
+    keys* {.importc: "keys".}: pointer ##  all keys
+    key_offs* {.importc: "key_offs".}: ptr culong ##  num + 1 key offsets
+    vals* {.importc: "vals".}: pointer ##  all data or null
+    val_offs* {.importc: "val_offs".}: ptr culong ##  num + 1 data offsets
+    num* {.importc: "num".}: cuint ##  number of items
+
 ##  Access method description structure.
 
 type
@@ -64,6 +87,17 @@ type
                                                     ## 
     userinfolen* {.importc: "userinfolen".}: cuint ##  how many bytes for user information
     numconfigs* {.importc: "numconfigs".}: cuint ##  number of configurations
+    ioengine* {.importc: "ioengine".}: cint ##  page I/O engine: 0 auto, 1 sync, 2 io_uring
+    orderedindex* {.importc: "orderedindex".}: cint ##  keep an ordered index of the keys of
+                                                ##  a new database for range reads
+    hashfunc* {.importc: "hashfunc".}: cint ##  hash function of a new database:
+                                        ##  0 default, 1 fnv, 2 wyhash
+    compress* {.importc: "compress".}: cint ##  codec of the data of a new database:
+                                        ##  0 none, 1 lz
+    compressmin* {.importc: "compressmin".}: cuint ##  data shorter than this are stored
+                                               ##  as they are, 0 for the default
+    filterwidth* {.importc: "filterwidth".}: cuint ##  element width of the data for the
+                                               ##  shuffle filter, 0 for none
   
 
 ## 
@@ -92,6 +126,16 @@ proc filedb_close*(dbh: ptr FILEDB_DB): cint {.importc: "filedb_close",
 proc filedb_is_db_empty*(dbhh: ptr FILEDB_DB): cint {.importc: "filedb_is_db_empty",
     header: "ffdb_header.h".}
 ## *
+##  Get number of keys in the database. Only the header is consulted
+## 
+##  @param dbhh pointer to underlying database
+## 
+##  @return number of keys
+## 
+
+proc filedb_num_keys*(dbhh: ptr FILEDB_DB): cuint {.importc: "filedb_num_keys",
+    header: "ffdb_header.h".}
+## *
 ##  Set a paticular configuration information
 ##  
 ##  @param db pointer to underlying database
@@ -163,6 +207,39 @@ proc filedb_set_all_configs*(db: ptr FILEDB_DB; configs: cstringArray; nbin: cui
 proc filedb_get_num_configs*(dbhh: ptr FILEDB_DB): cuint {.
     importc: "filedb_get_num_configs", header: "ffdb_header.h".}
 ## *
+##  Layouts of the values of the configurations. With config major the
+##  value of each configuration of a key is stored on its own, on the
+##  data pages of the configuration
+##
+
+const
+  FFDB_LAYOUT_KEY_MAJOR* = cint(0)
+  FFDB_LAYOUT_CONFIG_MAJOR* = cint(1)
+
+## *
+##  Set the layout of the values of the configurations. It is kept in
+##  the information of each configuration, and set when the
+##  configurations are set
+##
+##  @param dbh database pointer
+##  @param layout the layout
+##
+##  @return 0 on success -1 on failure with a proper errno set
+##
+
+proc filedb_set_config_layout*(dbh: ptr FILEDB_DB; layout: cint): cint {.
+    importc: "filedb_set_config_layout", header: "ffdb_header.h".}
+## *
+##  Get the layout of the values of the configurations
+##
+##  @param dbh database pointer
+##
+##  @return the layout, or -1 on failure
+##
+
+proc filedb_get_config_layout*(dbh: ptr FILEDB_DB): cint {.
+    importc: "filedb_get_config_layout", header: "ffdb_header.h".}
+## *
 ##  Set user information for the database
 ## 
 ##  @param db pointer to underlying database
@@ -218,6 +295,85 @@ proc filedb_get_all_pairs*(dbhh: ptr FILEDB_DB; keyss: pointer; valss: pointer;
                           num: ptr cuint) {.importc: "filedb_get_all_pairs",
     header: "ffdb_header.h".}
 ## *
+##  Return the keys of one of nparts partitions of the buckets to vectors
+##  in binary form of strings. Partitions are disjoint and cover all keys,
+##  and each of them can be read by a different thread
+## 
+
+proc filedb_get_partition_keys*(dbhh: ptr FILEDB_DB; part: cuint; nparts: cuint;
+                               keyss: pointer; num: ptr cuint) {.
+    importc: "filedb_get_partition_keys", header: "ffdb_header.h".}
+## *
+##  Return the keys & data of one of nparts partitions of the buckets to
+##  vectors in binary form of strings. Partitions are disjoint and cover
+##  all pairs, and each of them can be read by a different thread
+## 
+
+proc filedb_get_partition_pairs*(dbhh: ptr FILEDB_DB; part: cuint; nparts: cuint;
+                                keyss: pointer; valss: pointer; num: ptr cuint) {.
+    importc: "filedb_get_partition_pairs", header: "ffdb_header.h".}
+## *
+##  Return all keys & data to vectors in binary form of strings.
+##  The file is read front to back and pairs come in the order
+##  their data are stored, which is much faster than a cursor for
+##  large files
+## 
+
+proc filedb_scan_all_pairs*(dbhh: ptr FILEDB_DB; keyss: pointer; valss: pointer;
+                           num: ptr cuint) {.importc: "filedb_scan_all_pairs",
+    header: "ffdb_header.h".}
+## *
+##  Return all keys, and all data if with_data is set, packed into
+##  one buffer each
+## 
+
+proc filedb_get_all_packed*(dbhh: ptr FILEDB_DB; with_data: cint;
+                           packed: ptr FILEDB_PACKED) {.
+    importc: "filedb_get_all_packed", header: "ffdb_header.h".}
+## *
+##  Return the keys, and the data if with_data is set, of one of nparts
+##  partitions of the buckets packed into one buffer each
+## 
+
+proc filedb_get_partition_packed*(dbhh: ptr FILEDB_DB; part: cuint; nparts: cuint;
+                                 with_data: cint; packed: ptr FILEDB_PACKED) {.
+    importc: "filedb_get_partition_packed", header: "ffdb_header.h".}
+## *
+##  Return all keys & data packed into one buffer each. Pairs come in
+##  the order their data are stored as in filedb_scan_all_pairs
+## 
+
+proc filedb_scan_all_packed*(dbhh: ptr FILEDB_DB; packed: ptr FILEDB_PACKED) {.
+    importc: "filedb_scan_all_packed", header: "ffdb_header.h".}
+## *
+##  Return the keys from lo up to but not including hi in key order, and
+##  their data if with_data is set, packed into one buffer each. A null
+##  lo or hi leaves the range open at that end. Keys are compared byte by
+##  byte.
+##
+##  @return 0 on success, -1 if the database keeps no ordered key index
+## 
+
+proc filedb_get_range_packed*(dbhh: ptr FILEDB_DB; lo: ptr FILEDB_DBT; hi: ptr FILEDB_DBT;
+                             with_data: cint; packed: ptr FILEDB_PACKED): cint {.
+    importc: "filedb_get_range_packed", header: "ffdb_header.h".}
+## *
+##  Return the keys starting with prefix in key order, and their data if
+##  with_data is set, packed into one buffer each
+##
+##  @return 0 on success, -1 if the database keeps no ordered key index
+## 
+
+proc filedb_get_prefix_packed*(dbhh: ptr FILEDB_DB; prefix: ptr FILEDB_DBT;
+                              with_data: cint; packed: ptr FILEDB_PACKED): cint {.
+    importc: "filedb_get_prefix_packed", header: "ffdb_header.h".}
+## *
+##  Release the buffers of packed keys & data
+## 
+
+proc filedb_free_packed*(packed: ptr FILEDB_PACKED) {.
+    importc: "filedb_free_packed", header: "ffdb_header.h".}
+## *
 ##  get key and data pair from a database pointed by pointer dbh
 ## 
 ##  @param dbh database pointer
@@ -230,6 +386,90 @@ proc filedb_get_all_pairs*(dbhh: ptr FILEDB_DB; keyss: pointer; valss: pointer;
 proc filedb_get_data*(dbh: ptr FILEDB_DB; key: ptr FILEDB_DBT; data: ptr FILEDB_DBT): cint {.
     importc: "filedb_get_data", header: "ffdb_header.h".}
 ## *
+##  get the length of the data for a key without reading the data
+##
+##  @param dbh database pointer
+##  @key key associated with this data. This key must be string form
+##  @size the length of the data on return
+##
+##  @return 0 on success, 1 if the key is not found. -1 on failure
+## 
+
+proc filedb_get_data_size*(dbh: ptr FILEDB_DB; key: ptr FILEDB_DBT; size: ptr cuint): cint {.
+    importc: "filedb_get_data_size", header: "ffdb_header.h".}
+## *
+##  get len bytes of the data for a key starting at byte offset. Only the
+##  pages holding these bytes are read
+##
+##  @param dbh database pointer
+##  @key key associated with this data. This key must be string form
+##  @data data to be retrieved, malloced and to be freed by the caller
+##  @offset the first byte of the data
+##  @len number of bytes
+##
+##  @return 0 on success, 1 if the key is not found. -1 on failure, with
+##  errno EINVAL if the bytes lie beyond the data
+## 
+
+proc filedb_get_data_range*(dbh: ptr FILEDB_DB; key: ptr FILEDB_DBT; data: ptr FILEDB_DBT;
+                           offset: cuint; len: cuint): cint {.
+    importc: "filedb_get_data_range", header: "ffdb_header.h".}
+## *
+##  get data for a key without copying it when the data lies on a single
+##  page. The data stays valid until the view is released
+## 
+##  @param dbh database pointer
+##  @key key associated with this data. This key must be string form
+##  @data data points into the database page or a copy held by the view
+##  @view view to be released by filedb_release_view
+## 
+##  @return 0 on success. Otherwise failure
+## 
+
+proc filedb_get_view*(dbh: ptr FILEDB_DB; key: ptr FILEDB_DBT; data: ptr FILEDB_DBT;
+                     view: ptr FILEDB_VIEW): cint {.
+    importc: "filedb_get_view", header: "ffdb_header.h".}
+## *
+##  release a view obtained from filedb_get_view
+## 
+##  @param dbh database pointer
+##  @view the view
+## 
+
+proc filedb_release_view*(dbh: ptr FILEDB_DB; view: ptr FILEDB_VIEW) {.
+    importc: "filedb_release_view", header: "ffdb_header.h".}
+## *
+##  get data for many keys at once reading pages in ascending order
+## 
+##  @param dbh database pointer
+##  @keys n keys in string form
+##  @vals n data. The data of a key not found is empty. Caller has to free
+##  the data of each key found
+##  @n number of keys
+##  @nthreads number of threads reading the database
+## 
+##  @return 0 on success. 1 if some keys are not found. Otherwise failure
+## 
+
+proc filedb_get_many*(dbh: ptr FILEDB_DB; keys: ptr FILEDB_DBT; vals: ptr FILEDB_DBT;
+                     n: cuint; nthreads: cuint): cint {.
+    importc: "filedb_get_many", header: "ffdb_header.h".}
+## *
+##  Load key and data pairs into an empty database without splitting
+##  buckets
+## 
+##  @param dbh database pointer
+##  @keys n keys in string form
+##  @vals n data in string form
+##  @n number of pairs
+## 
+##  @return 0 on success. Otherwise failure
+## 
+
+proc filedb_bulk_load*(dbh: ptr FILEDB_DB; keys: ptr FILEDB_DBT; vals: ptr FILEDB_DBT;
+                      n: cuint): cint {.
+    importc: "filedb_bulk_load", header: "ffdb_header.h".}
+## *
 ##  Insert key and data pair in string format into the database
 ## 
 ##  @param dbh database pointer
@@ -240,4 +480,61 @@ proc filedb_get_data*(dbh: ptr FILEDB_DB; key: ptr FILEDB_DBT; data: ptr FILEDB_
 ## 
 
 proc filedb_insert_data*(dbh: ptr FILEDB_DB; key: ptr FILEDB_DBT; data: ptr FILEDB_DBT): cint {.
-    importc: "filedb_insert_data", header: "ffdb_header.h".}
\ No newline at end of file
+    importc: "filedb_insert_data", header: "ffdb_header.h".}
+## *
+##  Insert key and data pair into the database, with the data placed on
+##  the data pages of configuration config
+##
+##  @param dbh database pointer
+##  @key key associated with this data. This key must be string form
+##  @data data to be stored into the database
+##  @config the configuration number
+##
+##  @return 0 on success. Otherwise failure
+##
+
+proc filedb_insert_config_data*(dbh: ptr FILEDB_DB; key: ptr FILEDB_DBT;
+                               data: ptr FILEDB_DBT; config: cuint): cint {.
+    importc: "filedb_insert_config_data", header: "ffdb_header.h".}
+## *
+##  Overwrite part of the data for a key in place. The length of the data
+##  stays the same and only the pages holding these bytes are written
+##
+##  @param dbh database pointer
+##  @key key associated with this data. This key must be string form
+##  @data the new bytes
+##  @offset the first byte of the data to overwrite
+##
+##  @return 0 on success, 1 if the key is not found. -1 on failure, with
+##  errno EINVAL if the bytes lie beyond the data
+##
+
+proc filedb_update_data_range*(dbh: ptr FILEDB_DB; key: ptr FILEDB_DBT;
+                              data: ptr FILEDB_DBT; offset: cuint): cint {.
+    importc: "filedb_update_data_range", header: "ffdb_header.h".}## *
+##  Delete key and data pair from the database
+## 
+##  @param dbh database pointer
+##  @key key to be deleted. This key must be string form
+## 
+##  @return 0 on success, 1 if the key is not in the database.
+##  Otherwise failure
+## 
+
+proc filedb_delete_data*(dbh: ptr FILEDB_DB; key: ptr FILEDB_DBT): cint {.
+    importc: "filedb_delete_data", header: "ffdb_header.h".}
+## *
+##  Compact the database while it is open: live data on mostly empty
+##  data pages are moved and free pages at the end of the file are
+##  given back
+## 
+##  @param dbh database pointer
+##  @npages maximum number of pages to look at. The next call continues
+##  where this one stopped
+## 
+##  @return 1 if there are more pages to look at, 0 when the whole file
+##  has been compacted. Otherwise failure
+## 
+
+proc filedb_compact*(dbh: ptr FILEDB_DB; npages: cuint): cint {.
+    importc: "filedb_compact", header: "ffdb_header.h".}
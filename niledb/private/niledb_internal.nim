@@ -93,6 +93,28 @@ proc disablePageMove*(options: var FILEDB_OPENINFO) =
   options.rearrangepages = 0
 
 
+proc enableOrderedIndex*(options: var FILEDB_OPENINFO) =
+  ## Keep an ordered index of the keys for range and prefix reads
+  ##
+  ## This only takes effect when the database is created
+  options.orderedindex = 1
+
+
+proc enableCompression*(options: var FILEDB_OPENINFO; minSize = 0;
+                        elementSize = 0) =
+  ## Compress the values of at least ``minSize`` bytes, or of the
+  ## default size if 0. Values that do not compress are stored as they are
+  ##
+  ## Values that are arrays of numbers of ``elementSize`` bytes, like
+  ## 8 for ``float64`` and 16 for ``Complex64``, are shuffled by byte first,
+  ## which lets them compress much better
+  ##
+  ## This only takes effect when the database is created
+  options.compress = 1
+  options.compressmin = cuint(minSize)
+  options.filterwidth = cuint(elementSize)
+
+
 proc setMaxUserInfoLen*(options: var FILEDB_OPENINFO; len: int) =
   ## Set and get maximum user information length
   options.userinfolen = cuint(len)
@@ -104,11 +126,8 @@ proc setMaxNumberConfigs*(options: var FILEDB_OPENINFO; num: cuint) =
 
 
 proc isDBEmpty(dbh: ptr FILEDB_DB): bool =
-  ## Check if a DB is empty
-  if filedb_is_db_empty(dbh) != 0:
-    return true
-  else:
-    return false
+  ## Check if a DB is empty. The number of keys is kept in the header
+  return filedb_num_keys(dbh) == 0
 
 
 #[
@@ -170,6 +189,59 @@ proc insertBinary(dbh: ptr FILEDB_DB; keyObj: var string; dataObj: var string):
   return int(ret)
 
 
+proc insertConfigBinary(dbh: ptr FILEDB_DB; keyObj: var string; dataObj: var string;
+                        cfg: int): int =
+  ## Insert a pair of data and key into the database, with the data on
+  ## the data pages of configuration `cfg`
+  ##
+  ## @return 0 on successful write, -1 on failure with proper errno set
+  var dbkey = FILEDB_DBT(data: addr(keyObj[0]), size: cuint(keyObj.len))
+  var dbdata = FILEDB_DBT(data: addr(dataObj[0]), size: cuint(dataObj.len))
+
+  let ret = filedb_insert_config_data(dbh, addr(dbkey), addr(dbdata), cuint(cfg))
+  return int(ret)
+
+
+proc updateBinaryRange(dbh: ptr FILEDB_DB; keyObj: var string; offset: int;
+                       dataObj: var string): int =
+  ## Overwrite the bytes of the data for `keyObj` starting at byte
+  ## `offset` with `dataObj`. Only the pages holding these bytes are written
+  ##
+  ## @return 0 on success, 1 if the key is not found, -1 on failure with
+  ## proper errno set
+  var dbkey = FILEDB_DBT(data: addr(keyObj[0]), size: cuint(keyObj.len))
+  var dbdata = FILEDB_DBT(data: addr(dataObj[0]), size: cuint(dataObj.len))
+
+  let ret = filedb_update_data_range(dbh, addr(dbkey), addr(dbdata), cuint(offset))
+  return int(ret)
+
+
+proc bulkInsertBinary(dbh: ptr FILEDB_DB; keyObjs: var seq[string]; dataObjs: var seq[string]): int =
+  ## Load pairs of binary keys and data into an empty database
+  ##
+  ## @return 0 on successful write, -1 on failure with proper errno set
+  if keyObjs.len == 0: return 0
+
+  var dbkeys = newSeq[FILEDB_DBT](keyObjs.len)
+  var dbdata = newSeq[FILEDB_DBT](keyObjs.len)
+  for i in 0..keyObjs.len-1:
+    dbkeys[i] = FILEDB_DBT(data: addr(keyObjs[i][0]), size: cuint(keyObjs[i].len))
+    dbdata[i] = FILEDB_DBT(data: addr(dataObjs[i][0]), size: cuint(dataObjs[i].len))
+
+  let ret = filedb_bulk_load(dbh, addr(dbkeys[0]), addr(dbdata[0]), cuint(keyObjs.len))
+  return int(ret)
+
+
+proc deleteBinary(dbh: ptr FILEDB_DB; keyObj: var string): int =
+  ## Delete a binary `keyObj` and its data from the database
+  ##
+  ## @return 0 on success, 1 if the key is not found, -1 on failure
+  var dbkey = FILEDB_DBT(data: addr(keyObj[0]), size: cuint(keyObj.len))
+
+  let ret = filedb_delete_data(dbh, addr(dbkey))
+  return int(ret)
+
+
 proc getBinary(dbh: ptr FILEDB_DB; keyObj: var string; data: var string): int =
   ## Get binary `data` for a given binary `keyObj`
   ## return 0 on success, otherwise the key not found
@@ -190,6 +262,85 @@ proc getBinary(dbh: ptr FILEDB_DB; keyObj: var string; data: var string): int =
   return int(ret)
 
 
+proc getBinarySize(dbh: ptr FILEDB_DB; keyObj: var string; size: var int): int =
+  ## Get the byte `size` of the data for a binary `keyObj` without
+  ## reading the data. Return 0 on success, otherwise the key not found
+  var dbkey = FILEDB_DBT(data: addr(keyObj[0]), size: cuint(keyObj.len))
+  var dbsize: cuint
+
+  let ret = filedb_get_data_size(dbh, addr(dbkey), addr(dbsize))
+  if ret == 0:
+    size = int(dbsize)
+
+  return int(ret)
+
+
+proc getBinaryRange(dbh: ptr FILEDB_DB; keyObj: var string; offset, len: int;
+                    data: var string): int =
+  ## Get `len` bytes of the binary data for `keyObj` starting at byte
+  ## `offset`. Only the pages holding these bytes are read
+  ## return 0 on success, otherwise the key not found or the bytes lie
+  ## beyond the data
+  var dbkey = FILEDB_DBT(data: addr(keyObj[0]), size: cuint(keyObj.len))
+  var dbdata: FILEDB_DBT
+
+  let ret = filedb_get_data_range(dbh, addr(dbkey), addr(dbdata), cuint(offset), cuint(len))
+  if ret == 0:
+    data = $dbdata
+    cfree(dbdata.data)
+
+  return int(ret)
+
+
+proc getDeserialized[D](dbh: ptr FILEDB_DB; keyObj: var string; data: var D): int =
+  ## Get `data` for a given binary `keyObj`, deserialized straight from
+  ## a view of the database page instead of a malloc'ed copy
+  ## return 0 on success, otherwise the key not found
+  # create key
+  var dbkey = FILEDB_DBT(data: addr(keyObj[0]), size: cuint(keyObj.len))
+
+  # the view keeps the data page until it is released
+  var dbdata: FILEDB_DBT
+  var view: FILEDB_VIEW
+
+  let ret = filedb_get_view(dbh, addr(dbkey), addr(dbdata), addr(view))
+  if ret == 0:
+    try:
+      data = deserializeBinary[D]($dbdata)
+    finally:
+      filedb_release_view(dbh, addr(view))
+
+  return int(ret)
+
+
+proc getMany[K,D](dbh: ptr FILEDB_DB; keys: seq[K]; data: var seq[D]; nthreads: int): int =
+  ## Get `data` for all `keys` in one pass over the database pages
+  ## return 0 on success, 1 if some keys are not found. The data of a
+  ## key not found is left at its default value
+  newSeq[D](data, keys.len)
+  if keys.len == 0: return 0
+
+  # create keys
+  var keyObjs = newSeq[string](keys.len)
+  var dbkeys  = newSeq[FILEDB_DBT](keys.len)
+  for i in 0..keys.len-1:
+    keyObjs[i] = serializeBinary(keys[i])
+    dbkeys[i] = FILEDB_DBT(data: addr(keyObjs[i][0]), size: cuint(keyObjs[i].len))
+
+  # now retrieve data from database
+  var dbdata = newSeq[FILEDB_DBT](keys.len)
+  let ret = filedb_get_many(dbh, addr(dbkeys[0]), addr(dbdata[0]), cuint(keys.len), cuint(nthreads))
+  if ret < 0: return int(ret)
+
+  for i in 0..keys.len-1:
+    if dbdata[i].data != nil:
+      data[i] = deserializeBinary[D]($dbdata[i])
+      # I have to use free since I use malloc in c code
+      cfree(dbdata[i].data)
+
+  return int(ret)
+
+
 proc `[]`[K](dbh: ptr FILEDB_DB; key: K): string =
   ## Get data for a given key
   ## @param key user supplied key
@@ -225,63 +376,146 @@ proc exist[K](dbh: ptr FILEDB_DB; key: K): bool =
     result = false
 
 
-proc allBinaryKeys(dbh: ptr FILEDB_DB): seq[string] =
-  ## Return all available keys to user
-  ## @param keys user suppled an empty vector which is populated
-  ## by keys after this call.
+proc unpack(buf: pointer; offs: ptr culong; i: int): string =
+  ## Copy item `i` out of a packed buffer into a proper string
+  let lo = int(asarray[culong](offs)[i])
+  let sz = int(asarray[culong](offs)[i+1]) - lo
+  result = newString(sz)
+  if sz > 0:
+    copyMem(addr(result[0]), addr(asarray[char](buf)[lo]), sz)
 
-  var 
-    dbkeys: pointer
-    num0:   cuint
-    
-  # Grab all keys in string form
-  filedb_get_all_keys(dbh, addr(dbkeys), addr(num0))
-  let num = int(num0)
+
+proc packedKeys(packed: var FILEDB_PACKED): seq[string] =
+  ## Slice the keys out of the packed buffers, which are released afterwards
+  let num = int(packed.num)
 
   # Hold the result
   newSeq[string](result, num)
 
-  # Loop over all the keys and deserialize them
   for i in 0..num-1:
-    ## convert into key object
-    result[i] = $asarray[FILEDB_DBT](dbkeys)[i]
-    
-    # free memory
-    cfree(asarray[FILEDB_DBT](dbkeys)[i].data)
+    result[i] = unpack(packed.keys, packed.key_offs, i)
+
+  # Cleanup: the buffers are a single allocation each
+  filedb_free_packed(addr(packed))
+
+
+proc packedPairs(packed: var FILEDB_PACKED): seq[tuple[key:string,val:string]] =
+  ## Slice the key/value pairs out of the packed buffers, which are
+  ## released afterwards
+  let num = int(packed.num)
+
+  # Hold the result
+  newSeq[tuple[key:string,val:string]](result, num)
+
+  for i in 0..num-1:
+    result[i] = (unpack(packed.keys, packed.key_offs, i), unpack(packed.vals, packed.val_offs, i))
+
+  # Cleanup: the buffers are a single allocation each
+  filedb_free_packed(addr(packed))
 
-  # Cleanup
-  cfree(dbkeys)
+
+proc allBinaryKeys(dbh: ptr FILEDB_DB): seq[string] =
+  ## Return all available keys to user
+  ## @param keys user suppled an empty vector which is populated
+  ## by keys after this call.
+  var packed: FILEDB_PACKED
+    
+  # Grab all keys in string form
+  filedb_get_all_packed(dbh, 0, addr(packed))
+  result = packedKeys(packed)
 
 
 proc allBinaryPairs(dbh: ptr FILEDB_DB): seq[tuple[key:string,val:string]] =
   ## Return all available key/value pairs to user
   ## @param keys user suppled an empty vector which is populated
   ## by keys after this call.
+  var packed: FILEDB_PACKED
 
-  var 
-    dbkeys: pointer
-    dbvals: pointer
-    num0:   cuint
+  # Grab all keys & data in string form, reading the file front to back
+  filedb_scan_all_packed(dbh, addr(packed))
+  result = packedPairs(packed)
 
-  # Grab all keys & data in string form
-  filedb_get_all_pairs(dbh, addr(dbkeys), addr(dbvals), addr(num0))
-  let num = int(num0)
 
-  # Hold the result
-  newSeq[tuple[key:string,val:string]](result, num)
+proc partitionBinaryKeys(dbh: ptr FILEDB_DB; part, nparts: int): seq[string] =
+  ## Return the keys of partition `part` out of `nparts` partitions
+  ## of the buckets
+  var packed: FILEDB_PACKED
+    
+  # Grab the keys of this partition in string form
+  filedb_get_partition_packed(dbh, cuint(part), cuint(nparts), 0, addr(packed))
+  result = packedKeys(packed)
+
+
+proc partitionBinaryPairs(dbh: ptr FILEDB_DB; part, nparts: int): seq[tuple[key:string,val:string]] =
+  ## Return the key/value pairs of partition `part` out of `nparts`
+  ## partitions of the buckets
+  var packed: FILEDB_PACKED
+
+  # Grab the keys & data of this partition in string form
+  filedb_get_partition_packed(dbh, cuint(part), cuint(nparts), 1, addr(packed))
+  result = packedPairs(packed)
+
+
+proc rangePacked(dbh: ptr FILEDB_DB; lo, hi: var string; withData: int;
+                 packed: var FILEDB_PACKED) =
+  ## Grab the keys from `lo` up to but not including `hi` in key order.
+  ## An empty bound leaves the range open at that end
+  var dblo = FILEDB_DBT(data: nil, size: 0)
+  var dbhi = FILEDB_DBT(data: nil, size: 0)
+  var plo, phi: ptr FILEDB_DBT = nil
+  if lo.len > 0:
+    dblo = FILEDB_DBT(data: addr(lo[0]), size: cuint(lo.len))
+    plo = addr(dblo)
+  if hi.len > 0:
+    dbhi = FILEDB_DBT(data: addr(hi[0]), size: cuint(hi.len))
+    phi = addr(dbhi)
+
+  if filedb_get_range_packed(dbh, plo, phi, cint(withData), addr(packed)) != 0:
+    quit("Database keeps no ordered key index")
+
+
+proc rangeBinaryKeys(dbh: ptr FILEDB_DB; lo, hi: var string): seq[string] =
+  ## Return the keys from `lo` up to but not including `hi` in key order
+  var packed: FILEDB_PACKED
+
+  rangePacked(dbh, lo, hi, 0, packed)
+  result = packedKeys(packed)
+
+
+proc rangeBinaryPairs(dbh: ptr FILEDB_DB; lo, hi: var string): seq[tuple[key:string,val:string]] =
+  ## Return the key/value pairs from `lo` up to but not including `hi`
+  ## in key order
+  var packed: FILEDB_PACKED
+
+  rangePacked(dbh, lo, hi, 1, packed)
+  result = packedPairs(packed)
+
+
+proc prefixPacked(dbh: ptr FILEDB_DB; prefix: var string; withData: int;
+                  packed: var FILEDB_PACKED) =
+  ## Grab the keys starting with `prefix` in key order
+  var dbprefix = FILEDB_DBT(data: nil, size: 0)
+  if prefix.len > 0:
+    dbprefix = FILEDB_DBT(data: addr(prefix[0]), size: cuint(prefix.len))
+
+  if filedb_get_prefix_packed(dbh, addr(dbprefix), cint(withData), addr(packed)) != 0:
+    quit("Database keeps no ordered key index")
+
+
+proc prefixBinaryKeys(dbh: ptr FILEDB_DB; prefix: var string): seq[string] =
+  ## Return the keys starting with `prefix` in key order
+  var packed: FILEDB_PACKED
+
+  prefixPacked(dbh, prefix, 0, packed)
+  result = packedKeys(packed)
 
-  # Loop over all the keys and deserialize them
-  for i in 0..num-1:
-    # put this new pair into the table
-    result[i] = ($asarray[FILEDB_DBT](dbkeys)[i], $asarray[FILEDB_DBT](dbvals)[i])
 
-    # free memory
-    cfree(asarray[FILEDB_DBT](dbkeys)[i].data)
-    cfree(asarray[FILEDB_DBT](dbvals)[i].data)
+proc prefixBinaryPairs(dbh: ptr FILEDB_DB; prefix: var string): seq[tuple[key:string,val:string]] =
+  ## Return the key/value pairs starting with `prefix` in key order
+  var packed: FILEDB_PACKED
 
-  # Cleanup
-  cfree(dbkeys)
-  cfree(dbvals)
+  prefixPacked(dbh, prefix, 1, packed)
+  result = packedPairs(packed)
 
 
 proc allKeys[K](dbh: ptr FILEDB_DB): seq[K] =